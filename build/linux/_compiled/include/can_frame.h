@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/can_frame.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/canring.h
\ No newline at end of file
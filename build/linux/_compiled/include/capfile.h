@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/capfile.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/common.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/cryptlib.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/macan_debug.h
\ No newline at end of file
@@ -0,0 +1 @@
+/root/repo/build/linux/macan/src/linux/macan_ev.h
\ No newline at end of file
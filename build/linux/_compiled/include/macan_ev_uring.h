@@ -0,0 +1 @@
+/root/repo/build/linux/macan/src/linux/macan_ev_uring.h
\ No newline at end of file
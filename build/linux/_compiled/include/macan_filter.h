@@ -0,0 +1 @@
+/root/repo/build/linux/macan/include/macan_filter.h
\ No newline at end of file
@@ -79,10 +79,10 @@ void sig_callback(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
 	printf("received signal(%"PRIu8") = %"PRIu32" status: %d\n", sig_num, sig_val, s);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 	int s;
-	s = helper_init("can0");
+	s = helper_init(argc > 1 ? argv[1] : "can0");
 
 	macan_ev_loop *loop = MACAN_EV_DEFAULT;
 	macan_ev_timer sig_send;
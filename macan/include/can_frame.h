@@ -36,4 +36,85 @@ struct can_frame {
 #include <linux/can.h>
 #endif /* __CPU_TC1798__ */
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* CAN FD frames
+ *
+ * struct can_frame and struct canfd_frame share the layout, so a
+ * pointer to struct can_frame may point to a CAN FD frame, which is
+ * marked by CANFD_FDF in its flags. Frames passed through the library
+ * are stored in union macan_frame, which can hold both. Frames of up to
+ * 8 bytes are handled as classic frames, because the flags are in the
+ * padding of struct can_frame, which applications often do not clear.
+ */
+#ifdef CANFD_MTU
+#ifndef CANFD_FDF
+#define CANFD_FDF 0x04
+#endif
+#endif
+
+union macan_frame {
+	struct can_frame cf;
+#ifdef CANFD_MTU
+	struct canfd_frame fd;
+#endif
+};
+
+static inline bool macan_is_canfd(const struct can_frame *cf)
+{
+#ifdef CANFD_MTU
+	return cf->can_dlc > CAN_MAX_DLEN &&
+		(((const uint8_t *)cf)[offsetof(struct canfd_frame, flags)] & CANFD_FDF) != 0;
+#else
+	(void)cf;
+	return false;
+#endif
+}
+
+/* Size of the frame structure, i.e. CAN_MTU or CANFD_MTU */
+static inline size_t macan_frame_size(const struct can_frame *cf)
+{
+#ifdef CANFD_MTU
+	if (macan_is_canfd(cf))
+		return sizeof(struct canfd_frame);
+#endif
+	return sizeof(struct can_frame);
+}
+
+/* Number of data bytes of the frame */
+static inline unsigned macan_frame_len(const struct can_frame *cf)
+{
+#ifdef CANFD_MTU
+	if (macan_is_canfd(cf))
+		return ((const struct canfd_frame *)cf)->len;
+#endif
+	return cf->can_dlc > 8 ? 8U : cf->can_dlc;
+}
+
+static inline void macan_frame_copy(union macan_frame *dst, const struct can_frame *cf)
+{
+	memcpy(dst, cf, macan_frame_size(cf));
+}
+
+/* Worst case length on the wire of a data frame with @a len bytes,
+ * i.e. with the most stuff bits possible, EOF and the interframe space.
+ * The data phase of CAN FD frames is counted at the nominal bitrate. */
+static inline unsigned macan_frame_bits_max(uint32_t can_id, unsigned len)
+{
+	unsigned stuffed = 34 + 8 * len;	/* SOF to the end of the CRC */
+
+#ifdef CAN_EFF_FLAG
+	if (can_id & CAN_EFF_FLAG)
+		stuffed += 20;
+#else
+	(void)can_id;
+#endif
+	return stuffed + 13 + (stuffed - 1) / 4;
+}
+
+/* Exact length on the wire (framebits.c, Linux and simulation builds) */
+unsigned macan_can_frame_bits(const struct can_frame *cf, unsigned *data_bits);
+
 #endif /* CAN_H_ */
@@ -0,0 +1,64 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CANRING_H
+#define CANRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CANRING_MAX_IDS	255	/* IDs accepted by canring_set_ids() */
+
+struct can_frame;
+struct canring;
+
+struct canring_stats {
+	uint64_t packets;	/* Frames seen by the kernel */
+	uint64_t drops;		/* Frames dropped because the ring was full */
+	uint64_t freezes;	/* Times the kernel found no free block */
+	uint64_t blocks;	/* Blocks processed by canring_process() */
+	uint64_t fd_frames;	/* CAN FD frames skipped by canring_process() */
+};
+
+/**
+ * Callback invoked for every captured classic CAN frame.
+ *
+ * @param ts_ns   Kernel receive timestamp (CLOCK_REALTIME) in ns.
+ * @param ifindex Interface the frame was received on.
+ */
+typedef void (*canring_cb)(void *arg, const struct can_frame *cf,
+			   uint64_t ts_ns, int ifindex);
+
+struct canring *canring_open(const char *ifname);
+int canring_fd(const struct canring *r);
+bool canring_set_ids(struct canring *r, const uint32_t *ids, unsigned n);
+unsigned canring_process(struct canring *r, canring_cb cb, void *arg);
+bool canring_wait(struct canring *r, int timeout_ms);
+void canring_get_stats(struct canring *r, struct canring_stats *stats);
+void canring_close(struct canring *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Indexed CAN capture files
+ *
+ * Layout (all integers in host byte order, little endian in practice):
+ *
+ *   file header       CAPFILE_HDR_SIZE bytes
+ *   chunk 0           chunk header followed by frame records
+ *   chunk 1           each chunk occupies chunk_size bytes
+ *   ...
+ *   index             written when the capture is closed
+ *
+ * Records carry nanoseconds since the start of the capture, which
+ * never decrease. The index lists the time span of every chunk and,
+ * for every CAN ID, the chunks containing it. Readers can therefore
+ * seek to a time or extract one CAN ID without scanning the whole
+ * file. Captures that were not closed have no index, readers rebuild
+ * it from the chunk headers. They do so also when the index refers
+ * outside of the file, e.g. in a truncated capture.
+ */
+
+#ifndef CAPFILE_H
+#define CAPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPFILE_MAGIC		"MACANCAP"
+#define CAPFILE_VERSION		1
+#define CAPFILE_HDR_SIZE	4096
+#define CAPFILE_CHUNK_SIZE	(256 * 1024)	/* Default, ~1 s of a saturated bus */
+#define CAPFILE_MAX_IFS		16
+#define CAPFILE_IFNAMSIZ	16
+
+struct capfile_header {
+	char magic[8];		/**< CAPFILE_MAGIC */
+	uint32_t version;
+	uint32_t chunk_size;	/**< Multiple of CAPFILE_HDR_SIZE */
+	uint64_t config_hash;	/**< capfile_config_hash() or 0 */
+	uint64_t start_ns;	/**< Wall clock (CLOCK_REALTIME) at start */
+	uint64_t index_offset;	/**< 0 if the capture was not closed */
+	uint32_t chunk_count;
+	uint32_t if_count;
+	char ifname[CAPFILE_MAX_IFS][CAPFILE_IFNAMSIZ];
+};
+
+struct capfile_chunk_hdr {
+	char magic[4];		/**< "CHNK" */
+	uint32_t count;		/**< Number of records */
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint32_t seq;		/**< Chunk number */
+	uint32_t reserved[9];
+};
+
+struct capfile_rec {
+	uint64_t ts_ns;		/**< Since start_ns, never decreasing */
+	uint32_t can_id;
+	uint8_t can_dlc;
+	uint8_t ifidx;		/**< Index to capfile_header.ifname */
+	uint8_t pad[2];
+	uint8_t data[8];
+};
+
+struct capfile_index_hdr {
+	char magic[4];		/**< "INDX" */
+	uint32_t chunk_count;
+	uint32_t id_count;
+	uint32_t list_len;
+	/* Followed by chunk_count capfile_chunk_ent, id_count
+	 * capfile_id_ent sorted by can_id and list_len uint32_t chunk
+	 * numbers referenced by capfile_id_ent.list_off */
+};
+
+struct capfile_chunk_ent {
+	uint64_t offset;
+	uint64_t first_ns;
+	uint64_t last_ns;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct capfile_id_ent {
+	uint32_t can_id;
+	uint32_t frames;
+	uint32_t chunk_count;
+	uint32_t list_off;
+};
+
+struct macan_config;
+struct capfile_writer;
+struct capfile;
+
+uint64_t capfile_config_hash(const struct macan_config *config);
+
+/* Writer */
+
+#define CAPFILE_O_DIRECT 1	/**< Bypass the page cache */
+
+struct capfile_writer *capfile_create(const char *path, uint32_t chunk_size,
+				      uint64_t config_hash, unsigned flags);
+int capfile_add_if(struct capfile_writer *w, const char *ifname);
+bool capfile_write(struct capfile_writer *w, uint64_t ts_ns, int ifidx,
+		   uint32_t can_id, uint8_t can_dlc, const uint8_t *data);
+uint64_t capfile_fd_skipped(const struct capfile_writer *w);
+bool capfile_close(struct capfile_writer *w);
+
+/* Reader */
+
+struct capfile_iter {
+	const struct capfile *cap;
+	uint64_t from_ns, to_ns;
+	const struct capfile_id_ent *id;	/**< NULL iterates all IDs */
+	uint32_t pos;		/**< Position in the chunk list of id */
+	uint32_t chunk;
+	uint32_t rec;
+	bool done;
+};
+
+struct capfile *capfile_open(const char *path);
+void capfile_free(struct capfile *cap);
+const struct capfile_header *capfile_hdr(const struct capfile *cap);
+uint32_t capfile_chunks(const struct capfile *cap);
+const struct capfile_chunk_ent *capfile_chunk(const struct capfile *cap, uint32_t i);
+const struct capfile_rec *capfile_chunk_recs(const struct capfile *cap, uint32_t i);
+const struct capfile_id_ent *capfile_find_id(const struct capfile *cap, uint32_t can_id);
+const struct capfile_id_ent *capfile_ids(const struct capfile *cap, uint32_t *count);
+uint32_t capfile_seek(const struct capfile *cap, uint64_t ts_ns);
+
+void capfile_iter_init(struct capfile_iter *it, const struct capfile *cap,
+		       uint64_t from_ns, uint64_t to_ns);
+void capfile_iter_init_id(struct capfile_iter *it, const struct capfile *cap,
+			  uint32_t can_id, uint64_t from_ns, uint64_t to_ns);
+const struct capfile_rec *capfile_next(struct capfile_iter *it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
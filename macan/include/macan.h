@@ -59,8 +59,54 @@ struct macan_sig_spec {
 	uint16_t can_nsid;  /**< CAN non-secured ID */
 	uint16_t can_sid;   /**< CAN secured ID */
 	uint8_t src_id;     /**< ECU-ID of node dispatching this signal */
-	uint8_t dst_id;     /**< ECU-ID of node receiving this signal */
+	uint8_t dst_id;     /**< ECU-ID of node receiving this signal or Group-ID of the receivers */
 	uint8_t presc;      /**< Prescaler if > 0, zero means on-demand signal (see sig_auth_req frame) */
+	uint32_t heartbeat; /**< If > 0, only changed values are sent and the value is repeated signed when no signed frame was sent for this long (microseconds) */
+	uint8_t presc_max;  /**< Largest prescaler the sender may use when the bus is loaded (see bitrate in struct macan_config), 0 for a fixed prescaler */
+};
+
+/**
+ * Group of nodes sharing one session key
+ *
+ * A signal sent to a Group-ID is signed once with the group key and
+ * received by all members of the group. The sender must be a member
+ * as well. Group-IDs must differ from all ECU-IDs.
+ */
+struct macan_group {
+	uint8_t group_id;   /**< Group-ID (0-63) */
+	uint32_t members;   /**< Bitmask of the ECU-IDs (0-23) of the members */
+};
+
+#define MACAN_PDU_CMAC_LEN 8	/**< Bytes of the CMAC of a CAN FD PDU */
+#define MACAN_PDU_MAX_SIGS ((64 - MACAN_PDU_CMAC_LEN) / 4)
+#define MACAN_PDU_CLASSIC 0x01	/**< Two 16-bit signals and a 4-byte CMAC in a classic frame */
+#define MACAN_PDU_CLASSIC_SIGS 2
+
+/**
+ * Authenticated PDU carrying several signals in one frame
+ *
+ * The CAN FD frame holds the 32-bit values of the signals in the order
+ * given by sigs followed by MACAN_PDU_CMAC_LEN bytes of the CMAC of
+ * the values, MaCAN time and the CAN-ID. With MACAN_PDU_CLASSIC, the
+ * lower 16 bits of up to two signals and a 4-byte CMAC fit a classic
+ * CAN frame. The signals are delivered to the callbacks registered for
+ * them. CAN FD PDUs need a CAN FD bus and the buffers passed to
+ * macan_read() must hold union macan_frame.
+ *
+ * The signals can be sent together with macan_send_pdu() or one by one
+ * with macan_send_sig(). The latter packs them: the PDU is sent when
+ * all its signals have been published or latency after the first of
+ * them, whichever comes first. Signals not published since the last
+ * PDU repeat their previous value.
+ */
+struct macan_pdu_spec {
+	uint32_t can_id;    /**< CAN-ID of the PDU */
+	uint8_t src_id;     /**< ECU-ID of node dispatching this PDU */
+	uint8_t dst_id;     /**< ECU-ID of node receiving this PDU or Group-ID of the receivers */
+	uint8_t sig_count;  /**< Number of signals in sigs (up to MACAN_PDU_MAX_SIGS or MACAN_PDU_CLASSIC_SIGS) */
+	const uint8_t *sigs; /**< Signal numbers */
+	uint8_t flags;      /**< MACAN_PDU_CLASSIC or zero */
+	uint32_t latency;   /**< Longest time a signal sent with macan_send_sig() waits for the others, 0 to send at once (microseconds) */
 };
 
 struct macan_ecu {
@@ -88,6 +134,12 @@ struct macan_config {
 	uint32_t skey_chg_timeout;            /**< Timeout for waiting for session key (microseconds) */
 	uint32_t time_req_sep;                /**< Minimum time between requests for authenticated time from one node (microseconds) */
 	uint32_t time_delta;                  /**< Maximum time difference between our clock and TS (microseconds) */
+	uint32_t liveness_timeout;            /**< A partner sending us no authenticated signal for this long is considered restarted, 0 to disable (microseconds) */
+	uint8_t group_count;                  /**< Number of groups in groups */
+	const struct macan_group *groups;     /**< Groups of nodes sharing a session key */
+	uint8_t pdu_count;                    /**< Number of PDUs in pdus (up to 126), CAN FD is used if any is not classic */
+	const struct macan_pdu_spec *pdus;    /**< Multi-signal PDUs */
+	uint32_t bitrate;                     /**< Nominal bitrate for the bus load estimate, 0 disables adaptive prescalers (bits per second) */
 };
 
 /**
@@ -115,6 +167,7 @@ enum macan_signal_status {
  * signal callback signature
  */
 typedef void (*macan_sig_cback)(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status status);
+typedef void (*macan_stale_cback)(uint8_t sig_num);
 
 enum macan_process_status {
 	MACAN_FRAME_UNKNOWN,
@@ -122,17 +175,54 @@ enum macan_process_status {
 	MACAN_FRAME_CHALLENGE,
 };
 
+/**
+ * Priority classes of the transmit queue
+ */
+enum macan_tx_prio {
+	MACAN_TX_PRIO_PROTO,	/**< Time and key/handshake frames */
+	MACAN_TX_PRIO_SIG,	/**< Signals */
+	MACAN_TX_PRIO_COUNT
+};
+
+/**
+ * Transmit queue statistics (see macan_get_tx_stats())
+ */
+struct macan_tx_stats {
+	uint32_t sent;		/**< Frames accepted by the CAN controller */
+	uint32_t retries;	/**< Transmissions postponed because the controller was busy */
+	uint32_t errors;	/**< Frames rejected by the CAN controller */
+	struct {
+		uint32_t depth;	    /**< Frames currently queued */
+		uint32_t max_depth; /**< Maximum number of queued frames */
+		uint32_t dropped;   /**< Frames dropped because the queue was full */
+	} prio[MACAN_TX_PRIO_COUNT];
+};
+
+/**
+ * Signal statistics (see macan_get_sig_stats())
+ */
+struct macan_sig_stats {
+	uint32_t auth;		/**< Signed frames sent */
+	uint32_t plain;		/**< Non-secure frames sent */
+	uint8_t presc;		/**< Current prescaler, i.e. every presc-th frame is signed, 0 if not signed periodically */
+	uint8_t busload;	/**< Bus load estimated by the node (percent) */
+};
+
 /* MaCAN API functions */
 
 struct macan_ctx *macan_alloc_mem(const struct macan_config *config,
 				  const struct macan_node_config *node);
 int  macan_init(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd);
 int  macan_init_ks(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd, const struct macan_key * const *ltks);
+int  macan_ks_predistribute(struct macan_ctx *ctx);
 int  macan_init_ts(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd);
+void macan_deinit(struct macan_ctx *ctx);
 
 void macan_request_keys(struct macan_ctx *ctx);
 int  macan_reg_callback(struct macan_ctx *ctx, uint8_t sig_num, macan_sig_cback fnc, macan_sig_cback invalid_cmac);
+int  macan_reg_stale_callback(struct macan_ctx *ctx, uint8_t sig_num, uint32_t timeout, macan_stale_cback fnc);
 void macan_send_sig(struct macan_ctx *ctx, uint8_t sig_num, uint32_t signal);
+int  macan_send_pdu(struct macan_ctx *ctx, uint8_t pdu_num, const uint32_t *sig_vals);
 enum macan_process_status macan_process_frame(struct macan_ctx *ctx, const struct can_frame *cf);
 void macan_request_key(struct macan_ctx *ctx, macan_ecuid fwd_id);
 
@@ -142,6 +232,8 @@ void macan_ev_timer_setup(struct macan_ctx *ctx, macan_ev_timer *ev,
 void macan_ev_canrx_setup(struct macan_ctx *ctx, macan_ev_can *ev,
 			  void (*cb) (macan_ev_loop *loop,  macan_ev_can *w, int revents));
 void macan_request_expired_keys(struct macan_ctx *ctx);
+void macan_get_tx_stats(struct macan_ctx *ctx, struct macan_tx_stats *stats);
+void macan_get_sig_stats(struct macan_ctx *ctx, uint8_t sig_num, struct macan_sig_stats *stats);
 
 bool macan_ev_run(macan_ev_loop *loop);
 
@@ -0,0 +1,90 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Rate and sequence anomaly detection on a monitored MaCAN bus
+ *
+ * Frames that are cheap to inject or replay are checked without any
+ * keys: CHALLENGE floods, repeated or out of order SESS_KEY fragments,
+ * authenticated time nobody asked for, non-secure signal frames of
+ * signals that are always signed and streams arriving faster than
+ * they were observed to.
+ *
+ * Each stream (signal in the clear, signal signed, plain time) keeps
+ * a learned period and a GCRA (virtual scheduling) state. The period
+ * is learned from the first frames of the stream or derived from the
+ * other stream of the same signal and its prescaler. All state is
+ * allocated when the detector is created, so memory does not grow
+ * with the traffic.
+ */
+
+#ifndef MACAN_ANOMALY_H
+#define MACAN_ANOMALY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum macan_anomaly_type {
+	MACAN_AN_CHALLENGE_FLOOD,	/* CHALLENGEs from a node above the configured rate */
+	MACAN_AN_SKEY_DUPLICATE,	/* SESS_KEY identical to a recent one */
+	MACAN_AN_SKEY_SEQUENCE,		/* SESS_KEY fragment out of order */
+	MACAN_AN_TIME_UNSOLICITED,	/* Authenticated time without a challenge */
+	MACAN_AN_NONSECURE,		/* Non-secure frame of an always signed signal */
+	MACAN_AN_RATE,			/* Stream faster than its period allows */
+	MACAN_AN_COUNT
+};
+
+struct macan_anomaly_info {
+	uint64_t ts_ns;
+	enum macan_anomaly_type type;
+	uint32_t can_id;
+	int node;		/* ECU-ID or -1 */
+	int sig_num;		/* Signal or -1 */
+	uint64_t period_ns;	/* Expected period of rate anomalies */
+	uint64_t interval_ns;	/* Observed interval of rate anomalies */
+};
+
+struct macan_anomaly_stats {
+	uint64_t frames;
+	uint64_t anomalies[MACAN_AN_COUNT];
+	uint64_t reported[MACAN_AN_COUNT];	/* Passed to the callback */
+};
+
+typedef void (*macan_anomaly_cb)(void *arg, const struct macan_anomaly_info *info);
+
+struct macan_anomaly;
+
+struct macan_anomaly *macan_anomaly_create(const struct macan_config *config,
+					   macan_anomaly_cb cb, void *arg);
+void macan_anomaly_free(struct macan_anomaly *an);
+void macan_anomaly_frame(struct macan_anomaly *an, uint64_t ts_ns, const struct can_frame *cf);
+void macan_anomaly_get_stats(const struct macan_anomaly *an, struct macan_anomaly_stats *stats);
+const char *macan_anomaly_name(enum macan_anomaly_type type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
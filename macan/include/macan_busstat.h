@@ -0,0 +1,86 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bus load statistics per CAN ID and per MaCAN message class
+ *
+ * Every frame is accounted with its exact length on the wire: the
+ * stuff bits are counted on the actual bit stream including the CRC,
+ * followed by the CRC delimiter, ACK, end of frame and interframe
+ * space. Inter-arrival times are summarised by their mean, standard
+ * deviation (jitter) and range with Welford's algorithm. Standard CAN
+ * IDs are looked up in a direct table, extended ones in a fixed size
+ * hash table, so each frame costs O(1).
+ *
+ * Statistics are collected in windows; macan_busstat_report() prints
+ * the window that just ended and starts the next one.
+ */
+
+#ifndef MACAN_BUSSTAT_H
+#define MACAN_BUSSTAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/can.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum macan_bclass {
+	MACAN_BC_TIME,
+	MACAN_BC_AUTH_TIME,
+	MACAN_BC_REQ_CHALLENGE,
+	MACAN_BC_CHALLENGE,
+	MACAN_BC_SESS_KEY,
+	MACAN_BC_ACK,
+	MACAN_BC_AUTH_REQ,
+	MACAN_BC_AUTH_SIG,	/* Signed 16-bit signal in a crypt frame */
+	MACAN_BC_AUTH_SIG32,	/* Signed 32-bit signal on its own CAN ID */
+	MACAN_BC_SIGNAL,	/* Non-secure signal */
+	MACAN_BC_OTHER,
+	MACAN_BC_COUNT
+};
+
+struct macan_bstat {
+	uint64_t frames, bits;			/* Current window */
+	uint64_t total_frames, total_bits;
+	uint64_t last_ns;			/* Last frame */
+	uint64_t gap_min, gap_max;		/* Inter-arrival times in the window */
+	double gap_mean, gap_m2;
+	uint32_t gaps;
+};
+
+struct macan_busstat;
+
+struct macan_busstat *macan_busstat_create(const struct macan_config *config, unsigned bitrate);
+void macan_busstat_free(struct macan_busstat *bs);
+void macan_busstat_frame(struct macan_busstat *bs, uint64_t ts_ns, const struct can_frame *cf);
+void macan_busstat_report(struct macan_busstat *bs, uint64_t now_ns, FILE *table, FILE *json);
+const struct macan_bstat *macan_busstat_class(const struct macan_busstat *bs, enum macan_bclass c);
+const struct macan_bstat *macan_busstat_id(const struct macan_busstat *bs, uint32_t can_id);
+const char *macan_bclass_name(enum macan_bclass c);
+double macan_bstat_jitter(const struct macan_bstat *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fast rendering of monitored frames
+ *
+ * Produces the same lines as print_frame(), optionally without
+ * colours or in a shorter form. CAN IDs are classified and node names
+ * formatted once when the display is created; frames are formatted
+ * without stdio into a large buffer, which is written out by
+ * macan_display_flush() or when it fills up.
+ */
+
+#ifndef MACAN_DISPLAY_H
+#define MACAN_DISPLAY_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "macan_private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACAN_DISPLAY_COLOR	0x1U	/* ANSI colours as print_frame() */
+#define MACAN_DISPLAY_COMPACT	0x2U	/* Short lines without padding */
+
+#define MACAN_DISPLAY_BUF_SIZE	(256 * 1024)
+
+struct macan_display_stats {
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t writes;	/* write() calls */
+};
+
+struct macan_display;
+
+struct macan_display *macan_display_create(const struct macan_ctx *ctx, int fd, unsigned flags);
+void macan_display_free(struct macan_display *d);
+void macan_display_frame(struct macan_display *d, uint64_t ts_ns, const struct can_frame *cf);
+int macan_display_flush(struct macan_display *d);
+void macan_display_get_stats(const struct macan_display *d, struct macan_display_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
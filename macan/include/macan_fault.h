@@ -0,0 +1,120 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fault injection
+ *
+ * A set of fault rules is attached to the contexts of the nodes
+ * whose transmissions it affects. The rules sit between macan_send()
+ * and the target's macan_xmit(), so they work with every backend.
+ * Frames matched by a rule are dropped, corrupted, delayed or sent
+ * after the next frame, either with a given probability or a given
+ * number of times. Restart rules call a function of the application
+ * at the given time, which is expected to replace the context of the
+ * node by a fresh one (see macan_deinit()).
+ *
+ * Rules are usually written as text, one per line:
+ *
+ *   drop SESS_KEY seq 3
+ *   drop p 0.2 node 2 at 10 s until 12 s
+ *   corrupt ACK count 3
+ *   delay 5 ms SIGNAL p 0.1
+ *   reorder id 0x200
+ *   restart node 5 at 10 s
+ *
+ * A rule affects one frame unless it has "count", "p" or "until". Frames can be matched
+ * by their type (REQ_CHALLENGE, CHALLENGE, SESS_KEY, ACK, AUTH_REQ,
+ * SIGNAL, TIME, SIGNED_TIME), CAN ID, sending node and the sequence
+ * number of a SESS_KEY frame. Times are given in s, ms or us from the
+ * start of read_time().
+ */
+
+#ifndef MACAN_FAULT_H
+#define MACAN_FAULT_H
+
+#include <stdint.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum macan_fault_action {
+	MACAN_FAULT_DROP,
+	MACAN_FAULT_CORRUPT,		/* Flip a random bit of the data */
+	MACAN_FAULT_DELAY,
+	MACAN_FAULT_REORDER,		/* Send after the next frame */
+	MACAN_FAULT_RESTART,		/* Restart the node at from_us */
+};
+
+enum macan_fault_type {
+	MACAN_FT_ANY,
+	MACAN_FT_REQ_CHALLENGE,
+	MACAN_FT_CHALLENGE,
+	MACAN_FT_SESS_KEY,
+	MACAN_FT_ACK,
+	MACAN_FT_AUTH_REQ,
+	MACAN_FT_SIGNAL,
+	MACAN_FT_TIME,
+	MACAN_FT_SIGNED_TIME,
+};
+
+struct macan_fault_rule {
+	enum macan_fault_action action;
+	enum macan_fault_type type;
+	uint32_t can_id, can_mask;	/* can_mask 0 matches any ID */
+	int node;			/* Sending node, -1 for any */
+	int seq;			/* SESS_KEY sequence number, -1 for any */
+	double prob;			/* Probability the frame is affected */
+	unsigned count;			/* Frames to affect, 0 for unlimited */
+	uint64_t from_us, until_us;	/* Time when the rule applies */
+	uint64_t delay_us;
+};
+
+struct macan_fault_stats {
+	uint32_t dropped;
+	uint32_t corrupted;
+	uint32_t delayed;
+	uint32_t reordered;
+	uint32_t restarts;
+	uint64_t first_us;		/* Time of the first fault, UINT64_MAX if none */
+	uint64_t last_us;		/* Time of the last fault */
+};
+
+/**
+ * Called when a restart rule fires. The application should stop the
+ * old context of @a node with macan_deinit() and initialize a new one.
+ */
+typedef void macan_fault_restart_fn(macan_ecuid node, void *arg);
+
+struct macan_faults;
+
+struct macan_faults *macan_fault_alloc(void);
+void macan_fault_free(struct macan_faults *f);
+int macan_fault_add(struct macan_faults *f, const struct macan_fault_rule *rule);
+int macan_fault_parse(struct macan_faults *f, const char *script);
+void macan_fault_set_restart(struct macan_faults *f, macan_fault_restart_fn *fn, void *arg);
+void macan_fault_attach(struct macan_faults *f, struct macan_ctx *ctx);
+void macan_fault_stats(struct macan_faults *f, struct macan_fault_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
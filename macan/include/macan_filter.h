@@ -0,0 +1,79 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Display filters for monitored frames
+ *
+ * An expression compares the fields decoded by print_frame():
+ *
+ *   id     CAN ID (without flags)
+ *   dlc    data length
+ *   type   time, authtime, reqchallenge, challenge, sesskey, ack,
+ *          sig16, authreq, nonsecure, secure or other
+ *   flags  MaCAN flags of crypt frames (0-3)
+ *   src    sending ECU (crypt frames, signals, time)
+ *   dst    destination ECU (crypt frames, signals)
+ *   fwd    ECU the (request for) challenge is about
+ *   sig    signal number (signals, sig16, authreq)
+ *   seq    SESS_KEY fragment
+ *   presc  prescaler requested by authreq
+ *   time   value of time frames
+ *
+ * with ==, !=, <, <=, > or >= and combines comparisons with &&, ||,
+ * ! (or and, or, not) and parentheses. Values are numbers (decimal
+ * or 0x hexadecimal), ECU names for src, dst and fwd and frame types
+ * for type. A type alone is a shorthand for type == <type>, e.g.
+ *
+ *   sesskey && dst == 5
+ *   (sig16 || secure) && src == ECU3
+ *
+ * A comparison of a field the frame does not have is false.
+ *
+ * The expression is compiled to bytecode with short circuit jumps;
+ * fields are decoded once per frame. The compiler also derives the set
+ * of CAN IDs that matching frames can have, which can be installed as
+ * a kernel filter.
+ */
+
+#ifndef MACAN_FILTER_H
+#define MACAN_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct macan_filter;
+
+struct macan_filter *macan_filter_compile(const struct macan_config *config, const char *expr,
+					  char *err, size_t err_size);
+void macan_filter_free(struct macan_filter *f);
+bool macan_filter_match(const struct macan_filter *f, const struct can_frame *cf);
+int macan_filter_can_ids(const struct macan_filter *f, const uint32_t **ids);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
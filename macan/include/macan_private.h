@@ -86,6 +86,24 @@ struct macan_signal_ex {
 	uint8_t cmac[4];
 };
 
+/**
+ * Deadline of a housekeeping action
+ *
+ * Pending deadlines of a context are kept in a binary min-heap
+ * (ctx->dlheap) so that the housekeeping timer can be armed for the
+ * earliest one only.
+ */
+struct macan_deadline {
+	uint64_t when;		/* Local time (us) when the deadline expires */
+	unsigned pos;		/* Position in the heap plus one, zero if not queued */
+	uint16_t owner;		/* ECU-ID of the communication partner or MACAN_DL_* */
+};
+
+#define MACAN_DL_TIME 0xff	/* Owner of the time request deadline */
+#define MACAN_DL_RESYNC 0x40	/* Owner flag of the liveness and resync deadlines */
+#define MACAN_DL_PDU 0x80	/* Owner flag of the PDU flush deadlines (PDU number) */
+#define MACAN_DL_SIG 0x100	/* Owner flag of the heartbeat and staleness deadlines (signal number) */
+
 /**
  * Timekeeping structure
  */
@@ -98,6 +116,7 @@ struct macan_timekeeping {
 	uint64_t chal_ts;   /* local timestamp when request for signed time was sent  */
 	uint8_t chg[6];	    /* challenge to the time server */
 	bool ready;   	    /* set to true after first signed time message was received */
+	struct macan_deadline req_dl; /* deferred request for signed time (see time_req_sep) */
 };
 
 /**
@@ -113,11 +132,15 @@ struct com_part {
 	bool key_received;	/* True iff any key was ever received from the key server */
 	struct macan_key skey;	/* Session key (from key server) */
 	uint64_t valid_until;	/* Local time of key expiration */
+	struct macan_deadline dl; /* Deadline queue entry for valid_until */
 	bool awaiting_skey;	/* True iff challenge was sent and we wait for the session key */
 	uint8_t chg[6];		/* Challenge for communication with key server */
 	uint8_t flags;
 	uint32_t group_field;	/* Bitmask of known key sharing */
 	macan_ecuid ecu_id;	/* ECU-ID of communication partner */
+	uint64_t last_auth;	/* Local time of the last authenticated signal from the partner */
+	uint32_t resync_backoff; /* Current resync interval, zero if not resynchronizing */
+	struct macan_deadline resync_dl; /* Liveness check or next resync attempt */
 	void (*skey_callback)(struct macan_ctx *ctx, macan_ecuid dst_id);
 };
 
@@ -132,8 +155,17 @@ struct sig_handle {
 	uint8_t presc_cnt;    /* prescaler counter counts the signal transmit attempts down and
 	                         allows the transmit to happen only if presc_cnt == 0 */
 	uint8_t flags;        /* mark AUTHREQ_SENT if signal request AUTH_REQ was sent */
+	uint8_t pdu;          /* PDU number + 1 of the PDU carrying the signal, 0 if none */
+	uint8_t pdu_pos;      /* Position of the signal in the PDU */
+	bool sent;            /* A value was sent (send-on-change signals) */
+	uint32_t sent_auth;   /* Signed frames sent */
+	uint32_t sent_plain;  /* Non-secure frames sent */
+	uint32_t last_val;    /* Last value sent (send-on-change signals) */
 	macan_sig_cback cback;
 	macan_sig_cback invalid_cback;
+	macan_stale_cback stale_cback;
+	uint32_t stale_timeout;
+	struct macan_deadline dl; /* Next heartbeat when sending, staleness when receiving */
 };
 
 #define SIG_DONTSIGN 0
@@ -141,6 +173,66 @@ struct sig_handle {
 
 #define AUTHREQ_SENT 1
 
+/**
+ * Packing state of a PDU (see macan_send_sig())
+ */
+struct pdu_handle {
+	uint32_t vals[MACAN_PDU_MAX_SIGS]; /* Last value of every signal */
+	uint16_t pending;	/* Bitmap of signals published since the last PDU */
+	struct macan_deadline dl; /* Sends the PDU when the latency expires */
+};
+
+/**
+ * Result of handing a frame to the CAN controller
+ */
+enum macan_xmit_status {
+	MACAN_XMIT_OK,		/* Frame accepted for transmission */
+	MACAN_XMIT_BUSY,	/* No room in the controller, retry when it is writable */
+	MACAN_XMIT_RETRY,	/* No room, but no writable event follows, retry after a backoff */
+	MACAN_XMIT_ERROR,	/* Frame cannot be sent */
+};
+
+#ifndef MACAN_TXQ_LEN
+#define MACAN_TXQ_LEN 16	/* Frames per priority class */
+#endif
+#ifndef MACAN_TXQ_BACKOFF
+#define MACAN_TXQ_BACKOFF 500	/* Retry interval after MACAN_XMIT_RETRY (us) */
+#endif
+
+/**
+ * Transmit queue (see txq.c)
+ */
+struct macan_txq {
+	union macan_frame frame[MACAN_TX_PRIO_COUNT][MACAN_TXQ_LEN];
+	uint8_t head[MACAN_TX_PRIO_COUNT];
+	enum macan_xmit_status (*xmit)(struct macan_ctx *ctx, const struct can_frame *cf);
+	macan_ev_can watcher;		       /* Waits for the controller to accept more frames */
+	macan_ev_timer retry;		       /* Retries when no writable event comes */
+	enum macan_xmit_status wait;	       /* BUSY: watcher started, RETRY: retry started */
+	struct macan_tx_stats stats;
+};
+
+#ifndef MACAN_LOAD_WINDOW
+#define MACAN_LOAD_WINDOW 100000	/* Bus load estimation window (us) */
+#endif
+#ifndef MACAN_LOAD_HIGH
+#define MACAN_LOAD_HIGH 70	/* Prescalers are doubled above this bus load (%) */
+#endif
+#ifndef MACAN_LOAD_LOW
+#define MACAN_LOAD_LOW 40	/* Prescalers are halved below this bus load (%) */
+#endif
+#define MACAN_PRESC_SHIFT_MAX 7
+
+/**
+ * Bus load estimate (see busload.c)
+ */
+struct macan_busload {
+	uint64_t window_start;	/* Local time when the current window started */
+	uint64_t bits;		/* Bits of the frames in the current window */
+	uint8_t load;		/* Load of the last window (%) */
+	uint8_t shift;		/* Adaptive prescalers are multiplied by 2^shift */
+};
+
 /**
  * MaCAN context
  *
@@ -151,6 +243,7 @@ struct macan_ctx {
 	const struct macan_node_config *node;  /* Node configuration */
 	struct com_part **cpart;               /* vector of communication partners, e.g. stores keys */
 	struct sig_handle **sighand;           /* stores signals settings, e.g prescaler, callback */
+	struct pdu_handle *pduhand;	       /* packing state of the PDUs indexed by PDU number */
 	struct macan_timekeeping time; 	       /* used to manage time of the protocol */
 	uint8_t keywrap[32];		       /* Temporary storage for wrapped session key */
 	unsigned rcvd_skey_seq;		       /* bitmap indicating which sess_key messages were received */
@@ -158,6 +251,13 @@ struct macan_ctx {
 	macan_ev_loop *loop;
 	macan_ev_can can_watcher;
 	macan_ev_timer housekeeping;
+	struct macan_txq txq;
+	struct macan_busload busload;
+	struct macan_deadline **dlheap;	       /* min-heap of pending deadlines (see deadline.c) */
+	unsigned dlcount;		       /* number of entries in dlheap */
+	uint64_t hk_armed;		       /* deadline the housekeeping timer is armed for */
+	bool hk_running;		       /* housekeeping callback is in progress */
+	struct macan_fault_port *fault;	       /* Fault injection (see fault.c) */
 	bool print_msg_enabled;
 #ifdef __linux__
 	bool dump_disabled;	/* Disable dumping frames even if MACAN_DUMP is defined */
@@ -173,6 +273,10 @@ struct macan_ctx {
 		} ts;
 		struct { /* key server */
 			const struct macan_key * const *ltk;
+			struct sess_key *skey_map;     /* Session keys of node pairs, see ks.c */
+			struct ks_chg *last_chg;       /* Last challenge answered for each node and partner */
+			struct ks_predist *predist;    /* Proactive key distribution, see ks.c */
+			macan_ev_timer predist_timer;
 			macan_ev_timer time_bcast;
 			uint64_t bcast_time;
 		} ks;
@@ -182,19 +286,38 @@ struct macan_ctx {
 #define CANID(ctx, ecuid) ((ctx)->config->canid->ecu[ecuid].canid)
 
 bool macan_canid2ecuid(const struct macan_config *cfg, uint32_t canid, macan_ecuid *ecuid);
+const struct macan_group *macan_get_group(const struct macan_config *cfg, macan_ecuid id);
+unsigned macan_id_count(const struct macan_config *cfg);
 bool is_skey_ready(struct macan_ctx *ctx, macan_ecuid dst_id);
 void receive_challenge(struct macan_ctx *ctx, const struct can_frame *cf);
 uint64_t read_time(void);
 uint64_t macan_get_time(struct macan_ctx *ctx);
 bool is_32bit_signal(struct macan_ctx *ctx, uint8_t sig_num);
 void print_frame(const struct macan_ctx *ctx, struct can_frame *cf, const char *prefix);
+void macan_sprint_ecuid(const struct macan_ctx *ctx, char *str, size_t size, macan_ecuid id);
 bool is_time_ready(struct macan_ctx *ctx);
 struct com_part *canid2cpart(struct macan_ctx *ctx, uint32_t can_id);
 bool gen_rand_data(void *dest, size_t len);
 bool macan_read(struct macan_ctx *ctx, struct can_frame *cf);
 bool macan_send(struct macan_ctx *ctx,  const struct can_frame *cf);
+enum macan_xmit_status macan_xmit(struct macan_ctx *ctx, const struct can_frame *cf);
+void macan_txq_init(struct macan_ctx *ctx);
+void macan_txq_stop(struct macan_ctx *ctx);
+void macan_busload_account(struct macan_ctx *ctx, const struct can_frame *cf);
+unsigned macan_sig_presc(struct macan_ctx *ctx, uint8_t sig_num);
+void macan_tx_complete(struct macan_ctx *ctx);
 const char *macan_ecu_name(struct macan_ctx *ctx, macan_ecuid id);
 
+static inline bool macan_uses_canfd(const struct macan_config *cfg)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->pdu_count; i++)
+		if (!(cfg->pdus[i].flags & MACAN_PDU_CLASSIC))
+			return true;
+	return false;
+}
+
 static inline macan_ecuid macan_crypt_dst(const struct can_frame *cf)
 {
 	return cf->data[0] & 0x3f;
@@ -206,7 +329,14 @@ static inline unsigned macan_crypt_flags(const struct can_frame *cf)
 }
 
 void __macan_init(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd);
+void macan_fault_detach(struct macan_ctx *ctx);
 void macan_housekeeping_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents);
+void macan_housekeeping_init(struct macan_ctx *ctx);
+
+void macan_deadline_set(struct macan_ctx *ctx, struct macan_deadline *dl, uint64_t when);
+void macan_deadline_cancel(struct macan_ctx *ctx, struct macan_deadline *dl);
+struct macan_deadline *macan_deadline_first(struct macan_ctx *ctx);
+void macan_deadline_arm(struct macan_ctx *ctx);
 void macan_target_init(struct macan_ctx *ctx);
 
 
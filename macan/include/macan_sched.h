@@ -0,0 +1,115 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Offline schedulability analysis of a MaCAN configuration
+ *
+ * The frames a configuration puts on the bus are derived from the
+ * signal specification and the signal periods:
+ *
+ *   - a signal with prescaler p sends every p-th value signed
+ *     (AUTH_SIG on the sender's CAN ID, or AUTH_SIG32 on can_sid) and
+ *     the others on can_nsid; on-demand signals (p = 0) are analysed
+ *     with the worst request, p = 1,
+ *   - the time server broadcasts the time every time_div,
+ *   - for every pair of communicating nodes, the key server sends 13
+ *     frames (two session keys and a REQ_CHALLENGE) every
+ *     skey_validity.
+ *
+ * Response times are computed with the CAN response time analysis of
+ * Davis et al., "Controller Area Network (CAN) schedulability
+ * analysis: Refuted, revisited and revised" (2007), with worst case
+ * stuffing. Both frames of a signal come from one source, so at most
+ * ceil(n/p) of n consecutive values interfere as signed frames.
+ *
+ * A receiver checks the CMAC against the times its clock may show
+ * when the frame arrives. The frame is signed at most the response
+ * time before and the clocks differ by at most the skew, hence
+ *
+ *   older = ceil((R + skew) / time_div),  newer = ceil(skew / time_div)
+ *
+ * time units around the receiver's time have to be tried.
+ */
+
+#ifndef MACAN_SCHED_H
+#define MACAN_SCHED_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACAN_SCHED_UNBOUNDED UINT64_MAX
+
+enum macan_smsg_kind {
+	MACAN_SM_SIGNAL,	/* Non-secure signal */
+	MACAN_SM_AUTH_SIG,
+	MACAN_SM_AUTH_SIG32,
+	MACAN_SM_TIME,
+	MACAN_SM_SESS_KEY,	/* Key distribution for one pair of nodes */
+	MACAN_SM_KIND_COUNT
+};
+
+/** Timing of a signal, in nanoseconds; period 0 means not sent */
+struct macan_sched_sig {
+	uint64_t period, deadline, jitter;
+};
+
+/** A stream of frames on one CAN ID */
+struct macan_smsg {
+	uint32_t can_id;
+	enum macan_smsg_kind kind;
+	int sig_num;		/* -1 for protocol frames */
+	unsigned presc;		/* Signal messages: prescaler used */
+	unsigned frames;	/* Frames per activation */
+	uint64_t period, deadline, jitter;
+	uint64_t c;		/* Worst case transmission time of one frame */
+	uint64_t r;		/* Worst case response time */
+	double util;		/* Average bus utilisation */
+};
+
+struct macan_sched {
+	const struct macan_config *config;
+	unsigned bitrate;
+	unsigned count;
+	struct macan_smsg *msg;		/* Sorted by priority */
+	double util[MACAN_SM_KIND_COUNT];
+	double util_total, util_plain;	/* util_plain: signals without MaCAN */
+	unsigned misses;
+};
+
+struct macan_sched *macan_sched_create(const struct macan_config *config,
+				       const struct macan_sched_sig *sigs, unsigned bitrate);
+void macan_sched_free(struct macan_sched *s);
+unsigned macan_sched_analyse(struct macan_sched *s);
+uint64_t macan_sched_frame_time(const struct macan_sched *s, uint32_t can_id, unsigned dlc);
+const struct macan_smsg *macan_sched_signed(const struct macan_sched *s, unsigned sig_num);
+bool macan_sched_window(const struct macan_sched *s, unsigned sig_num, uint64_t skew,
+			unsigned *older, unsigned *newer);
+void macan_sched_print(const struct macan_sched *s, FILE *f, uint64_t skew);
+const char *macan_smsg_kind_name(enum macan_smsg_kind kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Discrete event simulation of MaCAN networks in virtual time
+ *
+ * libmacansim is MaCAN built with the bare-metal event loop (evcore)
+ * on top of a simulated target: read_time() returns a virtual clock
+ * and, when no timer is due, the loop does not sleep but advances the
+ * clock to the next timer or frame arrival. All nodes share one
+ * simulated bus and one event loop in one thread; helper_init()
+ * attaches a node to the bus. Random data come from a seeded
+ * generator, so a run is fully determined by its seed and runs as
+ * fast as the nodes can process their events.
+ *
+ * By default the bus is ideal: frames are received right after they are
+ * sent. macan_sim_set_bitrate() turns on a model of CAN arbitration and
+ * bit timing in which frames wait in per-node TX queues for the bus and
+ * the queuing and transmission latency of every frame is reported.
+ *
+ * Applications are compiled with -DMACAN_SIM and linked with
+ * libmacansim instead of libmacan and libev.
+ */
+
+#ifndef MACAN_SIM_H
+#define MACAN_SIM_H
+
+#include <stdint.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct macan_sim_stats {
+	uint64_t frames;	/* Frames sent */
+	uint64_t deliveries;	/* Frames received by nodes */
+	uint64_t steps;		/* Advances of the virtual clock */
+	uint64_t busy_us;	/* Time the bus was transmitting */
+	uint64_t queue_us;	/* Sum of the queuing latencies */
+	uint64_t queue_max_us;	/* Maximal queuing latency */
+};
+
+/* Frame transmitted on a bus with a bitrate */
+struct macan_sim_tx {
+	int canfd;		/* Sender */
+	union {
+		struct can_frame cf;
+		union macan_frame f;	/* For CAN FD frames */
+	};
+	unsigned bits;		/* Including stuffing and interframe space */
+	unsigned data_bits;	/* Of bits, sent with the data bitrate */
+	uint64_t queued;	/* Time of macan_send() */
+	uint64_t start;		/* Won the arbitration */
+	uint64_t end;		/* End of the transmission */
+};
+
+/**
+ * Called for every frame sent, with the virtual time and the
+ * interface of the sender
+ */
+typedef void macan_sim_tap_fn(uint64_t time_us, int canfd, const struct can_frame *cf, void *arg);
+typedef void macan_sim_tx_fn(const struct macan_sim_tx *tx, void *arg);
+
+void macan_sim_reset(uint64_t seed);
+int macan_sim_open(void);
+void macan_sim_set_delay(uint64_t delay_us);
+void macan_sim_set_bitrate(uint32_t bits_per_sec);
+void macan_sim_set_data_bitrate(uint32_t bits_per_sec);
+void macan_sim_set_tap(macan_sim_tap_fn *tap, void *arg);
+void macan_sim_set_tx_hook(macan_sim_tx_fn *fn, void *arg);
+uint64_t macan_sim_run(macan_ev_loop *loop, uint64_t until_us);
+void macan_sim_stats(struct macan_sim_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
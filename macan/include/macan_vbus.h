@@ -0,0 +1,77 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Virtual CAN bus without SocketCAN
+ *
+ * A bus is a ring of the last MACAN_VBUS_SLOTS frames that every
+ * endpoint reads at its own pace. Buses are either private to a process
+ * or shared by processes through a file in /dev/shm. Endpoints are used
+ * like CAN sockets: helper_init("vbus:<name>") or helper_init("shm:<name>")
+ * returns a file descriptor that becomes readable when frames arrive and
+ * macan_read()/macan_xmit() on it receive and send frames. As on SocketCAN
+ * with the default options, a frame is received by all other endpoints
+ * of the bus but not by its sender unless MACAN_VBUS_RECV_OWN is given.
+ * CAN FD frames are received only by endpoints with MACAN_VBUS_FD_FRAMES,
+ * like by sockets with CAN_RAW_FD_FRAMES.
+ *
+ * Sending never blocks. A reader that falls more than the ring behind
+ * loses the oldest frames; they are counted in its statistics.
+ *
+ * Endpoints are opened and closed by one thread; they can be used from
+ * different threads afterwards.
+ */
+
+#ifndef MACAN_VBUS_H
+#define MACAN_VBUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/can.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACAN_VBUS_SLOTS 4096	/* Frames kept in the ring, power of 2 */
+#define MACAN_VBUS_PORTS 256	/* Maximum number of endpoints of a bus */
+
+#define MACAN_VBUS_SHARED   0x1	/* Bus shared with other processes */
+#define MACAN_VBUS_RECV_OWN 0x2	/* Receive frames sent by this endpoint */
+#define MACAN_VBUS_FD_FRAMES 0x4 /* Receive CAN FD frames (CAN_RAW_FD_FRAMES) */
+
+struct macan_vbus_stats {
+	uint64_t tx, rx;
+	uint64_t lost;		/* Frames overwritten before they were read */
+};
+
+int macan_vbus_open(const char *name, unsigned flags);
+void macan_vbus_close(int fd);
+bool macan_vbus_fd(int fd);
+int macan_vbus_set_fd_frames(int fd, bool enable);
+ssize_t macan_vbus_read(int fd, struct can_frame *cf);
+ssize_t macan_vbus_write(int fd, const struct can_frame *cf);
+void macan_vbus_stats(int fd, struct macan_vbus_stats *st);
+int macan_vbus_unlink(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
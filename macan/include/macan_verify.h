@@ -0,0 +1,159 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Passive verification of MaCAN traffic
+ *
+ * A verifier knows the long-term keys of all nodes. It follows the
+ * session key distribution (SESS_KEY frames of the key server) and
+ * the time broadcasts and keeps the history of both, so that frames
+ * can be checked against the state valid at their timestamp.
+ *
+ * Verification is split in three steps:
+ *
+ * 1. macan_verify_track() is fed the protocol frames in time order
+ *    (see macan_verify_is_protocol_id()). It updates the key and time
+ *    history and checks authenticated time itself.
+ *
+ * 2. macan_verify_prepare() turns an authenticated frame into a job
+ *    holding everything needed to check its CMAC. It only reads the
+ *    history, so it can run in parallel for different time ranges
+ *    once the history is complete.
+ *
+ * 3. macan_verify_batch() checks the CMACs of many jobs. It touches
+ *    no shared state and can run in worker threads.
+ */
+
+#ifndef MACAN_VERIFY_H
+#define MACAN_VERIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "macan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACAN_VERIFY_STALE_WINDOW 16	/* Time units searched for stale timestamps */
+
+enum macan_vkind {
+	MACAN_V_NONE,		/* Not an authenticated frame */
+	MACAN_V_SIG16,		/* AUTH_SIG in a crypt frame */
+	MACAN_V_SIG32,		/* AUTH_SIG32 in the secure CAN ID */
+	MACAN_V_ACK,
+	MACAN_V_AUTH_REQ,
+	MACAN_V_KIND_COUNT
+};
+
+enum macan_vresult {
+	MACAN_V_OK,		/* CMAC valid with time within +-1 */
+	MACAN_V_STALE,		/* CMAC valid with an older or newer time */
+	MACAN_V_INVALID,	/* CMAC invalid */
+	MACAN_V_NOKEY,		/* No session key known for the pair */
+	MACAN_V_NOTIME,		/* No time broadcast seen yet */
+	MACAN_V_RESULT_COUNT
+};
+
+enum macan_valert {
+	MACAN_A_INVALID_CMAC,
+	MACAN_A_STALE,
+	MACAN_A_KEY_RENEWAL,	/* Informational */
+	MACAN_A_BAD_SKEY,	/* Session key cannot be unwrapped */
+	MACAN_A_SKEY_REPLAY,	/* Session key answers another challenge */
+	MACAN_A_TIME_JUMP,	/* Plain time differs from the expected one */
+	MACAN_A_FORGED_TIME,	/* Authenticated time with invalid CMAC */
+	MACAN_A_COUNT
+};
+
+struct macan_vkey;
+
+struct macan_vjob {
+	uint64_t ts_ns;		/* Capture timestamp */
+	const struct macan_vkey *key;
+	uint32_t time;		/* Expected MaCAN time */
+	uint8_t plain[16];
+	uint8_t len;
+	uint8_t time_index;
+	uint8_t cmac[4];
+	uint8_t kind;		/* enum macan_vkind */
+	uint8_t result;		/* enum macan_vresult, set by macan_verify_batch() */
+	int8_t delta;		/* Time difference of stale frames */
+	uint8_t src, dst;
+	uint8_t sig_num;	/* Signals and auth requests */
+	uint32_t can_id;
+};
+
+struct macan_valert_info {
+	uint64_t ts_ns;
+	enum macan_valert alert;
+	uint32_t can_id;
+	uint8_t src, dst;	/* Node pair of session key alerts, equal
+				 * for alerts concerning one node */
+	int sig_num;		/* -1 if not related to a signal */
+	int64_t delta;		/* Time difference (stale frames, time jumps) */
+};
+
+struct macan_vsig_stats {
+	uint64_t plain;		/* Non-secure frames */
+	uint64_t result[MACAN_V_RESULT_COUNT];
+	uint64_t auth_req[MACAN_V_RESULT_COUNT];
+	uint64_t first_ok_ns, last_ok_ns;
+};
+
+struct macan_vreport {
+	unsigned sig_count;
+	struct macan_vsig_stats *sig;
+	uint64_t frames;
+	uint64_t kind[MACAN_V_KIND_COUNT][MACAN_V_RESULT_COUNT];
+	uint64_t alerts[MACAN_A_COUNT];
+	uint64_t keys;		/* Session keys distributed */
+	uint64_t time_plain;
+	uint64_t time_auth_ok;
+	/* Called for every alert, may be NULL */
+	void (*alert_cb)(void *arg, const struct macan_valert_info *a);
+	void *arg;
+};
+
+struct macan_verifier;
+
+struct macan_verifier *macan_verify_create(const struct macan_config *config,
+					   const struct macan_key * const *ltks);
+void macan_verify_free(struct macan_verifier *v);
+bool macan_verify_is_protocol_id(const struct macan_verifier *v, uint32_t can_id);
+void macan_verify_track(struct macan_verifier *v, uint64_t ts_ns,
+			const struct can_frame *cf, struct macan_vreport *rep);
+enum macan_vkind macan_verify_prepare(const struct macan_verifier *v, uint64_t ts_ns,
+				      const struct can_frame *cf, struct macan_vjob *job,
+				      struct macan_vreport *rep);
+void macan_verify_batch(struct macan_vjob *jobs, unsigned n);
+void macan_verify_account(const struct macan_vjob *job, struct macan_vreport *rep);
+
+bool macan_vreport_init(struct macan_vreport *rep, const struct macan_config *config);
+void macan_vreport_merge(struct macan_vreport *dst, const struct macan_vreport *src);
+void macan_vreport_free(struct macan_vreport *rep);
+const char *macan_valert_name(enum macan_valert alert);
+const char *macan_vresult_name(enum macan_vresult result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
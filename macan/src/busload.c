@@ -0,0 +1,97 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bus load estimate and adaptive signing rate
+ *
+ * Every frame the node receives or sends is accounted with its worst
+ * case length (stuff bits included, the data phase of CAN FD frames
+ * at the nominal bitrate). At the end of every MACAN_LOAD_WINDOW, the
+ * load of the window is computed from the bitrate in the
+ * configuration. Above MACAN_LOAD_HIGH, the prescalers of signals
+ * with presc_max are doubled, below MACAN_LOAD_LOW they are halved
+ * again, but never below the prescaler requested by the receiver nor
+ * above presc_max.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macan_private.h"
+
+static void window_end(struct macan_ctx *ctx, uint64_t now)
+{
+	struct macan_busload *bl = &ctx->busload;
+	uint64_t capacity = (now - bl->window_start) * ctx->config->bitrate / 1000000;
+	uint64_t load = capacity ? bl->bits * 100 / capacity : 100;
+
+	bl->load = (uint8_t)(load > 100 ? 100 : load);
+	if (bl->load > MACAN_LOAD_HIGH && bl->shift < MACAN_PRESC_SHIFT_MAX)
+		bl->shift++;
+	else if (bl->load < MACAN_LOAD_LOW && bl->shift > 0)
+		bl->shift--;
+	bl->window_start = now;
+	bl->bits = 0;
+}
+
+/**
+ * Account a frame received or sent by the node in the bus load.
+ */
+void macan_busload_account(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	struct macan_busload *bl = &ctx->busload;
+	uint64_t now;
+
+	if (!ctx->config->bitrate)
+		return;
+	now = read_time();
+	if (!bl->window_start)
+		bl->window_start = now;
+	else if (now - bl->window_start >= MACAN_LOAD_WINDOW)
+		window_end(ctx, now);
+	bl->bits += macan_frame_bits_max(cf->can_id, macan_frame_len(cf));
+}
+
+/**
+ * Return the prescaler currently used for the signal @a sig_num.
+ *
+ * This is the prescaler requested by the receiver, increased under
+ * bus load up to presc_max of the signal, or zero if the signal is
+ * not signed periodically.
+ */
+unsigned macan_sig_presc(struct macan_ctx *ctx, uint8_t sig_num)
+{
+	int p = ctx->sighand[sig_num]->presc;
+	unsigned presc = p > 0 ? (unsigned)p : 0;
+	unsigned max = ctx->config->sigspec[sig_num].presc_max;
+
+	if (!presc || !ctx->config->bitrate || max <= presc)
+		return presc;
+	presc <<= ctx->busload.shift;
+	return presc > max ? max : presc;
+}
+
+void macan_get_sig_stats(struct macan_ctx *ctx, uint8_t sig_num, struct macan_sig_stats *stats)
+{
+	const struct sig_handle *sighand = ctx->sighand[sig_num];
+
+	stats->auth = sighand->sent_auth;
+	stats->plain = sighand->sent_plain;
+	stats->presc = (uint8_t)macan_sig_presc(ctx, sig_num);
+	stats->busload = ctx->busload.load;
+}
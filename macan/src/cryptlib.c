@@ -148,6 +148,16 @@ int macan_aes_unwrap(const struct macan_key *key, size_t length, uint8_t *dst, u
  */
 int macan_check_cmac(struct macan_ctx *ctx, struct macan_key *skey, const uint8_t *cmac4,
 		     uint8_t *plain, int time_index, unsigned len)
+{
+	return macan_check_cmac_len(ctx, skey, cmac4, 4, plain, time_index, len);
+}
+
+/**
+ * Like macan_check_cmac() but with @a cmac_len bytes (up to 16) of
+ * the CMAC.
+ */
+int macan_check_cmac_len(struct macan_ctx *ctx, struct macan_key *skey, const uint8_t *cmac4,
+			 unsigned cmac_len, uint8_t *plain, int time_index, unsigned len)
 {
 	uint8_t cmac[16];
 	uint32_t *time_ptr;
@@ -155,7 +165,7 @@ int macan_check_cmac(struct macan_ctx *ctx, struct macan_key *skey, const uint8_
 	if (time_index < 0 || (unsigned)time_index > len - sizeof(*time_ptr)) {
 		macan_aes_cmac(skey, len, cmac, plain);
 		/* add memcmp instead of memchk */
-		return memchk(cmac4, cmac, 4);
+		return memchk(cmac4, cmac, cmac_len);
 	}
 
 	uint32_t time = (uint32_t)macan_get_time(ctx);
@@ -166,7 +176,7 @@ int macan_check_cmac(struct macan_ctx *ctx, struct macan_key *skey, const uint8_
 		*time_ptr = htole32(time + (uint32_t)delta_t);
 		macan_aes_cmac(skey, len, cmac, plain);
 
-		if (memcmp(cmac4, cmac, 4) == 0) {
+		if (memcmp(cmac4, cmac, cmac_len) == 0) {
 			return 1;
 		}
 	}
@@ -183,9 +193,17 @@ int macan_check_cmac(struct macan_ctx *ctx, struct macan_key *skey, const uint8_
  */
 void macan_sign(struct macan_key *skey, uint8_t *cmac4, uint8_t *plain, unsigned len)
 {
-	uint8_t cmac[16];
-	macan_aes_cmac(skey, len, cmac, plain);
-	memcpy(cmac4, cmac, 4);
+	macan_sign_len(skey, cmac4, 4, plain, len);
+}
+
+/**
+ * Like macan_sign() but writes @a cmac_len bytes (up to 16) of the CMAC.
+ */
+void macan_sign_len(struct macan_key *skey, uint8_t *cmac, unsigned cmac_len, uint8_t *plain, unsigned len)
+{
+	uint8_t full[16];
+	macan_aes_cmac(skey, len, full, plain);
+	memcpy(cmac, full, cmac_len);
 }
 
 /**
@@ -0,0 +1,153 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Deadline queue of the housekeeping timer
+ *
+ * Instead of scanning all communication partners periodically, every
+ * time-dependent action (key expiration, key request timeout,
+ * deferred request for signed time) registers its deadline here. The
+ * deadlines are kept in a binary min-heap and the housekeeping timer
+ * is armed for the earliest one only.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macan_ev.h"
+#include "macan_private.h"
+
+static void heap_place(struct macan_ctx *ctx, struct macan_deadline *dl, unsigned i)
+{
+	ctx->dlheap[i] = dl;
+	dl->pos = i + 1;
+}
+
+static void sift_up(struct macan_ctx *ctx, unsigned i)
+{
+	struct macan_deadline *dl = ctx->dlheap[i];
+
+	while (i > 0) {
+		unsigned parent = (i - 1) / 2;
+		if (ctx->dlheap[parent]->when <= dl->when)
+			break;
+		heap_place(ctx, ctx->dlheap[parent], i);
+		i = parent;
+	}
+	heap_place(ctx, dl, i);
+}
+
+static void sift_down(struct macan_ctx *ctx, unsigned i)
+{
+	struct macan_deadline *dl = ctx->dlheap[i];
+
+	while (1) {
+		unsigned child = 2 * i + 1;
+		if (child >= ctx->dlcount)
+			break;
+		if (child + 1 < ctx->dlcount &&
+		    ctx->dlheap[child + 1]->when < ctx->dlheap[child]->when)
+			child++;
+		if (dl->when <= ctx->dlheap[child]->when)
+			break;
+		heap_place(ctx, ctx->dlheap[child], i);
+		i = child;
+	}
+	heap_place(ctx, dl, i);
+}
+
+/**
+ * Return the earliest pending deadline or NULL if there is none.
+ */
+struct macan_deadline *macan_deadline_first(struct macan_ctx *ctx)
+{
+	return ctx->dlcount ? ctx->dlheap[0] : NULL;
+}
+
+/**
+ * Arm the housekeeping timer for the earliest deadline.
+ *
+ * The timer is only touched when the earliest deadline differs from
+ * the one it is currently armed for. When called from the
+ * housekeeping callback, rearming is postponed till the callback
+ * finishes.
+ */
+void macan_deadline_arm(struct macan_ctx *ctx)
+{
+	struct macan_deadline *first = macan_deadline_first(ctx);
+
+	if (ctx->hk_running)
+		return;
+
+	if (!first) {
+		if (ctx->hk_armed != UINT64_MAX) {
+			macan_ev_timer_stop(ctx->loop, &ctx->housekeeping);
+			ctx->hk_armed = UINT64_MAX;
+		}
+		return;
+	}
+
+	if (first->when != ctx->hk_armed) {
+		uint64_t now = read_time();
+		ctx->hk_armed = first->when;
+		macan_ev_timer_rearm(ctx->loop, &ctx->housekeeping,
+				     first->when > now ? first->when - now : 0);
+	}
+}
+
+/**
+ * Set (or move) a deadline.
+ *
+ * @param when Local time (read_time()) of the deadline.
+ */
+void macan_deadline_set(struct macan_ctx *ctx, struct macan_deadline *dl, uint64_t when)
+{
+	if (!ctx->dlheap)
+		return;
+
+	dl->when = when;
+	if (dl->pos == 0) {
+		heap_place(ctx, dl, ctx->dlcount++);
+		sift_up(ctx, dl->pos - 1);
+	} else {
+		sift_up(ctx, dl->pos - 1);
+		sift_down(ctx, dl->pos - 1);
+	}
+	macan_deadline_arm(ctx);
+}
+
+/**
+ * Remove a deadline from the queue (if it is queued).
+ */
+void macan_deadline_cancel(struct macan_ctx *ctx, struct macan_deadline *dl)
+{
+	unsigned i;
+
+	if (dl->pos == 0)
+		return;
+
+	i = dl->pos - 1;
+	dl->pos = 0;
+	if (i != --ctx->dlcount) {
+		struct macan_deadline *last = ctx->dlheap[ctx->dlcount];
+		heap_place(ctx, last, i);
+		sift_up(ctx, i);
+		sift_down(ctx, last->pos - 1);
+	}
+	macan_deadline_arm(ctx);
+}
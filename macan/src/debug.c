@@ -44,7 +44,7 @@ void debug_printf(const char* format, ...)
 #define GET_SEQ(byte) (((byte) & 0xF0) >> 4)
 #define GET_LEN(byte) ((byte) & 0x0F)
 
-static void get_ecuid_str(const struct macan_ctx *ctx, char *str, size_t size, macan_ecuid id)
+void macan_sprint_ecuid(const struct macan_ctx *ctx, char *str, size_t size, macan_ecuid id)
 {
 	if (id < ctx->config->node_count) {
 		if (ctx->config->canid->ecu[id].name) {
@@ -61,19 +61,24 @@ static void get_ecuid_str(const struct macan_ctx *ctx, char *str, size_t size, m
 			size_t l = strlen(str);
 			snprintf(str + l, size-l, "(me)");
 		}
-	} else
+	} else if (macan_get_group(ctx->config, id))
+		snprintf(str, size, "G%02u", id);
+	else
 		snprintf(str, size, "%02u (bad!)", id);
 }
 
 void print_frame(const struct macan_ctx *ctx, struct can_frame *cf, const char *prefix)
 {
-	char frame[80], comment[80];
+	char frame[160], comment[80];
 	macan_ecuid src;
 	const char *color = "";
 	comment[0] = 0;
-	sprint_canframe(frame, cf, 0, 8);
+	sprint_canframe(frame, cf, 0, macan_is_canfd(cf) ? 64 : 8);
 	if (ctx) {
-		if (cf->can_id == ctx->config->canid->time) {
+		if (macan_is_canfd(cf)) {
+			sprintf(comment, "CAN FD");
+		}
+		else if (cf->can_id == ctx->config->canid->time) {
 			uint32_t time;
 			memcpy(&time, cf->data, 4); /* FIXME: Handle endian */
 			switch (cf->can_dlc) {
@@ -97,7 +102,7 @@ void print_frame(const struct macan_ctx *ctx, struct can_frame *cf, const char *
 				case FL_REQ_CHALLENGE: {
 					struct macan_req_challenge *chg = (struct macan_req_challenge*)cf->data;
 					char fwdstr[20];
-					get_ecuid_str(ctx, fwdstr, sizeof(fwdstr), chg->fwd_id);
+					macan_sprint_ecuid(ctx, fwdstr, sizeof(fwdstr), chg->fwd_id);
 					sprintf(type, "req challenge fwd_id=%s%s", fwdstr,
 						cf->can_dlc == 2 ? "" : " wrong length");
 					break;
@@ -105,7 +110,7 @@ void print_frame(const struct macan_ctx *ctx, struct can_frame *cf, const char *
 				case FL_CHALLENGE: {
 					struct macan_challenge *chg = (struct macan_challenge*)cf->data;
 					char fwdstr[20];
-					get_ecuid_str(ctx, fwdstr, sizeof(fwdstr), chg->fwd_id);
+					macan_sprint_ecuid(ctx, fwdstr, sizeof(fwdstr), chg->fwd_id);
 					sprintf(type, "challenge fwd_id=%s", fwdstr);
 					color = ANSI_COLOR_DCYAN;
 					break;
@@ -152,8 +157,8 @@ void print_frame(const struct macan_ctx *ctx, struct can_frame *cf, const char *
 				char srcstr[8], dststr[8];
 				macan_ecuid dst = macan_crypt_dst(cf);
 
-				get_ecuid_str(ctx, srcstr, sizeof(srcstr), src);
-				get_ecuid_str(ctx, dststr, sizeof(dststr), dst);
+				macan_sprint_ecuid(ctx, srcstr, sizeof(srcstr), src);
+				macan_sprint_ecuid(ctx, dststr, sizeof(dststr), dst);
 
 				sprintf(comment, "crypt %s->%s (%d->%d): %s", srcstr, dststr, src, dst, type);
 			}
@@ -0,0 +1,223 @@
+/*
+ *  Copyright 2014, 2019 Czech Technical University in Prague
+ *
+ *  Authors: Michal Sojka <sojkam1@fel.cvut.cz>
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "macan_ev.h"
+
+macan_ev_loop macan_ev_loop_default;
+
+static void timer_unlink(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	macan_ev_timer **p;
+
+	for (p = &loop->timers; *p; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
+	}
+	w->next = NULL;
+	w->active = false;
+}
+
+/* Insert behind all timers with the same expiration time so that
+ * timers expiring at the same time run in the order of arming. */
+static void timer_insert(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	macan_ev_timer **p;
+
+	for (p = &loop->timers; *p && (*p)->expire_us <= w->expire_us; p = &(*p)->next);
+	w->next = *p;
+	*p = w;
+	w->active = true;
+}
+
+static void timer_set(macan_ev_loop *loop, macan_ev_timer *w, uint64_t expire_us)
+{
+	if (w->active)
+		timer_unlink(loop, w);
+	w->expire_us = expire_us;
+	timer_insert(loop, w);
+}
+
+void
+macan_ev_can_init(macan_ev_can *ev,
+		  void (*cb) (macan_ev_loop *loop,  macan_ev_can *w, int revents),
+		  int canfd, int events)
+{
+	ev->cb = cb;
+	ev->canfd = canfd;
+	ev->events = events;
+	ev->rx = (events & MACAN_EV_READ) ? macan_ev_rxring(canfd) : NULL;
+}
+
+void
+macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w)
+{
+	w->next = loop->cans;
+	loop->cans = w;
+}
+
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w)
+{
+	macan_ev_can **p;
+
+	for (p = &loop->cans; *p; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
+	}
+}
+
+void
+macan_ev_timer_init(macan_ev_timer *ev,
+		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
+		    unsigned after_ms, unsigned repeat_ms)
+{
+	ev->cb = cb;
+	ev->next = NULL;
+	ev->active = false;
+	ev->after_us = (uint64_t)after_ms * 1000;
+	ev->repeat_us = (uint64_t)repeat_ms * 1000;
+	ev->expire_us = UINT64_MAX;
+}
+
+void
+macan_ev_timer_start(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	timer_set(loop, w, read_time() + w->after_us);
+}
+
+/**
+ * Restart a repeating timer with its repeat interval, stop a one-shot
+ * one (same as ev_timer_again()).
+ */
+void
+macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	if (w->repeat_us)
+		timer_set(loop, w, read_time() + w->repeat_us);
+	else
+		macan_ev_timer_stop(loop, w);
+}
+
+/**
+ * Make the timer a one-shot timer expiring @a after_us from now.
+ */
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us)
+{
+	w->repeat_us = 0;
+	timer_set(loop, w, read_time() + after_us);
+}
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	if (w->active)
+		timer_unlink(loop, w);
+	w->expire_us = UINT64_MAX;
+}
+
+/**
+ * Return the expiration time of the earliest active timer or
+ * UINT64_MAX if no timer is active.
+ */
+uint64_t
+macan_ev_next_deadline(macan_ev_loop *loop)
+{
+	return loop->timers ? loop->timers->expire_us : UINT64_MAX;
+}
+
+/* Invoke callbacks of read watchers with queued frames and of write
+ * watchers whose interface can transmit. A read callback is expected
+ * to drain the ring with macan_read(). Callbacks may stop their
+ * watcher. */
+static void run_cans(macan_ev_loop *loop)
+{
+	macan_ev_can *can, *next;
+
+	for (can = loop->cans; can && !loop->stop; can = next) {
+		next = can->next;
+		if (can->events & MACAN_EV_READ) {
+			poll_can_fifo(can->rx);
+			if (!macan_rxring_empty(can->rx))
+				can->cb(loop, can, MACAN_EV_READ);
+		} else if (macan_ev_tx_ready(can->canfd))
+			can->cb(loop, can, MACAN_EV_WRITE);
+	}
+}
+
+/* Invoke callbacks of all timers expired at @a now. Repeating timers
+ * are rescheduled relative to their previous expiration so that they
+ * do not drift; if the loop got late by more than one period, the
+ * missed expirations are skipped. */
+static void run_timers(macan_ev_loop *loop, uint64_t now)
+{
+	macan_ev_timer *t;
+
+	while ((t = loop->timers) && t->expire_us <= now && !loop->stop) {
+		loop->timers = t->next;
+		t->next = NULL;
+		t->active = false;
+		if (t->repeat_us) {
+			t->expire_us += t->repeat_us;
+			if (t->expire_us <= now)
+				t->expire_us = now + t->repeat_us;
+			timer_insert(loop, t);
+		} else
+			t->expire_us = UINT64_MAX;
+		/* The callback may stop or rearm the timer */
+		t->cb(loop, t, MACAN_EV_TIMER);
+	}
+}
+
+bool
+macan_ev_run(macan_ev_loop *loop)
+{
+	loop->stop = false;
+	while (!loop->stop) {
+		uint64_t deadline;
+
+		run_cans(loop);
+
+		run_timers(loop, read_time());
+		if (loop->stop)
+			break;
+
+		deadline = macan_ev_next_deadline(loop);
+		if (deadline > read_time())
+			macan_ev_wait(loop, deadline);
+	}
+	return true;
+}
+
+/**
+ * Make macan_ev_run() return after the currently running callback.
+ */
+void
+macan_ev_break(macan_ev_loop *loop)
+{
+	loop->stop = true;
+}
@@ -0,0 +1,149 @@
+/*
+ *  Copyright 2014, 2019 Czech Technical University in Prague
+ *
+ *  Authors: Michal Sojka <sojkam1@fel.cvut.cz>
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Portable tickless event loop for bare-metal targets
+ *
+ * Timers are kept in a list sorted by expiration time so that the
+ * loop always knows the next deadline. When there is nothing to do,
+ * the loop calls the target's macan_ev_wait() hook, which may put the
+ * CPU to sleep until the deadline or until a CAN frame arrives.
+ *
+ * Received frames are queued by the target in a macan_rxring (usually
+ * from the RX interrupt) and the watcher's callback is invoked once
+ * for every batch of queued frames. Write watchers are invoked when
+ * the target reports that the controller can accept another frame.
+ *
+ * The core does not depend on anything else from MaCAN and can be
+ * built for the host (see libmacanevcore) to test and benchmark it
+ * with simulated hooks.
+ */
+
+#ifndef MACAN_EV_H
+#define MACAN_EV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macan_rxring.h"
+
+#define MACAN_EV_DEFAULT &macan_ev_loop_default;
+
+#define MACAN_EV_READ	 1
+#define MACAN_EV_TIMER	 2
+#define MACAN_EV_WRITE	 4
+
+struct macan_ev_loop;
+
+typedef struct macan_ev_can {
+	void (*cb) (struct macan_ev_loop *loop,  struct macan_ev_can *w, int revents);
+	struct macan_ev_can *next;
+	int canfd;
+	int events;			/* MACAN_EV_READ or MACAN_EV_WRITE */
+	struct macan_rxring *rx;	/* Frames received on canfd */
+	void *data;
+} macan_ev_can;
+
+typedef struct macan_ev_timer {
+	void (*cb) (struct macan_ev_loop *loop,  struct macan_ev_timer *w, int revents);
+	struct macan_ev_timer *next;
+	uint64_t after_us;
+	uint64_t repeat_us;
+	uint64_t expire_us;
+	bool active;
+	void *data;
+} macan_ev_timer;
+
+typedef struct macan_ev_loop {
+	macan_ev_can   *cans;
+	macan_ev_timer *timers;	/* Active timers sorted by expire_us */
+	bool stop;
+} macan_ev_loop;
+
+extern macan_ev_loop macan_ev_loop_default;
+
+void
+macan_ev_can_init(macan_ev_can *ev,
+		  void (*cb) (macan_ev_loop *loop,  macan_ev_can *w, int revents),
+		  int canfd, int events);
+void
+macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w);
+
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w);
+
+void
+macan_ev_timer_init(macan_ev_timer *ev,
+		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
+		    unsigned after_ms, unsigned repeat_ms);
+
+void
+macan_ev_timer_start(macan_ev_loop *loop, macan_ev_timer *w);
+
+void
+macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w);
+
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us);
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w);
+
+uint64_t
+macan_ev_next_deadline(macan_ev_loop *loop);
+
+bool
+macan_ev_run(macan_ev_loop *loop);
+
+void
+macan_ev_break(macan_ev_loop *loop);
+
+/* Hooks implemented by the target */
+
+uint64_t read_time(void);
+
+/**
+ * Return the receive ring of CAN interface @a canfd.
+ */
+struct macan_rxring *macan_ev_rxring(int canfd);
+
+/**
+ * Move frames from the CAN controller to the ring @a rx. Targets that
+ * fill the ring from the RX interrupt need not do anything here.
+ */
+void poll_can_fifo(struct macan_rxring *rx);
+
+/**
+ * Return whether CAN interface @a canfd can accept a frame for
+ * transmission.
+ */
+bool macan_ev_tx_ready(int canfd);
+
+/**
+ * Wait for the next event.
+ *
+ * Called by macan_ev_run() when no timer is due. The target may
+ * sleep until read_time() reaches @a deadline_us or until a CAN frame
+ * is queued to a receive ring, whichever comes first. Returning early is always
+ * allowed. @a deadline_us is UINT64_MAX when no timer is active.
+ */
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Lock-free receive ring between CAN RX interrupt and the event loop
+ *
+ * There must be exactly one producer (the RX interrupt or the FIFO
+ * polling code) and one consumer (macan_read()). Both indices run
+ * freely and wrap around; the number of queued frames is head - tail.
+ * When the ring is full, the producer drops the new frame and counts
+ * it in overflows.
+ */
+
+#ifndef MACAN_RXRING_H
+#define MACAN_RXRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "can_frame.h"
+
+#ifndef MACAN_RXRING_SIZE
+#define MACAN_RXRING_SIZE 16	/* Must be a power of two */
+#endif
+
+#ifndef MACAN_RXRING_BARRIER
+#if defined(__GNUC__)
+#define MACAN_RXRING_BARRIER() __sync_synchronize()
+#elif defined(__TASKING__)
+#define MACAN_RXRING_BARRIER() __dsync()
+#else
+#error "Define MACAN_RXRING_BARRIER() for your compiler"
+#endif
+#endif
+
+struct macan_rxring {
+	volatile uint32_t head;		/* Written only by the producer */
+	volatile uint32_t tail;		/* Written only by the consumer */
+	volatile uint32_t overflows;	/* Frames dropped because the ring was full */
+	volatile uint32_t hw_overruns;	/* Frames lost by the CAN controller (if known) */
+	uint32_t max_fill;		/* Highest number of queued frames seen by the consumer */
+	union macan_frame buf[MACAN_RXRING_SIZE];
+};
+
+static inline uint32_t macan_rxring_count(const struct macan_rxring *r)
+{
+	return r->head - r->tail;
+}
+
+static inline bool macan_rxring_empty(const struct macan_rxring *r)
+{
+	return r->head == r->tail;
+}
+
+/**
+ * Enqueue a received frame (producer side, callable from ISR).
+ *
+ * @return false if the ring is full and the frame was dropped.
+ */
+static inline bool macan_rxring_put(struct macan_rxring *r, const struct can_frame *cf)
+{
+	uint32_t head = r->head;
+
+	if (head - r->tail >= MACAN_RXRING_SIZE) {
+		r->overflows++;
+		return false;
+	}
+	macan_frame_copy(&r->buf[head & (MACAN_RXRING_SIZE - 1)], cf);
+	MACAN_RXRING_BARRIER();	/* Publish the frame before the index */
+	r->head = head + 1;
+	return true;
+}
+
+/**
+ * Dequeue the oldest frame (consumer side). @a cf must have room for
+ * a CAN FD frame if there are any on the bus.
+ *
+ * @return false if the ring is empty.
+ */
+static inline bool macan_rxring_get(struct macan_rxring *r, struct can_frame *cf)
+{
+	uint32_t tail = r->tail;
+	uint32_t fill = r->head - tail;
+
+	if (fill == 0)
+		return false;
+	if (fill > r->max_fill)
+		r->max_fill = fill;
+	MACAN_RXRING_BARRIER();	/* Read the index before the frame */
+	const union macan_frame *f = &r->buf[tail & (MACAN_RXRING_SIZE - 1)];
+	memcpy(cf, f, macan_frame_size(&f->cf));
+	MACAN_RXRING_BARRIER();	/* Copy the frame out before freeing the slot */
+	r->tail = tail + 1;
+	return true;
+}
+
+#endif
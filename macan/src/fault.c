@@ -0,0 +1,593 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fault injection (see macan_fault.h)
+ *
+ * Every attached context gets a port that replaces txq.xmit. Delayed
+ * and reordered frames are held in the port, sorted by the time they
+ * are released, and a timer of the port releases them. A reordered
+ * frame is released right after the next frame of the node or after
+ * its delay (one second by default), whichever comes first.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macan_ev.h"
+#include "macan_fault.h"
+#include "macan_private.h"
+
+#define FAULT_HELD 16			/* Frames a port can hold */
+#define FAULT_REORDER_HOLD 1000000	/* Default hold of reordered frames */
+#define FAULT_RETRY 1000		/* Release retry when the controller is busy */
+
+struct fault_rule {
+	struct macan_fault_rule r;
+	unsigned done;			/* Frames affected so far */
+};
+
+struct fault_frame {
+	uint64_t at;			/* Release time */
+	bool until_next;		/* Reordered, release after the next frame */
+	union macan_frame f;
+};
+
+struct macan_fault_port {
+	struct macan_faults *f;
+	struct macan_ctx *ctx;
+	enum macan_xmit_status (*xmit)(struct macan_ctx *ctx, const struct can_frame *cf);
+	struct fault_frame held[FAULT_HELD];
+	unsigned held_count;
+	macan_ev_timer timer;
+	struct macan_fault_port *next;
+};
+
+struct macan_faults {
+	struct fault_rule *rules;
+	unsigned rule_count;
+	macan_fault_restart_fn *restart;
+	void *restart_arg;
+	macan_ev_loop *loop;		/* Of the first attached context */
+	macan_ev_timer restart_timer;
+	struct macan_fault_port *ports;
+	struct macan_fault_stats stats;
+};
+
+static const char *const type_names[] = {
+	[MACAN_FT_ANY]		 = "ANY",
+	[MACAN_FT_REQ_CHALLENGE] = "REQ_CHALLENGE",
+	[MACAN_FT_CHALLENGE]	 = "CHALLENGE",
+	[MACAN_FT_SESS_KEY]	 = "SESS_KEY",
+	[MACAN_FT_ACK]		 = "ACK",
+	[MACAN_FT_AUTH_REQ]	 = "AUTH_REQ",
+	[MACAN_FT_SIGNAL]	 = "SIGNAL",
+	[MACAN_FT_TIME]		 = "TIME",
+	[MACAN_FT_SIGNED_TIME]	 = "SIGNED_TIME",
+};
+
+struct macan_faults *macan_fault_alloc(void)
+{
+	struct macan_faults *f = calloc(1, sizeof(*f));
+
+	if (f)
+		f->stats.first_us = UINT64_MAX;
+	return f;
+}
+
+/**
+ * Free the rules. The contexts they are attached to must not be used
+ * any more.
+ */
+void macan_fault_free(struct macan_faults *f)
+{
+	struct macan_fault_port *p, *next;
+
+	if (!f)
+		return;
+	for (p = f->ports; p; p = next) {
+		next = p->next;
+		macan_ev_timer_stop(p->ctx->loop, &p->timer);
+		p->ctx->txq.xmit = p->xmit;
+		p->ctx->fault = NULL;
+		free(p);
+	}
+	if (f->loop)
+		macan_ev_timer_stop(f->loop, &f->restart_timer);
+	free(f->rules);
+	free(f);
+}
+
+static void arm_restart(struct macan_faults *f)
+{
+	uint64_t next = UINT64_MAX, now;
+	unsigned i;
+
+	if (!f->loop)
+		return;
+	for (i = 0; i < f->rule_count; i++) {
+		const struct fault_rule *fr = &f->rules[i];
+
+		if (fr->r.action == MACAN_FAULT_RESTART && !fr->done && fr->r.from_us < next)
+			next = fr->r.from_us;
+	}
+	if (next == UINT64_MAX) {
+		macan_ev_timer_stop(f->loop, &f->restart_timer);
+		return;
+	}
+	now = read_time();
+	macan_ev_timer_rearm(f->loop, &f->restart_timer, next > now ? next - now : 0);
+}
+
+/**
+ * Add a rule.
+ *
+ * @return Zero on success, -1 if the rule is invalid or memory is
+ * exhausted.
+ */
+int macan_fault_add(struct macan_faults *f, const struct macan_fault_rule *rule)
+{
+	struct fault_rule *rules;
+
+	if (rule->action == MACAN_FAULT_RESTART && rule->node < 0)
+		return -1;
+	if (rule->prob < 0 || rule->prob > 1 || rule->from_us > rule->until_us)
+		return -1;
+	rules = realloc(f->rules, (f->rule_count + 1) * sizeof(*rules));
+	if (!rules)
+		return -1;
+	f->rules = rules;
+	f->rules[f->rule_count].r = *rule;
+	f->rules[f->rule_count].done = 0;
+	f->rule_count++;
+	if (rule->action == MACAN_FAULT_RESTART)
+		arm_restart(f);
+	return 0;
+}
+
+static const char *next_token(const char **s, size_t *len)
+{
+	const char *t = *s;
+
+	while (*t == ' ' || *t == '\t')
+		t++;
+	*s = t;
+	while (**s && !isspace((unsigned char)**s))
+		(*s)++;
+	*len = (size_t)(*s - t);
+	return *len ? t : NULL;
+}
+
+static bool token_is(const char *t, size_t len, const char *word)
+{
+	return t && strlen(word) == len && strncmp(t, word, len) == 0;
+}
+
+static bool parse_uint(const char *t, size_t len, unsigned long *val)
+{
+	char *end;
+
+	if (!t || !isdigit((unsigned char)*t))
+		return false;
+	*val = strtoul(t, &end, 0);
+	return end == t + len;
+}
+
+/* Time as "10 s", "10s" or "t=10 s" */
+static bool parse_time(const char **s, uint64_t *us)
+{
+	size_t len;
+	const char *t = next_token(s, &len), *unit;
+	char *end;
+	double val;
+
+	if (t && len > 2 && strncmp(t, "t=", 2) == 0) {
+		t += 2;
+		len -= 2;
+	}
+	if (!t || !(isdigit((unsigned char)*t) || *t == '.'))
+		return false;
+	val = strtod(t, &end);
+	if (end == t + len) {
+		unit = next_token(s, &len);
+	} else {
+		unit = end;
+		len = (size_t)(t + len - end);
+	}
+	if (token_is(unit, len, "s"))
+		val *= 1e6;
+	else if (token_is(unit, len, "ms"))
+		val *= 1e3;
+	else if (!token_is(unit, len, "us"))
+		return false;
+	*us = (uint64_t)(val + 0.5);
+	return true;
+}
+
+static bool parse_rule(const char *line, struct macan_fault_rule *r)
+{
+	const char *s = line, *t;
+	size_t len;
+	unsigned long val;
+	bool has_prob = false, has_count = false, has_until = false;
+
+	memset(r, 0, sizeof(*r));
+	r->node = -1;
+	r->seq = -1;
+	r->prob = 1;
+	r->until_us = UINT64_MAX;
+
+	t = next_token(&s, &len);
+	if (token_is(t, len, "drop")) {
+		r->action = MACAN_FAULT_DROP;
+	} else if (token_is(t, len, "corrupt")) {
+		r->action = MACAN_FAULT_CORRUPT;
+	} else if (token_is(t, len, "delay")) {
+		r->action = MACAN_FAULT_DELAY;
+		if (!parse_time(&s, &r->delay_us))
+			return false;
+	} else if (token_is(t, len, "reorder")) {
+		r->action = MACAN_FAULT_REORDER;
+	} else if (token_is(t, len, "restart")) {
+		r->action = MACAN_FAULT_RESTART;
+	} else {
+		return false;
+	}
+
+	while ((t = next_token(&s, &len)) != NULL) {
+		unsigned i;
+
+		for (i = 1; i < sizeof(type_names) / sizeof(*type_names); i++)
+			if (token_is(t, len, type_names[i]))
+				break;
+		if (i < sizeof(type_names) / sizeof(*type_names)) {
+			r->type = (enum macan_fault_type)i;
+		} else if (token_is(t, len, "id")) {
+			t = next_token(&s, &len);
+			if (!parse_uint(t, len, &val))
+				return false;
+			r->can_id = (uint32_t)val;
+			r->can_mask = CAN_EFF_MASK;
+		} else if (token_is(t, len, "mask")) {
+			t = next_token(&s, &len);
+			if (!parse_uint(t, len, &val))
+				return false;
+			r->can_mask = (uint32_t)val;
+		} else if (token_is(t, len, "node")) {
+			t = next_token(&s, &len);
+			if (!parse_uint(t, len, &val) || val > 63)
+				return false;
+			r->node = (int)val;
+		} else if (token_is(t, len, "seq")) {
+			t = next_token(&s, &len);
+			if (!parse_uint(t, len, &val) || val > 5)
+				return false;
+			r->seq = (int)val;
+		} else if (token_is(t, len, "count")) {
+			t = next_token(&s, &len);
+			if (!parse_uint(t, len, &val))
+				return false;
+			r->count = (unsigned)val;
+			has_count = true;
+		} else if (token_is(t, len, "p")) {
+			char *end;
+
+			t = next_token(&s, &len);
+			if (!t)
+				return false;
+			r->prob = strtod(t, &end);
+			if (end != t + len)
+				return false;
+			has_prob = true;
+		} else if (token_is(t, len, "at")) {
+			if (!parse_time(&s, &r->from_us))
+				return false;
+		} else if (token_is(t, len, "until")) {
+			if (!parse_time(&s, &r->until_us))
+				return false;
+			has_until = true;
+		} else {
+			return false;
+		}
+	}
+	if (!has_prob && !has_count && !has_until)
+		r->count = 1;
+	return true;
+}
+
+/**
+ * Add rules written as text (see macan_fault.h). Lines are separated
+ * by newlines or semicolons, "#" starts a comment.
+ *
+ * @return Zero on success or the number of the first invalid line.
+ * Rules before it are added.
+ */
+int macan_fault_parse(struct macan_faults *f, const char *script)
+{
+	int line = 0;
+
+	while (*script) {
+		char buf[160];
+		size_t len = strcspn(script, "\n;");
+		char *hash;
+		struct macan_fault_rule r;
+		const char *s = buf;
+		size_t tlen;
+
+		line++;
+		if (len >= sizeof(buf))
+			return line;
+		memcpy(buf, script, len);
+		buf[len] = 0;
+		script += len;
+		if (*script)
+			script++;
+		hash = strchr(buf, '#');
+		if (hash)
+			*hash = 0;
+		if (!next_token(&s, &tlen))
+			continue;	/* Empty line */
+		if (!parse_rule(buf, &r) || macan_fault_add(f, &r) != 0)
+			return line;
+	}
+	return 0;
+}
+
+void macan_fault_set_restart(struct macan_faults *f, macan_fault_restart_fn *fn, void *arg)
+{
+	f->restart = fn;
+	f->restart_arg = arg;
+}
+
+static void noted(struct macan_faults *f, uint64_t now)
+{
+	if (f->stats.first_us == UINT64_MAX)
+		f->stats.first_us = now;
+	f->stats.last_us = now;
+}
+
+static enum macan_fault_type frame_type(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	macan_ecuid src;
+
+	if (cf->can_id == ctx->config->canid->time)
+		return cf->can_dlc == 8 ? MACAN_FT_SIGNED_TIME : MACAN_FT_TIME;
+	if (!macan_canid2ecuid(ctx->config, cf->can_id, &src))
+		return MACAN_FT_SIGNAL;
+	switch (macan_crypt_flags(cf)) {
+	case FL_REQ_CHALLENGE:
+		return MACAN_FT_REQ_CHALLENGE;
+	case FL_CHALLENGE:
+		return MACAN_FT_CHALLENGE;
+	case FL_SESS_KEY_OR_ACK:
+		return src == ctx->config->key_server_id ? MACAN_FT_SESS_KEY : MACAN_FT_ACK;
+	default:
+		return cf->can_dlc == 8 ? MACAN_FT_SIGNAL : MACAN_FT_AUTH_REQ;
+	}
+}
+
+static bool rule_matches(const struct macan_fault_rule *r, struct macan_ctx *ctx,
+			 const struct can_frame *cf, enum macan_fault_type type, uint64_t now)
+{
+	if (r->action == MACAN_FAULT_RESTART)
+		return false;
+	if (now < r->from_us || now >= r->until_us)
+		return false;
+	if (r->type != MACAN_FT_ANY && r->type != type)
+		return false;
+	if ((cf->can_id & r->can_mask) != (r->can_id & r->can_mask))
+		return false;
+	if (r->node >= 0 && r->node != ctx->node->node_id)
+		return false;
+	if (r->seq >= 0 && (type != MACAN_FT_SESS_KEY || (cf->data[1] >> 4) != r->seq))
+		return false;
+	return true;
+}
+
+static bool chance(double prob)
+{
+	uint32_t r;
+
+	if (prob >= 1)
+		return true;
+	gen_rand_data(&r, sizeof(r));
+	return (double)r < prob * 4294967296.0;
+}
+
+static void arm_port(struct macan_fault_port *p)
+{
+	uint64_t now = read_time();
+
+	if (!p->held_count) {
+		macan_ev_timer_stop(p->ctx->loop, &p->timer);
+		return;
+	}
+	macan_ev_timer_rearm(p->ctx->loop, &p->timer,
+			     p->held[0].at > now ? p->held[0].at - now : 0);
+}
+
+static bool hold(struct macan_fault_port *p, const struct can_frame *cf, uint64_t at, bool until_next)
+{
+	unsigned i;
+
+	if (p->held_count == FAULT_HELD)
+		return false;
+	for (i = p->held_count; i > 0 && p->held[i - 1].at > at; i--)
+		p->held[i] = p->held[i - 1];
+	p->held[i].at = at;
+	p->held[i].until_next = until_next;
+	macan_frame_copy(&p->held[i].f, cf);
+	p->held_count++;
+	arm_port(p);
+	return true;
+}
+
+/* Transmit held frames due at @a now and, if @a next_sent, the
+ * reordered ones */
+static void release(struct macan_fault_port *p, uint64_t now, bool next_sent)
+{
+	unsigned i = 0, kept = 0;
+
+	for (i = 0; i < p->held_count; i++) {
+		struct fault_frame *h = &p->held[i];
+
+		if (h->at <= now || (next_sent && h->until_next)) {
+			enum macan_xmit_status st = p->xmit(p->ctx, &h->f.cf);
+
+			if (st != MACAN_XMIT_BUSY && st != MACAN_XMIT_RETRY)
+				continue;
+		}
+		if (h->at <= now)
+			h->at = now + FAULT_RETRY;
+		p->held[kept++] = *h;
+	}
+	p->held_count = kept;
+	arm_port(p);
+}
+
+static void
+port_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	release(w->data, read_time(), false);
+}
+
+static enum macan_xmit_status fault_xmit(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	struct macan_fault_port *p = ctx->fault;
+	struct macan_faults *f = p->f;
+	enum macan_fault_type type = frame_type(ctx, cf);
+	enum macan_xmit_status st;
+	uint64_t now = read_time();
+	union macan_frame buf;
+	struct can_frame *c = &buf.cf;
+	unsigned i;
+
+	macan_frame_copy(&buf, cf);
+	for (i = 0; i < f->rule_count; i++) {
+		struct fault_rule *fr = &f->rules[i];
+		uint32_t bit;
+		uint8_t *data;
+
+		if ((fr->r.count && fr->done >= fr->r.count) ||
+		    !rule_matches(&fr->r, ctx, c, type, now) ||
+		    !chance(fr->r.prob))
+			continue;
+		fr->done++;
+		noted(f, now);
+		switch (fr->r.action) {
+		case MACAN_FAULT_DROP:
+			f->stats.dropped++;
+			return MACAN_XMIT_OK;	/* Lost on the bus */
+		case MACAN_FAULT_CORRUPT:
+			f->stats.corrupted++;
+			if (!macan_frame_len(c))
+				break;
+			gen_rand_data(&bit, sizeof(bit));
+			bit %= 8U * macan_frame_len(c);
+			data = c->data;	/* Up to 64 bytes of a CAN FD frame */
+			data[bit / 8] ^= (uint8_t)(1U << (bit % 8));
+			break;
+		case MACAN_FAULT_DELAY:
+			if (!hold(p, c, now + fr->r.delay_us, false))
+				break;
+			f->stats.delayed++;
+			return MACAN_XMIT_OK;
+		case MACAN_FAULT_REORDER:
+			if (!hold(p, c, now + (fr->r.delay_us ? fr->r.delay_us : FAULT_REORDER_HOLD), true))
+				break;
+			f->stats.reordered++;
+			return MACAN_XMIT_OK;
+		case MACAN_FAULT_RESTART:
+			break;
+		}
+	}
+
+	st = p->xmit(ctx, c);
+	if (st == MACAN_XMIT_OK && p->held_count)
+		release(p, now, true);
+	return st;
+}
+
+static void
+restart_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	struct macan_faults *f = w->data;
+	uint64_t now = read_time();
+	unsigned i;
+
+	for (i = 0; i < f->rule_count; i++) {
+		struct fault_rule *fr = &f->rules[i];
+
+		if (fr->r.action != MACAN_FAULT_RESTART || fr->done || fr->r.from_us > now)
+			continue;
+		fr->done++;
+		f->stats.restarts++;
+		noted(f, now);
+		if (f->restart)
+			f->restart((macan_ecuid)fr->r.node, f->restart_arg);
+	}
+	arm_restart(f);
+}
+
+/**
+ * Apply the rules to frames sent by @a ctx. Must be called after the
+ * context is initialized. The first attached context provides the
+ * event loop for restart rules.
+ */
+void macan_fault_attach(struct macan_faults *f, struct macan_ctx *ctx)
+{
+	struct macan_fault_port *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return;
+	p->f = f;
+	p->ctx = ctx;
+	p->xmit = ctx->txq.xmit;
+	macan_ev_timer_init(&p->timer, port_cb, 0, 0);
+	p->timer.data = p;
+	p->next = f->ports;
+	f->ports = p;
+	ctx->txq.xmit = fault_xmit;
+	ctx->fault = p;
+
+	if (!f->loop) {
+		f->loop = ctx->loop;
+		macan_ev_timer_init(&f->restart_timer, restart_cb, 0, 0);
+		f->restart_timer.data = f;
+		arm_restart(f);
+	}
+}
+
+/* Forget frames held for a context that is going away */
+void macan_fault_detach(struct macan_ctx *ctx)
+{
+	struct macan_fault_port *p = ctx->fault;
+
+	macan_ev_timer_stop(ctx->loop, &p->timer);
+	p->held_count = 0;
+}
+
+void macan_fault_stats(struct macan_faults *f, struct macan_fault_stats *st)
+{
+	*st = f->stats;
+}
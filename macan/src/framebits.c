@@ -0,0 +1,224 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Exact length of frames on the wire
+ *
+ * Shared by the bus statistics of the tools and by the simulated bus,
+ * so that both count the same bits. The worst case, which is used by
+ * the bus load estimate of nodes and by the schedulability analysis,
+ * is macan_frame_bits_max() in can_frame.h.
+ *
+ * A classic frame up to the CRC is laid out in bytes with leading zero
+ * bits, which do not change the CRC, so that the CRC is computed
+ * bytewise. Stuff bits are counted with a table indexed by the
+ * stuffing state (last bit and the length of its run) and the next
+ * byte. CAN FD frames are stuffed bit by bit, as the fixed stuff bits
+ * of their CRC field follow other rules.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "can_frame.h"
+
+#define TAIL_BITS	13	/* CRC delimiter, ACK slot and delimiter, EOF, IFS */
+
+#define ST(last, run)	((last) * 4 + (run) - 1)	/* run 1-4 */
+
+static uint16_t crc_tab[256];
+static uint8_t stuff_tab[8][256];	/* Stuff bits << 3 | next state */
+static bool tables_ready;
+
+static unsigned stuff_bit(unsigned st, unsigned b, unsigned *stuff)
+{
+	unsigned last = st / 4, run = st % 4 + 1;
+
+	if (b != last)
+		return ST(b, 1);
+	if (++run < 5)
+		return ST(last, run);
+	/* The stuff bit starts a new run */
+	(*stuff)++;
+	return ST(!b, 1);
+}
+
+static void init_tables(void)
+{
+	unsigned i, j, st;
+
+	for (i = 0; i < 256; i++) {
+		unsigned crc = i << 7;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc << 1) ^ (crc & 0x4000 ? 0x4599 : 0);
+		crc_tab[i] = (uint16_t)(crc & 0x7fff);
+	}
+	for (st = 0; st < 8; st++) {
+		for (i = 0; i < 256; i++) {
+			unsigned next = st, stuff = 0;
+
+			for (j = 8; j-- > 0;)
+				next = stuff_bit(next, (i >> j) & 1, &stuff);
+			stuff_tab[st][i] = (uint8_t)(stuff << 3 | next);
+		}
+	}
+	tables_ready = true;
+}
+
+static unsigned classic_frame_bits(const struct can_frame *cf)
+{
+	uint8_t b[5 + 8 + 2];
+	bool rtr = cf->can_id & CAN_RTR_FLAG;
+	unsigned i, len = rtr ? 0 : (cf->can_dlc > 8 ? 8 : cf->can_dlc);
+	unsigned hdr, pad, end, crc = 0, st, stuff = 0;
+	uint64_t h;
+
+	if (!tables_ready)
+		init_tables();
+	if (cf->can_id & CAN_EFF_FLAG) {
+		/* SOF, base ID, SRR, IDE, extended ID, RTR, r1, r0, DLC */
+		h = (uint64_t)((cf->can_id & CAN_EFF_MASK) >> 18) << 27 | 3U << 25 |
+			(uint64_t)(cf->can_id & 0x3ffff) << 7;
+		hdr = 5;
+		pad = 1;
+	} else {
+		/* SOF, ID, RTR, IDE, r0, DLC */
+		h = (uint64_t)(cf->can_id & CAN_SFF_MASK) << 7;
+		hdr = 3;
+		pad = 5;
+	}
+	h |= (uint64_t)rtr << 6 | (cf->can_dlc & 0xfU);
+	for (i = 0; i < hdr; i++)
+		b[i] = (uint8_t)(h >> (8 * (hdr - 1 - i)));
+	memcpy(b + hdr, cf->data, len);
+	for (i = 0; i < hdr + len; i++)
+		crc = ((crc << 8) ^ crc_tab[((crc >> 7) ^ b[i]) & 0xff]) & 0x7fff;
+	b[hdr + len] = (uint8_t)(crc >> 7);
+	b[hdr + len + 1] = (uint8_t)(crc << 1);
+
+	/* SOF is dominant; stuff from the bit after it */
+	st = ST(0, 1);
+	for (i = 8 - pad - 1; i-- > 0;)
+		st = stuff_bit(st, (b[0] >> i) & 1, &stuff);
+	end = (hdr + len) * 8 + 15;
+	for (i = 1; i < end / 8; i++) {
+		st = stuff_tab[st][b[i]];
+		stuff += st >> 3;
+		st &= 7;
+	}
+	for (i = 0; i < end % 8; i++)
+		st = stuff_bit(st, (b[end / 8] >> (7 - i)) & 1, &stuff);
+	return end - pad + stuff + TAIL_BITS;
+}
+
+#ifdef CANFD_MTU
+static void put_bits(uint8_t *bits, unsigned *n, uint32_t val, unsigned len)
+{
+	while (len--)
+		bits[(*n)++] = (val >> len) & 1;
+}
+
+/* DLC of a CAN FD frame with @a len bytes */
+static unsigned fd_dlc(unsigned len)
+{
+	static const uint8_t max_len[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+	unsigned dlc = 0;
+
+	while (dlc < 15 && max_len[dlc] < len)
+		dlc++;
+	return dlc;
+}
+
+static unsigned fd_frame_bits(const struct can_frame *cf, unsigned *data_bits)
+{
+	const struct canfd_frame *fd = (const struct canfd_frame *)cf;
+	uint8_t bits[600];
+	unsigned n = 0, i, run, data_start, stuff = 0, data_stuff = 0;
+	unsigned crc_len = fd->len > 16 ? 21 : 17;
+	unsigned tail_bits;
+	uint32_t id;
+	uint8_t prev;
+
+	put_bits(bits, &n, 0, 1);				/* SOF */
+	if (cf->can_id & CAN_EFF_FLAG) {
+		id = cf->can_id & CAN_EFF_MASK;
+		put_bits(bits, &n, id >> 18, 11);
+		put_bits(bits, &n, 3, 2);			/* SRR, IDE */
+		put_bits(bits, &n, id & 0x3ffff, 18);
+	} else {
+		put_bits(bits, &n, cf->can_id & CAN_SFF_MASK, 11);
+		put_bits(bits, &n, 0, 1);			/* RRS */
+		put_bits(bits, &n, 0, 1);			/* IDE */
+	}
+	if (cf->can_id & CAN_EFF_FLAG)
+		put_bits(bits, &n, 0, 1);			/* RRS */
+	put_bits(bits, &n, 2, 2);				/* FDF, res */
+	put_bits(bits, &n, !!(fd->flags & CANFD_BRS), 1);
+	data_start = n;
+	put_bits(bits, &n, !!(fd->flags & CANFD_ESI), 1);
+	put_bits(bits, &n, fd_dlc(fd->len), 4);
+	for (i = 0; i < fd->len && i < CANFD_MAX_DLEN; i++)
+		put_bits(bits, &n, fd->data[i], 8);
+
+	/* Dynamic stuffing up to the end of the data field */
+	prev = bits[0];
+	for (i = 1, run = 1; i < n; i++) {
+		if (bits[i] == prev) {
+			run++;
+		} else {
+			prev = bits[i];
+			run = 1;
+		}
+		if (run == 5) {
+			if (i >= data_start)
+				data_stuff++;
+			else
+				stuff++;
+			prev = !prev;
+			run = 1;
+		}
+	}
+	/* Stuff count, CRC and the fixed stuff bits before the stuff
+	 * count and after every four bits */
+	tail_bits = 4 + crc_len + 1 + (4 + crc_len) / 4;
+	if (data_bits && (fd->flags & CANFD_BRS))
+		*data_bits = n - data_start + data_stuff + tail_bits;
+	return n + stuff + data_stuff + tail_bits + TAIL_BITS;
+}
+#endif
+
+/**
+ * Number of bits a frame occupies the bus for, including stuff bits,
+ * EOF and the interframe space.
+ *
+ * @param data_bits If not NULL, the bits of a CAN FD frame sent at the
+ * data bitrate (the data phase with bit rate switching) are stored
+ * there, zero for other frames.
+ */
+unsigned macan_can_frame_bits(const struct can_frame *cf, unsigned *data_bits)
+{
+	if (data_bits)
+		*data_bits = 0;
+#ifdef CANFD_MTU
+	if (macan_is_canfd(cf))
+		return fd_frame_bits(cf, data_bits);
+#endif
+	return classic_frame_bits(cf);
+}
@@ -35,7 +35,7 @@ void macan_target_init(struct macan_ctx* ctx){
 }
 
 //Not currently part of testing.
-bool macan_send(struct macan_ctx* ctx, const struct can_frame* cf){
+enum macan_xmit_status macan_xmit(struct macan_ctx* ctx, const struct can_frame* cf){
 	(void)ctx, (void)cf;
-	return true;
+	return MACAN_XMIT_OK;
 }
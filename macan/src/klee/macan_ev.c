@@ -49,6 +49,19 @@ macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w)
 	loop->cans = w;
 }
 
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w)
+{
+	macan_ev_can **p;
+
+	for (p = &loop->cans; *p; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
+	}
+}
+
 void
 macan_ev_timer_init(macan_ev_timer *ev,
 		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
@@ -74,6 +87,26 @@ macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w)
 	w->expire_us = read_time() + w->repeat_us;
 }
 
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us)
+{
+	macan_ev_timer *t;
+
+	w->expire_us = read_time() + after_us;
+	for (t = loop->timers; t; t = t->next)
+		if (t == w)
+			return;
+	w->next = loop->timers;
+	loop->timers = w;
+}
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	(void)loop;
+	w->expire_us = UINT64_MAX;
+}
+
 
 
 bool
@@ -87,8 +120,9 @@ macan_ev_run(macan_ev_loop *loop)
 
 		for (macan_ev_timer *t = loop->timers; t; t = t->next) {
 			if (now >= t->expire_us) {
+				/* One-shot timers stay stopped unless rearmed by the callback */
+				t->expire_us = t->repeat_us ? now + t->repeat_us : UINT64_MAX;
 				t->cb(loop, t, MACAN_EV_TIMER);
-				t->expire_us = now + t->repeat_us;
 			}
 		}
 		loop->cans->cb(NULL, loop->cans, 0);
@@ -29,6 +29,7 @@
 
 #define MACAN_EV_READ	 1
 #define MACAN_EV_TIMER	 2
+#define MACAN_EV_WRITE	 4
 
 struct macan_ev_loop;
 
@@ -63,6 +64,9 @@ macan_ev_can_init(macan_ev_can *ev,
 void
 macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w);
 
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w);
+
 void
 macan_ev_timer_init(macan_ev_timer *ev,
 		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
@@ -74,6 +78,12 @@ macan_ev_timer_start(macan_ev_loop *loop, macan_ev_timer *w);
 void
 macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w);
 
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us);
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w);
+
 bool
 macan_ev_run(macan_ev_loop *loop);
 
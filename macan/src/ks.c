@@ -22,6 +22,7 @@
  */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -30,16 +31,20 @@
 #include "common.h"
 #include "cryptlib.h"
 #include "macan.h"
+#include "macan_debug.h"
 #include "macan_ev.h"
 #include "macan_private.h"
 
-#define NODE_COUNT 64
-
 struct sess_key {
 	bool valid;
 	struct macan_key key;
 };
 
+struct ks_chg {
+	bool valid;
+	uint8_t chg[6];
+};
+
 static void generate_skey(struct macan_ctx *ctx, struct sess_key *skey)
 {
 	skey->valid = true;
@@ -51,17 +56,19 @@ static void generate_skey(struct macan_ctx *ctx, struct sess_key *skey)
 
 static bool lookup_or_generate_skey(struct macan_ctx *ctx, macan_ecuid src_id, macan_ecuid dst_id, struct macan_key **key_ret)
 {
-	static struct sess_key skey_map[NODE_COUNT - 1][NODE_COUNT] = {{{0}}};
-
 	struct sess_key *key;
 
+	/* All members of a group share one key */
+	if (macan_get_group(ctx->config, dst_id))
+		src_id = dst_id;
+
 	if (src_id > dst_id) {
 		macan_ecuid tmp = src_id;
 		src_id = dst_id;
 		dst_id = tmp;
 	}
 
-	key = &skey_map[src_id][dst_id];
+	key = &ctx->ks.skey_map[src_id * macan_id_count(ctx->config) + dst_id];
 	*key_ret = &key->key;
 
 	/* TODO: regenerate key when it expires */
@@ -86,8 +93,196 @@ void send_req_challenge(struct macan_ctx *ctx, macan_ecuid dst_id, macan_ecuid f
 	macan_send(ctx, &cf);
 }
 
+/* Proactive key distribution
+ *
+ * Instead of waiting for the nodes to ask, the KS asks every node for
+ * challenges for all the keys the node needs according to the signal
+ * matrix. Each node is asked for one key at a time, so that the node
+ * never waits for two keys whose SESS_KEY frames would compete on the
+ * bus, and the partners are visited in cyclic order starting after
+ * the node's own ID, so that the nodes ask for different pairs in
+ * every round. The time server comes first, because nodes need signed
+ * time before they can acknowledge any key. Unanswered requests are
+ * repeated with exponential backoff. Nodes that send challenges we did
+ * not ask for are already requesting all their keys, so they are left
+ * alone, and the first requests are sent only after PREDIST_RETRY_MS
+ * to give running nodes the chance to show up. Members of a group
+ * need the group key in addition to the keys of their partners.
+ */
+
+/* Initial interval of repeated REQ_CHALLENGEs (ms), doubled up to
+ * skey_chg_timeout. Nodes repeat challenges younger than
+ * MACAN_RECHALLENGE_SEP only after being asked again. */
+#define PREDIST_RETRY_MS 100
+
+struct ks_predist_node {
+	uint64_t need;		/* Partners the node needs keys for */
+	uint64_t served;	/* Partners the node sent us a challenge for */
+	uint64_t asked;		/* Partners we sent REQ_CHALLENGE for */
+	int pending;		/* Partner to ask for next, -1 if none */
+	uint64_t sent;		/* Time of the last REQ_CHALLENGE */
+	uint64_t backoff;
+};
+
+struct ks_predist {
+	struct ks_predist_node *node;
+	unsigned remaining;	/* Challenges still to be received */
+	uint64_t start;
+};
+
+static void predist_ask(struct macan_ctx *ctx, macan_ecuid id, macan_ecuid fwd_id)
+{
+	if (ctx->ks.predist)
+		ctx->ks.predist->node[id].asked |= 1ULL << fwd_id;
+	send_req_challenge(ctx, id, fwd_id);
+}
+
+/* Select the next key the node @a id should ask for and ask for it
+ * now or, if @a send is false, after PREDIST_RETRY_MS */
+static void predist_next(struct macan_ctx *ctx, macan_ecuid id, bool send)
+{
+	struct ks_predist_node *n = &ctx->ks.predist->node[id];
+	uint64_t todo = n->need & ~n->served;
+	unsigned count = macan_id_count(ctx->config);
+	unsigned k, p = ctx->config->time_server_id;
+
+	n->pending = -1;
+	if (!todo)
+		return;
+	if (!(todo & (1ULL << p)))
+		for (k = 1; k < count; k++) {
+			p = (id + k) % count;
+			if (todo & (1ULL << p))
+				break;
+		}
+	n->pending = (int)p;
+	n->sent = read_time();
+	n->backoff = PREDIST_RETRY_MS * 1000;
+	if (send)
+		predist_ask(ctx, id, (macan_ecuid)p);
+}
+
+/* Record that the node @a id asked for the key for @a fwd_id */
+static void predist_served(struct macan_ctx *ctx, macan_ecuid id, macan_ecuid fwd_id)
+{
+	struct ks_predist *pd = ctx->ks.predist;
+	struct ks_predist_node *n;
+
+	if (!pd || !pd->remaining)
+		return;
+	n = &pd->node[id];
+	if (!(n->need & ~n->served & (1ULL << fwd_id)))
+		return;
+	n->served |= 1ULL << fwd_id;
+	if (!(n->asked & (1ULL << fwd_id))) {
+		/* The node asks for all its keys on its own */
+		n->pending = -1;
+	} else if (n->pending == fwd_id) {
+		predist_next(ctx, id, true);
+	}
+	if (--pd->remaining == 0) {
+		print_msg(ctx, MSG_OK, "all keys distributed in %"PRIu64" ms\n",
+			  (read_time() - pd->start) / 1000);
+		macan_ev_timer_stop(ctx->loop, &ctx->ks.predist_timer);
+	}
+}
+
+static void predist_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	struct macan_ctx *ctx = w->data;
+	uint64_t now = read_time();
+	macan_ecuid i;
+
+	for (i = 0; i < ctx->config->node_count; i++) {
+		struct ks_predist_node *n = &ctx->ks.predist->node[i];
+
+		if (n->pending < 0 || now - n->sent < n->backoff)
+			continue;
+		n->sent = now;
+		n->backoff *= 2;
+		if (n->backoff > ctx->config->skey_chg_timeout)
+			n->backoff = ctx->config->skey_chg_timeout;
+		predist_ask(ctx, i, (macan_ecuid)n->pending);
+	}
+}
+
+/**
+ * Ask all nodes for the keys they need according to the signal matrix.
+ *
+ * Should be called after macan_init_ks(). Without it, the key server
+ * only answers the challenges the nodes send on their own, which they
+ * repeat only after skey_chg_timeout if the key server was not
+ * running.
+ *
+ * @return Zero on success, -1 if memory cannot be allocated.
+ */
+int macan_ks_predistribute(struct macan_ctx *ctx)
+{
+	const struct macan_config *cfg = ctx->config;
+	unsigned id_count = macan_id_count(cfg);
+	struct ks_predist *pd;
+	macan_ecuid i;
+
+	pd = calloc(1, sizeof(*pd));
+	if (!pd)
+		return -1;
+	pd->node = calloc(cfg->node_count, sizeof(*pd->node));
+	if (!pd->node) {
+		free(pd);
+		return -1;
+	}
+
+	for (i = 0; i < cfg->sig_count; i++) {
+		const struct macan_sig_spec *ss = &cfg->sigspec[i];
+
+		if (macan_get_group(cfg, ss->dst_id))
+			continue;
+		pd->node[ss->src_id].need |= 1ULL << ss->dst_id;
+		pd->node[ss->dst_id].need |= 1ULL << ss->src_id;
+	}
+	for (i = 0; i < cfg->pdu_count; i++) {
+		const struct macan_pdu_spec *pdu = &cfg->pdus[i];
+
+		if (macan_get_group(cfg, pdu->dst_id))
+			continue;
+		pd->node[pdu->src_id].need |= 1ULL << pdu->dst_id;
+		pd->node[pdu->dst_id].need |= 1ULL << pdu->src_id;
+	}
+	for (i = 0; i < cfg->group_count; i++) {
+		macan_ecuid m;
+
+		for (m = 0; m < cfg->node_count; m++)
+			if (cfg->groups[i].members & (1U << m))
+				pd->node[m].need |= 1ULL << cfg->groups[i].group_id;
+	}
+	for (i = 0; i < cfg->node_count; i++) {
+		if (i == cfg->key_server_id || i == cfg->time_server_id)
+			continue;
+		pd->node[i].need |= 1ULL << cfg->time_server_id;
+		pd->node[cfg->time_server_id].need |= 1ULL << i;
+	}
+
+	pd->start = read_time();
+	for (i = 0; i < cfg->node_count; i++) {
+		macan_ecuid j;
+
+		for (j = 0; j < id_count; j++)
+			if (pd->node[i].need & (1ULL << j))
+				pd->remaining++;
+	}
+	ctx->ks.predist = pd;
+
+	/* Nodes that are already running ask on their own */
+	for (i = 0; i < cfg->node_count; i++)
+		predist_next(ctx, i, false);
+	macan_ev_timer_setup(ctx, &ctx->ks.predist_timer, predist_cb,
+			     PREDIST_RETRY_MS, PREDIST_RETRY_MS);
+	return 0;
+}
+
 static
-void send_skey(struct macan_ctx *ctx,
+bool send_skey(struct macan_ctx *ctx,
 	       const struct macan_key *ltk,
 	       const struct macan_key *skey,
 	       macan_ecuid dst_id,
@@ -121,9 +316,14 @@ void send_skey(struct macan_ctx *ctx,
 		memcpy(skey_frame.data, wrap + (6 * i), len);
 		memcpy(cf.data, &skey_frame, sizeof(skey_frame));
 
-		/* ToDo: check all writes for success */
-		macan_send(ctx, &cf);
+		/* The node cannot unwrap an incomplete key, so do not
+		 * waste the bus with the rest of it */
+		if (!macan_send(ctx, &cf)) {
+			fail_printf(ctx, "failed to send SESS_KEY #%u for %d\n", i, dst_id);
+			return false;
+		}
 	}
+	return true;
 }
 
 /**
@@ -132,12 +332,15 @@ void send_skey(struct macan_ctx *ctx,
  * @cf:  received can frame
  *
  * This function responds with session key to the challenge sender
- * and also sends REQ_CHALLENGE to communication partner of the sender.
+ * and also sends REQ_CHALLENGE to communication partner of the sender
+ * or, for a new group key, to all other members of the group.
  */
 void ks_receive_challenge(struct macan_ctx *ctx, struct can_frame *cf)
 {
 	struct macan_challenge *chal;
 	macan_ecuid dst_id, fwd_id;
+	const struct macan_group *group;
+	unsigned id_count = macan_id_count(ctx->config);
 	uint8_t *chg;
 
 	if (cf->can_dlc != 8 ||
@@ -150,16 +353,39 @@ void ks_receive_challenge(struct macan_ctx *ctx, struct can_frame *cf)
 	chg = chal->chg;
 
 	if (fwd_id == dst_id ||
-	    fwd_id >= ctx->config->node_count ||
+	    fwd_id >= id_count ||
 	    dst_id == ctx->config->key_server_id)
 		return;
 
+	group = macan_get_group(ctx->config, fwd_id);
+	if (fwd_id >= ctx->config->node_count &&
+	    (!group || !(group->members & (1U << dst_id))))
+		return;		/* Not a member of the group */
+
+	/* Repeated challenge, e.g. after REQ_CHALLENGE, which we
+	 * have already answered */
+	struct ks_chg *last = &ctx->ks.last_chg[dst_id * id_count + fwd_id];
+	if (last->valid && memcmp(last->chg, chg, sizeof(last->chg)) == 0)
+		return;
+
+	predist_served(ctx, dst_id, fwd_id);
+
 	const struct macan_key *ltk = ctx->ks.ltk[dst_id];
 	struct macan_key *skey;
 	bool new_key = lookup_or_generate_skey(ctx, dst_id, fwd_id, &skey);
-	send_skey(ctx, ltk, skey, dst_id, fwd_id, chg);
-	if (new_key)
-		send_req_challenge(ctx, fwd_id, dst_id);
+	if (!send_skey(ctx, ltk, skey, dst_id, fwd_id, chg))
+		return;
+	last->valid = true;
+	memcpy(last->chg, chg, sizeof(last->chg));
+	if (new_key && group) {
+		macan_ecuid m;
+
+		for (m = 0; m < ctx->config->node_count; m++)
+			if (m != dst_id && (group->members & (1U << m)))
+				predist_ask(ctx, m, fwd_id);
+	} else if (new_key) {
+		predist_ask(ctx, fwd_id, dst_id);
+	}
 }
 
 static void
@@ -167,18 +393,20 @@ can_cb_ks (macan_ev_loop *loop, macan_ev_can *w, int revents)
 {
 	(void)loop; (void)revents; /* suppress warnings */
 	struct macan_ctx *ctx = w->data;
-	struct can_frame cf;
+	union macan_frame f;
+	struct can_frame *cf = &f.cf;
 
-	macan_read(ctx, &cf);
+	macan_read(ctx, cf);
 
 	/* Simple sanity checks first */
-	if (cf.can_dlc < 1 ||
-	    macan_crypt_dst(&cf) != ctx->config->key_server_id ||
-	    macan_crypt_flags(&cf) != FL_CHALLENGE)
+	if (macan_is_canfd(cf) ||
+	    cf->can_dlc < 1 ||
+	    macan_crypt_dst(cf) != ctx->config->key_server_id ||
+	    macan_crypt_flags(cf) != FL_CHALLENGE)
 		return;
 
 	/* All other checks are done in ks_receive_challenge() */
-	ks_receive_challenge(ctx, &cf);
+	ks_receive_challenge(ctx, cf);
 }
 
 int macan_init_ks(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd,
@@ -190,7 +418,13 @@ int macan_init_ks(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd,
 
 	macan_ev_canrx_setup(ctx, &ctx->can_watcher, can_cb_ks);
 
+	size_t n = macan_id_count(ctx->config);
+
 	ctx->ks.ltk = ltks;
+	ctx->ks.skey_map = calloc(n * n, sizeof(*ctx->ks.skey_map));
+	ctx->ks.last_chg = calloc(n * n, sizeof(*ctx->ks.last_chg));
+	if (!ctx->ks.skey_map || !ctx->ks.last_chg)
+		return -1;
 
 	return 0;
 }
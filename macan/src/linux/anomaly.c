@@ -0,0 +1,404 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Rate and sequence anomaly detection (see macan_anomaly.h) */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macan_anomaly.h"
+#include "macan_private.h"
+
+#define LEARN_FRAMES	16	/* Intervals observed before a stream is checked */
+#define BURST		4	/* Frames a stream may run ahead of its period */
+#define SKEY_HISTORY	4	/* Session key transfers remembered per node */
+#define SKEY_RESYNC	0xff	/* Waiting for the first SESS_KEY fragment */
+#define REPORT_HOLDOFF	1000000000ull	/* Minimum time between reports of a stream (ns) */
+
+struct stream {
+	uint64_t last_ns;
+	uint64_t period;	/* Learned or derived period (ns), 0 if unknown */
+	uint64_t tat;		/* GCRA theoretical arrival time */
+	uint64_t reported_ns;
+	uint32_t count;		/* Intervals learned */
+	bool seen;
+};
+
+struct signal_state {
+	struct stream sec, ns;
+	int presc;		/* Prescaler in effect, 0 if unknown */
+};
+
+struct node_state {
+	struct stream chg;
+	uint64_t skey_hash;
+	uint64_t skey_seen[SKEY_HISTORY];
+	unsigned skey_pos;
+	uint8_t skey_next;	/* Next expected SESS_KEY fragment */
+	uint8_t time_chg;	/* Challenges to the time server not answered */
+};
+
+enum id_type { ID_ECU, ID_SIG_NS, ID_SIG_S };
+
+struct id_ent {
+	uint32_t can_id;
+	uint8_t type;		/* enum id_type */
+	uint8_t index;		/* ECU-ID or signal number */
+};
+
+struct macan_anomaly {
+	const struct macan_config *config;
+	macan_anomaly_cb cb;
+	void *arg;
+
+	struct id_ent *ids;
+	unsigned id_count;
+	struct signal_state *sig;
+	struct node_state *node;
+	struct stream time;
+
+	uint64_t chg_period, chg_burst;	/* CHALLENGE GCRA parameters */
+	struct macan_anomaly_stats stats;
+};
+
+static int cmp_id(const void *a, const void *b)
+{
+	const struct id_ent *x = a, *y = b;
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+static const struct id_ent *find_id(const struct macan_anomaly *an, uint32_t can_id)
+{
+	unsigned lo = 0, hi = an->id_count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (an->ids[mid].can_id < can_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < an->id_count && an->ids[lo].can_id == can_id ? &an->ids[lo] : NULL;
+}
+
+/**
+ * Create an anomaly detector.
+ *
+ * @param cb  Called for anomalies, at most once per second and stream
+ */
+struct macan_anomaly *macan_anomaly_create(const struct macan_config *config,
+					   macan_anomaly_cb cb, void *arg)
+{
+	struct macan_anomaly *an = calloc(1, sizeof(*an));
+	uint64_t sep;
+	unsigned i;
+
+	if (!an)
+		return NULL;
+	an->config = config;
+	an->cb = cb;
+	an->arg = arg;
+	an->ids = calloc(config->node_count + 2U * config->sig_count, sizeof(*an->ids));
+	an->sig = calloc(config->sig_count ? config->sig_count : 1, sizeof(*an->sig));
+	an->node = calloc(config->node_count, sizeof(*an->node));
+	if (!an->ids || !an->sig || !an->node) {
+		macan_anomaly_free(an);
+		return NULL;
+	}
+
+	for (i = 0; i < config->node_count; i++)
+		an->ids[an->id_count++] = (struct id_ent){ config->canid->ecu[i].canid, ID_ECU, (uint8_t)i };
+	for (i = 0; i < config->sig_count; i++) {
+		const struct macan_sig_spec *ss = &config->sigspec[i];
+		if (ss->can_nsid)
+			an->ids[an->id_count++] = (struct id_ent){ ss->can_nsid, ID_SIG_NS, (uint8_t)i };
+		if (ss->can_sid)
+			an->ids[an->id_count++] = (struct id_ent){ ss->can_sid, ID_SIG_S, (uint8_t)i };
+		an->sig[i].presc = ss->presc;
+	}
+	qsort(an->ids, an->id_count, sizeof(*an->ids), cmp_id);
+
+	/* A node asks for the keys of all its peers and for time at
+	 * once and then repeats the requests after skey_chg_timeout or
+	 * time_req_sep. */
+	sep = config->time_req_sep < config->skey_chg_timeout ?
+		config->time_req_sep : config->skey_chg_timeout;
+	an->chg_period = sep * 1000 / 2;
+	an->chg_burst = 2ull * config->node_count * an->chg_period;
+	return an;
+}
+
+void macan_anomaly_free(struct macan_anomaly *an)
+{
+	free(an->ids);
+	free(an->sig);
+	free(an->node);
+	free(an);
+}
+
+static void report(struct macan_anomaly *an, uint64_t ts_ns, enum macan_anomaly_type type,
+		   uint32_t can_id, int node, int sig_num, struct stream *s, uint64_t interval)
+{
+	an->stats.anomalies[type]++;
+	if (s) {
+		if (s->reported_ns && ts_ns - s->reported_ns < REPORT_HOLDOFF)
+			return;
+		s->reported_ns = ts_ns;
+	}
+	an->stats.reported[type]++;
+	if (an->cb) {
+		struct macan_anomaly_info info = {
+			.ts_ns = ts_ns, .type = type, .can_id = can_id,
+			.node = node, .sig_num = sig_num,
+			.period_ns = s ? s->period : 0, .interval_ns = interval,
+		};
+		an->cb(an->arg, &info);
+	}
+}
+
+/* Generic cell rate algorithm: does a frame at ts conform to at most
+ * one frame per period with bursts of up to burst/period frames? */
+static bool gcra(struct stream *s, uint64_t ts, uint64_t period, uint64_t burst)
+{
+	if (ts + burst < s->tat)
+		return false;
+	s->tat = (s->tat > ts ? s->tat : ts) + period;
+	return true;
+}
+
+static bool stream_armed(const struct stream *s)
+{
+	return s->count >= LEARN_FRAMES;
+}
+
+/* Arm a stream with a period derived from elsewhere */
+static void stream_seed(struct stream *s, uint64_t period)
+{
+	if (stream_armed(s) || period == 0)
+		return;
+	s->period = period;
+	s->count = LEARN_FRAMES;
+	s->tat = 0;
+}
+
+/**
+ * Learn the period of a stream or check the frame against it.
+ *
+ * @return Interval since the previous frame if the stream runs too
+ * fast, zero otherwise.
+ */
+static uint64_t stream_frame(struct stream *s, uint64_t ts)
+{
+	uint64_t dt = ts - s->last_ns;
+	bool seen = s->seen;
+
+	s->seen = true;
+	s->last_ns = ts;
+	if (!seen)
+		return 0;
+
+	if (!stream_armed(s)) {
+		if (s->count++ == 0)
+			s->period = dt;
+		else
+			s->period = (uint64_t)((int64_t)s->period + ((int64_t)dt - (int64_t)s->period) / 4);
+		return 0;
+	}
+
+	/* Allow 50 % faster than the period plus a burst */
+	if (!gcra(s, ts, s->period * 2 / 3, BURST * s->period))
+		return dt ? dt : 1;
+
+	/* Follow slow drifts, not gaps */
+	if (dt < 4 * s->period)
+		s->period = (uint64_t)((int64_t)s->period + ((int64_t)dt - (int64_t)s->period) / 64);
+	return 0;
+}
+
+static void signal_frame(struct macan_anomaly *an, uint64_t ts, uint32_t can_id,
+			 unsigned sig_num, bool secure)
+{
+	struct signal_state *sig = &an->sig[sig_num];
+	struct stream *s = secure ? &sig->sec : &sig->ns;
+	uint64_t dt;
+
+	if (!secure && sig->presc == 1) {
+		report(an, ts, MACAN_AN_NONSECURE, can_id, an->config->sigspec[sig_num].src_id,
+		       (int)sig_num, s, 0);
+		return;
+	}
+
+	/* One of presc frames is signed */
+	if (sig->presc > 1) {
+		if (secure && stream_armed(&sig->ns))
+			stream_seed(s, sig->ns.period * (uint64_t)(sig->presc - 1));
+		else if (!secure && stream_armed(&sig->sec))
+			stream_seed(s, sig->sec.period / (uint64_t)(sig->presc - 1));
+	}
+
+	if ((dt = stream_frame(s, ts)))
+		report(an, ts, MACAN_AN_RATE, can_id, an->config->sigspec[sig_num].src_id,
+		       (int)sig_num, s, dt);
+}
+
+static void skey_frame(struct macan_anomaly *an, uint64_t ts, const struct can_frame *cf)
+{
+	macan_ecuid dst = macan_crypt_dst(cf);
+	struct node_state *n;
+	uint8_t seq;
+	unsigned i;
+
+	if (dst >= an->config->node_count || cf->can_dlc < 2)
+		return;
+	n = &an->node[dst];
+	seq = cf->data[1] >> 4;
+
+	if (seq != n->skey_next && seq != 0) {
+		if (n->skey_next != SKEY_RESYNC)
+			report(an, ts, MACAN_AN_SKEY_SEQUENCE, cf->can_id, dst, -1, NULL, 0);
+		n->skey_next = SKEY_RESYNC;
+		return;
+	}
+	if (seq == 0)
+		n->skey_hash = 0xcbf29ce484222325ull;
+	/* FNV-1a over the wrapped key */
+	for (i = 2; i < cf->can_dlc && i < 2U + (cf->data[1] & 0xf); i++)
+		n->skey_hash = (n->skey_hash ^ cf->data[i]) * 0x100000001b3ull;
+	n->skey_next = (uint8_t)(seq + 1);
+	if (seq < 5)
+		return;
+
+	/* The key server wraps every key with a fresh challenge, so a
+	 * repeated transfer is a replay */
+	n->skey_next = 0;
+	for (i = 0; i < SKEY_HISTORY; i++) {
+		if (n->skey_seen[i] == n->skey_hash) {
+			report(an, ts, MACAN_AN_SKEY_DUPLICATE, cf->can_id, dst, -1, NULL, 0);
+			return;
+		}
+	}
+	n->skey_seen[n->skey_pos++ % SKEY_HISTORY] = n->skey_hash;
+}
+
+static void crypt_frame(struct macan_anomaly *an, uint64_t ts, const struct can_frame *cf,
+			macan_ecuid src)
+{
+	const struct macan_config *cfg = an->config;
+	macan_ecuid dst = macan_crypt_dst(cf);
+	struct node_state *n = &an->node[src];
+
+	switch (macan_crypt_flags(cf)) {
+	case FL_CHALLENGE:
+		if (!gcra(&n->chg, ts, an->chg_period, an->chg_burst)) {
+			n->chg.period = an->chg_period;
+			report(an, ts, MACAN_AN_CHALLENGE_FLOOD, cf->can_id, src, -1, &n->chg, 0);
+		}
+		if (dst == cfg->time_server_id && n->time_chg < 2)
+			n->time_chg++;
+		break;
+	case FL_SESS_KEY_OR_ACK:
+		if (src == cfg->key_server_id)
+			skey_frame(an, ts, cf);
+		break;
+	case FL_SIGNAL_OR_AUTH_REQ:
+		if (cf->can_dlc < 2 || cf->data[1] >= cfg->sig_count)
+			break;
+		if (cf->can_dlc == 3 || cf->can_dlc == 7) {
+			/* Signal request, mirror receive_auth_req() */
+			const struct macan_sig_spec *ss = &cfg->sigspec[cf->data[1]];
+			struct signal_state *sig = &an->sig[cf->data[1]];
+			int presc = ss->can_nsid == 0 ? 1 : cf->data[2];
+
+			/* The rates change, learn them again */
+			if (ss->presc == 0 && presc != sig->presc)
+				*sig = (struct signal_state){ .presc = presc };
+		} else
+			signal_frame(an, ts, cf->can_id, cf->data[1], true);
+		break;
+	}
+}
+
+static void time_frame(struct macan_anomaly *an, uint64_t ts, const struct can_frame *cf)
+{
+	uint64_t dt;
+	unsigned i;
+
+	if (cf->can_dlc == 4) {
+		if ((dt = stream_frame(&an->time, ts)))
+			report(an, ts, MACAN_AN_RATE, cf->can_id, an->config->time_server_id,
+			       -1, &an->time, dt);
+		return;
+	}
+
+	/* Authenticated time answers a challenge */
+	for (i = 0; i < an->config->node_count; i++) {
+		if (an->node[i].time_chg) {
+			an->node[i].time_chg--;
+			return;
+		}
+	}
+	report(an, ts, MACAN_AN_TIME_UNSOLICITED, cf->can_id, an->config->time_server_id,
+	       -1, NULL, 0);
+}
+
+/**
+ * Process a frame. Frames must be passed in time order.
+ */
+void macan_anomaly_frame(struct macan_anomaly *an, uint64_t ts_ns, const struct can_frame *cf)
+{
+	const struct id_ent *id;
+
+	an->stats.frames++;
+	if (cf->can_id == an->config->canid->time) {
+		time_frame(an, ts_ns, cf);
+		return;
+	}
+	if (!(id = find_id(an, cf->can_id)) || cf->can_dlc < 1)
+		return;
+
+	switch (id->type) {
+	case ID_ECU:
+		crypt_frame(an, ts_ns, cf, id->index);
+		break;
+	case ID_SIG_NS:
+		signal_frame(an, ts_ns, cf->can_id, id->index, false);
+		break;
+	case ID_SIG_S:
+		signal_frame(an, ts_ns, cf->can_id, id->index, true);
+		break;
+	}
+}
+
+void macan_anomaly_get_stats(const struct macan_anomaly *an, struct macan_anomaly_stats *stats)
+{
+	*stats = an->stats;
+}
+
+const char *macan_anomaly_name(enum macan_anomaly_type type)
+{
+	static const char *const names[MACAN_AN_COUNT] = {
+		[MACAN_AN_CHALLENGE_FLOOD] = "challenge flood",
+		[MACAN_AN_SKEY_DUPLICATE] = "duplicated session key",
+		[MACAN_AN_SKEY_SEQUENCE] = "session key sequence",
+		[MACAN_AN_TIME_UNSOLICITED] = "unsolicited time",
+		[MACAN_AN_NONSECURE] = "non-secure signal",
+		[MACAN_AN_RATE] = "rate",
+	};
+	return (unsigned)type < MACAN_AN_COUNT ? names[type] : "?";
+}
@@ -0,0 +1,385 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bus load statistics (see macan_busstat.h) */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macan_busstat.h"
+#include "macan_private.h"
+
+#define EXT_SLOTS	1024	/* Extended CAN IDs tracked, power of two */
+
+enum id_kind { K_NONE, K_TIME, K_ECU, K_SIG_NS, K_SIG_S };
+
+struct id_stat {
+	struct macan_bstat st;
+	uint32_t can_id;	/* With CAN_EFF_FLAG for extended IDs */
+	uint8_t kind;		/* enum id_kind */
+	bool used;
+	uint16_t index;		/* ECU-ID or signal number */
+};
+
+struct macan_busstat {
+	const struct macan_config *config;
+	unsigned bitrate;
+	uint64_t window_start;
+	bool started;
+
+	struct macan_bstat cls[MACAN_BC_COUNT];
+	struct id_stat sff[CAN_SFF_MASK + 1];
+	struct id_stat ext[EXT_SLOTS];
+	struct id_stat overflow;	/* Extended IDs that did not fit */
+};
+
+static const char *const class_names[MACAN_BC_COUNT] = {
+	[MACAN_BC_TIME] = "TIME",
+	[MACAN_BC_AUTH_TIME] = "AUTH_TIME",
+	[MACAN_BC_REQ_CHALLENGE] = "REQ_CHALLENGE",
+	[MACAN_BC_CHALLENGE] = "CHALLENGE",
+	[MACAN_BC_SESS_KEY] = "SESS_KEY",
+	[MACAN_BC_ACK] = "ACK",
+	[MACAN_BC_AUTH_REQ] = "AUTH_REQ",
+	[MACAN_BC_AUTH_SIG] = "AUTH_SIG",
+	[MACAN_BC_AUTH_SIG32] = "AUTH_SIG32",
+	[MACAN_BC_SIGNAL] = "SIGNAL",
+	[MACAN_BC_OTHER] = "other",
+};
+
+const char *macan_bclass_name(enum macan_bclass c)
+{
+	return (unsigned)c < MACAN_BC_COUNT ? class_names[c] : "?";
+}
+
+static struct id_stat *ext_slot(struct macan_busstat *bs, uint32_t can_id, bool create)
+{
+	unsigned h = (can_id * 2654435761u) >> 22, i;
+
+	for (i = 0; i < EXT_SLOTS; i++) {
+		struct id_stat *e = &bs->ext[(h + i) & (EXT_SLOTS - 1)];
+		if (e->used && e->can_id == can_id)
+			return e;
+		if (!e->used) {
+			if (!create)
+				return NULL;
+			e->used = true;
+			e->can_id = can_id;
+			return e;
+		}
+	}
+	return create ? &bs->overflow : NULL;
+}
+
+static struct id_stat *id_slot(struct macan_busstat *bs, uint32_t can_id, bool create)
+{
+	if (can_id & CAN_EFF_FLAG)
+		return ext_slot(bs, can_id & (CAN_EFF_FLAG | CAN_EFF_MASK), create);
+	return &bs->sff[can_id & CAN_SFF_MASK];
+}
+
+/* Classify a configured ID unless it has a class already */
+static void classify(struct macan_busstat *bs, uint32_t can_id, enum id_kind kind, unsigned index)
+{
+	struct id_stat *e;
+
+	if (can_id > CAN_SFF_MASK)
+		can_id |= CAN_EFF_FLAG;
+	e = id_slot(bs, can_id, true);
+	if (e->kind == K_NONE) {
+		e->kind = (uint8_t)kind;
+		e->index = (uint16_t)index;
+	}
+}
+
+/**
+ * Create bus statistics for a bus running at bitrate bit/s.
+ */
+struct macan_busstat *macan_busstat_create(const struct macan_config *config, unsigned bitrate)
+{
+	struct macan_busstat *bs = calloc(1, sizeof(*bs));
+	unsigned i;
+
+	if (!bs)
+		return NULL;
+	bs->config = config;
+	bs->bitrate = bitrate;
+	for (i = 0; i <= CAN_SFF_MASK; i++) {
+		bs->sff[i].can_id = i;
+		bs->sff[i].used = true;
+	}
+	classify(bs, config->canid->time, K_TIME, 0);
+	for (i = 0; i < config->node_count; i++)
+		classify(bs, config->canid->ecu[i].canid, K_ECU, i);
+	for (i = 0; i < config->sig_count; i++) {
+		if (config->sigspec[i].can_nsid)
+			classify(bs, config->sigspec[i].can_nsid, K_SIG_NS, i);
+		if (config->sigspec[i].can_sid)
+			classify(bs, config->sigspec[i].can_sid, K_SIG_S, i);
+	}
+	return bs;
+}
+
+void macan_busstat_free(struct macan_busstat *bs)
+{
+	free(bs);
+}
+
+static enum macan_bclass frame_class(const struct macan_busstat *bs, const struct id_stat *e,
+				     const struct can_frame *cf)
+{
+	switch (e->kind) {
+	case K_TIME:
+		return cf->can_dlc == 8 ? MACAN_BC_AUTH_TIME : MACAN_BC_TIME;
+	case K_SIG_NS:
+		return MACAN_BC_SIGNAL;
+	case K_SIG_S:
+		return MACAN_BC_AUTH_SIG32;
+	case K_ECU:
+		if (cf->can_dlc < 2)
+			break;
+		switch (macan_crypt_flags(cf)) {
+		case FL_REQ_CHALLENGE:
+			return MACAN_BC_REQ_CHALLENGE;
+		case FL_CHALLENGE:
+			return MACAN_BC_CHALLENGE;
+		case FL_SESS_KEY_OR_ACK:
+			return e->index == bs->config->key_server_id ? MACAN_BC_SESS_KEY : MACAN_BC_ACK;
+		case FL_SIGNAL_OR_AUTH_REQ:
+			return cf->can_dlc == 3 || cf->can_dlc == 7 ? MACAN_BC_AUTH_REQ : MACAN_BC_AUTH_SIG;
+		}
+	}
+	return MACAN_BC_OTHER;
+}
+
+static void account(struct macan_bstat *st, uint64_t ts, unsigned bits)
+{
+	st->frames++;
+	st->bits += bits;
+	st->total_frames++;
+	st->total_bits += bits;
+	if (st->total_frames > 1 && ts >= st->last_ns) {
+		uint64_t gap = ts - st->last_ns;
+		double d = (double)gap - st->gap_mean;
+
+		if (st->gaps == 0 || gap < st->gap_min)
+			st->gap_min = gap;
+		if (gap > st->gap_max)
+			st->gap_max = gap;
+		st->gaps++;
+		st->gap_mean += d / st->gaps;
+		st->gap_m2 += d * ((double)gap - st->gap_mean);
+	}
+	st->last_ns = ts;
+}
+
+void macan_busstat_frame(struct macan_busstat *bs, uint64_t ts_ns, const struct can_frame *cf)
+{
+	struct id_stat *e = id_slot(bs, cf->can_id, true);
+	unsigned bits = macan_can_frame_bits(cf, NULL);
+
+	if (!bs->started) {
+		bs->window_start = ts_ns;
+		bs->started = true;
+	}
+	account(&e->st, ts_ns, bits);
+	account(&bs->cls[frame_class(bs, e, cf)], ts_ns, bits);
+}
+
+/* Square root by Newton's method, so that users need not link libm */
+static double root(double x)
+{
+	double r = x > 1 ? x : 1, prev = 0;
+
+	if (x <= 0)
+		return 0;
+	while (r != prev) {
+		prev = r;
+		r = (r + x / r) / 2;
+		if (r >= prev)
+			break;
+	}
+	return r;
+}
+
+/**
+ * Standard deviation of the inter-arrival times in the window (ns).
+ */
+double macan_bstat_jitter(const struct macan_bstat *st)
+{
+	return st->gaps > 1 ? root(st->gap_m2 / (st->gaps - 1)) : 0;
+}
+
+const struct macan_bstat *macan_busstat_class(const struct macan_busstat *bs, enum macan_bclass c)
+{
+	return &bs->cls[c];
+}
+
+const struct macan_bstat *macan_busstat_id(const struct macan_busstat *bs, uint32_t can_id)
+{
+	struct id_stat *e = id_slot((struct macan_busstat *)bs, can_id, false);
+	return e ? &e->st : NULL;
+}
+
+static void window_reset(struct macan_bstat *st)
+{
+	st->frames = st->bits = 0;
+	st->gaps = 0;
+	st->gap_min = st->gap_max = 0;
+	st->gap_mean = st->gap_m2 = 0;
+}
+
+static void describe(const struct macan_busstat *bs, const struct id_stat *e, char *buf, size_t size)
+{
+	const struct macan_config *cfg = bs->config;
+
+	switch (e->kind) {
+	case K_TIME:
+		snprintf(buf, size, "time");
+		break;
+	case K_ECU:
+		if (cfg->canid->ecu[e->index].name)
+			snprintf(buf, size, "ECU %s", cfg->canid->ecu[e->index].name);
+		else
+			snprintf(buf, size, "ECU %u", e->index);
+		break;
+	case K_SIG_NS:
+		snprintf(buf, size, "signal #%u", e->index);
+		break;
+	case K_SIG_S:
+		snprintf(buf, size, "signal #%u auth", e->index);
+		break;
+	default:
+		snprintf(buf, size, "-");
+	}
+}
+
+static void print_row(FILE *f, const char *id, const char *what, const struct macan_bstat *st,
+		      double secs, double capacity)
+{
+	fprintf(f, "%-9s %-16s %9.1f %7.2f %6.1f %10.3f %9.3f %9.3f %9.3f\n", id, what,
+		(double)st->frames / secs, 100.0 * (double)st->bits / capacity,
+		(double)st->bits / (double)st->frames, st->gap_mean / 1e6,
+		macan_bstat_jitter(st) / 1e6, (double)st->gap_min / 1e6, (double)st->gap_max / 1e6);
+}
+
+static void json_stat(FILE *f, const struct macan_bstat *st, double secs, double capacity)
+{
+	fprintf(f, "\"fps\":%.3f,\"load\":%.6f,\"frames\":%llu,\"bits\":%llu,"
+		"\"period_ms\":%.6f,\"jitter_ms\":%.6f,\"min_ms\":%.6f,\"max_ms\":%.6f",
+		(double)st->frames / secs, (double)st->bits / capacity,
+		(unsigned long long)st->frames, (unsigned long long)st->bits,
+		st->gap_mean / 1e6, macan_bstat_jitter(st) / 1e6,
+		(double)st->gap_min / 1e6, (double)st->gap_max / 1e6);
+}
+
+static int cmp_stat(const void *a, const void *b)
+{
+	const struct id_stat *x = *(const struct id_stat *const *)a, *y = *(const struct id_stat *const *)b;
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+/**
+ * Print the statistics of the window ending at now_ns and start a new
+ * window.
+ *
+ * @param table  Human readable table, or NULL
+ * @param json   One line JSON snapshot, or NULL
+ */
+void macan_busstat_report(struct macan_busstat *bs, uint64_t now_ns, FILE *table, FILE *json)
+{
+	static struct id_stat *active[CAN_SFF_MASK + 1 + EXT_SLOTS + 1];
+	double secs = bs->started && now_ns > bs->window_start ?
+		(double)(now_ns - bs->window_start) / 1e9 : 0;
+	double capacity = secs * bs->bitrate;
+	uint64_t frames = 0, bits = 0, macan_bits = 0;
+	unsigned i, n = 0;
+	bool first = true;
+
+	for (i = 0; i < MACAN_BC_COUNT; i++) {
+		frames += bs->cls[i].frames;
+		bits += bs->cls[i].bits;
+		if (i != MACAN_BC_SIGNAL && i != MACAN_BC_OTHER)
+			macan_bits += bs->cls[i].bits;
+	}
+	for (i = 0; i <= CAN_SFF_MASK; i++)
+		if (bs->sff[i].st.frames)
+			active[n++] = &bs->sff[i];
+	for (i = 0; i < EXT_SLOTS; i++)
+		if (bs->ext[i].used && bs->ext[i].st.frames)
+			active[n++] = &bs->ext[i];
+	qsort(active, n, sizeof(active[0]), cmp_stat);
+	if (bs->overflow.st.frames)
+		active[n++] = &bs->overflow;
+
+	if (table && secs > 0) {
+		fprintf(table, "Bus load %.2f %% of %u bit/s, %.1f frames/s, MaCAN frames %.2f %%\n\n",
+			100.0 * (double)bits / capacity, bs->bitrate, (double)frames / secs,
+			100.0 * (double)macan_bits / capacity);
+		fprintf(table, "%-9s %-16s %9s %7s %6s %10s %9s %9s %9s\n", "CAN ID", "", "frames/s",
+			"load %", "bits", "period ms", "jitter ms", "min ms", "max ms");
+		for (i = 0; i < MACAN_BC_COUNT; i++)
+			if (bs->cls[i].frames)
+				print_row(table, "class", class_names[i], &bs->cls[i], secs, capacity);
+		for (i = 0; i < n; i++) {
+			char id[16], what[32];
+
+			if (active[i] == &bs->overflow)
+				snprintf(id, sizeof(id), "ext");
+			else if (active[i]->can_id & CAN_EFF_FLAG)
+				snprintf(id, sizeof(id), "%08x", active[i]->can_id & CAN_EFF_MASK);
+			else
+				snprintf(id, sizeof(id), "%03x", active[i]->can_id);
+			describe(bs, active[i], what, sizeof(what));
+			print_row(table, id, what, &active[i]->st, secs, capacity);
+		}
+		fflush(table);
+	}
+
+	if (json && secs > 0) {
+		fprintf(json, "{\"ts_ns\":%llu,\"window_s\":%.6f,\"bitrate\":%u,\"load\":%.6f,"
+			"\"macan_load\":%.6f,\"fps\":%.3f,\"classes\":{",
+			(unsigned long long)now_ns, secs, bs->bitrate, (double)bits / capacity,
+			(double)macan_bits / capacity, (double)frames / secs);
+		for (i = 0; i < MACAN_BC_COUNT; i++) {
+			if (!bs->cls[i].frames)
+				continue;
+			fprintf(json, "%s\"%s\":{", first ? "" : ",", class_names[i]);
+			json_stat(json, &bs->cls[i], secs, capacity);
+			fputc('}', json);
+			first = false;
+		}
+		fputs("},\"ids\":[", json);
+		for (i = 0; i < n; i++) {
+			fprintf(json, "%s{\"id\":%lld,", i ? "," : "",
+				active[i] == &bs->overflow ? -1LL : (long long)(active[i]->can_id & CAN_EFF_MASK));
+			json_stat(json, &active[i]->st, secs, capacity);
+			fputc('}', json);
+		}
+		fputs("]}\n", json);
+		fflush(json);
+	}
+
+	for (i = 0; i < MACAN_BC_COUNT; i++)
+		window_reset(&bs->cls[i]);
+	for (i = 0; i < n; i++)
+		window_reset(&active[i]->st);
+	bs->window_start = now_ns;
+	bs->started = true;
+}
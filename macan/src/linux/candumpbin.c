@@ -19,33 +19,222 @@
  *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "canring.h"
+#include "capfile.h"
 #include "helper.h"
 #include "macan.h"
+#include <dlfcn.h>
 #include <linux/can.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-int main(int argc, char *argv[])
+static volatile sig_atomic_t stop;
+
+/* Indexed capture file output (-o) */
+static struct capfile_writer *cap;
+static uint64_t start_mono, start_real;
+static int if_kernel[CAPFILE_MAX_IFS];	/* Kernel ifindex of capfile interfaces */
+
+static void sig_stop(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int cap_ifidx(int ifindex)
+{
+	char name[IF_NAMESIZE];
+	int i;
+
+	for (i = 0; i < CAPFILE_MAX_IFS && if_kernel[i]; i++)
+		if (if_kernel[i] == ifindex)
+			return i;
+	if (!if_indextoname((unsigned)ifindex, name))
+		return 0;
+	i = capfile_add_if(cap, name);
+	if (i < 0)
+		return 0;
+	if_kernel[i] = ifindex;
+	return i;
+}
+
+/**
+ * Write a frame to the output.
+ *
+ * @param ts_ns Kernel timestamp (CLOCK_REALTIME) or 0 for now.
+ */
+static void output_frame(const struct can_frame *cf, uint64_t ts_ns, int ifindex, FILE *out)
+{
+	if (cap) {
+		uint64_t t;
+
+		if (ts_ns)
+			t = ts_ns > start_real ? ts_ns - start_real : 0;
+		else
+			t = now_ns(CLOCK_MONOTONIC) - start_mono;
+		if (!capfile_write(cap, t, ifindex ? cap_ifidx(ifindex) : 0,
+				   cf->can_id, cf->can_dlc, cf->data))
+			stop = 1;
+		return;
+	}
+	fwrite(&cf->can_id, sizeof(cf->can_id), 1, out);
+	fwrite(&cf->can_dlc, sizeof(cf->can_dlc), 1, out);
+	fwrite(cf->data, sizeof(cf->data), 1, out);
+}
+
+static void write_frame(void *arg, const struct can_frame *cf, uint64_t ts_ns, int ifindex)
 {
-	(void)argc; (void)argv;
+	output_frame(cf, ts_ns, ifindex, arg);
+}
+
+/* Capture whole blocks of frames from a memory mapped ring */
+static int dump_ring(const char *ifname)
+{
+	static char buf[1 << 16];
+	struct canring *ring = canring_open(ifname);
+	struct canring_stats st;
+
+	if (!ring)
+		return 1;
+	setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+
+	while (!stop) {
+		if (!canring_wait(ring, 1000))
+			continue;
+		if (canring_process(ring, write_frame, stdout) && !cap)
+			fflush(stdout);
+	}
 
-	int s = helper_init("can0");
+	canring_get_stats(ring, &st);
+	fprintf(stderr, "candumpbin: %llu frames, %llu dropped by kernel, %llu CAN FD skipped\n",
+		(unsigned long long)st.packets, (unsigned long long)st.drops,
+		(unsigned long long)st.fd_frames);
+	canring_close(ring);
+	return 0;
+}
+
+static int dump_socket(const char *ifname)
+{
+	int s = helper_init(ifname);
 	fcntl(s, F_SETFL, 0); // Unset O_NONBLOCK flag
 
-	while (1) {
+	while (!stop) {
 		struct can_frame cf;
 		ssize_t ret = read(s, &cf, sizeof(cf));
 		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
 			perror("read");
 			exit(1);
 		}
 		if (ret != sizeof(cf))
 			continue;
+		if (cap) {
+			output_frame(&cf, 0, 0, NULL);
+			continue;
+		}
 		write(1, &cf.can_id, sizeof(cf.can_id));
 		write(1, &cf.can_dlc, sizeof(cf.can_dlc));
 		write(1, cf.data, sizeof(cf.data));
 	}
 	return 0;
 }
+
+static void print_help(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-d <CAN interface>] [-m] [-o <file> [-c <config_shlib>] [-D]]\n"
+		"  -m  capture through a memory mapped ring (-d any captures all interfaces)\n"
+		"  -o  write an indexed capture file instead of raw frames to stdout\n"
+		"  -c  store the hash of this configuration in the capture file\n"
+		"  -D  write the capture file with O_DIRECT\n",
+		argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = "can0";
+	const char *path = NULL;
+	const struct macan_config *config = NULL;
+	unsigned flags = 0;
+	bool use_ring = false;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "c:d:mo:D")) != -1) {
+		switch (opt) {
+		case 'c': {
+			void *handle = dlopen(optarg, RTLD_LAZY);
+			config = handle ? dlsym(handle, "config") : NULL;
+			if (!config) {
+				fprintf(stderr, "%s: no configuration\n", optarg);
+				exit(1);
+			}
+			break;
+		}
+		case 'd':
+			ifname = optarg;
+			break;
+		case 'm':
+			use_ring = true;
+			break;
+		case 'o':
+			path = optarg;
+			break;
+		case 'D':
+			flags |= CAPFILE_O_DIRECT;
+			break;
+		default:
+			print_help(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (path) {
+		cap = capfile_create(path, 0, config ? capfile_config_hash(config) : 0, flags);
+		if (!cap)
+			exit(1);
+		start_mono = now_ns(CLOCK_MONOTONIC);
+		start_real = now_ns(CLOCK_REALTIME);
+		if (!use_ring || strcmp(ifname, "any") != 0) {
+			capfile_add_if(cap, ifname);
+			if_kernel[0] = (int)if_nametoindex(ifname);
+		}
+	}
+
+	/* Buffered output must be finished on exit. Raw output to
+	 * stdout is unbuffered and keeps the default signal handling. */
+	if (path || use_ring) {
+		struct sigaction sa = { .sa_handler = sig_stop };
+
+		/* No SA_RESTART, a blocked read() must return */
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGPIPE, &sa, NULL);
+	}
+
+	ret = use_ring ? dump_ring(ifname) : dump_socket(ifname);
+
+	if (cap && capfile_fd_skipped(cap))
+		fprintf(stderr, "%s: %llu CAN FD frames not captured\n", path,
+			(unsigned long long)capfile_fd_skipped(cap));
+	if (cap && !capfile_close(cap)) {
+		fprintf(stderr, "%s: capture not finished properly\n", path);
+		ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,258 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Capture of CAN traffic through a memory mapped TPACKET_V3 ring
+ *
+ * The kernel fills blocks of the ring with received frames and hands
+ * a block over when it is full or when it retires after a timeout.
+ * All frames of a block are processed without any system call.
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/can.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "canring.h"
+
+#define BLOCK_SIZE	(1 << 16)	/* ~1000 frames */
+#define BLOCK_COUNT	64
+#define FRAME_SIZE	256
+#define BLOCK_TIMEOUT	10		/* ms, latency of a sparse bus */
+
+/* TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) without sign conversion */
+#define HDR_LEN ((sizeof(struct tpacket3_hdr) + TPACKET_ALIGNMENT - 1) & \
+		 ~(size_t)(TPACKET_ALIGNMENT - 1))
+
+struct canring {
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	unsigned block;		/* Next block to process */
+	struct canring_stats stats;
+};
+
+static struct tpacket_block_desc *block_desc(struct canring *r, unsigned i)
+{
+	return (struct tpacket_block_desc *)(r->map + (size_t)i * BLOCK_SIZE);
+}
+
+/**
+ * Open a capture ring.
+ *
+ * @param ifname CAN interface or NULL (or "any") to capture all
+ * interfaces at once.
+ *
+ * @return NULL on error (reported with perror()).
+ */
+struct canring *canring_open(const char *ifname)
+{
+	struct canring *r;
+	struct tpacket_req3 req;
+	struct sockaddr_ll addr;
+	int ver = TPACKET_V3;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_CAN));
+	if (r->fd < 0) {
+		perror("socket(PF_PACKET)");
+		goto err_free;
+	}
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) != 0) {
+		perror("PACKET_VERSION");
+		goto err_close;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_block_nr = BLOCK_COUNT;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = BLOCK_SIZE / FRAME_SIZE * BLOCK_COUNT;
+	req.tp_retire_blk_tov = BLOCK_TIMEOUT;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+		perror("PACKET_RX_RING");
+		goto err_close;
+	}
+
+	r->map_size = (size_t)BLOCK_SIZE * BLOCK_COUNT;
+	r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_LOCKED, r->fd, 0);
+	if (r->map == MAP_FAILED) /* MAP_LOCKED needs privileges */
+		r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		perror("mmap(PACKET_RX_RING)");
+		goto err_close;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_CAN);
+	if (ifname && strcmp(ifname, "any") != 0) {
+		addr.sll_ifindex = (int)if_nametoindex(ifname);
+		if (addr.sll_ifindex == 0) {
+			perror(ifname);
+			goto err_unmap;
+		}
+	}
+	if (bind(r->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("bind(PF_PACKET)");
+		goto err_unmap;
+	}
+	return r;
+
+err_unmap:
+	munmap(r->map, r->map_size);
+err_close:
+	close(r->fd);
+err_free:
+	free(r);
+	return NULL;
+}
+
+/**
+ * Capture only frames with the given CAN IDs (without flags) by
+ * attaching a socket filter to the ring.
+ */
+bool canring_set_ids(struct canring *r, const uint32_t *ids, unsigned n)
+{
+	struct sock_filter code[CANRING_MAX_IDS + 4];
+	struct sock_fprog prog = { .len = (unsigned short)(n + 4), .filter = code };
+	unsigned i;
+
+	if (n > CANRING_MAX_IDS)
+		return false;
+	/* Loads are big endian, so compare with byte swapped IDs */
+	code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0);
+	code[1] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, ntohl(~CAN_RTR_FLAG));
+	for (i = 0; i < n; i++) {
+		uint32_t id = ids[i] > CAN_SFF_MASK ? ids[i] | CAN_EFF_FLAG : ids[i];
+		code[2 + i] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(id),
+							   (uint8_t)(n - i), 0);
+	}
+	code[n + 2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+	code[n + 3] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	if (setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0) {
+		perror("SO_ATTACH_FILTER");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * File descriptor that becomes readable when a block is ready, for
+ * use with an event loop watcher.
+ */
+int canring_fd(const struct canring *r)
+{
+	return r->fd;
+}
+
+/**
+ * Process all blocks handed over by the kernel.
+ *
+ * @return Number of frames passed to the callback.
+ */
+unsigned canring_process(struct canring *r, canring_cb cb, void *arg)
+{
+	unsigned frames = 0;
+
+	while (1) {
+		struct tpacket_block_desc *bd = block_desc(r, r->block);
+		struct tpacket3_hdr *ph;
+		uint32_t i, num;
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		num = bd->hdr.bh1.num_pkts;
+		ph = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < num; i++) {
+			const struct sockaddr_ll *sll = (const struct sockaddr_ll *)
+				((uint8_t *)ph + HDR_LEN);
+
+			/* Frames sent by this host appear twice */
+			if (ph->tp_snaplen >= CAN_MTU && sll->sll_pkttype != PACKET_OUTGOING) {
+				/* The tools decode classic frames only */
+				if (ph->tp_snaplen > CAN_MTU) {
+					r->stats.fd_frames++;
+				} else {
+					cb(arg, (const struct can_frame *)((uint8_t *)ph + ph->tp_mac),
+					   (uint64_t)ph->tp_sec * 1000000000 + ph->tp_nsec,
+					   sll->sll_ifindex);
+					frames++;
+				}
+			}
+			ph = (struct tpacket3_hdr *)((uint8_t *)ph + ph->tp_next_offset);
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		r->block = (r->block + 1) % BLOCK_COUNT;
+		r->stats.blocks++;
+	}
+	return frames;
+}
+
+/**
+ * Wait until a block is ready.
+ *
+ * @return false on timeout or signal.
+ */
+bool canring_wait(struct canring *r, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = r->fd, .events = POLLIN | POLLERR };
+
+	if (block_desc(r, r->block)->hdr.bh1.block_status & TP_STATUS_USER)
+		return true;
+	return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void canring_get_stats(struct canring *r, struct canring_stats *stats)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	/* The kernel resets the counters on every read */
+	if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		r->stats.packets += st.tp_packets;
+		r->stats.drops += st.tp_drops;
+		r->stats.freezes += st.tp_freeze_q_cnt;
+	}
+	*stats = r->stats;
+}
+
+void canring_close(struct canring *r)
+{
+	munmap(r->map, r->map_size);
+	close(r->fd);
+	free(r);
+}
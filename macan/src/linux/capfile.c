@@ -0,0 +1,800 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Writer and mmap based reader of indexed capture files (see capfile.h) */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capfile.h"
+#include "macan.h"
+
+#define CHUNK_HDR_SIZE sizeof(struct capfile_chunk_hdr)
+
+static uint32_t recs_per_chunk(uint32_t chunk_size)
+{
+	return (uint32_t)((chunk_size - CHUNK_HDR_SIZE) / sizeof(struct capfile_rec));
+}
+
+/* Table of CAN IDs with the list of chunks each of them appears in */
+
+struct id_slot {
+	bool used;
+	uint32_t can_id;
+	uint32_t frames;
+	uint32_t last_chunk;	/* Last chunk number + 1 in chunks[] */
+	uint32_t n, cap;
+	uint32_t *chunks;
+};
+
+struct idtab {
+	struct id_slot *slot;
+	uint32_t size;		/* Power of two */
+	uint32_t count;
+};
+
+static struct id_slot *idtab_get(struct idtab *t, uint32_t can_id);
+
+static bool idtab_grow(struct idtab *t)
+{
+	struct idtab n = { .size = t->size ? t->size * 2 : 256 };
+	uint32_t i;
+
+	n.slot = calloc(n.size, sizeof(*n.slot));
+	if (!n.slot)
+		return false;
+	for (i = 0; i < t->size; i++) {
+		if (t->slot[i].used) {
+			struct id_slot *s = idtab_get(&n, t->slot[i].can_id);
+			*s = t->slot[i];
+		}
+	}
+	free(t->slot);
+	*t = n;
+	return true;
+}
+
+static struct id_slot *idtab_get(struct idtab *t, uint32_t can_id)
+{
+	uint32_t i;
+
+	if ((t->count + 1) * 2 > t->size && !idtab_grow(t))
+		return NULL;
+	for (i = (can_id * 2654435761u) & (t->size - 1);
+	     t->slot[i].used; i = (i + 1) & (t->size - 1))
+		if (t->slot[i].can_id == can_id)
+			return &t->slot[i];
+	t->slot[i].used = true;
+	t->slot[i].can_id = can_id;
+	t->count++;
+	return &t->slot[i];
+}
+
+static bool idtab_add(struct idtab *t, uint32_t can_id, uint32_t chunk)
+{
+	struct id_slot *s = idtab_get(t, can_id);
+
+	if (!s)
+		return false;
+	s->frames++;
+	if (s->last_chunk == chunk + 1)
+		return true;
+	if (s->n == s->cap) {
+		uint32_t cap = s->cap ? s->cap * 2 : 8;
+		uint32_t *c = realloc(s->chunks, cap * sizeof(*c));
+		if (!c)
+			return false;
+		s->chunks = c;
+		s->cap = cap;
+	}
+	s->chunks[s->n++] = chunk;
+	s->last_chunk = chunk + 1;
+	return true;
+}
+
+static void idtab_free(struct idtab *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < t->size; i++)
+		free(t->slot[i].chunks);
+	free(t->slot);
+}
+
+static int cmp_slot(const void *a, const void *b)
+{
+	const struct id_slot *x = *(struct id_slot * const *)a;
+	const struct id_slot *y = *(struct id_slot * const *)b;
+
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+/**
+ * Serialize the index.
+ *
+ * @return Malloced buffer, its size is stored to *len.
+ */
+static void *index_build(struct idtab *t, const struct capfile_chunk_ent *chunks,
+			 uint32_t chunk_count, size_t *len)
+{
+	struct id_slot **sorted;
+	struct capfile_index_hdr *ih;
+	struct capfile_id_ent *ids;
+	uint32_t *lists;
+	uint32_t i, n = 0, list_len = 0;
+	uint8_t *buf;
+
+	sorted = malloc((t->count ? t->count : 1) * sizeof(*sorted));
+	if (!sorted)
+		return NULL;
+	for (i = 0; i < t->size; i++)
+		if (t->slot[i].used) {
+			sorted[n++] = &t->slot[i];
+			list_len += t->slot[i].n;
+		}
+	qsort(sorted, n, sizeof(*sorted), cmp_slot);
+
+	*len = sizeof(*ih) + chunk_count * sizeof(*chunks) +
+		n * sizeof(*ids) + list_len * sizeof(*lists);
+	buf = calloc(1, *len);
+	if (!buf) {
+		free(sorted);
+		return NULL;
+	}
+	ih = (struct capfile_index_hdr *)buf;
+	memcpy(ih->magic, "INDX", 4);
+	ih->chunk_count = chunk_count;
+	ih->id_count = n;
+	ih->list_len = list_len;
+	memcpy(ih + 1, chunks, chunk_count * sizeof(*chunks));
+	ids = (struct capfile_id_ent *)(buf + sizeof(*ih) + chunk_count * sizeof(*chunks));
+	lists = (uint32_t *)(ids + n);
+
+	list_len = 0;
+	for (i = 0; i < n; i++) {
+		ids[i].can_id = sorted[i]->can_id;
+		ids[i].frames = sorted[i]->frames;
+		ids[i].chunk_count = sorted[i]->n;
+		ids[i].list_off = list_len;
+		memcpy(&lists[list_len], sorted[i]->chunks, sorted[i]->n * sizeof(*lists));
+		list_len += sorted[i]->n;
+	}
+	free(sorted);
+	return buf;
+}
+
+/**
+ * Hash of the MaCAN configuration the capture was taken with, so that
+ * analysis tools can detect a mismatching configuration.
+ */
+uint64_t capfile_config_hash(const struct macan_config *config)
+{
+	uint64_t h = 14695981039346656037ull;	/* FNV-1a */
+	uint32_t i;
+
+#define HASH(x) do {						\
+		const uint8_t *p = (const uint8_t *)&(x);	\
+		size_t k;					\
+		for (k = 0; k < sizeof(x); k++)			\
+			h = (h ^ p[k]) * 1099511628211ull;	\
+	} while (0)
+
+	HASH(config->sig_count);
+	for (i = 0; i < config->sig_count; i++) {
+		const struct macan_sig_spec *s = &config->sigspec[i];
+		HASH(s->can_nsid); HASH(s->can_sid);
+		HASH(s->src_id); HASH(s->dst_id); HASH(s->presc);
+	}
+	HASH(config->node_count);
+	HASH(config->canid->time);
+	for (i = 0; i < config->node_count; i++)
+		HASH(config->canid->ecu[i].canid);
+	HASH(config->key_server_id);
+	HASH(config->time_server_id);
+	HASH(config->time_div);
+#undef HASH
+	return h;
+}
+
+/* Writer */
+
+struct capfile_writer {
+	int fd;
+	struct capfile_header hdr;
+	uint8_t *buf;		/* Current chunk, aligned for O_DIRECT */
+	uint32_t nrec, max_rec;
+	uint64_t last_ns;
+	struct capfile_chunk_ent *chunks;
+	uint32_t chunks_cap;
+	struct idtab ids;
+	uint64_t fd_skipped;
+	bool failed;
+};
+
+static bool pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+	const uint8_t *p = buf;
+
+	while (len) {
+		ssize_t ret = pwrite(fd, p, len, off);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("capfile write");
+			return false;
+		}
+		p += ret;
+		off += ret;
+		len -= (size_t)ret;
+	}
+	return true;
+}
+
+static uint64_t chunk_offset(const struct capfile_header *hdr, uint32_t seq)
+{
+	return CAPFILE_HDR_SIZE + (uint64_t)seq * hdr->chunk_size;
+}
+
+static bool flush_chunk(struct capfile_writer *w)
+{
+	struct capfile_chunk_hdr *ch = (struct capfile_chunk_hdr *)w->buf;
+	const struct capfile_rec *rec = (const struct capfile_rec *)(w->buf + CHUNK_HDR_SIZE);
+	uint32_t seq = w->hdr.chunk_count;
+	struct capfile_chunk_ent *ent;
+
+	if (w->nrec == 0)
+		return true;
+	if (seq == w->chunks_cap) {
+		uint32_t cap = w->chunks_cap ? w->chunks_cap * 2 : 64;
+		struct capfile_chunk_ent *c = realloc(w->chunks, cap * sizeof(*c));
+		if (!c)
+			return false;
+		w->chunks = c;
+		w->chunks_cap = cap;
+	}
+
+	memset(ch, 0, sizeof(*ch));
+	memcpy(ch->magic, "CHNK", 4);
+	ch->count = w->nrec;
+	ch->first_ns = rec[0].ts_ns;
+	ch->last_ns = rec[w->nrec - 1].ts_ns;
+	ch->seq = seq;
+	memset(w->buf + CHUNK_HDR_SIZE + w->nrec * sizeof(*rec), 0,
+	       (w->max_rec - w->nrec) * sizeof(*rec));
+
+	ent = &w->chunks[seq];
+	ent->offset = chunk_offset(&w->hdr, seq);
+	ent->first_ns = ch->first_ns;
+	ent->last_ns = ch->last_ns;
+	ent->count = ch->count;
+	ent->reserved = 0;
+
+	if (!pwrite_all(w->fd, w->buf, w->hdr.chunk_size, (off_t)ent->offset))
+		return false;
+	w->hdr.chunk_count++;
+	w->nrec = 0;
+	return true;
+}
+
+static bool write_header(struct capfile_writer *w)
+{
+	memset(w->buf, 0, CAPFILE_HDR_SIZE);
+	memcpy(w->buf, &w->hdr, sizeof(w->hdr));
+	return pwrite_all(w->fd, w->buf, CAPFILE_HDR_SIZE, 0);
+}
+
+/**
+ * Create a capture file.
+ *
+ * @param chunk_size Size of chunks in bytes (multiple of
+ * CAPFILE_HDR_SIZE) or 0 for CAPFILE_CHUNK_SIZE.
+ * @param flags CAPFILE_O_DIRECT to write without the page cache.
+ *
+ * @return NULL on error (reported with perror()).
+ */
+struct capfile_writer *capfile_create(const char *path, uint32_t chunk_size,
+				      uint64_t config_hash, unsigned flags)
+{
+	struct capfile_writer *w;
+	struct timespec ts;
+	int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+
+	if (chunk_size == 0)
+		chunk_size = CAPFILE_CHUNK_SIZE;
+	if (chunk_size % CAPFILE_HDR_SIZE) {
+		fprintf(stderr, "capfile: chunk size must be a multiple of %d\n", CAPFILE_HDR_SIZE);
+		return NULL;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	if (posix_memalign((void **)&w->buf, CAPFILE_HDR_SIZE, chunk_size) != 0) {
+		free(w);
+		return NULL;
+	}
+	if (flags & CAPFILE_O_DIRECT)
+		oflags |= O_DIRECT;
+	w->fd = open(path, oflags, 0644);
+	if (w->fd < 0) {
+		perror(path);
+		free(w->buf);
+		free(w);
+		return NULL;
+	}
+
+	memcpy(w->hdr.magic, CAPFILE_MAGIC, sizeof(w->hdr.magic));
+	w->hdr.version = CAPFILE_VERSION;
+	w->hdr.chunk_size = chunk_size;
+	w->hdr.config_hash = config_hash;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	w->hdr.start_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+	w->max_rec = recs_per_chunk(chunk_size);
+	if (!write_header(w)) {
+		close(w->fd);
+		free(w->buf);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+/**
+ * Register an interface name.
+ *
+ * @return Interface index for capfile_write() or -1 if the table is
+ * full.
+ */
+int capfile_add_if(struct capfile_writer *w, const char *ifname)
+{
+	uint32_t i;
+
+	for (i = 0; i < w->hdr.if_count; i++)
+		if (strncmp(w->hdr.ifname[i], ifname, CAPFILE_IFNAMSIZ) == 0)
+			return (int)i;
+	if (w->hdr.if_count == CAPFILE_MAX_IFS)
+		return -1;
+	strncpy(w->hdr.ifname[i], ifname, CAPFILE_IFNAMSIZ - 1);
+	return (int)w->hdr.if_count++;
+}
+
+/**
+ * Append a frame.
+ *
+ * @param ts_ns Nanoseconds since the start of the capture. Timestamps
+ * lower than the previous one are raised to it.
+ *
+ * Records hold classic frames only; CAN FD frames (@a can_dlc above 8)
+ * are skipped and counted in capfile_fd_skipped().
+ */
+bool capfile_write(struct capfile_writer *w, uint64_t ts_ns, int ifidx,
+		   uint32_t can_id, uint8_t can_dlc, const uint8_t *data)
+{
+	struct capfile_rec *rec;
+
+	if (w->failed)
+		return false;
+	if (can_dlc > sizeof(rec->data)) {
+		w->fd_skipped++;
+		return true;
+	}
+	if (w->nrec == w->max_rec && !flush_chunk(w)) {
+		w->failed = true;
+		return false;
+	}
+	if (!idtab_add(&w->ids, can_id, w->hdr.chunk_count)) {
+		w->failed = true;
+		return false;
+	}
+
+	if (ts_ns < w->last_ns)
+		ts_ns = w->last_ns;
+	w->last_ns = ts_ns;
+
+	rec = (struct capfile_rec *)(w->buf + CHUNK_HDR_SIZE) + w->nrec++;
+	rec->ts_ns = ts_ns;
+	rec->can_id = can_id;
+	rec->can_dlc = can_dlc;
+	rec->ifidx = (uint8_t)(ifidx > 0 ? ifidx : 0);
+	rec->pad[0] = rec->pad[1] = 0;
+	memcpy(rec->data, data, sizeof(rec->data));
+	return true;
+}
+
+/**
+ * Number of CAN FD frames skipped by capfile_write()
+ */
+uint64_t capfile_fd_skipped(const struct capfile_writer *w)
+{
+	return w->fd_skipped;
+}
+
+/**
+ * Write the last chunk and the index and close the file.
+ */
+bool capfile_close(struct capfile_writer *w)
+{
+	bool ok = !w->failed && flush_chunk(w);
+	void *index;
+	size_t len;
+
+	/* The index has arbitrary size */
+	fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+
+	if (ok) {
+		index = index_build(&w->ids, w->chunks, w->hdr.chunk_count, &len);
+		w->hdr.index_offset = chunk_offset(&w->hdr, w->hdr.chunk_count);
+		ok = index && pwrite_all(w->fd, index, len, (off_t)w->hdr.index_offset);
+		free(index);
+	}
+	if (ok)
+		ok = write_header(w);
+	else
+		w->hdr.index_offset = 0;
+
+	if (close(w->fd) != 0)
+		ok = false;
+	idtab_free(&w->ids);
+	free(w->chunks);
+	free(w->buf);
+	free(w);
+	return ok;
+}
+
+/* Reader */
+
+struct capfile {
+	const uint8_t *map;
+	size_t size;
+	const struct capfile_header *hdr;
+	const struct capfile_chunk_ent *chunks;
+	uint32_t chunk_count;
+	const struct capfile_id_ent *ids;
+	uint32_t id_count;
+	const uint32_t *lists;
+	void *rebuilt;		/* Index built by the reader */
+};
+
+/* Check that the index read from the file refers only to the mapped
+ * chunks and to its own chunk lists */
+static bool index_valid(const struct capfile *cap, const struct capfile_index_hdr *ih,
+			const struct capfile_chunk_ent *chunks,
+			const struct capfile_id_ent *ids, const uint32_t *lists)
+{
+	uint32_t chunk_size = cap->hdr->chunk_size;
+	uint32_t max_rec = recs_per_chunk(chunk_size);
+	uint32_t i, j;
+
+	for (i = 0; i < ih->chunk_count; i++)
+		if (chunks[i].offset < CAPFILE_HDR_SIZE ||
+		    chunks[i].offset > cap->size - chunk_size ||
+		    chunks[i].count > max_rec)
+			return false;
+	for (i = 0; i < ih->id_count; i++) {
+		if (ids[i].list_off > ih->list_len ||
+		    ids[i].chunk_count > ih->list_len - ids[i].list_off)
+			return false;
+		for (j = 0; j < ids[i].chunk_count; j++)
+			if (lists[ids[i].list_off + j] >= ih->chunk_count)
+				return false;
+	}
+	return true;
+}
+
+static bool index_load(struct capfile *cap)
+{
+	const struct capfile_index_hdr *ih;
+	const struct capfile_chunk_ent *chunks;
+	const struct capfile_id_ent *ids;
+	const uint32_t *lists;
+	uint64_t off = cap->hdr->index_offset;
+
+	if (off == 0 || off + sizeof(*ih) > cap->size || cap->hdr->chunk_size > cap->size)
+		return false;
+	ih = (const struct capfile_index_hdr *)(cap->map + off);
+	if (memcmp(ih->magic, "INDX", 4) != 0 ||
+	    off + sizeof(*ih) + ih->chunk_count * sizeof(struct capfile_chunk_ent) +
+	    ih->id_count * sizeof(struct capfile_id_ent) +
+	    ih->list_len * sizeof(uint32_t) > cap->size)
+		return false;
+
+	chunks = (const struct capfile_chunk_ent *)(ih + 1);
+	ids = (const struct capfile_id_ent *)(chunks + ih->chunk_count);
+	lists = (const uint32_t *)(ids + ih->id_count);
+	if (!index_valid(cap, ih, chunks, ids, lists))
+		return false;
+
+	cap->chunk_count = ih->chunk_count;
+	cap->chunks = chunks;
+	cap->id_count = ih->id_count;
+	cap->ids = ids;
+	cap->lists = lists;
+	return true;
+}
+
+/* Walk the chunks of a capture that was not closed properly */
+static bool index_rebuild(struct capfile *cap)
+{
+	uint32_t chunk_size = cap->hdr->chunk_size;
+	uint32_t max_rec = recs_per_chunk(chunk_size);
+	struct capfile_chunk_ent *chunks = NULL;
+	struct idtab ids = { 0 };
+	uint32_t n = 0, cap_n = 0, i;
+	uint64_t off;
+	size_t len;
+	bool ok = true;
+
+	for (off = CAPFILE_HDR_SIZE; ok && off + chunk_size <= cap->size; off += chunk_size) {
+		const struct capfile_chunk_hdr *ch = (const struct capfile_chunk_hdr *)(cap->map + off);
+		const struct capfile_rec *rec = (const struct capfile_rec *)(ch + 1);
+
+		if (memcmp(ch->magic, "CHNK", 4) != 0 || ch->count > max_rec || ch->seq != n)
+			break;
+		if (n == cap_n) {
+			struct capfile_chunk_ent *c;
+			cap_n = cap_n ? cap_n * 2 : 64;
+			c = realloc(chunks, cap_n * sizeof(*c));
+			if (!c) {
+				ok = false;
+				break;
+			}
+			chunks = c;
+		}
+		chunks[n].offset = off;
+		chunks[n].first_ns = ch->first_ns;
+		chunks[n].last_ns = ch->last_ns;
+		chunks[n].count = ch->count;
+		chunks[n].reserved = 0;
+		for (i = 0; ok && i < ch->count; i++)
+			ok = idtab_add(&ids, rec[i].can_id, n);
+		n++;
+	}
+
+	if (ok) {
+		cap->rebuilt = index_build(&ids, chunks, n, &len);
+		ok = cap->rebuilt != NULL;
+	}
+	idtab_free(&ids);
+	free(chunks);
+	if (!ok)
+		return false;
+
+	cap->chunk_count = n;
+	cap->chunks = (const struct capfile_chunk_ent *)
+		((struct capfile_index_hdr *)cap->rebuilt + 1);
+	cap->id_count = ((struct capfile_index_hdr *)cap->rebuilt)->id_count;
+	cap->ids = (const struct capfile_id_ent *)(cap->chunks + cap->chunk_count);
+	cap->lists = (const uint32_t *)(cap->ids + cap->id_count);
+	return true;
+}
+
+/**
+ * Map a capture file.
+ *
+ * @return NULL on error (reported to stderr).
+ */
+struct capfile *capfile_open(const char *path)
+{
+	struct capfile *cap;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < CAPFILE_HDR_SIZE) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return NULL;
+	}
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		goto err;
+	cap->map = map;
+	cap->size = (size_t)st.st_size;
+	cap->hdr = map;
+	if (memcmp(cap->hdr->magic, CAPFILE_MAGIC, sizeof(cap->hdr->magic)) != 0 ||
+	    cap->hdr->version != CAPFILE_VERSION ||
+	    cap->hdr->chunk_size < CAPFILE_HDR_SIZE ||
+	    cap->hdr->chunk_size % CAPFILE_HDR_SIZE) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		goto err;
+	}
+	if (!index_load(cap) && !index_rebuild(cap)) {
+		fprintf(stderr, "%s: cannot build index\n", path);
+		goto err;
+	}
+	return cap;
+err:
+	free(cap);
+	munmap(map, (size_t)st.st_size);
+	return NULL;
+}
+
+void capfile_free(struct capfile *cap)
+{
+	munmap((void *)cap->map, cap->size);
+	free(cap->rebuilt);
+	free(cap);
+}
+
+const struct capfile_header *capfile_hdr(const struct capfile *cap)
+{
+	return cap->hdr;
+}
+
+uint32_t capfile_chunks(const struct capfile *cap)
+{
+	return cap->chunk_count;
+}
+
+const struct capfile_chunk_ent *capfile_chunk(const struct capfile *cap, uint32_t i)
+{
+	return &cap->chunks[i];
+}
+
+/**
+ * Return the records of chunk i (capfile_chunk(cap, i)->count of them).
+ */
+const struct capfile_rec *capfile_chunk_recs(const struct capfile *cap, uint32_t i)
+{
+	return (const struct capfile_rec *)(cap->map + cap->chunks[i].offset + CHUNK_HDR_SIZE);
+}
+
+const struct capfile_id_ent *capfile_ids(const struct capfile *cap, uint32_t *count)
+{
+	*count = cap->id_count;
+	return cap->ids;
+}
+
+const struct capfile_id_ent *capfile_find_id(const struct capfile *cap, uint32_t can_id)
+{
+	uint32_t lo = 0, hi = cap->id_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (cap->ids[mid].can_id < can_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < cap->id_count && cap->ids[lo].can_id == can_id ? &cap->ids[lo] : NULL;
+}
+
+/**
+ * Find the first chunk that may contain frames at or after ts_ns.
+ *
+ * @return Chunk number, capfile_chunks() if there is none.
+ */
+uint32_t capfile_seek(const struct capfile *cap, uint64_t ts_ns)
+{
+	uint32_t lo = 0, hi = cap->chunk_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (cap->chunks[mid].last_ns < ts_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Iterate over all frames with timestamps in [from_ns, to_ns].
+ */
+void capfile_iter_init(struct capfile_iter *it, const struct capfile *cap,
+		       uint64_t from_ns, uint64_t to_ns)
+{
+	memset(it, 0, sizeof(*it));
+	it->cap = cap;
+	it->from_ns = from_ns;
+	it->to_ns = to_ns;
+	it->chunk = capfile_seek(cap, from_ns);
+}
+
+/**
+ * Iterate over frames of one CAN ID with timestamps in [from_ns,
+ * to_ns]. Only chunks containing the ID are visited.
+ */
+void capfile_iter_init_id(struct capfile_iter *it, const struct capfile *cap,
+			  uint32_t can_id, uint64_t from_ns, uint64_t to_ns)
+{
+	const uint32_t *list;
+	uint32_t lo = 0, hi;
+
+	memset(it, 0, sizeof(*it));
+	it->cap = cap;
+	it->from_ns = from_ns;
+	it->to_ns = to_ns;
+	it->id = capfile_find_id(cap, can_id);
+	if (!it->id) {
+		it->done = true;
+		return;
+	}
+
+	list = cap->lists + it->id->list_off;
+	hi = it->id->chunk_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (cap->chunks[list[mid]].last_ns < from_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	it->pos = lo;
+	if (lo < it->id->chunk_count)
+		it->chunk = list[lo];
+	else
+		it->done = true;
+}
+
+/**
+ * Return the next frame or NULL at the end. The record points to the
+ * mapped file and is valid until capfile_free().
+ */
+const struct capfile_rec *capfile_next(struct capfile_iter *it)
+{
+	const struct capfile *cap = it->cap;
+
+	while (!it->done && it->chunk < cap->chunk_count) {
+		const struct capfile_chunk_ent *ch = &cap->chunks[it->chunk];
+		const struct capfile_rec *rec = (const struct capfile_rec *)
+			(cap->map + ch->offset + CHUNK_HDR_SIZE);
+
+		while (it->rec < ch->count) {
+			const struct capfile_rec *r = &rec[it->rec++];
+
+			if (r->ts_ns > it->to_ns) {
+				it->done = true;
+				return NULL;
+			}
+			if (r->ts_ns >= it->from_ns && (!it->id || r->can_id == it->id->can_id))
+				return r;
+		}
+
+		it->rec = 0;
+		if (it->id) {
+			if (++it->pos >= it->id->chunk_count)
+				break;
+			it->chunk = cap->lists[it->id->list_off + it->pos];
+		} else
+			it->chunk++;
+	}
+	it->done = true;
+	return NULL;
+}
@@ -0,0 +1,418 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fast rendering of monitored frames (see macan_display.h) */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "macan_display.h"
+
+#define MAX_LINE	512	/* Longer than any rendered line */
+
+enum id_class { CL_NONE, CL_TIME, CL_ECU, CL_SIG_NS, CL_SIG_S };
+
+struct id_class_ent {
+	uint32_t can_id;
+	uint8_t type;		/* enum id_class */
+	uint16_t index;		/* ECU-ID or signal number */
+};
+
+/* ECU names as formatted by print_frame() into buffers of 8 and 20 bytes */
+struct ecu_name {
+	char s8[8], s20[20];
+	uint8_t len8, len20;
+};
+
+struct macan_display {
+	int fd;
+	unsigned flags;
+	macan_ecuid ks;
+	uint64_t base_ns;
+	bool started;
+
+	struct id_class_ent sff[CAN_SFF_MASK + 1];	/* Indexed by standard CAN ID */
+	struct id_class_ent *ext;			/* Other IDs, sorted */
+	unsigned ext_count;
+	struct ecu_name name[256];
+
+	struct macan_display_stats stats;
+	size_t len;
+	char buf[MACAN_DISPLAY_BUF_SIZE];
+};
+
+static int cmp_class(const void *a, const void *b)
+{
+	const struct id_class_ent *x = a, *y = b;
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+/* Store the class of an ID unless it already has one. Signals are
+ * stored from the last one to match print_frame() precedence. */
+static void classify(struct macan_display *d, uint32_t can_id, enum id_class type, unsigned index)
+{
+	struct id_class_ent *e;
+	unsigned i;
+
+	if (can_id <= CAN_SFF_MASK) {
+		e = &d->sff[can_id];
+	} else {
+		for (i = 0; i < d->ext_count && d->ext[i].can_id != can_id; i++);
+		e = &d->ext[i];
+		if (i == d->ext_count)
+			*e = (struct id_class_ent){ .can_id = can_id, .type = CL_NONE };
+		d->ext_count += i == d->ext_count;
+	}
+	if (e->type == CL_NONE) {
+		e->type = (uint8_t)type;
+		e->index = (uint16_t)index;
+	}
+}
+
+static const struct id_class_ent *lookup(const struct macan_display *d, uint32_t can_id)
+{
+	unsigned lo = 0, hi = d->ext_count;
+
+	if (can_id <= CAN_SFF_MASK)
+		return &d->sff[can_id];
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (d->ext[mid].can_id < can_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < d->ext_count && d->ext[lo].can_id == can_id ? &d->ext[lo] : NULL;
+}
+
+/**
+ * Create a display writing to fd.
+ *
+ * @param flags  MACAN_DISPLAY_COLOR, MACAN_DISPLAY_COMPACT
+ */
+struct macan_display *macan_display_create(const struct macan_ctx *ctx, int fd, unsigned flags)
+{
+	const struct macan_config *cfg = ctx->config;
+	struct macan_display *d = calloc(1, sizeof(*d));
+	unsigned i;
+
+	if (!d)
+		return NULL;
+	d->ext = calloc(1U + cfg->node_count + 2U * cfg->sig_count, sizeof(*d->ext));
+	if (!d->ext) {
+		free(d);
+		return NULL;
+	}
+	d->fd = fd;
+	d->flags = flags;
+	d->ks = cfg->key_server_id;
+
+	classify(d, cfg->canid->time, CL_TIME, 0);
+	for (i = 0; i < cfg->node_count; i++)
+		classify(d, cfg->canid->ecu[i].canid, CL_ECU, i);
+	for (i = cfg->sig_count; i-- > 0; ) {
+		classify(d, cfg->sigspec[i].can_nsid, CL_SIG_NS, i);
+		classify(d, cfg->sigspec[i].can_sid, CL_SIG_S, i);
+	}
+	qsort(d->ext, d->ext_count, sizeof(*d->ext), cmp_class);
+
+	for (i = 0; i < 256; i++) {
+		struct ecu_name *n = &d->name[i];
+		macan_sprint_ecuid(ctx, n->s8, sizeof(n->s8), (macan_ecuid)i);
+		macan_sprint_ecuid(ctx, n->s20, sizeof(n->s20), (macan_ecuid)i);
+		n->len8 = (uint8_t)strlen(n->s8);
+		n->len20 = (uint8_t)strlen(n->s20);
+	}
+	return d;
+}
+
+void macan_display_free(struct macan_display *d)
+{
+	macan_display_flush(d);
+	free(d->ext);
+	free(d);
+}
+
+/**
+ * Write out the buffered lines.
+ *
+ * @return 0 on success, -1 on a write error (the lines are dropped).
+ */
+int macan_display_flush(struct macan_display *d)
+{
+	size_t off = 0;
+
+	while (off < d->len) {
+		ssize_t ret = write(d->fd, d->buf + off, d->len - off);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			d->len = 0;
+			return -1;
+		}
+		off += (size_t)ret;
+		d->stats.writes++;
+	}
+	d->stats.bytes += d->len;
+	d->len = 0;
+	return 0;
+}
+
+void macan_display_get_stats(const struct macan_display *d, struct macan_display_stats *stats)
+{
+	*stats = d->stats;
+}
+
+static char *put_str(char *p, const char *s)
+{
+	size_t len = strlen(s);
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static char *put_mem(char *p, const char *s, size_t len)
+{
+	memcpy(p, s, len);
+	return p + len;
+}
+
+/* Unsigned decimal, right aligned to at least width characters */
+static char *put_uint(char *p, uint64_t v, unsigned width)
+{
+	char tmp[20];
+	unsigned n = 0;
+
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	while (width > n) {
+		*p++ = ' ';
+		width--;
+	}
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char *put_hex(char *p, uint32_t v, unsigned digits)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	while (digits--)
+		*p++ = hex[(v >> (4 * digits)) & 0xf];
+	return p;
+}
+
+/* Same as sprint_canframe(buf, cf, 0, 8) */
+static char *put_canframe(char *p, const struct can_frame *cf)
+{
+	unsigned i, len = cf->can_dlc > 8 ? 8 : cf->can_dlc;
+
+	if (cf->can_id & CAN_ERR_FLAG)
+		p = put_hex(p, cf->can_id & (CAN_ERR_MASK | CAN_ERR_FLAG), 8);
+	else if (cf->can_id & CAN_EFF_FLAG)
+		p = put_hex(p, cf->can_id & CAN_EFF_MASK, 8);
+	else
+		p = put_hex(p, cf->can_id & CAN_SFF_MASK, 3);
+	*p++ = '#';
+	if (cf->can_id & CAN_RTR_FLAG) {
+		*p++ = 'R';
+		if (cf->can_dlc)
+			p = put_uint(p, cf->can_dlc, 0);
+		return p;
+	}
+	for (i = 0; i < len; i++)
+		p = put_hex(p, cf->data[i], 2);
+	return p;
+}
+
+static char *put_name(const struct macan_display *d, char *p, unsigned id, bool wide)
+{
+	const struct ecu_name *n = &d->name[id & 0xff];
+	return wide ? put_mem(p, n->s20, n->len20) : put_mem(p, n->s8, n->len8);
+}
+
+/* Crypt frame description as print_frame(), the compact form if short */
+static char *put_crypt(const struct macan_display *d, char *p, const struct can_frame *cf,
+		       macan_ecuid src, bool short_form, const char **color)
+{
+	macan_ecuid dst = macan_crypt_dst(cf);
+	unsigned i;
+
+	if (cf->can_dlc < 2)
+		return put_str(p, short_form ? "crypt?" : "broken crypt frame");
+
+	if (short_form) {
+		p = put_name(d, p, src, false);
+		*p++ = '>';
+		p = put_name(d, p, dst, false);
+		*p++ = ' ';
+	} else {
+		p = put_str(p, "crypt ");
+		p = put_name(d, p, src, false);
+		p = put_str(p, "->");
+		p = put_name(d, p, dst, false);
+		p = put_str(p, " (");
+		p = put_uint(p, src, 0);
+		p = put_str(p, "->");
+		p = put_uint(p, dst, 0);
+		p = put_str(p, "): ");
+	}
+
+	switch (macan_crypt_flags(cf)) {
+	case FL_REQ_CHALLENGE:
+		p = put_str(p, short_form ? "reqchg " : "req challenge fwd_id=");
+		p = put_name(d, p, cf->data[1], true);
+		if (cf->can_dlc != 2)
+			p = put_str(p, short_form ? "?" : " wrong length");
+		break;
+	case FL_CHALLENGE:
+		p = put_str(p, short_form ? "chg " : "challenge fwd_id=");
+		p = put_name(d, p, cf->data[1], true);
+		*color = ANSI_COLOR_DCYAN;
+		break;
+	case FL_SESS_KEY_OR_ACK:
+		if (src == d->ks) {
+			*color = ANSI_COLOR_DBLUE;
+			p = put_str(p, short_form ? "skey " : "sess_key seq=");
+			p = put_uint(p, cf->data[1] >> 4, 0);
+			p = put_str(p, short_form ? "/" : " len=");
+			p = put_uint(p, cf->data[1] & 0xf, 0);
+		} else {
+			char delim = '[';
+
+			*color = ANSI_COLOR_BLUE;
+			p = put_str(p, short_form ? "ack=" : "ack group=");
+			for (i = 0; i < 24; i++) {
+				if (cf->data[1 + i / 8] & (0x01 << (i % 8))) {
+					*p++ = delim;
+					p = put_uint(p, i, 0);
+					delim = ' ';
+				}
+			}
+			*p++ = ']';
+		}
+		break;
+	case FL_SIGNAL_OR_AUTH_REQ:
+		if (cf->can_dlc == 8) {
+			p = put_str(p, short_form ? "sig " : "signal #");
+			p = put_uint(p, cf->data[1], 0);
+		} else {
+			*color = ANSI_COLOR_MAGENTA;
+			if (short_form) {
+				p = put_str(p, "areq ");
+				p = put_uint(p, cf->data[1], 0);
+				*p++ = '/';
+				p = put_uint(p, cf->data[2], 0);
+				if (cf->can_dlc != 3 && cf->can_dlc != 7)
+					*p++ = '?';
+				break;
+			}
+			p = put_str(p, "auth req ");
+			switch (cf->can_dlc) {
+			case 3: p = put_str(p, "NO MAC"); break;
+			case 7: p = put_str(p, "+ MAC"); break;
+			default: p = put_str(p, "BROKEN!!!"); break;
+			}
+			p = put_str(p, " signal=#");
+			p = put_uint(p, cf->data[1], 0);
+			p = put_str(p, " presc=");
+			p = put_uint(p, cf->data[2], 0);
+		}
+		break;
+	}
+	return p;
+}
+
+/**
+ * Render a frame received at ts_ns. Times are printed relative to
+ * the first rendered frame.
+ */
+void macan_display_frame(struct macan_display *d, uint64_t ts_ns, const struct can_frame *cf)
+{
+	const struct id_class_ent *cl = lookup(d, cf->can_id);
+	bool compact = d->flags & MACAN_DISPLAY_COMPACT;
+	const char *color = "";
+	char comment[MAX_LINE / 2], *c = comment, *p, *start;
+	uint64_t ms;
+	uint32_t time;
+
+	if (d->len > sizeof(d->buf) - MAX_LINE)
+		macan_display_flush(d);
+	if (!d->started) {
+		d->base_ns = ts_ns;
+		d->started = true;
+	}
+
+	switch (cl ? cl->type : CL_NONE) {
+	case CL_TIME:
+		memcpy(&time, cf->data, 4);
+		if (cf->can_dlc == 4) {
+			color = ANSI_COLOR_LGRAY;
+			c = put_str(c, "time ");
+		} else if (cf->can_dlc == 8) {
+			color = ANSI_COLOR_DGRAY;
+			c = put_str(c, compact ? "atime " : "authenticated time ");
+		} else {
+			c = put_str(c, compact ? "time?" : "broken time!!!");
+			break;
+		}
+		c = put_uint(c, time, 0);
+		break;
+	case CL_ECU:
+		c = put_crypt(d, c, cf, (macan_ecuid)cl->index, compact, &color);
+		break;
+	case CL_SIG_NS:
+		c = put_str(c, compact ? "ns #" : "non-secure signal #");
+		c = put_uint(c, cl->index, 0);
+		break;
+	case CL_SIG_S:
+		c = put_str(c, compact ? "s #" : "secure signal #");
+		c = put_uint(c, cl->index, 0);
+		break;
+	}
+
+	p = d->buf + d->len;
+	if (d->flags & MACAN_DISPLAY_COLOR)
+		p = put_str(p, color);
+	ms = (ts_ns - d->base_ns) / 1000000;
+	p = put_uint(p, ms / 1000, compact ? 0 : 4);
+	*p++ = '.';
+	*p++ = (char)('0' + ms / 100 % 10);
+	*p++ = (char)('0' + ms / 10 % 10);
+	*p++ = (char)('0' + ms % 10);
+	*p++ = ' ';
+	start = p;
+	p = put_canframe(p, cf);
+	if (!compact)
+		while (p < start + 20)
+			*p++ = ' ';
+	*p++ = ' ';
+	p = put_mem(p, comment, (size_t)(c - comment));
+	if (d->flags & MACAN_DISPLAY_COLOR)
+		p = put_str(p, ANSI_COLOR_RESET);
+	*p++ = '\n';
+
+	d->len = (size_t)(p - d->buf);
+	d->stats.frames++;
+}
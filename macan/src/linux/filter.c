@@ -0,0 +1,703 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Display filters (see macan_filter.h) */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macan_filter.h"
+#include "macan_private.h"
+
+#define MAX_NODES	256	/* Comparisons and operators in an expression */
+#define MAX_IDS		128	/* CAN IDs derived for the kernel filter */
+
+enum field { F_ID, F_DLC, F_TYPE, F_FLAGS, F_SRC, F_DST, F_FWD, F_SIG, F_SEQ, F_PRESC, F_TIME, F_COUNT };
+
+enum frame_type {
+	T_OTHER, T_TIME, T_AUTHTIME, T_REQCHG, T_CHG, T_SKEY, T_ACK, T_SIG16,
+	T_AUTHREQ, T_NONSECURE, T_SECURE, T_COUNT
+};
+
+enum op { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_NOT, OP_JF, OP_JT };
+
+static const char *const field_names[F_COUNT] = {
+	"id", "dlc", "type", "flags", "src", "dst", "fwd", "sig", "seq", "presc", "time",
+};
+
+static const char *const type_names[T_COUNT] = {
+	"other", "time", "authtime", "reqchallenge", "challenge", "sesskey", "ack", "sig16",
+	"authreq", "nonsecure", "secure",
+};
+
+static const char *const op_names[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+/* Instruction. Comparisons set the accumulator, jumps test it. */
+struct insn {
+	uint8_t op;
+	uint8_t field;
+	uint16_t target;
+	uint32_t value;
+};
+
+enum id_class { CL_TIME, CL_ECU, CL_SIG_NS, CL_SIG_S };
+
+struct id_ent {
+	uint32_t can_id;
+	uint8_t type;		/* enum id_class */
+	uint16_t index;		/* ECU-ID or signal number */
+};
+
+struct macan_filter {
+	const struct macan_config *config;
+	struct insn *code;
+	unsigned len;
+	struct id_ent *ids;
+	unsigned id_count;
+	uint32_t can_ids[MAX_IDS];
+	int can_id_count;	/* -1 if any ID can match */
+};
+
+/* Compiler */
+
+enum node_kind { N_CMP, N_NOT, N_AND, N_OR };
+
+struct node {
+	uint8_t kind;
+	uint8_t field, op;
+	uint32_t value;
+	int l, r;
+};
+
+struct idset {
+	bool any;
+	unsigned n;
+	uint32_t id[MAX_IDS];
+};
+
+struct parser {
+	const struct macan_config *cfg;
+	const char *expr, *p;
+	char *err;
+	size_t err_size;
+	bool failed;
+	struct node node[MAX_NODES];
+	int n;
+};
+
+static void error(struct parser *ps, const char *msg)
+{
+	if (!ps->failed)
+		snprintf(ps->err, ps->err_size, "%s at offset %d", msg, (int)(ps->p - ps->expr));
+	ps->failed = true;
+}
+
+static int new_node(struct parser *ps, struct node n)
+{
+	if (ps->n == MAX_NODES) {
+		error(ps, "expression too long");
+		return -1;
+	}
+	ps->node[ps->n] = n;
+	return ps->n++;
+}
+
+static void skip_space(struct parser *ps)
+{
+	while (isspace((unsigned char)*ps->p))
+		ps->p++;
+}
+
+/* Consume the token tok if it follows */
+static bool accept(struct parser *ps, const char *tok)
+{
+	size_t len = strlen(tok);
+
+	skip_space(ps);
+	if (strncmp(ps->p, tok, len) != 0)
+		return false;
+	/* Word operators must not be a prefix of an identifier */
+	if (isalpha((unsigned char)tok[0]) && (isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_'))
+		return false;
+	ps->p += len;
+	return true;
+}
+
+static size_t ident(struct parser *ps, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	skip_space(ps);
+	while ((isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_') && len + 1 < size) {
+		buf[len] = ps->p[len];
+		len++;
+	}
+	buf[len] = 0;
+	if (len && isdigit((unsigned char)buf[0]))
+		return 0;
+	ps->p += len;
+	return len;
+}
+
+static int lookup(const char *const *names, unsigned count, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++)
+		if (strcmp(names[i], name) == 0)
+			return (int)i;
+	return -1;
+}
+
+static int ecu_by_name(const struct macan_config *cfg, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->node_count; i++)
+		if (cfg->canid->ecu[i].name && strcmp(cfg->canid->ecu[i].name, name) == 0)
+			return (int)i;
+	if (strcmp(name, "KS") == 0)
+		return cfg->key_server_id;
+	if (strcmp(name, "TS") == 0)
+		return cfg->time_server_id;
+	return -1;
+}
+
+static bool value(struct parser *ps, enum field field, uint32_t *v)
+{
+	char name[64], *end;
+	int i;
+
+	skip_space(ps);
+	if (isdigit((unsigned char)*ps->p)) {
+		*v = (uint32_t)strtoul(ps->p, &end, 0);
+		ps->p = end;
+		return true;
+	}
+	if (!ident(ps, name, sizeof(name))) {
+		error(ps, "value expected");
+		return false;
+	}
+	if (field == F_TYPE)
+		i = lookup(type_names, T_COUNT, name);
+	else if (field == F_SRC || field == F_DST || field == F_FWD)
+		i = ecu_by_name(ps->cfg, name);
+	else
+		i = -1;
+	if (i < 0) {
+		ps->p -= strlen(name);
+		error(ps, "unknown value");
+		return false;
+	}
+	*v = (uint32_t)i;
+	return true;
+}
+
+static int parse_or(struct parser *ps);
+
+static int parse_primary(struct parser *ps)
+{
+	const char *start;
+	char name[64];
+	int n, f;
+	unsigned i;
+
+	if (accept(ps, "(")) {
+		n = parse_or(ps);
+		if (n >= 0 && !accept(ps, ")")) {
+			error(ps, "')' expected");
+			return -1;
+		}
+		return n;
+	}
+	if (accept(ps, "!") || accept(ps, "not")) {
+		if ((n = parse_primary(ps)) < 0)
+			return -1;
+		return new_node(ps, (struct node){ .kind = N_NOT, .l = n });
+	}
+
+	start = ps->p;
+	if (!ident(ps, name, sizeof(name))) {
+		error(ps, "field or frame type expected");
+		return -1;
+	}
+	if ((f = lookup(field_names, F_COUNT, name)) >= 0) {
+		/* Two-character operators first */
+		static const uint8_t ops[] = { OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT };
+
+		for (i = 0; i < sizeof(ops) && !accept(ps, op_names[ops[i]]); i++);
+		if (i < sizeof(ops)) {
+			struct node cmp = { .kind = N_CMP, .field = (uint8_t)f, .op = ops[i] };
+			if (!value(ps, (enum field)f, &cmp.value))
+				return -1;
+			return new_node(ps, cmp);
+		}
+	}
+	if ((f = lookup(type_names, T_COUNT, name)) >= 0)
+		return new_node(ps, (struct node){ .kind = N_CMP, .field = F_TYPE, .op = OP_EQ,
+						   .value = (uint32_t)f });
+	ps->p = start;
+	error(ps, lookup(field_names, F_COUNT, name) >= 0 ?
+	      "comparison expected" : "unknown field or frame type");
+	return -1;
+}
+
+static int parse_and(struct parser *ps)
+{
+	int l = parse_primary(ps), r;
+
+	while (l >= 0 && (accept(ps, "&&") || accept(ps, "and"))) {
+		if ((r = parse_primary(ps)) < 0)
+			return -1;
+		l = new_node(ps, (struct node){ .kind = N_AND, .l = l, .r = r });
+	}
+	return l;
+}
+
+static int parse_or(struct parser *ps)
+{
+	int l = parse_and(ps), r;
+
+	while (l >= 0 && (accept(ps, "||") || accept(ps, "or"))) {
+		if ((r = parse_and(ps)) < 0)
+			return -1;
+		l = new_node(ps, (struct node){ .kind = N_OR, .l = l, .r = r });
+	}
+	return l;
+}
+
+static unsigned emit(const struct parser *ps, struct insn *code, unsigned pc, int n)
+{
+	const struct node *nd = &ps->node[n];
+	unsigned jump;
+
+	switch (nd->kind) {
+	case N_CMP:
+		code[pc++] = (struct insn){ .op = nd->op, .field = nd->field, .value = nd->value };
+		break;
+	case N_NOT:
+		pc = emit(ps, code, pc, nd->l);
+		code[pc++] = (struct insn){ .op = OP_NOT };
+		break;
+	case N_AND:
+	case N_OR:
+		pc = emit(ps, code, pc, nd->l);
+		jump = pc++;
+		pc = emit(ps, code, pc, nd->r);
+		code[jump] = (struct insn){ .op = nd->kind == N_AND ? OP_JF : OP_JT,
+					    .target = (uint16_t)pc };
+		break;
+	}
+	return pc;
+}
+
+/* CAN ID sets for the kernel filter */
+
+static void set_add(struct idset *s, uint32_t id)
+{
+	unsigned i;
+
+	if (s->any)
+		return;
+	for (i = 0; i < s->n; i++)
+		if (s->id[i] == id)
+			return;
+	if (s->n == MAX_IDS)
+		s->any = true;
+	else
+		s->id[s->n++] = id;
+}
+
+static void set_union(struct idset *s, const struct idset *a)
+{
+	unsigned i;
+
+	if (a->any)
+		s->any = true;
+	for (i = 0; i < a->n; i++)
+		set_add(s, a->id[i]);
+}
+
+static void set_intersect(struct idset *s, const struct idset *a, const struct idset *b)
+{
+	unsigned i, j;
+
+	if (a->any || b->any) {
+		*s = *(a->any ? b : a);
+		return;
+	}
+	s->any = false;
+	s->n = 0;
+	for (i = 0; i < a->n; i++)
+		for (j = 0; j < b->n; j++)
+			if (a->id[i] == b->id[j])
+				set_add(s, a->id[i]);
+}
+
+static void add_ecus(const struct macan_config *cfg, struct idset *s)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->node_count; i++)
+		set_add(s, cfg->canid->ecu[i].canid);
+}
+
+/* Add the IDs of signals, only those of ECU node (as source or
+ * destination) or signal sig if they are >= 0 */
+static void add_sigs(const struct macan_config *cfg, struct idset *s, bool ns, bool sec,
+		     int src, int dst, int sig)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->sig_count; i++) {
+		const struct macan_sig_spec *ss = &cfg->sigspec[i];
+		if ((src >= 0 && ss->src_id != src) || (dst >= 0 && ss->dst_id != dst) ||
+		    (sig >= 0 && (int)i != sig))
+			continue;
+		if (ns && ss->can_nsid)
+			set_add(s, ss->can_nsid);
+		if (sec && ss->can_sid)
+			set_add(s, ss->can_sid);
+	}
+}
+
+/* IDs of frames a comparison can be true for */
+static void cmp_ids(const struct macan_config *cfg, const struct node *nd, struct idset *s)
+{
+	bool eq = nd->op == OP_EQ;
+	int v = eq ? (int)nd->value : -1;
+
+	s->any = false;
+	s->n = 0;
+	switch (nd->field) {
+	case F_ID:
+		if (eq)
+			set_add(s, nd->value);
+		else
+			s->any = true;
+		break;
+	case F_TYPE:
+		switch (eq ? (int)nd->value : T_OTHER) {
+		case T_TIME:
+		case T_AUTHTIME:
+			set_add(s, cfg->canid->time);
+			break;
+		case T_SKEY:
+			set_add(s, cfg->canid->ecu[cfg->key_server_id].canid);
+			break;
+		case T_REQCHG:
+		case T_CHG:
+		case T_ACK:
+		case T_SIG16:
+		case T_AUTHREQ:
+			add_ecus(cfg, s);
+			break;
+		case T_NONSECURE:
+			add_sigs(cfg, s, true, false, -1, -1, -1);
+			break;
+		case T_SECURE:
+			add_sigs(cfg, s, false, true, -1, -1, -1);
+			break;
+		default:
+			s->any = true;
+		}
+		break;
+	case F_FLAGS:
+	case F_FWD:
+	case F_PRESC:
+		add_ecus(cfg, s);
+		break;
+	case F_SEQ:
+		set_add(s, cfg->canid->ecu[cfg->key_server_id].canid);
+		break;
+	case F_TIME:
+		set_add(s, cfg->canid->time);
+		break;
+	case F_SRC:
+		if (v < 0 || v < cfg->node_count) {
+			if (v < 0)
+				add_ecus(cfg, s);
+			else
+				set_add(s, cfg->canid->ecu[v].canid);
+		}
+		add_sigs(cfg, s, true, true, v, -1, -1);
+		if (v < 0 || v == cfg->time_server_id)
+			set_add(s, cfg->canid->time);
+		break;
+	case F_DST:
+		add_ecus(cfg, s);
+		add_sigs(cfg, s, true, true, -1, v, -1);
+		break;
+	case F_SIG:
+		add_ecus(cfg, s);
+		add_sigs(cfg, s, true, true, -1, -1, v);
+		break;
+	default:
+		s->any = true;
+	}
+}
+
+static void derive_can_ids(struct macan_filter *f, const struct parser *ps)
+{
+	struct idset *set = malloc((size_t)ps->n * sizeof(*set));
+	int i;
+
+	f->can_id_count = -1;
+	if (!set)
+		return;
+	/* Children are created before their parents */
+	for (i = 0; i < ps->n; i++) {
+		const struct node *nd = &ps->node[i];
+		switch (nd->kind) {
+		case N_CMP:
+			cmp_ids(f->config, nd, &set[i]);
+			break;
+		case N_NOT:
+			set[i] = (struct idset){ .any = true };
+			break;
+		case N_AND:
+			set_intersect(&set[i], &set[nd->l], &set[nd->r]);
+			break;
+		case N_OR:
+			set[i] = set[nd->l];
+			set_union(&set[i], &set[nd->r]);
+			break;
+		}
+	}
+	if (!set[ps->n - 1].any) {
+		f->can_id_count = (int)set[ps->n - 1].n;
+		memcpy(f->can_ids, set[ps->n - 1].id, set[ps->n - 1].n * sizeof(uint32_t));
+	}
+	free(set);
+}
+
+/* Classification of CAN IDs, with the precedence of print_frame() */
+
+static int cmp_id(const void *a, const void *b)
+{
+	const struct id_ent *x = a, *y = b;
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+static void classify(struct macan_filter *f, uint32_t can_id, enum id_class type, unsigned index)
+{
+	unsigned i;
+
+	for (i = 0; i < f->id_count; i++)
+		if (f->ids[i].can_id == can_id)
+			return;
+	f->ids[f->id_count++] = (struct id_ent){ can_id, (uint8_t)type, (uint16_t)index };
+}
+
+static const struct id_ent *find_id(const struct macan_filter *f, uint32_t can_id)
+{
+	unsigned lo = 0, hi = f->id_count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (f->ids[mid].can_id < can_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < f->id_count && f->ids[lo].can_id == can_id ? &f->ids[lo] : NULL;
+}
+
+/**
+ * Compile a filter expression.
+ *
+ * @return The filter or NULL with a message in err.
+ */
+struct macan_filter *macan_filter_compile(const struct macan_config *config, const char *expr,
+					  char *err, size_t err_size)
+{
+	struct parser *ps = calloc(1, sizeof(*ps));
+	struct macan_filter *f = calloc(1, sizeof(*f));
+	unsigned i;
+	int root;
+
+	if (!ps || !f) {
+		snprintf(err, err_size, "out of memory");
+		goto fail;
+	}
+	*ps = (struct parser){ .cfg = config, .expr = expr, .p = expr, .err = err, .err_size = err_size };
+	root = parse_or(ps);
+	skip_space(ps);
+	if (root >= 0 && *ps->p)
+		error(ps, "unexpected text");
+	if (ps->failed)
+		goto fail;
+
+	f->config = config;
+	f->code = calloc((size_t)ps->n, sizeof(*f->code));
+	f->ids = calloc(1U + config->node_count + 2U * config->sig_count, sizeof(*f->ids));
+	if (!f->code || !f->ids) {
+		snprintf(err, err_size, "out of memory");
+		goto fail;
+	}
+	f->len = emit(ps, f->code, 0, root);
+	derive_can_ids(f, ps);
+
+	classify(f, config->canid->time, CL_TIME, 0);
+	for (i = 0; i < config->node_count; i++)
+		classify(f, config->canid->ecu[i].canid, CL_ECU, i);
+	for (i = config->sig_count; i-- > 0; ) {
+		if (config->sigspec[i].can_nsid)
+			classify(f, config->sigspec[i].can_nsid, CL_SIG_NS, i);
+		if (config->sigspec[i].can_sid)
+			classify(f, config->sigspec[i].can_sid, CL_SIG_S, i);
+	}
+	qsort(f->ids, f->id_count, sizeof(*f->ids), cmp_id);
+	free(ps);
+	return f;
+fail:
+	free(ps);
+	if (f)
+		macan_filter_free(f);
+	return NULL;
+}
+
+void macan_filter_free(struct macan_filter *f)
+{
+	free(f->code);
+	free(f->ids);
+	free(f);
+}
+
+/**
+ * CAN IDs of the frames the filter can match.
+ *
+ * @return Number of IDs or -1 if frames with any ID can match.
+ */
+int macan_filter_can_ids(const struct macan_filter *f, const uint32_t **ids)
+{
+	*ids = f->can_ids;
+	return f->can_id_count;
+}
+
+#define SET(fld, val) (v[fld] = (val), present |= 1U << (fld))
+
+/* Decode the fields of a frame, return the mask of present fields */
+static unsigned decode(const struct macan_filter *f, const struct can_frame *cf, uint32_t v[F_COUNT])
+{
+	const struct macan_config *cfg = f->config;
+	const struct id_ent *id = find_id(f, cf->can_id);
+	unsigned present = 0;
+	uint32_t time;
+
+	SET(F_ID, cf->can_id & CAN_EFF_MASK);
+	SET(F_DLC, cf->can_dlc);
+	SET(F_TYPE, T_OTHER);
+	if (!id)
+		return present;
+
+	switch (id->type) {
+	case CL_TIME:
+		memcpy(&time, cf->data, 4);
+		if (cf->can_dlc == 4 || cf->can_dlc == 8) {
+			SET(F_TYPE, cf->can_dlc == 4 ? T_TIME : T_AUTHTIME);
+			SET(F_TIME, time);
+		}
+		SET(F_SRC, cfg->time_server_id);
+		break;
+	case CL_SIG_NS:
+	case CL_SIG_S:
+		SET(F_TYPE, id->type == CL_SIG_NS ? T_NONSECURE : T_SECURE);
+		SET(F_SIG, id->index);
+		SET(F_SRC, cfg->sigspec[id->index].src_id);
+		SET(F_DST, cfg->sigspec[id->index].dst_id);
+		break;
+	case CL_ECU:
+		SET(F_SRC, id->index);
+		if (cf->can_dlc < 2)
+			break;
+		SET(F_FLAGS, macan_crypt_flags(cf));
+		SET(F_DST, macan_crypt_dst(cf));
+		switch (macan_crypt_flags(cf)) {
+		case FL_REQ_CHALLENGE:
+			SET(F_TYPE, T_REQCHG);
+			SET(F_FWD, cf->data[1]);
+			break;
+		case FL_CHALLENGE:
+			SET(F_TYPE, T_CHG);
+			SET(F_FWD, cf->data[1]);
+			break;
+		case FL_SESS_KEY_OR_ACK:
+			if (id->index == cfg->key_server_id) {
+				SET(F_TYPE, T_SKEY);
+				SET(F_SEQ, cf->data[1] >> 4);
+			} else
+				SET(F_TYPE, T_ACK);
+			break;
+		case FL_SIGNAL_OR_AUTH_REQ:
+			SET(F_SIG, cf->data[1]);
+			if (cf->can_dlc == 8) {
+				SET(F_TYPE, T_SIG16);
+			} else {
+				SET(F_TYPE, T_AUTHREQ);
+				SET(F_PRESC, cf->data[2]);
+			}
+			break;
+		}
+		break;
+	}
+	return present;
+}
+
+bool macan_filter_match(const struct macan_filter *f, const struct can_frame *cf)
+{
+	uint32_t v[F_COUNT];
+	unsigned present = decode(f, cf, v), pc = 0;
+	bool acc = true;
+
+	while (pc < f->len) {
+		const struct insn *in = &f->code[pc++];
+		uint32_t x;
+
+		switch (in->op) {
+		case OP_JF:
+			if (!acc)
+				pc = in->target;
+			continue;
+		case OP_JT:
+			if (acc)
+				pc = in->target;
+			continue;
+		case OP_NOT:
+			acc = !acc;
+			continue;
+		}
+		if (!(present & (1U << in->field))) {
+			acc = false;
+			continue;
+		}
+		x = v[in->field];
+		switch (in->op) {
+		case OP_EQ: acc = x == in->value; break;
+		case OP_NE: acc = x != in->value; break;
+		case OP_LT: acc = x <  in->value; break;
+		case OP_LE: acc = x <= in->value; break;
+		case OP_GT: acc = x >  in->value; break;
+		case OP_GE: acc = x >= in->value; break;
+		}
+	}
+	return acc;
+}
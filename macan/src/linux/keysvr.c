@@ -40,7 +40,7 @@
 
 void print_help(char *argv0)
 {
-	fprintf(stderr, "Usage: %s -c <config_shlib> -k <ltk_lib> [-d <CAN interface>]\n", argv0);
+	fprintf(stderr, "Usage: %s -c <config_shlib> -k <ltk_lib> [-d <CAN interface>] [-p]\n", argv0);
 }
 
 int main(int argc, char *argv[])
@@ -51,9 +51,10 @@ int main(int argc, char *argv[])
 	static void *ltk_handle;
 	int i;
 	char *device = "can0";
+	bool predist = false;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "c:d:k:")) != -1) {
+	while ((opt = getopt(argc, argv, "c:d:k:p")) != -1) {
 		switch (opt) {
 		case 'c': {
 			void *handle = dlopen(optarg, RTLD_LAZY);
@@ -79,6 +80,9 @@ int main(int argc, char *argv[])
 			   exit(1);
 			}
 			break;
+		case 'p':
+			predist = true;
+			break;
 		default: /* '?' */
 			print_help(argv[0]);
 			exit(1);
@@ -118,6 +122,10 @@ int main(int argc, char *argv[])
 
 	macan_init_ks(macan_ctx, loop, s, ltks);
 	macan_ctx->print_msg_enabled = true;
+	if (predist && macan_ks_predistribute(macan_ctx) != 0) {
+		fprintf(stderr, "Cannot allocate key distribution state\n");
+		exit(1);
+	}
 
 	macan_ev_run(loop);
 
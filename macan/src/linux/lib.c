@@ -139,6 +139,7 @@ void sprint_canframe(char *buf , struct can_frame *cf, int sep, int maxdlen) {
 
 	int i,offset;
 	int len = (cf->can_dlc > maxdlen) ? maxdlen : cf->can_dlc;
+	const __u8 *data = cf->data; /* Up to 64 bytes of a CAN FD frame */
 
 	if (cf->can_id & CAN_ERR_FLAG) {
 		sprintf(buf, "%08X#", cf->can_id & (CAN_ERR_MASK|CAN_ERR_FLAG));
@@ -151,8 +152,14 @@ void sprint_canframe(char *buf , struct can_frame *cf, int sep, int maxdlen) {
 		offset = 4;
 	}
 
+	if (maxdlen == CANFD_MAX_DLEN) {
+		/* print CAN FD flags and separator */
+		sprintf(buf+offset, "#%X", ((struct canfd_frame *)cf)->flags & 0xF);
+		offset += 2;
+	}
+
 	/* standard CAN frames may have RTR enabled. There are no ERR frames with RTR */
-	if (cf->can_id & CAN_RTR_FLAG) {
+	if (maxdlen == CAN_MAX_DLEN && (cf->can_id & CAN_RTR_FLAG)) {
 
 		/* print a given CAN 2.0B DLC if it's not zero */
 		if (cf->can_dlc)
@@ -164,7 +171,7 @@ void sprint_canframe(char *buf , struct can_frame *cf, int sep, int maxdlen) {
 	}
 
 	for (i = 0; i < len; i++) {
-		sprintf(buf+offset, "%02X", cf->data[i]);
+		sprintf(buf+offset, "%02X", data[i]);
 		offset += 2;
 		if (sep && (i+1 < len))
 			sprintf(buf+offset++, ".");
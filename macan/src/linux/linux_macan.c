@@ -36,7 +36,10 @@
 #include <time.h>
 #include <unistd.h>
 #include <linux/can.h>
+#include <linux/can/raw.h>
+#include "macan_fault.h"
 #include "macan_private.h"
+#include "macan_vbus.h"
 
 /**
  * read_time() - returns time in microseconds
@@ -91,15 +94,27 @@ bool gen_rand_data(void *dest, size_t len)
 
 bool macan_read(struct macan_ctx *ctx, struct can_frame *cf)
 {
-#ifndef WITH_AFL
+#if defined(MACAN_EV_URING)
+	/* The frame was already received by the event loop */
+	if (!macan_ev_uring_read(ctx->loop, ctx->sockfd, cf))
+		return false;
+#elif !defined(WITH_AFL)
 	ssize_t rbyte;
+	/* With CAN FD, cf must have room for union macan_frame */
+	size_t mtu = ctx->config && macan_uses_canfd(ctx->config) ? CANFD_MTU : CAN_MTU;
 
-	rbyte = read(ctx->sockfd, cf, sizeof(struct can_frame));
+	if (macan_vbus_fd(ctx->sockfd))
+		rbyte = macan_vbus_read(ctx->sockfd, cf);
+	else
+		rbyte = read(ctx->sockfd, cf, mtu);
 	if (rbyte == -1 && errno == EAGAIN) {
 		return false;
 	}
 
-	if (rbyte != sizeof(*cf)) {
+	if (rbyte == CANFD_MTU && mtu == CANFD_MTU) {
+		/* Older kernels do not set CANFD_FDF */
+		((struct canfd_frame *)cf)->flags |= CANFD_FDF;
+	} else if (rbyte != CAN_MTU) {
 		perror("macan_read");
 		abort();
 	}
@@ -118,6 +133,12 @@ bool macan_read(struct macan_ctx *ctx, struct can_frame *cf)
 	return true;
 }
 
+/**
+ * Opens a CAN interface
+ *
+ * Names "vbus:<name>" and "shm:<name>" open a virtual bus in the process
+ * or in shared memory instead of a SocketCAN interface.
+ */
 int helper_init(const char *ifname)
 {
 	int s;
@@ -125,6 +146,20 @@ int helper_init(const char *ifname)
 	struct ifreq ifr;
 	struct sockaddr_can addr;
 
+	if (strncmp(ifname, "vbus:", 5) == 0 || strncmp(ifname, "shm:", 4) == 0) {
+		bool shared = ifname[0] == 's';
+#ifdef MACAN_EV_URING
+		fprintf(stderr, "%s: virtual buses are not supported with io_uring\n", ifname);
+		exit(1);
+#endif
+		s = macan_vbus_open(strchr(ifname, ':') + 1, shared ? MACAN_VBUS_SHARED : 0);
+		if (s < 0) {
+			perror(ifname);
+			exit(1);
+		}
+		return s;
+	}
+
 	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
 		perror("socket(PF_CAN, SOCK_RAW, CAN_RAW)");
 		exit(1);
@@ -158,16 +193,64 @@ int helper_init(const char *ifname)
 	return s;
 }
 
-bool macan_send(struct macan_ctx *ctx,  const struct can_frame *cf)
+enum macan_xmit_status macan_xmit(struct macan_ctx *ctx, const struct can_frame *cf)
 {
-	ssize_t ret = write(ctx->sockfd, cf, sizeof(*cf));
-	if (ret == -1)
-		perror("macan_send");
-	return (ret == sizeof(*cf));
+#ifdef MACAN_EV_URING
+	/* Submitted in a batch when the event loop waits next time. The
+	 * loop retries ENOBUFS itself and reports failures to the queue. */
+	return macan_ev_uring_send(ctx->loop, ctx->sockfd, cf, &ctx->txq.stats) ?
+		MACAN_XMIT_OK : MACAN_XMIT_BUSY;
+#else
+	ssize_t ret;
+	size_t size = macan_frame_size(cf);
+
+	if (macan_vbus_fd(ctx->sockfd))
+		ret = macan_vbus_write(ctx->sockfd, cf);
+	else
+		ret = write(ctx->sockfd, cf, size);
+	if (ret == (ssize_t)size)
+		return MACAN_XMIT_OK;
+	if (ret == -1 && errno == EAGAIN)
+		return MACAN_XMIT_BUSY;
+	/* The device queue is full, but the socket stays writable */
+	if (ret == -1 && errno == ENOBUFS)
+		return MACAN_XMIT_RETRY;
+	perror("macan_xmit");
+	return MACAN_XMIT_ERROR;
+#endif
 }
 
 void macan_target_init(struct macan_ctx *ctx)
 {
+	static struct macan_faults *faults;
+	const char *script = getenv("MACAN_FAULTS");
+
 	if (getenv("MACAN_DEBUG"))
 		ctx->print_msg_enabled = true;
+
+	if (macan_uses_canfd(ctx->config)) {
+		int on = 1;
+
+		if (macan_vbus_fd(ctx->sockfd))
+			macan_vbus_set_fd_frames(ctx->sockfd, true);
+		else if (setsockopt(ctx->sockfd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) < 0) {
+			perror("CAN_RAW_FD_FRAMES");
+			exit(1);
+		}
+	}
+
+	/* Fault rules for testing, e.g. MACAN_FAULTS="drop SESS_KEY seq 3" */
+	if (script) {
+		if (!faults) {
+			int line;
+
+			faults = macan_fault_alloc();
+			line = faults ? macan_fault_parse(faults, script) : -1;
+			if (line) {
+				fprintf(stderr, "MACAN_FAULTS: invalid rule %d\n", line);
+				exit(1);
+			}
+		}
+		macan_fault_attach(faults, ctx);
+	}
 }
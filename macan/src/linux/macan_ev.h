@@ -19,10 +19,20 @@
  *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef MACAN_SIM
+/* The simulation (libmacansim) runs the bare-metal event loop */
+#include "macan_evcore.h"
+#else
+
 #ifndef MACAN_EV_H
 #define MACAN_EV_H
 
+#ifdef MACAN_EV_URING
+#include "macan_ev_uring.h"
+#else
+
 #include <ev.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +40,7 @@ extern "C" {
 
 #define MACAN_EV_DEFAULT EV_DEFAULT
 #define MACAN_EV_READ	 EV_READ
+#define MACAN_EV_WRITE	 EV_WRITE
 
 typedef struct ev_loop  macan_ev_loop;
 typedef struct ev_io    macan_ev_can;
@@ -49,6 +60,12 @@ macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w)
 	ev_io_start(loop, w);
 }
 
+static inline void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w)
+{
+	ev_io_stop(loop, w);
+}
+
 static inline void
 macan_ev_timer_init(macan_ev_timer *ev,
 		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
@@ -69,14 +86,39 @@ macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w)
 	ev_timer_again(loop, w);
 }
 
+/* (Re)start the timer as one-shot, expiring after_us from now */
+static inline void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us)
+{
+	ev_timer_stop(loop, w);
+	ev_timer_set(w, (double)after_us/1000000.0, 0.);
+	ev_timer_start(loop, w);
+}
+
+static inline void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	ev_timer_stop(loop, w);
+}
+
 static inline bool
 macan_ev_run(macan_ev_loop *loop)
 {
 	return ev_run(loop, 0);
 }
 
+static inline void
+macan_ev_break(macan_ev_loop *loop)
+{
+	ev_break(loop, EVBREAK_ALL);
+}
+
 #ifdef __cplusplus
 }
 #endif
 
+#endif /* MACAN_EV_URING */
+
 #endif
+
+#endif /* MACAN_SIM */
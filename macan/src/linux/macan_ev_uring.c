@@ -0,0 +1,609 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* io_uring backend of the macan_ev API (see macan_ev_uring.h)
+ *
+ * The ring is driven by raw system calls so that no library besides
+ * libc is needed. Requires Linux 6.0 or newer (multishot receive with
+ * provided buffer rings).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/io_uring.h>
+
+#include "can_frame.h"
+#include "macan.h"
+
+#define RING_ENTRIES	256
+#define RXBUF_COUNT	256	/* Power of two */
+#define RXBUF_SIZE	CANFD_MTU
+#define RXBUF_GROUP	0
+#define TX_SLOTS	256	/* ~30 ms of a fully loaded 1 Mbit/s bus */
+#define TX_RETRY_US	500	/* Backoff of sends failed with ENOBUFS */
+
+/* Low bits of user_data tell what the completion belongs to */
+#define UD_RECV		0	/* Pointer to macan_ev_can */
+#define UD_SEND		1	/* TX slot index << 2 */
+#define UD_IGNORE	2
+#define UD_MASK		3
+
+struct tx_slot {
+	union macan_frame f;
+	int fd;
+	struct macan_tx_stats *stats; /* Of the TX queue the frame came from */
+};
+
+struct macan_ev_loop {
+	int fd;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_entries, sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf_ring *br;
+	uint16_t br_tail;
+	uint8_t *rxbufs;
+
+	struct tx_slot tx[TX_SLOTS];
+	uint16_t tx_free[TX_SLOTS];
+	unsigned tx_nfree;
+	uint16_t tx_retry[TX_SLOTS];	/* Slots to be sent again at tx_retry_at */
+	unsigned tx_nretry;
+	uint64_t tx_retry_at;
+
+	macan_ev_can *cans;
+	macan_ev_timer *timers;	/* Active timers sorted by expire_us */
+
+	int cur_fd;		/* Frame being passed to a read watcher */
+	const struct can_frame *cur_frame;
+
+	bool stop;
+	struct macan_ev_uring_stats stats;
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void fatal(const char *what)
+{
+	perror(what);
+	abort();
+}
+
+/* Ring setup */
+
+static void buf_recycle(macan_ev_loop *loop, uint16_t bid)
+{
+	struct io_uring_buf *b = &loop->br->bufs[loop->br_tail & (RXBUF_COUNT - 1)];
+
+	b->addr = (uint64_t)(uintptr_t)(loop->rxbufs + (size_t)bid * RXBUF_SIZE);
+	b->len = RXBUF_SIZE;
+	b->bid = bid;
+	loop->br_tail++;
+	__atomic_store_n(&loop->br->tail, loop->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_init(macan_ev_loop *loop)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	size_t sq_sz, cq_sz;
+	uint8_t *sq_ptr, *cq_ptr;
+	unsigned i;
+
+	memset(loop, 0, sizeof(*loop));
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	loop->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+	if (loop->fd < 0 && errno == EINVAL) {
+		/* Kernel older than 6.1 */
+		memset(&p, 0, sizeof(p));
+		loop->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+	}
+	if (loop->fd < 0)
+		fatal("io_uring_setup");
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		fprintf(stderr, "io_uring: kernel does not support wait timeouts\n");
+		abort();
+	}
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_sz > sq_sz)
+			sq_sz = cq_sz;
+		cq_sz = sq_sz;
+	}
+	sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      loop->fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		fatal("mmap(sq)");
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq_ptr = sq_ptr;
+	else {
+		cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			      loop->fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			fatal("mmap(cq)");
+	}
+	loop->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  loop->fd, IORING_OFF_SQES);
+	if (loop->sqes == MAP_FAILED)
+		fatal("mmap(sqes)");
+
+	loop->sq_head  = (unsigned *)(sq_ptr + p.sq_off.head);
+	loop->sq_tail  = (unsigned *)(sq_ptr + p.sq_off.tail);
+	loop->sq_mask  = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	loop->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	loop->sq_entries = p.sq_entries;
+	loop->sq_local_tail = *loop->sq_tail;
+	loop->cq_head  = (unsigned *)(cq_ptr + p.cq_off.head);
+	loop->cq_tail  = (unsigned *)(cq_ptr + p.cq_off.tail);
+	loop->cq_mask  = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+	loop->cqes     = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+	/* Provided buffers for multishot receives */
+	if (posix_memalign((void **)&loop->br, (size_t)sysconf(_SC_PAGESIZE),
+			   RXBUF_COUNT * sizeof(struct io_uring_buf)) != 0)
+		fatal("posix_memalign");
+	memset(loop->br, 0, RXBUF_COUNT * sizeof(struct io_uring_buf));
+	loop->rxbufs = malloc(RXBUF_COUNT * RXBUF_SIZE);
+	if (!loop->rxbufs)
+		fatal("malloc");
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)loop->br;
+	reg.ring_entries = RXBUF_COUNT;
+	reg.bgid = RXBUF_GROUP;
+	if (syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		fatal("io_uring_register(PBUF_RING)");
+	for (i = 0; i < RXBUF_COUNT; i++)
+		buf_recycle(loop, (uint16_t)i);
+
+	for (i = 0; i < TX_SLOTS; i++)
+		loop->tx_free[i] = (uint16_t)i;
+	loop->tx_nfree = TX_SLOTS;
+}
+
+macan_ev_loop *macan_ev_default_loop(void)
+{
+	static macan_ev_loop loop;
+	static bool initialized;
+
+	if (!initialized) {
+		uring_init(&loop);
+		initialized = true;
+	}
+	return &loop;
+}
+
+/* Submission and completion */
+
+static unsigned sq_pending(macan_ev_loop *loop)
+{
+	return loop->sq_local_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void enter(macan_ev_loop *loop, bool wait, uint64_t timeout_us)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned flags = 0;
+	long ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout_us != UINT64_MAX) {
+			ts.tv_sec = (long long)(timeout_us / 1000000);
+			ts.tv_nsec = (long long)(timeout_us % 1000000) * 1000;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+	ret = syscall(__NR_io_uring_enter, loop->fd, sq_pending(loop), wait ? 1 : 0,
+		      flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+	loop->stats.enters++;
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+		fatal("io_uring_enter");
+}
+
+static struct io_uring_sqe *get_sqe(macan_ev_loop *loop)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (sq_pending(loop) == loop->sq_entries) {
+		enter(loop, false, 0);
+		if (sq_pending(loop) == loop->sq_entries)
+			return NULL;
+	}
+	idx = loop->sq_local_tail & *loop->sq_mask;
+	sqe = &loop->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	loop->sq_array[idx] = idx;
+	loop->sq_local_tail++;
+	__atomic_store_n(loop->sq_tail, loop->sq_local_tail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+static void post_recv(macan_ev_loop *loop, macan_ev_can *w)
+{
+	struct io_uring_sqe *sqe = get_sqe(loop);
+
+	if (!sqe)
+		return;		/* Retried in the next iteration */
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = w->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RXBUF_GROUP;
+	sqe->user_data = (uint64_t)(uintptr_t)w | UD_RECV;
+	w->armed = true;
+}
+
+static bool post_send(macan_ev_loop *loop, unsigned slot)
+{
+	struct io_uring_sqe *sqe = get_sqe(loop);
+
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = loop->tx[slot].fd;
+	sqe->addr = (uint64_t)(uintptr_t)&loop->tx[slot].f;
+	sqe->len = (unsigned)macan_frame_size(&loop->tx[slot].f.cf);
+	sqe->user_data = (uint64_t)slot << 2 | UD_SEND;
+	return true;
+}
+
+static void complete_recv(macan_ev_loop *loop, macan_ev_can *w, int res, unsigned flags)
+{
+	if ((flags & IORING_CQE_F_BUFFER)) {
+		uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+		if (res >= (int)sizeof(struct can_frame) && w->active) {
+			struct canfd_frame *f = (struct canfd_frame *)(loop->rxbufs + (size_t)bid * RXBUF_SIZE);
+
+			/* Older kernels do not set CANFD_FDF */
+			if (res == CANFD_MTU)
+				f->flags |= CANFD_FDF;
+			loop->cur_fd = w->fd;
+			loop->cur_frame = (struct can_frame *)f;
+			loop->stats.rx_frames++;
+			w->cb(loop, w, MACAN_EV_READ);
+			loop->cur_frame = NULL;
+		}
+		buf_recycle(loop, bid);
+	}
+	if (!(flags & IORING_CQE_F_MORE)) {
+		w->armed = false;
+		/* Running out of buffers ends the multishot receive,
+		 * it is posted again in the next iteration */
+		if (res < 0 && res != -ENOBUFS && res != -ECANCELED && w->active) {
+			fprintf(stderr, "macan_ev: receive on fd %d: %s\n", w->fd, strerror(-res));
+			macan_ev_can_stop(loop, w);
+		}
+	}
+}
+
+/* Failed sends are reported to the TX queue, which counted the frame
+ * as sent when it was queued */
+static void complete_send(macan_ev_loop *loop, unsigned slot, int res)
+{
+	struct macan_tx_stats *stats = loop->tx[slot].stats;
+
+	if (res == -ENOBUFS || res == -EAGAIN) {
+		/* The socket stays writable while the device queue is
+		 * full, so a send posted again would fail at once */
+		if (!loop->tx_nretry)
+			loop->tx_retry_at = now_us() + TX_RETRY_US;
+		loop->tx_retry[loop->tx_nretry++] = (uint16_t)slot;
+		loop->stats.tx_retries++;
+		if (stats)
+			stats->retries++;
+		return;
+	}
+	if (res < 0) {
+		fprintf(stderr, "macan_xmit: %s\n", strerror(-res));
+		if (stats) {
+			stats->sent--;
+			stats->errors++;
+		}
+	}
+	loop->tx_free[loop->tx_nfree++] = (uint16_t)slot;
+}
+
+static void retry_sends(macan_ev_loop *loop)
+{
+	unsigned i, kept = 0;
+
+	if (!loop->tx_nretry || now_us() < loop->tx_retry_at)
+		return;
+	for (i = 0; i < loop->tx_nretry; i++)
+		if (!post_send(loop, loop->tx_retry[i]))
+			loop->tx_retry[kept++] = loop->tx_retry[i];
+	loop->tx_nretry = kept;
+	loop->tx_retry_at = now_us() + TX_RETRY_US;
+}
+
+static void process_cqes(macan_ev_loop *loop)
+{
+	unsigned head = *loop->cq_head;
+
+	while (head != __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &loop->cqes[head & *loop->cq_mask];
+		uint64_t ud = cqe->user_data;
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+
+		__atomic_store_n(loop->cq_head, ++head, __ATOMIC_RELEASE);
+
+		switch (ud & UD_MASK) {
+		case UD_RECV:
+			complete_recv(loop, (macan_ev_can *)(uintptr_t)ud, res, flags);
+			break;
+		case UD_SEND:
+			complete_send(loop, (unsigned)(ud >> 2), res);
+			break;
+		}
+	}
+}
+
+bool macan_ev_uring_read(macan_ev_loop *loop, int fd, struct can_frame *cf)
+{
+	if (!loop->cur_frame || loop->cur_fd != fd)
+		return false;
+	memcpy(cf, loop->cur_frame, macan_frame_size(loop->cur_frame));
+	loop->cur_frame = NULL;
+	return true;
+}
+
+/**
+ * Queue a frame for transmission. It is submitted together with
+ * other requests when the loop waits for events next time. Sends that
+ * fail later are counted in @a stats (may be NULL).
+ *
+ * @return false if there is no free transmit slot.
+ */
+bool macan_ev_uring_send(macan_ev_loop *loop, int fd, const struct can_frame *cf,
+			 struct macan_tx_stats *stats)
+{
+	unsigned slot;
+
+	if (loop->tx_nfree == 0)
+		return false;
+	slot = loop->tx_free[loop->tx_nfree - 1];
+	macan_frame_copy(&loop->tx[slot].f, cf);
+	loop->tx[slot].fd = fd;
+	loop->tx[slot].stats = stats;
+	if (!post_send(loop, slot))
+		return false;
+	loop->tx_nfree--;
+	loop->stats.tx_frames++;
+	return true;
+}
+
+void macan_ev_uring_get_stats(macan_ev_loop *loop, struct macan_ev_uring_stats *stats)
+{
+	*stats = loop->stats;
+}
+
+/* Watchers */
+
+void
+macan_ev_can_init(macan_ev_can *ev,
+		  void (*cb) (macan_ev_loop *loop,  macan_ev_can *w, int revents),
+		  int canfd, int events)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->cb = cb;
+	ev->fd = canfd;
+	ev->events = events;
+}
+
+void
+macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w)
+{
+	if (w->active)
+		return;
+	w->active = true;
+	w->next = loop->cans;
+	loop->cans = w;
+	if ((w->events & MACAN_EV_READ) && !w->armed)
+		post_recv(loop, w);
+}
+
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w)
+{
+	macan_ev_can **p;
+
+	if (!w->active)
+		return;
+	w->active = false;
+	for (p = &loop->cans; *p; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
+	}
+	if (w->armed) {
+		struct io_uring_sqe *sqe = get_sqe(loop);
+		if (sqe) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (uint64_t)(uintptr_t)w | UD_RECV;
+			sqe->user_data = UD_IGNORE;
+		}
+	}
+}
+
+static void timer_unlink(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	macan_ev_timer **p;
+
+	for (p = &loop->timers; *p; p = &(*p)->next) {
+		if (*p == w) {
+			*p = w->next;
+			break;
+		}
+	}
+	w->active = false;
+}
+
+static void timer_set(macan_ev_loop *loop, macan_ev_timer *w, uint64_t expire_us)
+{
+	macan_ev_timer **p;
+
+	if (w->active)
+		timer_unlink(loop, w);
+	w->expire_us = expire_us;
+	for (p = &loop->timers; *p && (*p)->expire_us <= expire_us; p = &(*p)->next);
+	w->next = *p;
+	*p = w;
+	w->active = true;
+}
+
+void
+macan_ev_timer_init(macan_ev_timer *ev,
+		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
+		    unsigned after_ms, unsigned repeat_ms)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->cb = cb;
+	ev->after_us = (uint64_t)after_ms * 1000;
+	ev->repeat_us = (uint64_t)repeat_ms * 1000;
+}
+
+void
+macan_ev_timer_start(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	timer_set(loop, w, now_us() + w->after_us);
+}
+
+void
+macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	if (w->repeat_us)
+		timer_set(loop, w, now_us() + w->repeat_us);
+	else
+		macan_ev_timer_stop(loop, w);
+}
+
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us)
+{
+	w->repeat_us = 0;
+	timer_set(loop, w, now_us() + after_us);
+}
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w)
+{
+	if (w->active)
+		timer_unlink(loop, w);
+}
+
+static void run_timers(macan_ev_loop *loop)
+{
+	uint64_t now = now_us();
+	macan_ev_timer *t;
+
+	while ((t = loop->timers) && t->expire_us <= now && !loop->stop) {
+		if (t->repeat_us) {
+			uint64_t next = t->expire_us + t->repeat_us;
+			timer_set(loop, t, next > now ? next : now + t->repeat_us);
+		} else
+			timer_unlink(loop, t);
+		t->cb(loop, t, MACAN_EV_TIMER);
+	}
+}
+
+static void run_writers(macan_ev_loop *loop)
+{
+	macan_ev_can *w, *next;
+
+	for (w = loop->cans; w && !loop->stop && loop->tx_nfree; w = next) {
+		next = w->next;
+		if (w->events & MACAN_EV_WRITE)
+			w->cb(loop, w, MACAN_EV_WRITE);
+	}
+}
+
+bool
+macan_ev_run(macan_ev_loop *loop)
+{
+	macan_ev_can *w;
+
+	loop->stop = false;
+	while (!loop->stop && (loop->cans || loop->timers || loop->tx_nretry)) {
+		uint64_t now, timeout = UINT64_MAX;
+
+		run_timers(loop);
+		if (loop->stop)
+			break;
+		retry_sends(loop);
+
+		for (w = loop->cans; w; w = w->next)
+			if ((w->events & MACAN_EV_READ) && !w->armed) {
+				post_recv(loop, w);
+				loop->stats.rx_rearms++;
+			}
+
+		now = now_us();
+		if (loop->timers)
+			timeout = loop->timers->expire_us > now ? loop->timers->expire_us - now : 0;
+		if (loop->tx_nretry) {
+			uint64_t t = loop->tx_retry_at > now ? loop->tx_retry_at - now : 0;
+
+			if (t < timeout)
+				timeout = t;
+		}
+		enter(loop, true, timeout);
+		process_cqes(loop);
+		run_writers(loop);
+	}
+	/* Do not leave queued frames unsent */
+	if (sq_pending(loop))
+		enter(loop, false, 0);
+	return true;
+}
+
+void
+macan_ev_break(macan_ev_loop *loop)
+{
+	loop->stop = true;
+}
@@ -0,0 +1,123 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* io_uring implementation of the macan_ev API
+ *
+ * Selected by defining MACAN_EV_URING and linking with libmacanuring
+ * instead of libmacan and libev. CAN sockets are read by multishot
+ * receives into a provided buffer ring, frames are transmitted by
+ * queueing send requests that are submitted in a batch with the next
+ * wait for completions. Timers are kept sorted and the wait for
+ * completions times out at the earliest one.
+ */
+
+#ifndef MACAN_EV_URING_H
+#define MACAN_EV_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MACAN_EV_DEFAULT macan_ev_default_loop()
+#define MACAN_EV_READ	 1
+#define MACAN_EV_WRITE	 2
+#define MACAN_EV_TIMER	 4
+
+struct can_frame;
+struct macan_tx_stats;
+typedef struct macan_ev_loop macan_ev_loop;
+
+typedef struct macan_ev_can {
+	void (*cb) (macan_ev_loop *loop,  struct macan_ev_can *w, int revents);
+	struct macan_ev_can *next;
+	int fd;
+	int events;
+	bool active;
+	bool armed;		/* Multishot receive is posted */
+	void *data;
+} macan_ev_can;
+
+typedef struct macan_ev_timer {
+	void (*cb) (macan_ev_loop *loop,  struct macan_ev_timer *w, int revents);
+	struct macan_ev_timer *next;
+	uint64_t after_us;
+	uint64_t repeat_us;
+	uint64_t expire_us;
+	bool active;
+	void *data;
+} macan_ev_timer;
+
+struct macan_ev_uring_stats {
+	uint64_t enters;	/* io_uring_enter() calls */
+	uint64_t rx_frames;	/* Frames received */
+	uint64_t tx_frames;	/* Frames submitted for transmission */
+	uint64_t tx_retries;	/* Transmissions repeated after ENOBUFS (with a backoff) */
+	uint64_t rx_rearms;	/* Multishot receives posted again */
+};
+
+macan_ev_loop *macan_ev_default_loop(void);
+
+void
+macan_ev_can_init(macan_ev_can *ev,
+		  void (*cb) (macan_ev_loop *loop,  macan_ev_can *w, int revents),
+		  int canfd, int events);
+void
+macan_ev_can_start(macan_ev_loop *loop, macan_ev_can *w);
+
+void
+macan_ev_can_stop(macan_ev_loop *loop, macan_ev_can *w);
+
+void
+macan_ev_timer_init(macan_ev_timer *ev,
+		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
+		    unsigned after_ms, unsigned repeat_ms);
+
+void
+macan_ev_timer_start(macan_ev_loop *loop, macan_ev_timer *w);
+
+void
+macan_ev_timer_again(macan_ev_loop *loop, macan_ev_timer *w);
+
+void
+macan_ev_timer_rearm(macan_ev_loop *loop, macan_ev_timer *w, uint64_t after_us);
+
+void
+macan_ev_timer_stop(macan_ev_loop *loop, macan_ev_timer *w);
+
+bool
+macan_ev_run(macan_ev_loop *loop);
+
+void
+macan_ev_break(macan_ev_loop *loop);
+
+/* Used by macan_read() and macan_xmit() */
+bool macan_ev_uring_read(macan_ev_loop *loop, int fd, struct can_frame *cf);
+bool macan_ev_uring_send(macan_ev_loop *loop, int fd, const struct can_frame *cf,
+			 struct macan_tx_stats *stats);
+
+void macan_ev_uring_get_stats(macan_ev_loop *loop, struct macan_ev_uring_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
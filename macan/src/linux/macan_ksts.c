@@ -45,7 +45,7 @@
 
 void print_help(char *argv0)
 {
-	fprintf(stderr, "Usage: %s -c <config_shlib> -k <ltk_lib> [-d <CAN interface>]\n", argv0);
+	fprintf(stderr, "Usage: %s -c <config_shlib> -k <ltk_lib> [-d <CAN interface>] [-p]\n", argv0);
 }
 
 int main(int argc, char *argv[])
@@ -55,9 +55,10 @@ int main(int argc, char *argv[])
 	static void *ltk_handle;
 	int i;
 	char *device = "can0";
+	bool predist = false;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "c:d:k:")) != -1) {
+	while ((opt = getopt(argc, argv, "c:d:k:p")) != -1) {
 		switch (opt) {
 		case 'c': {
 			void *handle = dlopen(optarg, RTLD_LAZY);
@@ -83,6 +84,9 @@ int main(int argc, char *argv[])
 			   exit(1);
 			}
 			break;
+		case 'p':
+			predist = true;
+			break;
 		default: /* '?' */
 			print_help(argv[0]);
 			exit(1);
@@ -141,6 +145,11 @@ int main(int argc, char *argv[])
 	macan_init_ts(ctx_ts, loop, s);
 	ctx_ts->print_msg_enabled = true;
 
+	if (predist && macan_ks_predistribute(ctx_ks) != 0) {
+		fprintf(stderr, "Cannot allocate key distribution state\n");
+		exit(1);
+	}
+
 
 	/**********************/
         /* Run the event loop */
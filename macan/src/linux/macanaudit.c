@@ -0,0 +1,343 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Offline verification of a capture file (candumpbin -o)
+ *
+ * The key distribution and time broadcasts are replayed first, in
+ * time order, from the frames of the protocol CAN IDs only. Then the
+ * capture is split into ranges of chunks, which are verified in
+ * parallel.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+
+#include "capfile.h"
+#include "macan_private.h"
+#include "macan_verify.h"
+
+#define NODE_COUNT 64
+#define JOBS 256
+
+struct worker {
+	pthread_t thread;
+	uint32_t from, to;	/* Chunk range */
+	struct macan_vreport rep;
+};
+
+static const struct macan_config *config;
+static struct capfile *cap;
+static struct macan_verifier *verifier;
+static bool print_alerts;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *ecu_name(uint8_t id)
+{
+	return id < config->node_count && config->canid->ecu[id].name ?
+		config->canid->ecu[id].name : "?";
+}
+
+static void rec2frame(const struct capfile_rec *r, struct can_frame *cf)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = r->can_id;
+	cf->can_dlc = r->can_dlc;
+	memcpy(cf->data, r->data, sizeof(cf->data));
+}
+
+static void alert_cb(void *arg, const struct macan_valert_info *a)
+{
+	(void)arg;
+	if (a->alert == MACAN_A_KEY_RENEWAL)
+		return;
+	printf("(%.6f) %s: id %x %s", (double)a->ts_ns / 1e9, macan_valert_name(a->alert),
+	       a->can_id, ecu_name(a->src));
+	if (a->dst != a->src)
+		printf("->%s", ecu_name(a->dst));
+	if (a->sig_num >= 0)
+		printf(" signal %d", a->sig_num);
+	if (a->delta)
+		printf(" delta %lld", (long long)a->delta);
+	printf("\n");
+}
+
+/* Replay the protocol frames in time order */
+static void track(struct macan_vreport *rep)
+{
+	struct capfile_iter *it = calloc(config->node_count + 1U, sizeof(*it));
+	const struct capfile_rec **next = calloc(config->node_count + 1U, sizeof(*next));
+	unsigned n = 0, i;
+
+	if (!it || !next) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i <= config->node_count; i++) {
+		uint32_t id = i < config->node_count ? config->canid->ecu[i].canid : config->canid->time;
+		capfile_iter_init_id(&it[n], cap, id, 0, UINT64_MAX);
+		if ((next[n] = capfile_next(&it[n])))
+			n++;
+	}
+	while (n) {
+		struct can_frame cf;
+		unsigned min = 0;
+
+		for (i = 1; i < n; i++)
+			if (next[i]->ts_ns < next[min]->ts_ns)
+				min = i;
+		rec2frame(next[min], &cf);
+		macan_verify_track(verifier, next[min]->ts_ns, &cf, rep);
+		if (!(next[min] = capfile_next(&it[min]))) {
+			n--;
+			it[min] = it[n];
+			next[min] = next[n];
+		}
+	}
+	free(it);
+	free(next);
+}
+
+static void *verify_chunks(void *arg)
+{
+	struct worker *w = arg;
+	struct macan_vjob *jobs = malloc(JOBS * sizeof(*jobs));
+	unsigned n = 0, i;
+	uint32_t c;
+
+	if (!jobs) {
+		perror("malloc");
+		exit(1);
+	}
+	for (c = w->from; c < w->to; c++) {
+		const struct capfile_rec *r = capfile_chunk_recs(cap, c);
+		uint32_t count = capfile_chunk(cap, c)->count, j;
+
+		for (j = 0; j < count; j++) {
+			struct can_frame cf;
+
+			rec2frame(&r[j], &cf);
+			if (macan_verify_prepare(verifier, r[j].ts_ns, &cf, &jobs[n], &w->rep) == MACAN_V_NONE)
+				continue;
+			if (++n == JOBS) {
+				macan_verify_batch(jobs, n);
+				for (i = 0; i < n; i++)
+					macan_verify_account(&jobs[i], &w->rep);
+				n = 0;
+			}
+		}
+	}
+	macan_verify_batch(jobs, n);
+	for (i = 0; i < n; i++)
+		macan_verify_account(&jobs[i], &w->rep);
+	free(jobs);
+	return NULL;
+}
+
+static void print_report(const struct macan_vreport *rep, double duration)
+{
+	static const char *const kinds[MACAN_V_KIND_COUNT] = {
+		[MACAN_V_SIG16] = "AUTH_SIG", [MACAN_V_SIG32] = "AUTH_SIG32",
+		[MACAN_V_ACK] = "ACK", [MACAN_V_AUTH_REQ] = "AUTH_REQ",
+	};
+	unsigned i, j;
+
+	printf("frames:           %llu (%.0f frames/s verified)\n",
+	       (unsigned long long)rep->frames, (double)rep->frames / duration);
+	printf("session keys:     %llu (%llu renewals, %llu bad, %llu replayed)\n",
+	       (unsigned long long)rep->keys,
+	       (unsigned long long)rep->alerts[MACAN_A_KEY_RENEWAL],
+	       (unsigned long long)rep->alerts[MACAN_A_BAD_SKEY],
+	       (unsigned long long)rep->alerts[MACAN_A_SKEY_REPLAY]);
+	printf("time:             %llu plain, %llu authenticated, %llu forged, %llu jumps\n",
+	       (unsigned long long)rep->time_plain, (unsigned long long)rep->time_auth_ok,
+	       (unsigned long long)rep->alerts[MACAN_A_FORGED_TIME],
+	       (unsigned long long)rep->alerts[MACAN_A_TIME_JUMP]);
+	for (i = MACAN_V_SIG16; i < MACAN_V_KIND_COUNT; i++) {
+		printf("%-11s      ", kinds[i]);
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++)
+			printf(" %8llu %s", (unsigned long long)rep->kind[i][j],
+			       macan_vresult_name((enum macan_vresult)j));
+		printf("\n");
+	}
+
+	printf("\nsignal src->dst         plain       ok    stale  invalid   no key  no time  req ok req bad\n");
+	for (i = 0; i < rep->sig_count; i++) {
+		const struct macan_vsig_stats *s = &rep->sig[i];
+		const struct macan_sig_spec *ss = &config->sigspec[i];
+		char pair[32];
+
+		snprintf(pair, sizeof(pair), "%s->%s", ecu_name(ss->src_id), ecu_name(ss->dst_id));
+		printf("%6u %-14s %8llu %8llu %8llu %8llu %8llu %8llu %7llu %7llu\n", i, pair,
+		       (unsigned long long)s->plain,
+		       (unsigned long long)s->result[MACAN_V_OK],
+		       (unsigned long long)s->result[MACAN_V_STALE],
+		       (unsigned long long)s->result[MACAN_V_INVALID],
+		       (unsigned long long)s->result[MACAN_V_NOKEY],
+		       (unsigned long long)s->result[MACAN_V_NOTIME],
+		       (unsigned long long)s->auth_req[MACAN_V_OK],
+		       (unsigned long long)(s->auth_req[MACAN_V_INVALID] + s->auth_req[MACAN_V_STALE]));
+	}
+}
+
+static void print_help(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s -c <config_shlib> -k <ltk_lib> [-j <threads>] [-a] <capture>\n"
+		"  -a  print every alert\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct macan_key *ltks[NODE_COUNT];
+	void *ltk_handle = NULL;
+	struct macan_vreport rep;
+	struct worker *workers;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t frames = 0, done = 0;
+	uint32_t chunks, c;
+	double start, t_track, t_verify;
+	char *error;
+	long i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ac:j:k:")) != -1) {
+		switch (opt) {
+		case 'a': print_alerts = true; break;
+		case 'c': {
+			void *handle = dlopen(optarg, RTLD_LAZY);
+			if (!handle) {
+				fprintf(stderr, "%s\n", dlerror());
+				exit(1);
+			}
+			config = dlsym(handle, "config");
+			break;
+		}
+		case 'j': threads = atol(optarg); break;
+		case 'k':
+			ltk_handle = dlopen(optarg, RTLD_LAZY);
+			if (!ltk_handle) {
+				fprintf(stderr, "%s\n", dlerror());
+				exit(1);
+			}
+			break;
+		default:
+			print_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!config || !ltk_handle || optind != argc - 1) {
+		print_help(argv[0]);
+		exit(1);
+	}
+	if (threads < 1)
+		threads = 1;
+
+	dlerror();
+	for (i = 0; i < config->node_count; i++) {
+		char node_id_str[30];
+
+		if (i == config->key_server_id)
+			continue;
+		sprintf(node_id_str, "macan_ltk_node%ld", i);
+		ltks[i] = dlsym(ltk_handle, node_id_str);
+		if ((error = dlerror()) != NULL) {
+			fprintf(stderr, "Unable to load ltk key for node #%ld\nReason: %s\n", i, error);
+			exit(1);
+		}
+	}
+
+	cap = capfile_open(argv[optind]);
+	if (!cap)
+		exit(1);
+	if (capfile_hdr(cap)->config_hash &&
+	    capfile_hdr(cap)->config_hash != capfile_config_hash(config))
+		fprintf(stderr, "Warning: capture was taken with a different configuration\n");
+	verifier = macan_verify_create(config, ltks);
+	if (!verifier || !macan_vreport_init(&rep, config)) {
+		perror("macan_verify_create");
+		exit(1);
+	}
+	if (print_alerts)
+		rep.alert_cb = alert_cb;
+
+	start = now();
+	track(&rep);
+	t_track = now() - start;
+
+	/* Split the chunks into ranges with similar frame counts */
+	chunks = capfile_chunks(cap);
+	for (c = 0; c < chunks; c++)
+		frames += capfile_chunk(cap, c)->count;
+	workers = calloc((size_t)threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0, c = 0; i < threads; i++) {
+		workers[i].from = c;
+		while (c < chunks && done < frames * (uint64_t)(i + 1) / (uint64_t)threads)
+			done += capfile_chunk(cap, c++)->count;
+		workers[i].to = c;
+		if (!macan_vreport_init(&workers[i].rep, config)) {
+			perror("calloc");
+			exit(1);
+		}
+		if (print_alerts)
+			workers[i].rep.alert_cb = alert_cb;
+	}
+
+	start = now();
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, verify_chunks, &workers[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		macan_vreport_merge(&rep, &workers[i].rep);
+		macan_vreport_free(&workers[i].rep);
+	}
+	t_verify = now() - start;
+
+	if (chunks)
+		printf("capture:          %.3f s in %u chunks\n",
+		       (double)(capfile_chunk(cap, chunks - 1)->last_ns - capfile_chunk(cap, 0)->first_ns) / 1e9,
+		       chunks);
+	printf("analysis:         %.3f s replay, %.3f s verification in %ld threads\n",
+	       t_track, t_verify, threads);
+	print_report(&rep, t_verify > 0 ? t_verify : 1e-9);
+
+	macan_vreport_free(&rep);
+	macan_verify_free(verifier);
+	free(workers);
+	capfile_free(cap);
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Print frames from an indexed capture file (candumpbin -o)
+ *
+ * Only the chunks covering the requested time range and containing
+ * the requested CAN IDs are read.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/can.h>
+
+#include "capfile.h"
+#include "lib.h"
+#include "macan_private.h"
+
+#define MAX_IDS 3
+
+static const struct capfile_header *hdr;
+
+static void print_rec(const struct capfile_rec *r)
+{
+	struct can_frame cf;
+	char buf[CL_CFSZ];
+
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = r->can_id;
+	cf.can_dlc = r->can_dlc;
+	memcpy(cf.data, r->data, sizeof(cf.data));
+	sprint_canframe(buf, &cf, 0, 8);
+	printf("(%llu.%06llu) %s %s\n",
+	       (unsigned long long)(r->ts_ns / 1000000000),
+	       (unsigned long long)(r->ts_ns % 1000000000 / 1000),
+	       r->ifidx < hdr->if_count ? hdr->ifname[r->ifidx] : "?", buf);
+}
+
+static void list_index(const struct capfile *cap)
+{
+	const struct capfile_id_ent *ids;
+	uint32_t n, i, chunks = capfile_chunks(cap);
+	uint64_t frames = 0;
+
+	for (i = 0; i < chunks; i++)
+		frames += capfile_chunk(cap, i)->count;
+	printf("config hash %016llx, %llu frames in %u chunks of %u bytes%s\n",
+	       (unsigned long long)hdr->config_hash, (unsigned long long)frames,
+	       chunks, hdr->chunk_size, hdr->index_offset ? "" : " (no index)");
+	if (chunks)
+		printf("time %.6f - %.6f s\n", (double)capfile_chunk(cap, 0)->first_ns / 1e9,
+		       (double)capfile_chunk(cap, chunks - 1)->last_ns / 1e9);
+	for (i = 0; i < hdr->if_count; i++)
+		printf("interface %u: %.*s\n", i, CAPFILE_IFNAMSIZ, hdr->ifname[i]);
+
+	ids = capfile_ids(cap, &n);
+	for (i = 0; i < n; i++)
+		printf("id %8x: %10u frames in %u chunks\n",
+		       ids[i].can_id, ids[i].frames, ids[i].chunk_count);
+}
+
+/* Frames of a signal are sent in its own CAN IDs or, as crypt frames,
+ * in the CAN ID of the sending ECU. */
+static bool signal_frame(const struct capfile_rec *r, uint32_t crypt_id, uint8_t sig_num)
+{
+	return r->can_id != crypt_id ||
+		(r->can_dlc >= 2 && (r->data[0] & 0xc0) >> 6 == FL_SIGNAL_OR_AUTH_REQ &&
+		 r->data[1] == sig_num);
+}
+
+static void print_help(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-l] [-f <from_s>] [-t <to_s>] [-i <can_id> | -s <signal> -c <config_shlib>] <capture>\n"
+		"  -l  list the index of the capture\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct macan_config *config = NULL;
+	struct capfile *cap;
+	struct capfile_iter it[MAX_IDS];
+	const struct capfile_rec *next[MAX_IDS];
+	uint32_t ids[MAX_IDS], crypt_id = 0;
+	unsigned nids = 0, i;
+	uint64_t from = 0, to = UINT64_MAX;
+	long sig = -1;
+	bool list = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:f:i:ls:t:")) != -1) {
+		switch (opt) {
+		case 'c': {
+			void *handle = dlopen(optarg, RTLD_LAZY);
+			config = handle ? dlsym(handle, "config") : NULL;
+			break;
+		}
+		case 'f': from = (uint64_t)(atof(optarg) * 1e9); break;
+		case 't': to = (uint64_t)(atof(optarg) * 1e9); break;
+		case 'i': ids[0] = (uint32_t)strtoul(optarg, NULL, 16); nids = 1; break;
+		case 'l': list = true; break;
+		case 's': sig = atol(optarg); break;
+		default:
+			print_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != argc - 1) {
+		print_help(argv[0]);
+		exit(1);
+	}
+
+	cap = capfile_open(argv[optind]);
+	if (!cap)
+		exit(1);
+	hdr = capfile_hdr(cap);
+
+	if (list) {
+		list_index(cap);
+		capfile_free(cap);
+		return 0;
+	}
+
+	if (sig >= 0) {
+		const struct macan_sig_spec *ss;
+
+		if (!config || sig >= config->sig_count) {
+			fprintf(stderr, "Signal %ld is not in the configuration\n", sig);
+			exit(1);
+		}
+		if (hdr->config_hash && hdr->config_hash != capfile_config_hash(config))
+			fprintf(stderr, "Warning: capture was taken with a different configuration\n");
+		ss = &config->sigspec[sig];
+		crypt_id = config->canid->ecu[ss->src_id].canid;
+		ids[0] = ss->can_nsid;
+		ids[1] = ss->can_sid;
+		ids[2] = crypt_id;
+		nids = 3;
+	}
+
+	if (nids == 0) {
+		struct capfile_iter all;
+		const struct capfile_rec *r;
+
+		capfile_iter_init(&all, cap, from, to);
+		while ((r = capfile_next(&all)))
+			print_rec(r);
+		capfile_free(cap);
+		return 0;
+	}
+
+	/* Merge the frames of all requested IDs by time */
+	for (i = 0; i < nids; i++) {
+		capfile_iter_init_id(&it[i], cap, ids[i], from, to);
+		next[i] = capfile_next(&it[i]);
+	}
+	while (1) {
+		unsigned min = MAX_IDS;
+
+		for (i = 0; i < nids; i++)
+			if (next[i] && (min == MAX_IDS || next[i]->ts_ns < next[min]->ts_ns))
+				min = i;
+		if (min == MAX_IDS)
+			break;
+		if (sig < 0 || signal_frame(next[min], crypt_id, (uint8_t)sig))
+			print_rec(next[min]);
+		next[min] = capfile_next(&it[min]);
+	}
+
+	capfile_free(cap);
+	return 0;
+}
@@ -23,6 +23,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <net/if.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -35,32 +36,417 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <time.h>
 
+#include "canring.h"
 #include "common.h"
 #include "helper.h"
+#include "macan_anomaly.h"
+#include "macan_busstat.h"
+#include "macan_display.h"
+#include "macan_filter.h"
 #include "macan_private.h"
+#include "macan_vbus.h"
+#include "macan_verify.h"
 
 #define NODE_COUNT 64
+#define VBATCH_JOBS 64		/* Jobs handed to a worker at once */
+#define VBATCHES 256		/* Batches in flight */
 
 static struct macan_ctx macan_ctx;
+static struct canring *ring;
+static bool quiet;
+static struct macan_display *display;
+static bool color = true;
+static struct macan_filter *filter;	/* -f */
+static struct macan_anomaly *anomaly;	/* -a */
+static struct macan_busstat *busstat;	/* -s, -S */
+static bool stats_table;		/* -s */
+static FILE *stats_json;		/* -S */
+
+/* Verification (-k): the main thread follows the key distribution
+ * and prepares jobs, workers check the CMACs */
+
+struct vbatch {
+	unsigned n;
+	struct macan_vjob jobs[VBATCH_JOBS];
+};
+
+struct vworker {
+	pthread_t thread;
+	pthread_mutex_t lock;	/* Protects rep */
+	struct macan_vreport rep;
+};
+
+static struct macan_verifier *verifier;
+static struct macan_vreport vrep;	/* Main thread */
+static struct vworker *vworkers;
+static unsigned vworker_count;
+static struct vbatch vbatches[VBATCHES];
+static struct vbatch *vcur;		/* Batch being filled */
+static const char *export_path;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t full_cond;
+	struct vbatch *full[VBATCHES], *free[VBATCHES];
+	unsigned full_head, full_count, free_count;
+} vq = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.full_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+print_alert(void *arg, const struct macan_valert_info *a)
+{
+	(void)arg;
+	char pair[64], sig[32] = "", delta[32] = "";
+
+	if (a->alert == MACAN_A_KEY_RENEWAL)
+		return;
+	if (a->src == a->dst)
+		snprintf(pair, sizeof(pair), "%s", macan_ecu_name(&macan_ctx, a->src));
+	else
+		snprintf(pair, sizeof(pair), "%s->%s", macan_ecu_name(&macan_ctx, a->src),
+			 macan_ecu_name(&macan_ctx, a->dst));
+	if (a->sig_num >= 0)
+		sprintf(sig, " signal #%d", a->sig_num);
+	if (a->delta)
+		sprintf(delta, " delta %lld", (long long)a->delta);
+	printf("%sALERT %s: id %03x %s%s%s%s\n", color ? ANSI_COLOR_RED : "",
+	       macan_valert_name(a->alert), a->can_id, pair, sig, delta, color ? ANSI_COLOR_RESET : "");
+	fflush(stdout);
+}
+
+static void
+print_anomaly(void *arg, const struct macan_anomaly_info *a)
+{
+	(void)arg;
+	char node[32] = "", sig[32] = "", rate[64] = "";
+
+	if (a->node >= 0)
+		snprintf(node, sizeof(node), " %s", macan_ecu_name(&macan_ctx, (macan_ecuid)a->node));
+	if (a->sig_num >= 0)
+		sprintf(sig, " signal #%d", a->sig_num);
+	if (a->type == MACAN_AN_RATE)
+		sprintf(rate, " interval %.3f ms, period %.3f ms",
+			(double)a->interval_ns / 1e6, (double)a->period_ns / 1e6);
+	if (display)
+		macan_display_flush(display);
+	printf("%sANOMALY %s: id %03x%s%s%s%s\n", color ? ANSI_COLOR_YELLOW : "",
+	       macan_anomaly_name(a->type), a->can_id, node, sig, rate, color ? ANSI_COLOR_RESET : "");
+	fflush(stdout);
+}
+
+static void *
+verify_worker(void *arg)
+{
+	struct vworker *w = arg;
+	struct vbatch *b;
+	unsigned i;
+
+	while (1) {
+		pthread_mutex_lock(&vq.lock);
+		while (vq.full_count == 0)
+			pthread_cond_wait(&vq.full_cond, &vq.lock);
+		b = vq.full[vq.full_head];
+		vq.full_head = (vq.full_head + 1) % VBATCHES;
+		vq.full_count--;
+		pthread_mutex_unlock(&vq.lock);
+
+		macan_verify_batch(b->jobs, b->n);
+		pthread_mutex_lock(&w->lock);
+		for (i = 0; i < b->n; i++)
+			macan_verify_account(&b->jobs[i], &w->rep);
+		pthread_mutex_unlock(&w->lock);
+
+		pthread_mutex_lock(&vq.lock);
+		vq.free[vq.free_count++] = b;
+		pthread_mutex_unlock(&vq.lock);
+	}
+	return NULL;
+}
+
+/* Hand the current batch over to the workers. When they do not keep
+ * up, the next batch is verified in this thread. */
+static void
+verify_flush(void)
+{
+	static struct vbatch own;
+	unsigned i;
+
+	if (vcur->n == 0)
+		return;
+
+	if (vcur == &own) {
+		macan_verify_batch(own.jobs, own.n);
+		for (i = 0; i < own.n; i++)
+			macan_verify_account(&own.jobs[i], &vrep);
+	}
+
+	pthread_mutex_lock(&vq.lock);
+	if (vcur != &own) {
+		vq.full[(vq.full_head + vq.full_count++) % VBATCHES] = vcur;
+		pthread_cond_signal(&vq.full_cond);
+	}
+	vcur = vq.free_count ? vq.free[--vq.free_count] : &own;
+	pthread_mutex_unlock(&vq.lock);
+	vcur->n = 0;
+}
+
+static void
+verify_frame(const struct can_frame *cf, uint64_t ts_ns)
+{
+	if (macan_verify_is_protocol_id(verifier, cf->can_id))
+		macan_verify_track(verifier, ts_ns, cf, &vrep);
+	if (macan_verify_prepare(verifier, ts_ns, cf, &vcur->jobs[vcur->n], &vrep) != MACAN_V_NONE &&
+	    ++vcur->n == VBATCH_JOBS)
+		verify_flush();
+}
+
+static void
+verify_start(const struct macan_config *config, const struct macan_key * const *ltks,
+	     unsigned workers)
+{
+	unsigned i;
+
+	verifier = macan_verify_create(config, ltks);
+	vworkers = calloc(workers, sizeof(*vworkers));
+	if (!verifier || !vworkers || !macan_vreport_init(&vrep, config)) {
+		perror("macan_verify_create");
+		exit(1);
+	}
+	vrep.alert_cb = print_alert;
+	for (i = 1; i < VBATCHES; i++)
+		vq.free[vq.free_count++] = &vbatches[i];
+	vcur = &vbatches[0];
+
+	for (i = 0; i < workers; i++) {
+		struct vworker *w = &vworkers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		if (!macan_vreport_init(&w->rep, config)) {
+			perror("calloc");
+			exit(1);
+		}
+		w->rep.alert_cb = print_alert;
+		if (pthread_create(&w->thread, NULL, verify_worker, w) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	vworker_count = workers;
+}
+
+/* Write the verification counters in the Prometheus text format */
+static void
+export_counters(const struct macan_vreport *rep)
+{
+	static const char *const kinds[MACAN_V_KIND_COUNT] = {
+		[MACAN_V_SIG16] = "auth_sig", [MACAN_V_SIG32] = "auth_sig32",
+		[MACAN_V_ACK] = "ack", [MACAN_V_AUTH_REQ] = "auth_req",
+	};
+	char tmp[PATH_MAX];
+	FILE *f;
+	unsigned i, j;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", export_path);
+	if (!(f = fopen(tmp, "w"))) {
+		perror(tmp);
+		return;
+	}
+	fprintf(f, "macan_frames_total %llu\n", (unsigned long long)rep->frames);
+	fprintf(f, "macan_session_keys_total %llu\n", (unsigned long long)rep->keys);
+	fprintf(f, "macan_time_plain_total %llu\n", (unsigned long long)rep->time_plain);
+	fprintf(f, "macan_time_auth_total %llu\n", (unsigned long long)rep->time_auth_ok);
+	for (i = 0; i < MACAN_A_COUNT; i++)
+		fprintf(f, "macan_alerts_total{alert=\"%s\"} %llu\n",
+			macan_valert_name((enum macan_valert)i), (unsigned long long)rep->alerts[i]);
+	for (i = MACAN_V_SIG16; i < MACAN_V_KIND_COUNT; i++)
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++)
+			fprintf(f, "macan_frames_verified_total{kind=\"%s\",result=\"%s\"} %llu\n",
+				kinds[i], macan_vresult_name((enum macan_vresult)j),
+				(unsigned long long)rep->kind[i][j]);
+	for (i = 0; i < rep->sig_count; i++) {
+		const struct macan_vsig_stats *s = &rep->sig[i];
+
+		fprintf(f, "macan_signal_frames_total{signal=\"%u\",result=\"plain\"} %llu\n",
+			i, (unsigned long long)s->plain);
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++)
+			fprintf(f, "macan_signal_frames_total{signal=\"%u\",result=\"%s\"} %llu\n",
+				i, macan_vresult_name((enum macan_vresult)j),
+				(unsigned long long)s->result[j]);
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++)
+			fprintf(f, "macan_signal_requests_total{signal=\"%u\",result=\"%s\"} %llu\n",
+				i, macan_vresult_name((enum macan_vresult)j),
+				(unsigned long long)s->auth_req[j]);
+	}
+	if (fclose(f) != 0 || rename(tmp, export_path) != 0)
+		perror(export_path);
+}
+
+static void
+verify_stats_cb (macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents; (void)w;
+	struct macan_vreport sum;
+	unsigned i;
+
+	verify_flush();
+	if (!export_path || !macan_vreport_init(&sum, macan_ctx.config))
+		return;
+	macan_vreport_merge(&sum, &vrep);
+	for (i = 0; i < vworker_count; i++) {
+		pthread_mutex_lock(&vworkers[i].lock);
+		macan_vreport_merge(&sum, &vworkers[i].rep);
+		pthread_mutex_unlock(&vworkers[i].lock);
+	}
+	export_counters(&sum);
+	macan_vreport_free(&sum);
+}
 
 static void
 print_frame_cb (macan_ev_loop *loop, macan_ev_can *w, int revents)
 {
 	(void)loop; (void)revents; (void)w; /* suppress warnings */
-	struct can_frame cf;
+	union macan_frame f;
+	uint64_t ts_ns = read_time() * 1000;	/* Once per batch */
+
+	while (macan_read(&macan_ctx, &f.cf)) {
+		if (busstat)	/* Jitter needs the time of each frame */
+			ts_ns = read_time() * 1000;
+		if (anomaly)
+			macan_anomaly_frame(anomaly, ts_ns, &f.cf);
+		if (verifier)
+			verify_frame(&f.cf, ts_ns);
+		if (filter && !macan_filter_match(filter, &f.cf))
+			continue;
+		if (display)
+			macan_display_frame(display, ts_ns, &f.cf);
+		if (busstat)
+			macan_busstat_frame(busstat, ts_ns, &f.cf);
+	}
+	if (verifier)
+		verify_flush();
+	if (display)
+		macan_display_flush(display);
+}
 
-	while (macan_read(&macan_ctx, &cf))
-		print_frame(&macan_ctx, &cf, "");
+static void
+ring_frame(void *arg, const struct can_frame *frame, uint64_t ts_ns, int ifindex)
+{
+	(void)arg; (void)ifindex;
+	struct can_frame cf = *frame;
+
+	if (anomaly)
+		macan_anomaly_frame(anomaly, ts_ns, &cf);
+	if (verifier)
+		verify_frame(&cf, ts_ns);
+	if (filter && !macan_filter_match(filter, &cf))
+		return;
+	if (display)
+		macan_display_frame(display, ts_ns, &cf);
+	if (busstat)
+		macan_busstat_frame(busstat, ts_ns, &cf);
+}
+
+static void
+ring_cb (macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	(void)loop; (void)revents; (void)w;
+
+	canring_process(ring, ring_frame, NULL);
+	if (verifier)
+		verify_flush();
+	if (display)
+		macan_display_flush(display);
+}
+
+static void
+ring_stats_cb (macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents; (void)w;
+	static uint64_t reported, reported_fd;
+	struct canring_stats st;
+
+	canring_get_stats(ring, &st);
+	if (st.drops != reported) {
+		fprintf(stderr, "macanmon: kernel dropped %llu of %llu frames\n",
+			(unsigned long long)st.drops, (unsigned long long)st.packets);
+		reported = st.drops;
+	}
+	if (st.fd_frames != reported_fd) {
+		fprintf(stderr, "macanmon: skipped %llu CAN FD frames\n",
+			(unsigned long long)st.fd_frames);
+		reported_fd = st.fd_frames;
+	}
+}
+
+/* Print the bus statistics of the last second. Frame times come from
+ * the kernel on the ring and from read_time() on the socket. */
+static void
+busstat_cb (macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents; (void)w;
+	uint64_t now_ns;
+
+	if (ring) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+	} else
+		now_ns = read_time() * 1000;
+	if (stats_table && isatty(STDOUT_FILENO))
+		fputs("\033[H\033[2J", stdout);
+	macan_busstat_report(busstat, now_ns, stats_table ? stdout : NULL, stats_json);
 }
 
+/* Let the kernel pass only frames the filter can match. The verifier,
+ * the anomaly detector and the bus statistics need all frames. Virtual
+ * buses have no kernel filter. */
+static void
+push_filter(int s)
+{
+	static struct can_filter kf[CANRING_MAX_IDS];
+	const uint32_t *ids;
+	int i, n = macan_filter_can_ids(filter, &ids);
 
+	if (n < 0 || n > CANRING_MAX_IDS || verifier || anomaly || busstat ||
+	    macan_vbus_fd(s))
+		return;
+	if (ring) {
+		canring_set_ids(ring, ids, (unsigned)n);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (ids[i] > CAN_SFF_MASK)
+			kf[i] = (struct can_filter){ ids[i] | CAN_EFF_FLAG, CAN_EFF_FLAG | CAN_EFF_MASK };
+		else
+			kf[i] = (struct can_filter){ ids[i], CAN_EFF_FLAG | CAN_SFF_MASK };
+	}
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, kf, (socklen_t)((size_t)n * sizeof(kf[0]))) != 0)
+		perror("CAN_RAW_FILTER");
+}
 
 void print_help(char *argv0)
 {
-	fprintf(stderr, "Usage: %s -c <config_shlib>\n", argv0);
+	fprintf(stderr, "Usage: %s -c <config_shlib> [-d <CAN interface>] [-m] [-a] [-k <ltk_lib> [-j <workers>] [-e <file>]] [-q | -C | -s] [-n] [-f <filter>] [-b <bitrate>] [-S <file>]\n"
+		"  -m  capture through a memory mapped ring (-d any captures all interfaces)\n"
+		"  -a  detect rate and sequence anomalies\n"
+		"  -k  verify authenticated frames with the long term keys of all nodes\n"
+		"  -j  number of verification threads\n"
+		"  -e  export verification counters to a file every second\n"
+		"  -q  print alerts and anomalies only\n"
+		"  -C  compact output\n"
+		"  -n  no colours\n"
+		"  -f  display only frames matching the filter expression\n"
+		"  -s  print bus load and statistics per CAN ID every second instead of frames\n"
+		"  -b  bus bitrate for the load statistics (default 500000)\n"
+		"  -S  append statistics snapshots as JSON lines to a file\n",
+		argv0);
 }
 
 int main(int argc, char *argv[])
@@ -71,20 +457,74 @@ int main(int argc, char *argv[])
 		.node_id = 0xff, /* Invalid node ID - passive apps do not need a valid id */
 	};
 
+	const char *ifname = "can0";
+	bool use_ring = false;
+	void *ltk_handle = NULL;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	bool detect = false;
+	const char *filter_expr = NULL;
+	unsigned display_flags = MACAN_DISPLAY_COLOR;
+	unsigned bitrate = 500000;
+	const char *json_path = NULL;
+
 	int opt;
-	while ((opt = getopt(argc, argv, "c:")) != -1) {
+	while ((opt = getopt(argc, argv, "aCb:c:d:e:f:j:k:mnqsS:")) != -1) {
 		switch (opt) {
+		case 'a':
+			detect = true;
+			break;
+		case 'C':
+			display_flags |= MACAN_DISPLAY_COMPACT;
+			break;
+		case 'b':
+			bitrate = (unsigned)atol(optarg);
+			break;
 		case 'c': {
 			void *handle = dlopen(optarg, RTLD_LAZY);
 			config = dlsym(handle, "config");
 			break;
 		}
+		case 'd':
+			ifname = optarg;
+			break;
+		case 'e':
+			export_path = optarg;
+			break;
+		case 'f':
+			filter_expr = optarg;
+			break;
+		case 'j':
+			workers = atol(optarg);
+			break;
+		case 'k':
+			ltk_handle = dlopen(optarg, RTLD_LAZY);
+			if (!ltk_handle) {
+				fprintf(stderr, "%s\n", dlerror());
+				exit(1);
+			}
+			break;
+		case 'm':
+			use_ring = true;
+			break;
+		case 'n':
+			display_flags &= ~MACAN_DISPLAY_COLOR;
+			color = false;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 's':
+			stats_table = true;
+			break;
+		case 'S':
+			json_path = optarg;
+			break;
 		default: /* '?' */
 			print_help(argv[0]);
 			exit(1);
 		}
 	}
-	if (!config) {
+	if (!config || bitrate == 0) {
 		print_help(argv[0]);
 		exit(1);
 	}
@@ -92,17 +532,92 @@ int main(int argc, char *argv[])
 	srand((unsigned)time(NULL));
 
 	macan_ev_can can_watcher;
+	macan_ev_timer stats_timer, verify_timer, busstat_timer;
 	macan_ev_loop *loop = MACAN_EV_DEFAULT;
 
-	s = helper_init("can0");
-
-	macan_ctx.sockfd = s;
 	macan_ctx.config = config;
 	macan_ctx.node = &node;
 	macan_ctx.loop = loop;
 
-	macan_ev_canrx_setup (&macan_ctx, &can_watcher, print_frame_cb);
-	macan_ev_can_start (loop, &can_watcher);
+	if (filter_expr) {
+		char err[128];
+
+		filter = macan_filter_compile(config, filter_expr, err, sizeof(err));
+		if (!filter) {
+			fprintf(stderr, "Filter: %s\n", err);
+			exit(1);
+		}
+	}
+
+	if (json_path && !(stats_json = fopen(json_path, "a"))) {
+		perror(json_path);
+		exit(1);
+	}
+	if (stats_table || stats_json) {
+		busstat = macan_busstat_create(config, bitrate);
+		if (!busstat) {
+			perror("macan_busstat_create");
+			exit(1);
+		}
+		macan_ev_timer_setup(&macan_ctx, &busstat_timer, busstat_cb, 1000, 1000);
+	}
+
+	if (!quiet && !stats_table) {
+		display = macan_display_create(&macan_ctx, STDOUT_FILENO, display_flags);
+		if (!display) {
+			perror("macan_display_create");
+			exit(1);
+		}
+	}
+
+	if (detect) {
+		anomaly = macan_anomaly_create(config, print_anomaly, NULL);
+		if (!anomaly) {
+			perror("macan_anomaly_create");
+			exit(1);
+		}
+	}
+
+	if (ltk_handle) {
+		static const struct macan_key *ltks[NODE_COUNT];
+		char *error;
+		int i;
+
+		dlerror();
+		for (i = 0; i < config->node_count; i++) {
+			char node_id_str[30];
+
+			if (i == config->key_server_id)
+				continue;
+			sprintf(node_id_str, "macan_ltk_node%d", i);
+			ltks[i] = dlsym(ltk_handle, node_id_str);
+			if ((error = dlerror()) != NULL) {
+				fprintf(stderr, "Unable to load ltk key for node #%d from shared library\nReason: %s\n",
+					i, error);
+				exit(1);
+			}
+		}
+		verify_start(config, ltks, workers < 1 ? 1 : (unsigned)workers);
+		macan_ev_timer_setup(&macan_ctx, &verify_timer, verify_stats_cb, 1000, 1000);
+	}
+
+	if (use_ring) {
+		ring = canring_open(ifname);
+		if (!ring)
+			exit(1);
+		if (filter)
+			push_filter(-1);
+		macan_ev_can_init(&can_watcher, ring_cb, canring_fd(ring), MACAN_EV_READ);
+		macan_ev_can_start(loop, &can_watcher);
+		macan_ev_timer_setup(&macan_ctx, &stats_timer, ring_stats_cb, 1000, 1000);
+	} else {
+		s = helper_init(ifname);
+		macan_ctx.sockfd = s;
+		if (filter)
+			push_filter(s);
+		macan_ev_canrx_setup (&macan_ctx, &can_watcher, print_frame_cb);
+		macan_ev_can_start (loop, &can_watcher);
+	}
 
 	macan_ev_run(loop);
 
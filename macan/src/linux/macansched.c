@@ -0,0 +1,148 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bus utilisation, response times and CMAC time windows of a
+ * configuration before it is deployed
+ *
+ * The signal periods are read from a file with lines
+ *
+ *   <signal> <period ms> [<deadline ms> [<jitter ms>]]
+ *
+ * Empty lines and lines starting with # are ignored. Signals not
+ * listed use the -P period or are not analysed.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "macan_sched.h"
+
+static const struct macan_config *config;
+
+static uint64_t ms2ns(double ms)
+{
+	return (uint64_t)(ms * 1e6 + 0.5);
+}
+
+static bool read_periods(const char *path, struct macan_sched_sig *sigs)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+	unsigned lineno = 0;
+
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		double period, deadline = 0, jitter = 0;
+		unsigned sig;
+		char *p = line + strspn(line, " \t");
+
+		lineno++;
+		if (*p == '#' || *p == '\n' || *p == '\0')
+			continue;
+		if (sscanf(p, "%u %lf %lf %lf", &sig, &period, &deadline, &jitter) < 2 ||
+		    sig >= config->sig_count || period <= 0 || deadline < 0 || jitter < 0) {
+			fprintf(stderr, "%s:%u: invalid line\n", path, lineno);
+			fclose(f);
+			return false;
+		}
+		sigs[sig].period = ms2ns(period);
+		sigs[sig].deadline = ms2ns(deadline);
+		sigs[sig].jitter = ms2ns(jitter);
+	}
+	fclose(f);
+	return true;
+}
+
+static void print_help(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s -c <config_shlib> [-p <periods>] [-P <period ms>] [-b <bitrate>] [-s <skew ms>]\n"
+		"  -p  file with signal periods, deadlines and jitter\n"
+		"  -P  period of signals not in the file\n"
+		"  -b  bus bitrate (default 500000)\n"
+		"  -s  maximum clock difference of two nodes (default 2 * time_delta)\n"
+		"Exits with 2 when a deadline can be missed.\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct macan_sched_sig *sigs;
+	struct macan_sched *s;
+	const char *periods = NULL;
+	double def_period = 0, skew_ms = -1;
+	unsigned bitrate = 500000, i, sent = 0;
+	uint64_t skew;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:c:p:P:s:")) != -1) {
+		switch (opt) {
+		case 'b': bitrate = (unsigned)atol(optarg); break;
+		case 'c': {
+			void *handle = dlopen(optarg, RTLD_LAZY);
+			if (!handle) {
+				fprintf(stderr, "%s\n", dlerror());
+				exit(1);
+			}
+			config = dlsym(handle, "config");
+			break;
+		}
+		case 'p': periods = optarg; break;
+		case 'P': def_period = atof(optarg); break;
+		case 's': skew_ms = atof(optarg); break;
+		default:
+			print_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!config || bitrate == 0 || optind != argc) {
+		print_help(argv[0]);
+		exit(1);
+	}
+
+	sigs = calloc(config->sig_count ? config->sig_count : 1, sizeof(*sigs));
+	if (!sigs) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < config->sig_count; i++)
+		sigs[i].period = ms2ns(def_period);
+	if (periods && !read_periods(periods, sigs))
+		exit(1);
+	for (i = 0; i < config->sig_count; i++)
+		if (sigs[i].period)
+			sent++;
+	if (sent < config->sig_count)
+		fprintf(stderr, "Warning: %u of %u signals have no period and are not analysed\n",
+			config->sig_count - sent, config->sig_count);
+
+	s = macan_sched_create(config, sigs, bitrate);
+	if (!s) {
+		perror("macan_sched_create");
+		exit(1);
+	}
+	skew = skew_ms >= 0 ? ms2ns(skew_ms) : 2000ULL * config->time_delta;
+	macan_sched_analyse(s);
+	macan_sched_print(s, stdout, skew);
+	return s->misses ? 2 : 0;
+}
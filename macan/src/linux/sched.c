@@ -0,0 +1,406 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Schedulability analysis (see macan_sched.h) */
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/can.h>
+
+#include "macan_sched.h"
+
+#define SKEY_FRAMES	13	/* 2 x 6 SESS_KEY and a REQ_CHALLENGE */
+#define LIMIT_NS	1000000000000ULL
+#define MAX_ITER	100000
+
+static const char *const kind_names[MACAN_SM_KIND_COUNT] = {
+	[MACAN_SM_SIGNAL] = "SIGNAL",
+	[MACAN_SM_AUTH_SIG] = "AUTH_SIG",
+	[MACAN_SM_AUTH_SIG32] = "AUTH_SIG32",
+	[MACAN_SM_TIME] = "TIME",
+	[MACAN_SM_SESS_KEY] = "SESS_KEY",
+};
+
+const char *macan_smsg_kind_name(enum macan_smsg_kind kind)
+{
+	return (unsigned)kind < MACAN_SM_KIND_COUNT ? kind_names[kind] : "?";
+}
+
+static uint64_t div_up(uint64_t a, uint64_t b)
+{
+	return (a + b - 1) / b;
+}
+
+static bool is_ext(uint32_t can_id)
+{
+	return (can_id & CAN_EFF_FLAG) || (can_id & CAN_EFF_MASK) > CAN_SFF_MASK;
+}
+
+/* Arbitration order, lower wins. A standard frame wins over an
+ * extended one with the same base ID (RTR vs. SRR). */
+static uint64_t prio(uint32_t can_id)
+{
+	uint32_t id = can_id & CAN_EFF_MASK;
+
+	if (!is_ext(can_id))
+		return (uint64_t)id << 19;
+	return (uint64_t)(id >> 18) << 19 | 1U << 18 | (id & 0x3ffff);
+}
+
+/**
+ * Worst case transmission time of a data frame including stuff bits.
+ */
+uint64_t macan_sched_frame_time(const struct macan_sched *s, uint32_t can_id, unsigned dlc)
+{
+	uint64_t bits = macan_frame_bits_max(is_ext(can_id) ? can_id | CAN_EFF_FLAG : can_id, dlc);
+
+	return div_up(bits * 1000000000ULL, s->bitrate);
+}
+
+static struct macan_smsg *add(struct macan_sched *s, uint32_t can_id, enum macan_smsg_kind kind,
+			      unsigned dlc, uint64_t period, uint64_t deadline)
+{
+	struct macan_smsg *m = &s->msg[s->count++];
+
+	memset(m, 0, sizeof(*m));
+	m->can_id = can_id;
+	m->kind = kind;
+	m->sig_num = -1;
+	m->frames = 1;
+	m->period = period;
+	m->deadline = deadline ? deadline : period;
+	m->c = macan_sched_frame_time(s, can_id, dlc);
+	m->util = (double)m->c / (double)period;
+	return m;
+}
+
+static int cmp_msg(const void *a, const void *b)
+{
+	const struct macan_smsg *x = a, *y = b;
+	uint64_t px = prio(x->can_id), py = prio(y->can_id);
+
+	if (px != py)
+		return px < py ? -1 : 1;
+	if (x->sig_num != y->sig_num)
+		return x->sig_num < y->sig_num ? -1 : 1;
+	return x->kind < y->kind ? -1 : x->kind > y->kind;
+}
+
+/**
+ * Derive the frames of a configuration.
+ *
+ * @param sigs     Timing of each of config->sig_count signals
+ * @param bitrate  Bus bitrate (bit/s)
+ */
+struct macan_sched *macan_sched_create(const struct macan_config *config,
+				       const struct macan_sched_sig *sigs, unsigned bitrate)
+{
+	struct macan_sched *s = calloc(1, sizeof(*s));
+	unsigned n = config->node_count, i, j;
+	bool *pair = calloc((size_t)n * n, sizeof(*pair));
+
+	if (!s || !pair || !(s->msg = calloc(2 * config->sig_count + 1 + (size_t)n * n, sizeof(*s->msg)))) {
+		free(pair);
+		macan_sched_free(s);
+		return NULL;
+	}
+	s->config = config;
+	s->bitrate = bitrate;
+
+	for (i = 0; i < config->sig_count; i++) {
+		const struct macan_sig_spec *spec = &config->sigspec[i];
+		const struct macan_sched_sig *t = &sigs[i];
+		unsigned p = spec->presc ? spec->presc : 1;
+		struct macan_smsg *m;
+		uint32_t plain_id = spec->can_nsid;
+
+		if (!t->period)
+			continue;
+		/* The signed value is due within the signal's deadline */
+		if (spec->can_sid)
+			m = add(s, spec->can_sid, MACAN_SM_AUTH_SIG32, 8,
+				p * t->period, t->deadline ? t->deadline : t->period);
+		else
+			m = add(s, config->canid->ecu[spec->src_id].canid, MACAN_SM_AUTH_SIG, 8,
+				p * t->period, t->deadline ? t->deadline : t->period);
+		m->sig_num = (int)i;
+		m->presc = p;
+		m->jitter = t->jitter;
+		if (p > 1 && spec->can_nsid) {
+			m = add(s, spec->can_nsid, MACAN_SM_SIGNAL, 4, t->period, t->deadline);
+			m->sig_num = (int)i;
+			m->presc = p;
+			m->jitter = t->jitter;
+			m->util = m->util * (p - 1) / p;
+		}
+		if (!plain_id)
+			plain_id = spec->can_sid ? spec->can_sid : config->canid->ecu[spec->src_id].canid;
+		s->util_plain += (double)macan_sched_frame_time(s, plain_id, 4) / (double)t->period;
+
+		/* Session keys needed by the signal */
+		if (spec->src_id < n && spec->dst_id < n) {
+			pair[spec->src_id * n + spec->dst_id] = true;
+			pair[spec->src_id * n + config->time_server_id] = true;
+			pair[spec->dst_id * n + config->time_server_id] = true;
+		}
+	}
+
+	if (config->time_div)
+		add(s, config->canid->time, MACAN_SM_TIME, 4, config->time_div * 1000ULL, 0);
+
+	for (i = 0; i < n && config->skey_validity; i++) {
+		for (j = i + 1; j < n; j++) {
+			struct macan_smsg *m;
+
+			if ((!pair[i * n + j] && !pair[j * n + i]) ||
+			    i == config->key_server_id || j == config->key_server_id)
+				continue;
+			m = add(s, config->canid->ecu[config->key_server_id].canid, MACAN_SM_SESS_KEY, 8,
+				config->skey_validity * 1000, config->skey_chg_timeout * 1000ULL);
+			m->frames = SKEY_FRAMES;
+			m->util *= SKEY_FRAMES;
+		}
+	}
+	free(pair);
+
+	qsort(s->msg, s->count, sizeof(*s->msg), cmp_msg);
+	for (i = 0; i < s->count; i++) {
+		s->util[s->msg[i].kind] += s->msg[i].util;
+		s->util_total += s->msg[i].util;
+	}
+	return s;
+}
+
+void macan_sched_free(struct macan_sched *s)
+{
+	if (!s)
+		return;
+	free(s->msg);
+	free(s);
+}
+
+/* The other message of the same signal, or -1 */
+static int sibling(const struct macan_sched *s, unsigned k)
+{
+	unsigned i;
+
+	if (s->msg[k].sig_num < 0)
+		return -1;
+	for (i = 0; i < s->count; i++)
+		if (i != k && s->msg[i].sig_num == s->msg[k].sig_num)
+			return (int)i;
+	return -1;
+}
+
+/* Interference of messages with priority higher or equal to m in a
+ * window of length t (plus jitter and extra). Both messages of a
+ * signal are sent by one source, which sends a signed frame for every
+ * presc-th value. */
+static uint64_t interference(const struct macan_sched *s, const int *sib, unsigned m,
+			     uint64_t t, uint64_t extra, bool self)
+{
+	uint64_t pm = prio(s->msg[m].can_id), sum = 0;
+	unsigned k;
+
+#define CONSIDERED(i) (prio(s->msg[i].can_id) <= pm && (self || (i) != m))
+	for (k = 0; k < s->count && prio(s->msg[k].can_id) <= pm; k++) {
+		const struct macan_smsg *x = &s->msg[k];
+		int o = sib[k];
+
+		if (!CONSIDERED(k))
+			continue;
+		if (o >= 0 && CONSIDERED((unsigned)o)) {
+			/* Both messages of the signal interfere */
+			const struct macan_smsg *ns = x->kind == MACAN_SM_SIGNAL ? x : &s->msg[o];
+			const struct macan_smsg *sg = x->kind == MACAN_SM_SIGNAL ? &s->msg[o] : x;
+			uint64_t n, signed_n;
+
+			if ((unsigned)o < k)
+				continue;	/* Counted already */
+			n = div_up(t + ns->jitter + extra, ns->period);
+			signed_n = div_up(n, ns->presc);
+			sum += signed_n * sg->c + (n - signed_n) * ns->c;
+			continue;
+		}
+		sum += div_up(t + x->jitter + extra, x->period) * x->frames * x->c;
+	}
+#undef CONSIDERED
+	return sum;
+}
+
+static uint64_t response_time(const struct macan_sched *s, const int *sib, unsigned m, uint64_t tau)
+{
+	const struct macan_smsg *x = &s->msg[m];
+	uint64_t pm = prio(x->can_id), b = 0, cm = x->frames * x->c, t, r = 0;
+	uint64_t q, nq;
+	unsigned k, iter;
+
+	for (k = 0; k < s->count; k++)
+		if (prio(s->msg[k].can_id) > pm && s->msg[k].c > b)
+			b = s->msg[k].c;
+
+	/* Level-m busy period */
+	t = cm;
+	for (iter = 0;; iter++) {
+		uint64_t next = b + interference(s, sib, m, t, 0, true);
+		if (next == t)
+			break;
+		if (next > LIMIT_NS || iter == MAX_ITER)
+			return MACAN_SCHED_UNBOUNDED;
+		t = next;
+	}
+
+	nq = div_up(t + x->jitter, x->period);
+	if (nq > MAX_ITER)
+		return MACAN_SCHED_UNBOUNDED;
+	for (q = 0; q < nq; q++) {
+		uint64_t w = b + q * cm, rq;
+
+		for (iter = 0;; iter++) {
+			uint64_t next = b + q * cm + interference(s, sib, m, w, tau, false);
+			if (next == w)
+				break;
+			if (next > LIMIT_NS || iter == MAX_ITER)
+				return MACAN_SCHED_UNBOUNDED;
+			w = next;
+		}
+		rq = x->jitter + w + cm - q * x->period;
+		if (rq > r)
+			r = rq;
+	}
+	return r;
+}
+
+/**
+ * Compute the worst case response times of all messages.
+ *
+ * @return Number of messages missing their deadlines
+ */
+unsigned macan_sched_analyse(struct macan_sched *s)
+{
+	uint64_t tau = div_up(1000000000ULL, s->bitrate);
+	int *sib = malloc((s->count ? s->count : 1) * sizeof(*sib));
+	unsigned i;
+
+	if (!sib)
+		return s->misses = s->count;
+	for (i = 0; i < s->count; i++)
+		sib[i] = sibling(s, i);
+	s->misses = 0;
+	for (i = 0; i < s->count; i++) {
+		s->msg[i].r = response_time(s, sib, i, tau);
+		if (s->msg[i].r > s->msg[i].deadline)
+			s->misses++;
+	}
+	free(sib);
+	return s->misses;
+}
+
+/**
+ * The signed message of a signal, NULL if the signal is not sent.
+ */
+const struct macan_smsg *macan_sched_signed(const struct macan_sched *s, unsigned sig_num)
+{
+	unsigned i;
+
+	for (i = 0; i < s->count; i++)
+		if (s->msg[i].sig_num == (int)sig_num && s->msg[i].kind != MACAN_SM_SIGNAL)
+			return &s->msg[i];
+	return NULL;
+}
+
+/**
+ * Number of time units before and after its own time a receiver must
+ * try when checking the CMAC of a signal.
+ *
+ * @param skew  Maximum difference of two nodes' clocks (ns)
+ * @return false if the signal is not sent or its response time is
+ * unbounded
+ */
+bool macan_sched_window(const struct macan_sched *s, unsigned sig_num, uint64_t skew,
+			unsigned *older, unsigned *newer)
+{
+	const struct macan_smsg *m = macan_sched_signed(s, sig_num);
+	uint64_t unit = s->config->time_div * 1000ULL;
+
+	if (!m || m->r == MACAN_SCHED_UNBOUNDED || !unit)
+		return false;
+	*older = (unsigned)div_up(m->r + skew, unit);
+	*newer = (unsigned)div_up(skew, unit);
+	return true;
+}
+
+static void print_ms(FILE *f, uint64_t ns)
+{
+	if (ns == MACAN_SCHED_UNBOUNDED)
+		fprintf(f, " %10s", "unbounded");
+	else
+		fprintf(f, " %10.3f", (double)ns / 1e6);
+}
+
+/**
+ * Print the utilisation, response times and CMAC time windows.
+ */
+void macan_sched_print(const struct macan_sched *s, FILE *f, uint64_t skew)
+{
+	const struct macan_config *cfg = s->config;
+	unsigned i, older, newer;
+
+	fprintf(f, "Bitrate %u bit/s\n\nUtilisation\n", s->bitrate);
+	for (i = 0; i < MACAN_SM_KIND_COUNT; i++)
+		fprintf(f, "  %-12s %7.3f %%\n", kind_names[i], 100 * s->util[i]);
+	fprintf(f, "  %-12s %7.3f %%, %.3f %% without MaCAN (overhead %+.3f %%)\n\n", "total",
+		100 * s->util_total, 100 * s->util_plain, 100 * (s->util_total - s->util_plain));
+
+	fprintf(f, "%-8s %-10s %6s %5s %10s %10s %10s %10s\n", "CAN ID", "kind", "signal", "presc",
+		"period ms", "C ms", "R ms", "D ms");
+	for (i = 0; i < s->count; i++) {
+		const struct macan_smsg *m = &s->msg[i];
+		char sig[12] = "-", presc[12] = "-";
+
+		if (m->sig_num >= 0) {
+			snprintf(sig, sizeof(sig), "%d", m->sig_num);
+			snprintf(presc, sizeof(presc), "%u", m->presc);
+		}
+		fprintf(f, "%-8x %-10s %6s %5s", m->can_id & CAN_EFF_MASK, kind_names[m->kind], sig, presc);
+		print_ms(f, m->period);
+		print_ms(f, m->frames * m->c);
+		print_ms(f, m->r);
+		print_ms(f, m->deadline);
+		fprintf(f, "%s\n", m->r > m->deadline ? "  MISS" : "");
+	}
+
+	fprintf(f, "\nCMAC time window (time_div %.3f ms, clock skew %.3f ms)\n",
+		cfg->time_div / 1e3, (double)skew / 1e6);
+	fprintf(f, "%6s %10s %6s %6s\n", "signal", "R ms", "older", "newer");
+	for (i = 0; i < cfg->sig_count; i++) {
+		const struct macan_smsg *m = macan_sched_signed(s, i);
+
+		if (!m)
+			continue;
+		if (!macan_sched_window(s, i, skew, &older, &newer)) {
+			fprintf(f, "%6u %10s %6s %6s\n", i, "unbounded", "-", "-");
+			continue;
+		}
+		fprintf(f, "%6u %10.3f %6u %6u%s\n", i, (double)m->r / 1e6, older, newer,
+			older > 1 || newer > 1 ? "  exceeds the +-1 of macan_check_cmac()" : "");
+	}
+	if (s->misses)
+		fprintf(f, "\n%u message(s) miss their deadline\n", s->misses);
+}
@@ -0,0 +1,529 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Virtual CAN bus
+ *
+ * Senders reserve a sequence number by incrementing the head of the
+ * bus and publish the frame by storing the sequence number + 1 in its
+ * slot. Every endpoint has its own tail. A slot holding a newer sequence
+ * number than expected was overwritten, the reader then skips ahead.
+ *
+ * The file descriptor of an endpoint is an abstract unix datagram
+ * socket used as a doorbell. A reader that finds no frame arms its port
+ * and the next sender wakes it up with a datagram, so an idle bus costs
+ * nothing and a busy reader gets no datagrams at all.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_frame.h"
+#include "macan_vbus.h"
+
+#define VBUS_MAGIC 0x3242564d	/* "MVB2", slots hold CAN FD frames */
+#define VBUS_MASK (MACAN_VBUS_SLOTS - 1)
+
+struct vbus_slot {
+	uint64_t seq;		/* Sequence number + 1 of the frame */
+	uint32_t src;		/* Port of the sender */
+	uint32_t pad;
+	union macan_frame f;
+};
+
+struct vbus_port {
+	uint32_t used;
+	uint32_t armed;		/* Reader waits for a doorbell */
+	int32_t pid;
+	uint32_t pad;
+};
+
+/* Memory of the bus, shared by all endpoints */
+struct vbus_shm {
+	uint32_t magic;
+	uint32_t nports;	/* Ports ever used */
+	uint64_t head;		/* Next sequence number */
+	struct vbus_port port[MACAN_VBUS_PORTS];
+	struct vbus_slot slot[MACAN_VBUS_SLOTS];
+};
+
+struct vbus {
+	struct vbus *next;
+	char key[80];		/* Prefix of the doorbell addresses */
+	char name[64];
+	struct vbus_shm *shm;
+	bool shared;
+	unsigned users;
+};
+
+struct vbus_ep {
+	struct vbus *bus;
+	int fd;
+	uint32_t port;
+	unsigned flags;
+	uint64_t tail;
+	struct macan_vbus_stats st;
+};
+
+static struct vbus *buses;
+static struct vbus_ep **eps;	/* Indexed by file descriptor */
+static unsigned eps_size;
+
+static struct vbus_ep *ep_get(int fd)
+{
+	if (fd < 0 || (unsigned)fd >= eps_size)
+		return NULL;
+	return eps[fd];
+}
+
+static socklen_t port_addr(const struct vbus *bus, uint32_t port, struct sockaddr_un *sa)
+{
+	int len;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	/* sun_path[0] = 0: abstract namespace, nothing to clean up */
+	len = snprintf(sa->sun_path + 1, sizeof(sa->sun_path) - 1, "macan-vbus/%s/%u", bus->key, port);
+	return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + (size_t)len);
+}
+
+static bool shm_path(const char *name, char *path, size_t size)
+{
+	if (!*name || strchr(name, '/') ||
+	    (size_t)snprintf(path, size, "/dev/shm/macan-vbus-%s", name) >= size) {
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+static struct vbus_shm *shm_map(const char *name)
+{
+	char path[128];
+	struct vbus_shm *shm;
+	struct stat st;
+	int fd, i;
+	bool created = true;
+
+	if (!shm_path(name, path, sizeof(path)))
+		return NULL;
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		if (ftruncate(fd, sizeof(*shm)) != 0) {
+			close(fd);
+			unlink(path);
+			return NULL;
+		}
+	} else if (errno == EEXIST) {
+		created = false;
+		fd = open(path, O_RDWR);
+		if (fd < 0)
+			return NULL;
+		/* Wait for the creator to set the size */
+		for (i = 0; fstat(fd, &st) == 0 && st.st_size == 0 && i < 1000; i++)
+			nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+		if ((size_t)st.st_size != sizeof(*shm)) {
+			fprintf(stderr, "%s: not a virtual bus\n", path);
+			close(fd);
+			errno = EINVAL;
+			return NULL;
+		}
+	} else {
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+	if (created)
+		__atomic_store_n(&shm->magic, VBUS_MAGIC, __ATOMIC_RELEASE);
+	for (i = 0; __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != VBUS_MAGIC; i++) {
+		if (i == 1000) {
+			fprintf(stderr, "%s: not a virtual bus\n", path);
+			munmap(shm, sizeof(*shm));
+			errno = EINVAL;
+			return NULL;
+		}
+		nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+	}
+	return shm;
+}
+
+static struct vbus *bus_get(const char *name, bool shared)
+{
+	struct vbus *bus;
+
+	for (bus = buses; bus; bus = bus->next)
+		if (bus->shared == shared && strcmp(bus->name, name) == 0)
+			return bus;
+
+	if (strlen(name) >= sizeof(bus->name)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	bus = calloc(1, sizeof(*bus));
+	if (!bus)
+		return NULL;
+	bus->shared = shared;
+	strcpy(bus->name, name);
+	if (shared) {
+		bus->shm = shm_map(name);
+		snprintf(bus->key, sizeof(bus->key), "shm/%s", name);
+	} else {
+		bus->shm = calloc(1, sizeof(*bus->shm));
+		snprintf(bus->key, sizeof(bus->key), "%d/%s", getpid(), name);
+	}
+	if (!bus->shm) {
+		free(bus);
+		return NULL;
+	}
+	bus->next = buses;
+	buses = bus;
+	return bus;
+}
+
+static void bus_put(struct vbus *bus)
+{
+	struct vbus **p;
+
+	if (--bus->users)
+		return;
+	for (p = &buses; *p != bus; p = &(*p)->next)
+		;
+	*p = bus->next;
+	if (bus->shared)
+		munmap(bus->shm, sizeof(*bus->shm));
+	else
+		free(bus->shm);
+	free(bus);
+}
+
+/* Claims a free port or a port of a process that no longer exists */
+static bool port_claim(struct vbus_shm *shm, uint32_t port)
+{
+	struct vbus_port *p = &shm->port[port];
+	uint32_t used = 0;
+	int32_t pid;
+
+	if (__atomic_compare_exchange_n(&p->used, &used, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return true;
+	pid = __atomic_load_n(&p->pid, __ATOMIC_RELAXED);
+	if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH)
+		return false;
+	return __atomic_compare_exchange_n(&p->pid, &pid, getpid(), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static bool eps_add(struct vbus_ep *ep)
+{
+	if ((unsigned)ep->fd >= eps_size) {
+		unsigned size = (unsigned)ep->fd + 16;
+		struct vbus_ep **n = realloc(eps, size * sizeof(*eps));
+
+		if (!n)
+			return false;
+		memset(n + eps_size, 0, (size - eps_size) * sizeof(*eps));
+		eps = n;
+		eps_size = size;
+	}
+	eps[ep->fd] = ep;
+	return true;
+}
+
+/**
+ * Opens an endpoint of a virtual bus
+ *
+ * @param name  Name of the bus; buses with the same name are the same
+ *              bus within the process or, with MACAN_VBUS_SHARED, on
+ *              the machine
+ * @param flags MACAN_VBUS_SHARED, MACAN_VBUS_RECV_OWN, MACAN_VBUS_FD_FRAMES
+ *
+ * @return Non-blocking file descriptor of the endpoint or -1 with errno
+ *         set
+ */
+int macan_vbus_open(const char *name, unsigned flags)
+{
+	struct vbus_ep *ep;
+	struct vbus *bus;
+	struct sockaddr_un sa;
+	uint32_t port, n;
+	int err;
+
+	bus = bus_get(name, flags & MACAN_VBUS_SHARED);
+	if (!bus)
+		return -1;
+	bus->users++;
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		goto err_bus;
+	ep->bus = bus;
+	ep->flags = flags;
+	ep->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ep->fd < 0)
+		goto err_ep;
+
+	for (port = 0; port < MACAN_VBUS_PORTS; port++) {
+		if (!port_claim(bus->shm, port))
+			continue;
+		if (bind(ep->fd, (struct sockaddr *)&sa, port_addr(bus, port, &sa)) == 0)
+			break;
+		/* A process still uses the port although its pid is gone
+		 * (pid namespaces); leave it alone. */
+	}
+	if (port == MACAN_VBUS_PORTS) {
+		errno = EMFILE;
+		goto err_sock;
+	}
+	ep->port = port;
+	__atomic_store_n(&bus->shm->port[port].pid, getpid(), __ATOMIC_RELAXED);
+	__atomic_store_n(&bus->shm->port[port].armed, 1, __ATOMIC_RELAXED);
+	n = __atomic_load_n(&bus->shm->nports, __ATOMIC_RELAXED);
+	while (n <= port &&
+	       !__atomic_compare_exchange_n(&bus->shm->nports, &n, port + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		;
+	/* Frames sent from now on are received */
+	ep->tail = __atomic_load_n(&bus->shm->head, __ATOMIC_ACQUIRE);
+	if (!eps_add(ep))
+		goto err_port;
+	return ep->fd;
+
+err_port:
+	__atomic_store_n(&bus->shm->port[port].used, 0, __ATOMIC_RELEASE);
+err_sock:
+	err = errno;
+	close(ep->fd);
+	errno = err;
+err_ep:
+	free(ep);
+err_bus:
+	err = errno;
+	bus_put(bus);
+	errno = err;
+	return -1;
+}
+
+void macan_vbus_close(int fd)
+{
+	struct vbus_ep *ep = ep_get(fd);
+	struct vbus_port *p;
+
+	if (!ep)
+		return;
+	p = &ep->bus->shm->port[ep->port];
+	__atomic_store_n(&p->armed, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->pid, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->used, 0, __ATOMIC_RELEASE);
+	eps[fd] = NULL;
+	close(fd);
+	bus_put(ep->bus);
+	free(ep);
+}
+
+/**
+ * Returns whether fd is an endpoint of a virtual bus
+ */
+bool macan_vbus_fd(int fd)
+{
+	return ep_get(fd) != NULL;
+}
+
+/**
+ * Enables or disables reception of CAN FD frames like the
+ * CAN_RAW_FD_FRAMES socket option
+ *
+ * @return 0 or -1 with errno set to EBADF
+ */
+int macan_vbus_set_fd_frames(int fd, bool enable)
+{
+	struct vbus_ep *ep = ep_get(fd);
+
+	if (!ep) {
+		errno = EBADF;
+		return -1;
+	}
+	if (enable)
+		ep->flags |= MACAN_VBUS_FD_FRAMES;
+	else
+		ep->flags &= ~(unsigned)MACAN_VBUS_FD_FRAMES;
+	return 0;
+}
+
+/* Skips frames lost by overwriting */
+static void ep_resync(struct vbus_ep *ep)
+{
+	uint64_t head = __atomic_load_n(&ep->bus->shm->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = head - MACAN_VBUS_SLOTS / 2;
+
+	if (head < MACAN_VBUS_SLOTS / 2 || tail < ep->tail)
+		tail = ep->tail + 1;
+	ep->st.lost += tail - ep->tail;
+	ep->tail = tail;
+}
+
+/* Returns 1 with a frame, 0 when there is no frame and -1 for a frame
+ * not received by the endpoint */
+static int ep_get_frame(struct vbus_ep *ep, struct can_frame *cf)
+{
+	struct vbus_slot *s = &ep->bus->shm->slot[ep->tail & VBUS_MASK];
+	uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+	union macan_frame f;
+	uint32_t src;
+
+	if (seq <= ep->tail) {
+		/* Not published yet; a sender that died after reserving
+		 * the slot must not stop the bus forever */
+		if (__atomic_load_n(&ep->bus->shm->head, __ATOMIC_ACQUIRE) - ep->tail < MACAN_VBUS_SLOTS / 2)
+			return 0;
+		ep_resync(ep);
+		return -1;
+	}
+	if (seq == ep->tail + 1) {
+		src = s->src;
+		memcpy(&f, &s->f, macan_frame_size(&s->f.cf));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+			ep->tail++;
+			if (src == ep->port && !(ep->flags & MACAN_VBUS_RECV_OWN))
+				return -1;
+			if (macan_is_canfd(&f.cf) && !(ep->flags & MACAN_VBUS_FD_FRAMES))
+				return -1;
+			memcpy(cf, &f, macan_frame_size(&f.cf));
+			return 1;
+		}
+	}
+	ep_resync(ep);
+	return -1;
+}
+
+/**
+ * Receives a frame like read() on a CAN socket
+ *
+ * @return CAN_MTU, CANFD_MTU for CAN FD frames, or -1 with errno set
+ *         to EAGAIN when there is no frame. CAN FD frames are received
+ *         only with MACAN_VBUS_FD_FRAMES; @a cf must then have room for
+ *         union macan_frame.
+ */
+ssize_t macan_vbus_read(int fd, struct can_frame *cf)
+{
+	struct vbus_ep *ep = ep_get(fd);
+	struct vbus_port *p;
+	char buf[16];
+	int r;
+
+	if (!ep) {
+		errno = EBADF;
+		return -1;
+	}
+	p = &ep->bus->shm->port[ep->port];
+	for (;;) {
+		while ((r = ep_get_frame(ep, cf)) < 0)
+			;
+		if (r > 0)
+			break;
+		if (__atomic_load_n(&p->armed, __ATOMIC_RELAXED)) {
+			errno = EAGAIN;
+			return -1;
+		}
+		/* Consume the doorbell, arm and look once more so that a
+		 * frame sent in between is not missed */
+		while (recv(fd, buf, sizeof(buf), 0) > 0)
+			;
+		__atomic_store_n(&p->armed, 1, __ATOMIC_SEQ_CST);
+	}
+	ep->st.rx++;
+	return (ssize_t)macan_frame_size(cf);
+}
+
+/**
+ * Sends a frame like write() on a CAN socket
+ *
+ * @return the size of the frame; the bus is never busy
+ */
+ssize_t macan_vbus_write(int fd, const struct can_frame *cf)
+{
+	struct vbus_ep *ep = ep_get(fd);
+	struct vbus_shm *shm;
+	struct vbus_slot *s;
+	struct sockaddr_un sa;
+	uint64_t seq;
+	uint32_t port, nports;
+
+	if (!ep) {
+		errno = EBADF;
+		return -1;
+	}
+	shm = ep->bus->shm;
+	seq = __atomic_fetch_add(&shm->head, 1, __ATOMIC_ACQ_REL);
+	s = &shm->slot[seq & VBUS_MASK];
+	/* Readers comparing the sequence number before and after copying
+	 * the frame see the change */
+	__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->src = ep->port;
+	macan_frame_copy(&s->f, cf);
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_SEQ_CST);
+	ep->st.tx++;
+
+	nports = __atomic_load_n(&shm->nports, __ATOMIC_ACQUIRE);
+	for (port = 0; port < nports; port++) {
+		struct vbus_port *p = &shm->port[port];
+
+		if (port == ep->port && !(ep->flags & MACAN_VBUS_RECV_OWN))
+			continue;
+		if (!__atomic_load_n(&p->armed, __ATOMIC_SEQ_CST) ||
+		    !__atomic_exchange_n(&p->armed, 0, __ATOMIC_SEQ_CST))
+			continue;
+		/* Fails when the doorbell already rings or the reader is
+		 * gone, both are fine */
+		sendto(fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr *)&sa, port_addr(ep->bus, port, &sa));
+	}
+	return (ssize_t)macan_frame_size(cf);
+}
+
+void macan_vbus_stats(int fd, struct macan_vbus_stats *st)
+{
+	struct vbus_ep *ep = ep_get(fd);
+
+	if (ep)
+		*st = ep->st;
+	else
+		memset(st, 0, sizeof(*st));
+}
+
+/**
+ * Removes a shared bus; processes using it keep the old one
+ */
+int macan_vbus_unlink(const char *name)
+{
+	char path[128];
+
+	if (!shm_path(name, path, sizeof(path)))
+		return -1;
+	return unlink(path);
+}
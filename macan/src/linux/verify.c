@@ -0,0 +1,716 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Passive verification of MaCAN traffic (see macan_verify.h)
+ *
+ * All MaCAN plain texts are shorter than one AES block, so their CMAC
+ * is a single encryption of the padded plain text XORed with the
+ * second CMAC subkey (RFC 4493). The key schedule and the subkey are
+ * computed once per session key, and the blocks of all candidate
+ * times of consecutive jobs with the same key are encrypted in one
+ * call.
+ */
+
+#include <nettle/aes.h>
+#include <nettle/memxor.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptlib.h"
+#include "endian.h"
+#include "macan_private.h"
+#include "macan_verify.h"
+
+#define BATCH_BLOCKS	192	/* Blocks encrypted in one call */
+
+struct macan_vkey {
+	struct aes128_ctx aes;
+	uint8_t k2[16];
+	uint8_t data[16];
+	uint64_t from_ns;		/* First distribution of the key */
+	const struct macan_vkey *prev;	/* Previous key of the same pair */
+};
+
+struct time_sample {
+	uint64_t ts_ns;
+	uint32_t time;
+};
+
+enum id_type { ID_ECU, ID_SIG_NS, ID_SIG_S };
+
+struct id_ent {
+	uint32_t can_id;
+	uint8_t type;		/* enum id_type */
+	uint8_t index;		/* ECU-ID or signal number */
+};
+
+struct macan_verifier {
+	const struct macan_config *config;
+	const struct macan_key * const *ltks;
+	unsigned nodes;
+	unsigned id_space;	/* ECU-IDs and Group-IDs, macan_id_count() */
+
+	struct id_ent *ids;
+	unsigned id_count;
+
+	/* Newest key of each node pair and group, indexed by key_index() */
+	struct macan_vkey **keys;
+
+	/* Challenges sent to the key server, indexed by node and
+	 * forwarded ID, and to the time server, indexed by node */
+	uint8_t (*ks_chg)[6];
+	bool *ks_chg_valid;
+	uint8_t (*ts_chg)[6];
+	bool *ts_chg_valid;
+
+	/* SESS_KEY reassembly, indexed by the destination node */
+	uint8_t (*wrap)[32];
+	uint8_t *wrap_seq;
+
+	struct time_sample *time;
+	unsigned time_count, time_cap;
+};
+
+/* All members of a group share one key, which the key server keeps
+ * as the Group-ID paired with itself. IDs above the ECU-IDs that are
+ * not Group-IDs never get a key. */
+static unsigned key_index(const struct macan_verifier *v, macan_ecuid a, macan_ecuid b)
+{
+	if (b >= v->nodes)
+		a = b;
+	else if (a >= v->nodes)
+		b = a;
+	return a < b ? a * v->id_space + b : b * v->id_space + a;
+}
+
+static void lshift(uint8_t *dst, const uint8_t *src)
+{
+	int i;
+
+	for (i = 0; i < 15; i++)
+		dst[i] = (uint8_t)((src[i] << 1) | (src[i + 1] >> 7));
+	dst[15] = (uint8_t)(src[15] << 1);
+}
+
+static struct macan_vkey *vkey_new(const uint8_t *data, uint64_t from_ns)
+{
+	static const uint8_t zero[16];
+	struct macan_vkey *k = calloc(1, sizeof(*k));
+	uint8_t l[16], k1[16];
+
+	if (!k)
+		return NULL;
+	memcpy(k->data, data, 16);
+	k->from_ns = from_ns;
+	aes128_set_encrypt_key(&k->aes, data);
+	aes128_encrypt(&k->aes, 16, l, zero);
+	lshift(k1, l);
+	if (l[0] & 0x80)
+		k1[15] ^= 0x87;
+	lshift(k->k2, k1);
+	if (k1[0] & 0x80)
+		k->k2[15] ^= 0x87;
+	return k;
+}
+
+static int cmp_id(const void *a, const void *b)
+{
+	const struct id_ent *x = a, *y = b;
+	return x->can_id < y->can_id ? -1 : x->can_id > y->can_id;
+}
+
+static const struct id_ent *find_id(const struct macan_verifier *v, uint32_t can_id)
+{
+	unsigned lo = 0, hi = v->id_count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (v->ids[mid].can_id < can_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < v->id_count && v->ids[lo].can_id == can_id ? &v->ids[lo] : NULL;
+}
+
+/**
+ * Create a verifier.
+ *
+ * @param config MaCAN configuration
+ * @param ltks   Long-term keys indexed by ECU-ID (NULL for the key server)
+ */
+struct macan_verifier *macan_verify_create(const struct macan_config *config,
+					   const struct macan_key * const *ltks)
+{
+	struct macan_verifier *v = calloc(1, sizeof(*v));
+	unsigned n = config->node_count, ids = macan_id_count(config), i;
+
+	if (!v)
+		return NULL;
+	v->config = config;
+	v->ltks = ltks;
+	v->nodes = n;
+	v->id_space = ids;
+	v->ids = calloc(n + 2 * config->sig_count, sizeof(*v->ids));
+	v->keys = calloc(ids * ids, sizeof(*v->keys));
+	v->ks_chg = calloc(n * ids, sizeof(*v->ks_chg));
+	v->ks_chg_valid = calloc(n * ids, sizeof(*v->ks_chg_valid));
+	v->ts_chg = calloc(n, sizeof(*v->ts_chg));
+	v->ts_chg_valid = calloc(n, sizeof(*v->ts_chg_valid));
+	v->wrap = calloc(n, sizeof(*v->wrap));
+	v->wrap_seq = calloc(n, sizeof(*v->wrap_seq));
+	if (!v->ids || !v->keys || !v->ks_chg || !v->ks_chg_valid || !v->ts_chg ||
+	    !v->ts_chg_valid || !v->wrap || !v->wrap_seq) {
+		macan_verify_free(v);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++)
+		v->ids[v->id_count++] = (struct id_ent){ config->canid->ecu[i].canid, ID_ECU, (uint8_t)i };
+	for (i = 0; i < config->sig_count; i++) {
+		const struct macan_sig_spec *ss = &config->sigspec[i];
+		if (ss->can_nsid)
+			v->ids[v->id_count++] = (struct id_ent){ ss->can_nsid, ID_SIG_NS, (uint8_t)i };
+		if (ss->can_sid)
+			v->ids[v->id_count++] = (struct id_ent){ ss->can_sid, ID_SIG_S, (uint8_t)i };
+	}
+	qsort(v->ids, v->id_count, sizeof(*v->ids), cmp_id);
+	return v;
+}
+
+void macan_verify_free(struct macan_verifier *v)
+{
+	unsigned i;
+
+	if (v->keys) {
+		for (i = 0; i < v->id_space * v->id_space; i++) {
+			const struct macan_vkey *k = v->keys[i];
+			while (k) {
+				const struct macan_vkey *prev = k->prev;
+				free((void *)k);
+				k = prev;
+			}
+		}
+	}
+	free(v->ids);
+	free(v->keys);
+	free(v->ks_chg);
+	free(v->ks_chg_valid);
+	free(v->ts_chg);
+	free(v->ts_chg_valid);
+	free(v->wrap);
+	free(v->wrap_seq);
+	free(v->time);
+	free(v);
+}
+
+/**
+ * Return whether frames of can_id must be passed to macan_verify_track().
+ */
+bool macan_verify_is_protocol_id(const struct macan_verifier *v, uint32_t can_id)
+{
+	const struct id_ent *id;
+
+	if (can_id == v->config->canid->time)
+		return true;
+	id = find_id(v, can_id);
+	return id && id->type == ID_ECU;
+}
+
+static void alert(struct macan_vreport *rep, uint64_t ts_ns, enum macan_valert a,
+		  uint32_t can_id, uint8_t src, uint8_t dst, int sig_num, int64_t delta)
+{
+	rep->alerts[a]++;
+	if (rep->alert_cb) {
+		struct macan_valert_info info = {
+			.ts_ns = ts_ns, .alert = a, .can_id = can_id,
+			.src = src, .dst = dst, .sig_num = sig_num, .delta = delta,
+		};
+		rep->alert_cb(rep->arg, &info);
+	}
+}
+
+static const struct macan_vkey *key_at(const struct macan_verifier *v, macan_ecuid a,
+				       macan_ecuid b, uint64_t ts_ns)
+{
+	const struct macan_vkey *k;
+
+	if (a >= v->id_space || b >= v->id_space)
+		return NULL;
+	for (k = v->keys[key_index(v, a, b)]; k && k->from_ns > ts_ns; k = k->prev)
+		;
+	return k;
+}
+
+/* Expected MaCAN time at ts_ns according to the last plain time
+ * broadcast before it */
+static bool time_at(const struct macan_verifier *v, uint64_t ts_ns, uint32_t *time)
+{
+	unsigned lo = 0, hi = v->time_count;
+	const struct time_sample *s;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (v->time[mid].ts_ns <= ts_ns)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return false;
+	s = &v->time[lo - 1];
+	*time = s->time + (uint32_t)((ts_ns - s->ts_ns) / 1000 / v->config->time_div);
+	return true;
+}
+
+static void track_time(struct macan_verifier *v, uint64_t ts_ns,
+		       const struct can_frame *cf, struct macan_vreport *rep)
+{
+	uint32_t val, expected;
+	int64_t delta;
+
+	memcpy(&val, cf->data, 4);
+	val = le32toh(val);
+
+	if (cf->can_dlc == 4) {
+		rep->time_plain++;
+		if (time_at(v, ts_ns, &expected)) {
+			delta = (int64_t)val - (int64_t)expected;
+			if (llabs(delta) > 1 && (uint64_t)llabs(delta) * v->config->time_div > v->config->time_delta)
+				alert(rep, ts_ns, MACAN_A_TIME_JUMP, cf->can_id,
+				      v->config->time_server_id, v->config->time_server_id, -1, delta);
+		}
+		if (v->time_count == v->time_cap) {
+			unsigned cap = v->time_cap ? 2 * v->time_cap : 1024;
+			struct time_sample *t = realloc(v->time, cap * sizeof(*t));
+			if (!t)
+				return;
+			v->time = t;
+			v->time_cap = cap;
+		}
+		v->time[v->time_count++] = (struct time_sample){ ts_ns, val };
+	} else if (cf->can_dlc == 8) {
+		macan_ecuid ts_id = v->config->time_server_id;
+		uint8_t plain[16] = {0}, cmac[16];
+		uint32_t canid = htole32(v->config->canid->ecu[ts_id].canid);
+		unsigned i;
+
+		/* The answer to the challenge of one of the nodes */
+		memcpy(plain, cf->data, 4);
+		memcpy(plain + 10, &canid, 2);
+		plain[12] = 0x80;
+		for (i = 0; i < v->nodes; i++) {
+			const struct macan_vkey *k;
+
+			if (!v->ts_chg_valid[i] || !(k = key_at(v, ts_id, (macan_ecuid)i, ts_ns)))
+				continue;
+			memcpy(plain + 4, v->ts_chg[i], 6);
+			memxor3(cmac, plain, k->k2, 16);
+			aes128_encrypt(&k->aes, 16, cmac, cmac);
+			if (memcmp(cmac, cf->data + 4, 4) == 0) {
+				v->ts_chg_valid[i] = false;
+				rep->time_auth_ok++;
+				if (time_at(v, ts_ns, &expected)) {
+					delta = (int64_t)val - (int64_t)expected;
+					if (llabs(delta) > 1 && (uint64_t)llabs(delta) * v->config->time_div > v->config->time_delta)
+						alert(rep, ts_ns, MACAN_A_TIME_JUMP, cf->can_id,
+						      ts_id, (uint8_t)i, -1, delta);
+				}
+				return;
+			}
+		}
+		alert(rep, ts_ns, MACAN_A_FORGED_TIME, cf->can_id, ts_id, ts_id, -1, 0);
+	}
+}
+
+static void track_skey(struct macan_verifier *v, uint64_t ts_ns,
+		       const struct can_frame *cf, struct macan_vreport *rep)
+{
+	macan_ecuid dst = macan_crypt_dst(cf);
+	uint8_t seq, len, plain[24], tmp[32];
+	macan_ecuid fwd;
+	const struct macan_group *g;
+	struct macan_vkey **newest, *k;
+	unsigned pi;
+
+	if (cf->can_dlc < 2 || dst >= v->nodes)
+		return;
+	seq = cf->data[1] >> 4;
+	len = seq == 5 ? 2 : 6;
+	if (seq > 5 || cf->can_dlc < 2 + len)
+		return;
+	if (seq == 0)
+		v->wrap_seq[dst] = 0;
+	memcpy(v->wrap[dst] + 6 * seq, cf->data + 2, len);
+	v->wrap_seq[dst] |= (uint8_t)(1U << seq);
+	if (v->wrap_seq[dst] != 0x3f)
+		return;
+	v->wrap_seq[dst] = 0;
+
+	/* The key is forwarded to a node or to a group containing dst */
+	if (!v->ltks[dst] ||
+	    macan_aes_unwrap(v->ltks[dst], 32, plain, v->wrap[dst], tmp) != 0 ||
+	    plain[16] != dst || plain[17] >= v->id_space || plain[17] == dst ||
+	    (plain[17] >= v->nodes &&
+	     (!(g = macan_get_group(v->config, plain[17])) || !(g->members & (1U << dst))))) {
+		alert(rep, ts_ns, MACAN_A_BAD_SKEY, cf->can_id, dst, dst, -1, 0);
+		return;
+	}
+	fwd = plain[17];
+	pi = (unsigned)dst * v->id_space + fwd;
+	if (v->ks_chg_valid[pi]) {
+		if (memcmp(v->ks_chg[pi], plain + 18, 6) != 0) {
+			alert(rep, ts_ns, MACAN_A_SKEY_REPLAY, cf->can_id, dst, fwd, -1, 0);
+			return;
+		}
+		v->ks_chg_valid[pi] = false;
+	}
+
+	newest = &v->keys[key_index(v, dst, fwd)];
+	if (*newest && memcmp((*newest)->data, plain, 16) == 0)
+		return;
+	if (!(k = vkey_new(plain, ts_ns)))
+		return;
+	if (*newest)
+		alert(rep, ts_ns, MACAN_A_KEY_RENEWAL, cf->can_id, dst, fwd, -1, 0);
+	k->prev = *newest;
+	*newest = k;
+	rep->keys++;
+}
+
+/**
+ * Update the key and time history with a protocol frame.
+ *
+ * Frames must be passed in time order. Authenticated time is checked
+ * here, because it can only be verified against the challenge that
+ * requested it.
+ */
+void macan_verify_track(struct macan_verifier *v, uint64_t ts_ns,
+			const struct can_frame *cf, struct macan_vreport *rep)
+{
+	const struct macan_config *cfg = v->config;
+	const struct id_ent *id;
+	macan_ecuid src, dst;
+
+	if (cf->can_id == cfg->canid->time) {
+		track_time(v, ts_ns, cf, rep);
+		return;
+	}
+	if (!(id = find_id(v, cf->can_id)) || id->type != ID_ECU || cf->can_dlc < 1)
+		return;
+	src = id->index;
+	dst = macan_crypt_dst(cf);
+
+	switch (macan_crypt_flags(cf)) {
+	case FL_CHALLENGE:
+		if (cf->can_dlc != 8 || src >= v->nodes)
+			break;
+		if (dst == cfg->key_server_id && cf->data[1] < v->id_space) {
+			unsigned pi = (unsigned)src * v->id_space + cf->data[1];
+			memcpy(v->ks_chg[pi], cf->data + 2, 6);
+			v->ks_chg_valid[pi] = true;
+		} else if (dst == cfg->time_server_id) {
+			memcpy(v->ts_chg[src], cf->data + 2, 6);
+			v->ts_chg_valid[src] = true;
+		}
+		break;
+	case FL_SESS_KEY_OR_ACK:
+		if (src == cfg->key_server_id)
+			track_skey(v, ts_ns, cf, rep);
+		break;
+	}
+}
+
+/**
+ * Prepare the CMAC check of a frame.
+ *
+ * Non-secure signal frames are accounted in rep directly. Jobs that
+ * cannot be checked get their result set here and are skipped by
+ * macan_verify_batch().
+ *
+ * @return Kind of the frame, MACAN_V_NONE if no job was prepared.
+ */
+enum macan_vkind macan_verify_prepare(const struct macan_verifier *v, uint64_t ts_ns,
+				      const struct can_frame *cf, struct macan_vjob *job,
+				      struct macan_vreport *rep)
+{
+	const struct macan_config *cfg = v->config;
+	const struct id_ent *id;
+	macan_ecuid key_id;
+	uint32_t le;
+
+	rep->frames++;
+	if (!(id = find_id(v, cf->can_id)) || cf->can_dlc < 1)
+		return MACAN_V_NONE;
+
+	memset(job, 0, sizeof(*job));
+	job->ts_ns = ts_ns;
+	job->can_id = cf->can_id;
+
+	switch (id->type) {
+	case ID_SIG_NS:
+		rep->sig[id->index].plain++;
+		return MACAN_V_NONE;
+	case ID_SIG_S:
+		if (cf->can_dlc != 8)
+			return MACAN_V_NONE;
+		job->kind = MACAN_V_SIG32;
+		job->sig_num = id->index;
+		job->src = cfg->sigspec[id->index].src_id;
+		job->dst = cfg->sigspec[id->index].dst_id;
+		le = htole32(cf->can_id);
+		memcpy(job->plain, cf->data, 4);
+		memcpy(job->plain + 8, &le, 4);
+		job->time_index = 4;
+		job->len = 12;
+		memcpy(job->cmac, cf->data + 4, 4);
+		break;
+	case ID_ECU:
+		job->src = id->index;
+		job->dst = macan_crypt_dst(cf);
+		if (job->src == cfg->key_server_id || job->dst >= v->id_space)
+			return MACAN_V_NONE;
+		switch (macan_crypt_flags(cf)) {
+		case FL_ACK:
+			if (cf->can_dlc != 8)
+				return MACAN_V_NONE;
+			job->kind = MACAN_V_ACK;
+			job->plain[4] = job->dst;
+			memcpy(job->plain + 5, cf->data + 1, 3);
+			job->len = 8;
+			memcpy(job->cmac, cf->data + 4, 4);
+			break;
+		case FL_SIGNAL_OR_AUTH_REQ:
+			if (cf->can_dlc < 2 || cf->data[1] >= cfg->sig_count)
+				return MACAN_V_NONE;
+			job->sig_num = cf->data[1];
+			job->plain[4] = job->src;
+			job->plain[5] = job->dst;
+			job->plain[6] = job->sig_num;
+			if (cf->can_dlc == 7) {
+				job->kind = MACAN_V_AUTH_REQ;
+				job->plain[7] = cf->data[2];
+				job->len = 8;
+				memcpy(job->cmac, cf->data + 3, 4);
+			} else if (cf->can_dlc == 8) {
+				job->kind = MACAN_V_SIG16;
+				memcpy(job->plain + 7, cf->data + 2, 2);
+				job->len = 9;
+				memcpy(job->cmac, cf->data + 4, 4);
+			} else
+				return MACAN_V_NONE;	/* Auth request without CMAC */
+			break;
+		default:
+			return MACAN_V_NONE;
+		}
+		break;
+	}
+
+	/* Requests for group signals are signed with the group key */
+	key_id = job->dst;
+	if (job->kind == MACAN_V_AUTH_REQ && cfg->sigspec[job->sig_num].dst_id >= v->nodes)
+		key_id = cfg->sigspec[job->sig_num].dst_id;
+
+	if (!time_at(v, ts_ns, &job->time))
+		job->result = MACAN_V_NOTIME;
+	else if (!(job->key = key_at(v, job->src, key_id, ts_ns)))
+		job->result = MACAN_V_NOKEY;
+	return job->kind;
+}
+
+static void job_block(const struct macan_vjob *job, const struct macan_vkey *key,
+		      int delta, uint8_t *block)
+{
+	uint32_t t = htole32(job->time + (uint32_t)delta);
+
+	memcpy(block, job->plain, 16);
+	memcpy(block + job->time_index, &t, 4);
+	block[job->len] = 0x80;
+	memxor(block, key->k2, 16);
+}
+
+/* Search a wider window and the previous key of the pair for frames
+ * that did not match */
+static void check_slow(struct macan_vjob *job)
+{
+	uint8_t blocks[2 * MACAN_VERIFY_STALE_WINDOW + 1][16];
+	const struct macan_vkey *prev = job->key->prev;
+	int d;
+
+	if (prev) {
+		for (d = -1; d <= 1; d++)
+			job_block(job, prev, d, blocks[d + 1]);
+		aes128_encrypt(&prev->aes, 3 * 16, blocks[0], blocks[0]);
+		for (d = 0; d < 3; d++) {
+			if (memcmp(blocks[d], job->cmac, 4) == 0) {
+				job->result = MACAN_V_OK;
+				return;
+			}
+		}
+	}
+
+	for (d = -MACAN_VERIFY_STALE_WINDOW; d <= MACAN_VERIFY_STALE_WINDOW; d++)
+		job_block(job, job->key, d, blocks[d + MACAN_VERIFY_STALE_WINDOW]);
+	aes128_encrypt(&job->key->aes, sizeof(blocks), blocks[0], blocks[0]);
+	for (d = -MACAN_VERIFY_STALE_WINDOW; d <= MACAN_VERIFY_STALE_WINDOW; d++) {
+		if (memcmp(blocks[d + MACAN_VERIFY_STALE_WINDOW], job->cmac, 4) == 0) {
+			job->result = MACAN_V_STALE;
+			job->delta = (int8_t)d;
+			return;
+		}
+	}
+	job->result = MACAN_V_INVALID;
+}
+
+/**
+ * Check the CMACs of prepared jobs.
+ *
+ * Frames are signed with the sender's idea of the MaCAN time, so the
+ * expected time and its neighbours are tried, as macan_check_cmac()
+ * does.
+ */
+void macan_verify_batch(struct macan_vjob *jobs, unsigned n)
+{
+	uint8_t blocks[BATCH_BLOCKS][16];
+	unsigned i = 0;
+
+	while (i < n) {
+		const struct macan_vkey *key = jobs[i].key;
+		unsigned j, nb = 0, end;
+
+		if (!key) {
+			i++;
+			continue;
+		}
+		for (end = i; end < n && jobs[end].key == key && nb + 3 <= BATCH_BLOCKS; end++) {
+			int d;
+			for (d = -1; d <= 1; d++)
+				job_block(&jobs[end], key, d, blocks[nb++]);
+		}
+		aes128_encrypt(&key->aes, nb * 16, blocks[0], blocks[0]);
+
+		for (j = i, nb = 0; j < end; j++, nb += 3) {
+			if (memcmp(blocks[nb + 1], jobs[j].cmac, 4) == 0 ||
+			    memcmp(blocks[nb], jobs[j].cmac, 4) == 0 ||
+			    memcmp(blocks[nb + 2], jobs[j].cmac, 4) == 0)
+				jobs[j].result = MACAN_V_OK;
+			else
+				check_slow(&jobs[j]);
+		}
+		i = end;
+	}
+}
+
+/**
+ * Account the result of a job and raise alerts for failed checks.
+ */
+void macan_verify_account(const struct macan_vjob *job, struct macan_vreport *rep)
+{
+	int sig_num = job->kind == MACAN_V_ACK ? -1 : job->sig_num;
+
+	rep->kind[job->kind][job->result]++;
+	if (job->kind == MACAN_V_SIG16 || job->kind == MACAN_V_SIG32) {
+		struct macan_vsig_stats *s = &rep->sig[job->sig_num];
+
+		s->result[job->result]++;
+		if (job->result == MACAN_V_OK) {
+			if (!s->first_ok_ns)
+				s->first_ok_ns = job->ts_ns;
+			s->last_ok_ns = job->ts_ns;
+		}
+	} else if (job->kind == MACAN_V_AUTH_REQ)
+		rep->sig[job->sig_num].auth_req[job->result]++;
+
+	if (job->result == MACAN_V_INVALID)
+		alert(rep, job->ts_ns, MACAN_A_INVALID_CMAC, job->can_id,
+		      job->src, job->dst, sig_num, 0);
+	else if (job->result == MACAN_V_STALE)
+		alert(rep, job->ts_ns, MACAN_A_STALE, job->can_id,
+		      job->src, job->dst, sig_num, job->delta);
+}
+
+bool macan_vreport_init(struct macan_vreport *rep, const struct macan_config *config)
+{
+	memset(rep, 0, sizeof(*rep));
+	rep->sig_count = config->sig_count;
+	rep->sig = calloc(config->sig_count ? config->sig_count : 1, sizeof(*rep->sig));
+	return rep->sig != NULL;
+}
+
+void macan_vreport_merge(struct macan_vreport *dst, const struct macan_vreport *src)
+{
+	unsigned i, j;
+
+	dst->frames += src->frames;
+	for (i = 0; i < MACAN_V_KIND_COUNT; i++)
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++)
+			dst->kind[i][j] += src->kind[i][j];
+	for (i = 0; i < MACAN_A_COUNT; i++)
+		dst->alerts[i] += src->alerts[i];
+	dst->keys += src->keys;
+	dst->time_plain += src->time_plain;
+	dst->time_auth_ok += src->time_auth_ok;
+
+	for (i = 0; i < dst->sig_count && i < src->sig_count; i++) {
+		struct macan_vsig_stats *d = &dst->sig[i];
+		const struct macan_vsig_stats *s = &src->sig[i];
+
+		d->plain += s->plain;
+		for (j = 0; j < MACAN_V_RESULT_COUNT; j++) {
+			d->result[j] += s->result[j];
+			d->auth_req[j] += s->auth_req[j];
+		}
+		if (s->first_ok_ns && (!d->first_ok_ns || s->first_ok_ns < d->first_ok_ns))
+			d->first_ok_ns = s->first_ok_ns;
+		if (s->last_ok_ns > d->last_ok_ns)
+			d->last_ok_ns = s->last_ok_ns;
+	}
+}
+
+void macan_vreport_free(struct macan_vreport *rep)
+{
+	free(rep->sig);
+	rep->sig = NULL;
+}
+
+const char *macan_valert_name(enum macan_valert a)
+{
+	static const char *const names[MACAN_A_COUNT] = {
+		[MACAN_A_INVALID_CMAC] = "invalid CMAC",
+		[MACAN_A_STALE] = "stale time",
+		[MACAN_A_KEY_RENEWAL] = "key renewal",
+		[MACAN_A_BAD_SKEY] = "bad session key",
+		[MACAN_A_SKEY_REPLAY] = "session key replay",
+		[MACAN_A_TIME_JUMP] = "time jump",
+		[MACAN_A_FORGED_TIME] = "forged time",
+	};
+	return (unsigned)a < MACAN_A_COUNT ? names[a] : "?";
+}
+
+const char *macan_vresult_name(enum macan_vresult r)
+{
+	static const char *const names[MACAN_V_RESULT_COUNT] = {
+		[MACAN_V_OK] = "ok",
+		[MACAN_V_STALE] = "stale",
+		[MACAN_V_INVALID] = "invalid",
+		[MACAN_V_NOKEY] = "no key",
+		[MACAN_V_NOTIME] = "no time",
+	};
+	return (unsigned)r < MACAN_V_RESULT_COUNT ? names[r] : "?";
+}
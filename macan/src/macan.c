@@ -55,13 +55,76 @@
 
 static inline struct com_part *get_cpart(struct macan_ctx *ctx, macan_ecuid i)
 {
-	if (i < ctx->config->node_count) {
+	if (i < macan_id_count(ctx->config)) {
 		return ctx->cpart[i];
 	} else {
 		return NULL;
 	}
 }
 
+/**
+ * Return the group with Group-ID @a id or NULL if @a id is not a Group-ID.
+ */
+const struct macan_group *macan_get_group(const struct macan_config *cfg, macan_ecuid id)
+{
+	unsigned i;
+
+	for (i = 0; i < cfg->group_count; i++)
+		if (cfg->groups[i].group_id == id)
+			return &cfg->groups[i];
+	return NULL;
+}
+
+/**
+ * Return the number of ECU-IDs and Group-IDs, i.e. the size of the
+ * vectors indexed by them.
+ */
+unsigned macan_id_count(const struct macan_config *cfg)
+{
+	unsigned i, n = cfg->node_count;
+
+	for (i = 0; i < cfg->group_count; i++)
+		if (cfg->groups[i].group_id >= n)
+			n = cfg->groups[i].group_id + 1U;
+	return n;
+}
+
+/**
+ * Check whether frames addressed to @a dst_id are for us, i.e. whether
+ * it is our ECU-ID or the Group-ID of a group we are a member of.
+ */
+static bool is_dst(struct macan_ctx *ctx, macan_ecuid dst_id)
+{
+	const struct macan_group *g;
+
+	if (dst_id == ctx->node->node_id)
+		return true;
+	g = macan_get_group(ctx->config, dst_id);
+	return g && (g->members & (1U << ctx->node->node_id));
+}
+
+/**
+ * Return the ID of the session key protecting the signal @a sig_num
+ * exchanged with @a partner: the Group-ID for group signals.
+ */
+static macan_ecuid sig_key_id(struct macan_ctx *ctx, uint32_t sig_num, macan_ecuid partner)
+{
+	macan_ecuid dst_id = ctx->config->sigspec[sig_num].dst_id;
+
+	return macan_get_group(ctx->config, dst_id) ? dst_id : partner;
+}
+
+/**
+ * Return the ID of the session key protecting the PDU @a pdu: the
+ * Group-ID for group PDUs, the ECU-ID of the partner otherwise.
+ */
+static macan_ecuid pdu_key_id(struct macan_ctx *ctx, const struct macan_pdu_spec *pdu)
+{
+	if (macan_get_group(ctx->config, pdu->dst_id) || pdu->src_id == ctx->node->node_id)
+		return pdu->dst_id;
+	return pdu->src_id;
+}
+
 /**
  * Register a callback function.
  *
@@ -79,27 +142,78 @@ int macan_reg_callback(struct macan_ctx *ctx, uint8_t sig_num, macan_sig_cback f
 }
 
 /**
- * Check we have authenticated channel with dst.
+ * Register a callback for a stale signal.
+ *
+ * @a fnc is called when no authenticated value of the signal was
+ * received for @a timeout microseconds, then again only after the
+ * signal is received and lost once more. For send-on-change signals,
+ * the timeout should be somewhat longer than their heartbeat. Must be
+ * called after macan_init().
+ */
+int macan_reg_stale_callback(struct macan_ctx *ctx, uint8_t sig_num, uint32_t timeout, macan_stale_cback fnc)
+{
+	struct sig_handle *sighand = ctx->sighand[sig_num];
+
+	sighand->stale_cback = fnc;
+	sighand->stale_timeout = timeout;
+	if (fnc)
+		macan_deadline_set(ctx, &sighand->dl, read_time() + timeout);
+	else
+		macan_deadline_cancel(ctx, &sighand->dl);
+
+	return 0;
+}
+
+/* An authenticated value of the signal was received */
+static void sig_fresh(struct macan_ctx *ctx, uint8_t sig_num)
+{
+	struct sig_handle *sighand = ctx->sighand[sig_num];
+
+	if (sighand && sighand->stale_cback)
+		macan_deadline_set(ctx, &sighand->dl, read_time() + sighand->stale_timeout);
+}
+
+/**
+ * Check we have authenticated channel with partner.
  *
- * Checks if has the session key and if the communication partner
- * has acknowledged the communication with an ACK message.
+ * Checks if has the session key @a key_id (partner's ECU-ID or a
+ * Group-ID) and if the communication partner has acknowledged the
+ * communication with an ACK message.
  */
 static
-bool is_channel_ready(struct macan_ctx *ctx, macan_ecuid dst)
+bool is_ready_with(struct macan_ctx *ctx, macan_ecuid key_id, macan_ecuid partner)
 {
 #ifdef VW_COMPATIBLE
 	/* VW compatible -> ACK is disabled, channel is ready */
 	return true;
 #endif
 
-	struct com_part *cp = get_cpart(ctx, dst);
-	if (cp == NULL)
+	struct com_part *cp = get_cpart(ctx, key_id);
+	if (cp == NULL || partner >= 24)
 		return false;
 
-	uint32_t both = 1U << dst | 1U << ctx->node->node_id;
+	uint32_t both = 1U << partner | 1U << ctx->node->node_id;
 	return (cp->group_field & both) == both;
 }
 
+static
+bool is_channel_ready(struct macan_ctx *ctx, macan_ecuid dst)
+{
+	return is_ready_with(ctx, dst, dst);
+}
+
+/**
+ * Set the expiration time of the session key (or of the key request).
+ *
+ * The time is also registered in the deadline queue so that
+ * housekeeping wakes up exactly when the key needs to be renewed.
+ */
+static void set_valid_until(struct macan_ctx *ctx, struct com_part *cpart, uint64_t when)
+{
+	cpart->valid_until = when;
+	macan_deadline_set(ctx, &cpart->dl, when);
+}
+
 static void
 append(void *dst, unsigned *dstlen, const void *src, unsigned srclen)
 {
@@ -117,7 +231,7 @@ void send_auth_req(struct macan_ctx *ctx, macan_ecuid dst_id, uint8_t sig_num, u
 	struct macan_sig_auth_req areq;
 
 	t = macan_get_time(ctx);
-	skey = get_cpart(ctx, dst_id)->skey;
+	skey = get_cpart(ctx, sig_key_id(ctx, sig_num, dst_id))->skey;
 
 	uint32_t tl = htole32(t);
 	memcpy(plain, &tl, 4);
@@ -146,19 +260,27 @@ void request_signals(struct macan_ctx *ctx)
 	if (!ctx->time.ready)
 		return;
 
-	/* ToDo: repeat auth_req for the case the signal source will restart */
 	for (i = 0; i < ctx->config->sig_count; i++) {
 		const struct macan_sig_spec *sigspec = &ctx->config->sigspec[i];
 		struct sig_handle *sighand = ctx->sighand[i];
 
-		if (sigspec->dst_id != ctx->node->node_id ||
-		    !is_channel_ready(ctx, sigspec->src_id))
+		/* Signals of PDUs are sent by the application, not on request */
+		if (!is_dst(ctx, sigspec->dst_id) || sighand->pdu ||
+		    !is_ready_with(ctx, sig_key_id(ctx, i, sigspec->src_id), sigspec->src_id))
 			continue;
 
 		if (!(sighand->flags & AUTHREQ_SENT)) {
+			/* Liveness of group sources is not tracked */
+			struct com_part *cp = macan_get_group(ctx->config, sigspec->dst_id) ?
+				NULL : get_cpart(ctx, sigspec->src_id);
+
 			sighand->flags |= AUTHREQ_SENT;
 			print_msg(ctx, MSG_REQUEST,"Sending req auth for signal #%d\n",i);
 			send_auth_req(ctx, sigspec->src_id, i, sigspec->presc);
+
+			/* Repeat the request if no signal comes */
+			if (cp && ctx->config->liveness_timeout && !cp->resync_backoff && !cp->resync_dl.pos)
+				macan_deadline_set(ctx, &cp->resync_dl, read_time() + ctx->config->liveness_timeout);
 		}
 	}
 }
@@ -210,12 +332,110 @@ static void send_ack(struct macan_ctx *ctx, macan_ecuid dst_id)
 	return;
 }
 
+/* Initial interval between resync attempts (us), doubled up to skey_chg_timeout */
+#define MACAN_RESYNC_MIN 10000
+
+/* Minimum age of an unanswered challenge that is repeated when KS asks
+ * for it (us). Younger challenges are likely still queued for the bus. */
+#define MACAN_RECHALLENGE_SEP 100000
+
+static bool expects_signals(struct macan_ctx *ctx, macan_ecuid src_id)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctx->config->sig_count; i++)
+		if (ctx->config->sigspec[i].src_id == src_id &&
+		    ctx->config->sigspec[i].dst_id == ctx->node->node_id)
+			return true;
+	return false;
+}
+
+/**
+ * Forget the state shared with a partner that has restarted.
+ *
+ * The partner is removed from the group field so that the channel is
+ * not ready until the partner acknowledges the key again, and the
+ * signals it sends us are requested again. The exchange is repeated
+ * with exponential backoff by partner_check() until authenticated
+ * signals are restored.
+ */
+static void partner_lost(struct macan_ctx *ctx, struct com_part *cp, const char *why)
+{
+	uint32_t i;
+
+	if (cp->resync_backoff)
+		return;		/* Already resynchronizing */
+
+	print_msg(ctx, MSG_WARN, "lost %s (%s), resynchronizing\n",
+		  macan_ecu_name(ctx, cp->ecu_id), why);
+	cp->group_field &= 1U << ctx->node->node_id;
+	for (i = 0; i < ctx->config->sig_count; i++)
+		if (ctx->config->sigspec[i].src_id == cp->ecu_id &&
+		    ctx->config->sigspec[i].dst_id == ctx->node->node_id)
+			ctx->sighand[i]->flags &= (uint8_t)~AUTHREQ_SENT;
+	cp->last_auth = 0;
+	cp->resync_backoff = MACAN_RESYNC_MIN;
+	macan_deadline_set(ctx, &cp->resync_dl, read_time() + cp->resync_backoff);
+}
+
+/**
+ * Handle the liveness or resync deadline of a partner.
+ */
+static void partner_check(struct macan_ctx *ctx, struct com_part *cp)
+{
+	uint64_t now = read_time();
+	macan_ecuid e = cp->ecu_id;
+	uint32_t i;
+
+	if (!cp->resync_backoff) {
+		/* Liveness check */
+		if (cp->last_auth && now - cp->last_auth < ctx->config->liveness_timeout)
+			macan_deadline_set(ctx, &cp->resync_dl, cp->last_auth + ctx->config->liveness_timeout);
+		else if (is_channel_ready(ctx, e)) {
+			partner_lost(ctx, cp, "no authenticated signals");
+			send_ack(ctx, e);
+		}
+		return;
+	}
+
+	if (is_channel_ready(ctx, e) && (cp->last_auth || !expects_signals(ctx, e))) {
+		print_msg(ctx, MSG_OK, "%s resynchronized\n", macan_ecu_name(ctx, e));
+		cp->resync_backoff = 0;
+		if (cp->last_auth && ctx->config->liveness_timeout)
+			macan_deadline_set(ctx, &cp->resync_dl, cp->last_auth + ctx->config->liveness_timeout);
+		return;
+	}
+
+	if (!is_channel_ready(ctx, e)) {
+		send_ack(ctx, e);
+	} else {
+		for (i = 0; i < ctx->config->sig_count; i++)
+			if (ctx->config->sigspec[i].src_id == e &&
+			    ctx->config->sigspec[i].dst_id == ctx->node->node_id)
+				ctx->sighand[i]->flags &= (uint8_t)~AUTHREQ_SENT;
+		request_signals(ctx);
+	}
+
+	if (cp->resync_backoff < ctx->config->skey_chg_timeout / 2) {
+		cp->resync_backoff *= 2;
+	} else {
+		/* The partner may have got a new key from a restarted KS */
+		cp->resync_backoff = ctx->config->skey_chg_timeout;
+		macan_request_key(ctx, e);
+	}
+	macan_deadline_set(ctx, &cp->resync_dl, now + cp->resync_backoff);
+}
+
 static void receive_ack(struct macan_ctx *ctx, const struct can_frame *cf)
 {
 	struct com_part *cp = canid2cpart(ctx, cf->can_id);
 	struct macan_ack *ack = (struct macan_ack *)cf->data;
+	bool group = macan_get_group(ctx->config, macan_crypt_dst(cf)) != NULL;
 	uint8_t plain[8];
 
+	/* ACKs for a group key tell which members have the key */
+	if (group)
+		cp = get_cpart(ctx, macan_crypt_dst(cf));
 	if (!cp)
 		return;
 
@@ -232,6 +452,12 @@ static void receive_ack(struct macan_ctx *ctx, const struct can_frame *cf)
 	memcpy(&ack_group, ack->group, 3);
 	ack_group = le32toh(ack_group);
 
+	/* A fresh ACK without us from a partner we already share the
+	 * key with means that the partner has lost its state */
+	if ((ack_group & (1U << ctx->node->node_id)) == 0 && !group &&
+	    is_channel_ready(ctx, cp->ecu_id))
+		partner_lost(ctx, cp, "ACK");
+
 	cp->group_field |= ack_group;
 
 	if ((ack_group & (1U << ctx->node->node_id)) == 0)
@@ -284,6 +510,11 @@ static void request_time_auth(struct macan_ctx *ctx)
 		ctx->time.chal_ts = read_time();
 		gen_challenge(ctx, ctx->time.chg);
 		macan_send_challenge(ctx, ts_id, 0, ctx->time.chg);
+		macan_deadline_cancel(ctx, &ctx->time.req_dl);
+	} else {
+		/* Repeat the request as soon as it is allowed */
+		macan_deadline_set(ctx, &ctx->time.req_dl,
+				   ctx->time.chal_ts + ctx->config->time_req_sep + 1);
 	}
 }
 
@@ -343,7 +574,7 @@ static void receive_skey(struct macan_ctx *ctx, const struct can_frame *cf)
 			return;
 
 		cpart->awaiting_skey = false;
-		cpart->valid_until = read_time() + ctx->config->skey_validity;
+		set_valid_until(ctx, cpart, read_time() + ctx->config->skey_validity);
 
 		if (memcmp(cpart->skey.data, unwrapped, 16) != 0 ||
 		    !cpart->key_received) {
@@ -412,7 +643,7 @@ void receive_time_nonauth(struct macan_ctx *ctx, const struct can_frame *cf)
 static void send_acks(struct macan_ctx *ctx)
 {
         macan_ecuid i;
-	for (i = 0; i < ctx->config->node_count; i++)
+	for (i = 0; i < macan_id_count(ctx->config); i++)
 		if (is_skey_ready(ctx, i))
 			send_ack(ctx, i);
 }
@@ -470,6 +701,7 @@ void receive_time_auth(struct macan_ctx *ctx, const struct can_frame *cf)
 			  time_ts, t->nonauth_ts);
 	}
 	t->ready = true;
+	macan_deadline_cancel(ctx, &t->req_dl);
 
 	print_msg(ctx, MSG_OK,"signed time = %d, offs %"PRIu64"\n",time_ts, t->offs);
 
@@ -488,8 +720,9 @@ void receive_auth_req(struct macan_ctx *ctx, const struct can_frame *cf)
 	struct macan_sig_auth_req *areq;
 	struct com_part *cp;
 	struct sig_handle *sighand;
+	macan_ecuid src;
 
-	if(!(cp = canid2cpart(ctx, cf->can_id)))
+	if (!macan_canid2ecuid(ctx->config, cf->can_id, &src))
 		return;
 
 	areq = (struct macan_sig_auth_req *)cf->data;
@@ -497,13 +730,17 @@ void receive_auth_req(struct macan_ctx *ctx, const struct can_frame *cf)
 	if (areq->sig_num >= ctx->config->sig_count)
 		return;
 
+	/* Requests for group signals are signed with the group key */
+	if (!(cp = get_cpart(ctx, sig_key_id(ctx, areq->sig_num, src))))
+		return;
+
 	/* Do not check CMAC when compatible with VW (it does not use CMAC in it's sig requests */
 #ifndef VW_COMPATIBLE
 	uint8_t plain[8];
 	struct macan_key skey;
 
 	skey = cp->skey;
-	plain[4] = (macan_ecuid)cp->ecu_id;
+	plain[4] = src;
 	plain[5] = ctx->node->node_id;
 	plain[6] = areq->sig_num;
 	plain[7] = areq->prescaler;
@@ -532,7 +769,7 @@ void receive_auth_req(struct macan_ctx *ctx, const struct can_frame *cf)
 	   (can_nsid == 0 && can_sid != 0)) {
 		// ignore prescaler
 		sighand->presc = 1;
-		sighand->presc_cnt = 0;
+		sighand->presc_cnt = 1;
 	} else {
 		sighand->presc = areq->prescaler;
 		sighand->presc_cnt = (uint8_t)areq->prescaler;
@@ -623,13 +860,13 @@ int __macan_send_sig(struct macan_ctx *ctx, macan_ecuid dst_id, uint8_t sig_num,
 	cf.can_dlc = 8;
 	memcpy(&cf.data, &sig, 8);
 
-	/* ToDo: assure success */
-	macan_send(ctx, &cf);
+	if (!macan_send(ctx, &cf))
+		return -1;
 
 	return 0;
 }
 
-static void __send_non_secure_sig(struct macan_ctx *ctx, uint8_t sig_num, uint32_t sig_val)
+static bool __send_non_secure_sig(struct macan_ctx *ctx, uint8_t sig_num, uint32_t sig_val)
 {
 	const struct macan_sig_spec *sigspec = ctx->config->sigspec;
 
@@ -638,16 +875,149 @@ static void __send_non_secure_sig(struct macan_ctx *ctx, uint8_t sig_num, uint32
 			.can_id = sigspec[sig_num].can_nsid,
 			.can_dlc = 4 };
 		memcpy(cf.data, &sig_val, sizeof(sig_val));
-		macan_send(ctx, &cf);
 		/* TODO: receive_sig_noauth() expects little endian - ensure it here as well */
+		return macan_send(ctx, &cf);
 	}
-	return;
+	return false;
+}
+
+#ifdef CANFD_MTU
+/* Smallest CAN FD frame length holding @a len bytes */
+static uint8_t canfd_len(unsigned len)
+{
+	static const uint8_t lens[] = { 12, 16, 20, 24, 32, 48, 64 };
+	unsigned i;
+
+	if (len <= 8)
+		return (uint8_t)len;
+	for (i = 0; i < sizeof(lens) - 1 && lens[i] < len; i++)
+		;
+	return lens[i];
+}
+#endif
+
+/**
+ * Send the signals of a PDU in one authenticated frame.
+ *
+ * @param pdu_num   PDU number (index to pdus in the configuration)
+ * @param sig_vals  values of the signals in the order of the PDU spec
+ *
+ * @return Zero on success, -1 if the frame cannot be sent, e.g.
+ * because the session key is not ready yet.
+ */
+int macan_send_pdu(struct macan_ctx *ctx, uint8_t pdu_num, const uint32_t *sig_vals)
+{
+	const struct macan_pdu_spec *pdu;
+	union macan_frame f;
+	uint8_t plain[64];
+	unsigned i, n;
+	uint32_t t, id;
+	macan_ecuid key_id;
+	bool classic;
+
+	if (pdu_num >= ctx->config->pdu_count)
+		return -1;
+	pdu = &ctx->config->pdus[pdu_num];
+	classic = pdu->flags & MACAN_PDU_CLASSIC;
+	key_id = pdu_key_id(ctx, pdu);
+	if (pdu->src_id != ctx->node->node_id ||
+	    pdu->sig_count > (classic ? MACAN_PDU_CLASSIC_SIGS : MACAN_PDU_MAX_SIGS) ||
+	    !is_skey_ready(ctx, key_id) || !ctx->time.ready)
+		return -1;
+
+	for (i = 0, n = 0; i < pdu->sig_count; i++) {
+		uint32_t v = htole32(sig_vals[i]);
+
+		append(plain, &n, &v, classic ? 2 : 4);
+	}
+	t = htole32((uint32_t)macan_get_time(ctx));
+	id = htole32(pdu->can_id);
+	memcpy(plain + n, &t, 4);
+	memcpy(plain + n + 4, &id, 4);
+
+	memset(&f, 0, sizeof(f));
+	f.cf.can_id = pdu->can_id;
+	if (classic) {
+		memcpy(f.cf.data, plain, n);
+		macan_sign_len(&get_cpart(ctx, key_id)->skey, f.cf.data + n, 4, plain, n + 8);
+		f.cf.can_dlc = (uint8_t)(n + 4);
+	} else {
+#ifdef CANFD_MTU
+		memcpy(f.fd.data, plain, n);
+		macan_sign_len(&get_cpart(ctx, key_id)->skey, f.fd.data + n, MACAN_PDU_CMAC_LEN, plain, n + 8);
+		f.fd.len = canfd_len(n + MACAN_PDU_CMAC_LEN);
+		f.fd.flags = CANFD_FDF | CANFD_BRS;
+#else
+		return -1;
+#endif
+	}
+
+	return macan_send(ctx, &f.cf) ? 0 : -1;
+}
+
+/* Send the packed signals of a PDU */
+static void flush_pdu(struct macan_ctx *ctx, uint8_t pdu_num)
+{
+	struct pdu_handle *ph = &ctx->pduhand[pdu_num];
+
+	macan_deadline_cancel(ctx, &ph->dl);
+	ph->pending = 0;
+	/* Like signals, the PDU is dropped when the key is not ready */
+	macan_send_pdu(ctx, pdu_num, ph->vals);
+}
+
+/*
+ * Pack a signal into its PDU. The PDU is sent when all its signals
+ * are published, when a signal is published twice (i.e. in the next
+ * cycle) or when the latency of the PDU expires.
+ */
+static void pack_sig(struct macan_ctx *ctx, const struct sig_handle *sighand, uint32_t sig_val)
+{
+	uint8_t pdu_num = (uint8_t)(sighand->pdu - 1);
+	const struct macan_pdu_spec *pdu = &ctx->config->pdus[pdu_num];
+	struct pdu_handle *ph = &ctx->pduhand[pdu_num];
+	uint16_t bit = (uint16_t)(1U << sighand->pdu_pos);
+
+	if (ph->pending & bit)
+		flush_pdu(ctx, pdu_num);
+	ph->vals[sighand->pdu_pos] = sig_val;
+	ph->pending |= bit;
+	if (ph->pending == (1U << pdu->sig_count) - 1 || !pdu->latency)
+		flush_pdu(ctx, pdu_num);
+	else if (!ph->dl.pos)
+		macan_deadline_set(ctx, &ph->dl, read_time() + pdu->latency);
+}
+
+/* Repeat the last value of a send-on-change signal signed */
+static void send_heartbeat(struct macan_ctx *ctx, uint8_t sig_num)
+{
+	const struct macan_sig_spec *sigspec = &ctx->config->sigspec[sig_num];
+	struct sig_handle *sighand = ctx->sighand[sig_num];
+
+	if (__macan_send_sig(ctx, sigspec->dst_id, sig_num, sighand->last_val) == 0)
+		sighand->sent_auth++;
+	macan_deadline_set(ctx, &sighand->dl, read_time() + sigspec->heartbeat);
+}
+
+/* Heartbeat of a signal we send or staleness of a signal we receive */
+static void sig_deadline(struct macan_ctx *ctx, uint8_t sig_num)
+{
+	struct sig_handle *sighand = ctx->sighand[sig_num];
+
+	if (ctx->config->sigspec[sig_num].src_id == ctx->node->node_id)
+		send_heartbeat(ctx, sig_num);
+	else if (sighand->stale_cback)
+		sighand->stale_cback(sig_num);
 }
 
 /**
  * Dispatch a signal.
  *
  * The prescaler settings are considered and the signal is send.
+ * Signals of PDUs sent by us are packed into the PDU instead (see
+ * struct macan_pdu_spec). Signals with a heartbeat are sent only
+ * when their value changes; when no signed frame was sent for the
+ * heartbeat, the value is repeated signed by the library.
  *
  * @param sig_num  signal id
  * @param sig_val   signal value
@@ -658,29 +1028,53 @@ void macan_send_sig(struct macan_ctx *ctx, uint8_t sig_num, uint32_t sig_val)
 	macan_ecuid dst_id;
 	struct sig_handle **sighand;
 	const struct macan_sig_spec *sigspec;
+	bool auth = false, plain = false;
+	uint8_t presc;
 
 	sighand = ctx->sighand;
 	sigspec = ctx->config->sigspec;
 
 	dst_id = sigspec[sig_num].dst_id;
 
+	if (sighand[sig_num]->pdu && ctx->config->pdus[sighand[sig_num]->pdu - 1].src_id == ctx->node->node_id) {
+		pack_sig(ctx, sighand[sig_num], sig_val);
+		return;
+	}
+	if (sigspec[sig_num].heartbeat && sighand[sig_num]->sent && sighand[sig_num]->last_val == sig_val)
+		return;
+
 	switch (sighand[sig_num]->presc) {
 	case SIG_DONTSIGN:
-		__send_non_secure_sig(ctx, sig_num, sig_val);
+		plain = __send_non_secure_sig(ctx, sig_num, sig_val);
 		break;
 	case SIG_SIGNONCE:
-		__macan_send_sig(ctx, dst_id, sig_num, sig_val);
+		auth = __macan_send_sig(ctx, dst_id, sig_num, sig_val) == 0;
 		sighand[sig_num]->presc = SIG_DONTSIGN;
 		break;
 	default:
+		/* The prescaler adapts to the bus load (see busload.c) */
+		presc = (uint8_t)macan_sig_presc(ctx, sig_num);
+		if (sighand[sig_num]->presc_cnt > presc)
+			sighand[sig_num]->presc_cnt = presc;
 		if (--sighand[sig_num]->presc_cnt == 0) {
-			__macan_send_sig(ctx, dst_id, sig_num, sig_val);
-			sighand[sig_num]->presc_cnt = (uint8_t)sighand[sig_num]->presc;
+			auth = __macan_send_sig(ctx, dst_id, sig_num, sig_val) == 0;
+			sighand[sig_num]->presc_cnt = presc;
 		} else
-			__send_non_secure_sig(ctx, sig_num, sig_val);
+			plain = __send_non_secure_sig(ctx, sig_num, sig_val);
 
 		break;
 	}
+	if (auth)
+		sighand[sig_num]->sent_auth++;
+	if (plain)
+		sighand[sig_num]->sent_plain++;
+
+	if (sigspec[sig_num].heartbeat) {
+		sighand[sig_num]->sent = true;
+		sighand[sig_num]->last_val = sig_val;
+		if (auth || !sighand[sig_num]->dl.pos)
+			macan_deadline_set(ctx, &sighand[sig_num]->dl, read_time() + sigspec[sig_num].heartbeat);
+	}
 }
 
 static void __receive_sig(struct macan_ctx *ctx, uint32_t sig_num, uint32_t sig_val, uint8_t *cmac_ptr,
@@ -714,7 +1108,7 @@ void receive_sig32(struct macan_ctx *ctx, const struct can_frame *cf, uint32_t s
 		return;
 
 	sigspec = &ctx->config->sigspec[sig_num];
-	if (sigspec->dst_id != ctx->node->node_id)
+	if (!is_dst(ctx, sigspec->dst_id))
 		return; /* Ignore signals for other nodes. We don't
 			 * have a session key to check its CMAC. */
 
@@ -756,7 +1150,7 @@ void receive_sig16(struct macan_ctx *ctx, const struct can_frame *cf)
 
 	sigspec = &ctx->config->sigspec[sig_num];
 
-	if (sigspec->dst_id != ctx->node->node_id)
+	if (!is_dst(ctx, sigspec->dst_id))
 		return; /* Ignore signals for other nodes. We don't
 			 * have a session key to check its CMAC. */
 
@@ -768,7 +1162,7 @@ void receive_sig16(struct macan_ctx *ctx, const struct can_frame *cf)
 	time_index = (int)plain_length;
 	append(plain, &plain_length, &dummy_time, 4);
 	append(plain, &plain_length, &sigspec->src_id, 1);
-	append(plain, &plain_length, &ctx->node->node_id, 1);
+	append(plain, &plain_length, &sigspec->dst_id, 1);
 #ifndef VW_COMPATIBLE
 	append(plain, &plain_length, &sig_num, 1);
 #endif
@@ -777,6 +1171,14 @@ void receive_sig16(struct macan_ctx *ctx, const struct can_frame *cf)
 	__receive_sig(ctx, sig_num, sig_val, cmac_ptr, plain, time_index, plain_length);
 }
 
+/* Note an authenticated signal from the partner for the liveness check */
+static void partner_alive(struct macan_ctx *ctx, struct com_part *cp)
+{
+	cp->last_auth = read_time();
+	if (ctx->config->liveness_timeout && !cp->resync_backoff && !cp->resync_dl.pos)
+		macan_deadline_set(ctx, &cp->resync_dl, cp->last_auth + ctx->config->liveness_timeout);
+}
+
 static void __receive_sig(struct macan_ctx *ctx, uint32_t sig_num, uint32_t sig_val, uint8_t *cmac,
 			  uint8_t plain[10], int time_index, unsigned plain_length)
 {
@@ -784,15 +1186,16 @@ static void __receive_sig(struct macan_ctx *ctx, uint32_t sig_num, uint32_t sig_
 	struct com_part *cp;
 	const struct macan_sig_spec *sigspec = &ctx->config->sigspec[sig_num];
 	struct sig_handle *sighand;
+	macan_ecuid key_id = sig_key_id(ctx, sig_num, sigspec->src_id);
 
 	sighand = ctx->sighand[sig_num];
 
-	if (!is_skey_ready(ctx, sigspec->src_id)) {
+	if (!is_skey_ready(ctx, key_id)) {
 		fail_printf(ctx, "No key to check signal #%d from %d\n", sig_num, sigspec->src_id);
 		return;
 	}
 
-	cp = get_cpart(ctx, sigspec->src_id);
+	cp = get_cpart(ctx, key_id);
 	if (!cp)
 		return;
 	skey = cp->skey;
@@ -809,10 +1212,82 @@ static void __receive_sig(struct macan_ctx *ctx, uint32_t sig_num, uint32_t sig_
 
 	print_msg(ctx, MSG_SIGNAL,"Received signal #%d, value: %d\n", sig_num, sig_val);
 
+	if (key_id == sigspec->src_id)
+		partner_alive(ctx, cp);
+	sig_fresh(ctx, (uint8_t)sig_num);
+
 	if (sighand && sighand->cback)
 		sighand->cback((uint8_t)sig_num, sig_val, MACAN_SIGNAL_AUTH);
 }
 
+/**
+ * Receive a PDU.
+ *
+ * Checks the CMAC of the PDU and calls the callbacks of its signals.
+ */
+static void receive_pdu(struct macan_ctx *ctx, const struct can_frame *cf, uint8_t pdu_num)
+{
+	const struct macan_pdu_spec *pdu = &ctx->config->pdus[pdu_num];
+	const uint8_t *data = cf->data;	/* Up to 64 bytes of a CAN FD frame */
+	uint8_t plain[64];
+	bool classic = pdu->flags & MACAN_PDU_CLASSIC;
+	unsigned i, sig_len = classic ? 2U : 4U, n = sig_len * pdu->sig_count;
+	unsigned cmac_len = classic ? 4U : MACAN_PDU_CMAC_LEN;
+	uint32_t id = htole32(cf->can_id);
+	macan_ecuid key_id = pdu_key_id(ctx, pdu);
+	struct com_part *cp = get_cpart(ctx, key_id);
+	enum macan_signal_status status = MACAN_SIGNAL_AUTH;
+
+	if (!is_dst(ctx, pdu->dst_id) ||
+	    pdu->sig_count > (classic ? MACAN_PDU_CLASSIC_SIGS : MACAN_PDU_MAX_SIGS) ||
+	    macan_frame_len(cf) < n + cmac_len)
+		return;
+	if (!cp || !is_skey_ready(ctx, key_id)) {
+		fail_printf(ctx, "No key to check PDU #%d from %d\n", pdu_num, pdu->src_id);
+		return;
+	}
+
+	memcpy(plain, data, n);
+	memcpy(plain + n + 4, &id, 4);
+	if (!macan_check_cmac_len(ctx, &cp->skey, data + n, cmac_len, plain, (int)n, n + 8))
+		status = MACAN_SIGNAL_INVALID;
+	else if (key_id == pdu->src_id)
+		partner_alive(ctx, cp);
+
+	print_msg(ctx, status == MACAN_SIGNAL_AUTH ? MSG_SIGNAL : MSG_FAIL,
+		  "Received PDU #%d%s\n", pdu_num, status == MACAN_SIGNAL_AUTH ? "" : " with wrong CMAC");
+
+	for (i = 0; i < pdu->sig_count; i++) {
+		struct sig_handle *sighand = pdu->sigs[i] < ctx->config->sig_count ?
+			ctx->sighand[pdu->sigs[i]] : NULL;
+		macan_sig_cback cb;
+		uint32_t val = 0;
+
+		if (!sighand)
+			continue;
+		if (status == MACAN_SIGNAL_AUTH)
+			sig_fresh(ctx, pdu->sigs[i]);
+		cb = status == MACAN_SIGNAL_INVALID && sighand->invalid_cback ?
+			sighand->invalid_cback : sighand->cback;
+		memcpy(&val, data + sig_len * i, sig_len);
+		if (cb)
+			cb(pdu->sigs[i], le32toh(val), status);
+	}
+}
+
+/* Get the PDU number from its CAN-ID */
+static bool canid2pdu(struct macan_ctx *ctx, uint32_t can_id, uint8_t *pdu_num)
+{
+	uint8_t i;
+
+	for (i = 0; i < ctx->config->pdu_count; i++)
+		if (ctx->config->pdus[i].can_id == can_id) {
+			*pdu_num = i;
+			return true;
+		}
+	return false;
+}
+
 static
 void receive_sig_noauth(struct macan_ctx *ctx, const struct can_frame *cf, uint32_t sig_num)
 {
@@ -829,7 +1304,7 @@ void receive_sig_noauth(struct macan_ctx *ctx, const struct can_frame *cf, uint3
 
 void macan_request_key(struct macan_ctx *ctx, macan_ecuid fwd_id)
 {
-	struct com_part *cpart = ctx->cpart[fwd_id];
+	struct com_part *cpart = get_cpart(ctx, fwd_id);
 
 	if (!cpart)
 		return;
@@ -845,18 +1320,36 @@ void macan_request_key(struct macan_ctx *ctx, macan_ecuid fwd_id)
 		ctx->rcvd_skey_seq = 0;
 
 		/* Timeout for receiving a new session key */
-		cpart->valid_until = read_time() + ctx->config->skey_chg_timeout;
+		set_valid_until(ctx, cpart, read_time() + ctx->config->skey_chg_timeout);
 	}
 }
 
+/**
+ * Handle all expired deadlines.
+ *
+ * Requests keys that expired (or whose request timed out) and
+ * repeats deferred requests for signed time and resynchronization
+ * with restarted partners. Only the deadlines that are due are
+ * visited.
+ */
 void macan_request_expired_keys(struct macan_ctx *ctx)
 {
-	uint8_t i;
-	struct com_part **cpart = ctx->cpart;
+	struct macan_deadline *dl;
+	uint64_t now = read_time();
 
-	for (i = 0; i < ctx->config->node_count; i++)
-		if (cpart[i] && cpart[i]->valid_until <= read_time())
-			macan_request_key(ctx, i);
+	while ((dl = macan_deadline_first(ctx)) && dl->when <= now) {
+		macan_deadline_cancel(ctx, dl);
+		if (dl->owner == MACAN_DL_TIME)
+			request_time_auth(ctx);
+		else if (dl->owner & MACAN_DL_SIG)
+			sig_deadline(ctx, (uint8_t)(dl->owner & ~MACAN_DL_SIG));
+		else if (dl->owner & MACAN_DL_PDU)
+			flush_pdu(ctx, (uint8_t)(dl->owner & ~MACAN_DL_PDU));
+		else if (dl->owner & MACAN_DL_RESYNC)
+			partner_check(ctx, ctx->cpart[dl->owner & ~MACAN_DL_RESYNC]);
+		else
+			macan_request_key(ctx, (macan_ecuid)dl->owner);
+	}
 }
 
 /**
@@ -916,10 +1409,18 @@ enum macan_process_status macan_process_frame(struct macan_ctx *ctx, const struc
 	uint32_t sig_num;
 	bool secure;
 	macan_ecuid src;
+	uint8_t pdu_num;
 
 	if(cf->can_id == CANID(ctx, ctx->node->node_id))
 		return MACAN_FRAME_PROCESSED; /* Frame sent by us */
 
+	if (canid2pdu(ctx, cf->can_id, &pdu_num)) {
+		receive_pdu(ctx, cf, pdu_num);
+		return MACAN_FRAME_PROCESSED;
+	}
+	if (macan_is_canfd(cf))
+		return MACAN_FRAME_UNKNOWN;
+
 	if (cf->can_id == ctx->config->canid->time) {
 		switch(cf->can_dlc) {
 		case 4:
@@ -947,7 +1448,7 @@ enum macan_process_status macan_process_frame(struct macan_ctx *ctx, const struc
 	if (macan_canid2ecuid(ctx->config, cf->can_id, &src) == ERROR)
 		return MACAN_FRAME_UNKNOWN;
 
-	if (macan_crypt_dst(cf) != ctx->node->node_id)
+	if (!is_dst(ctx, macan_crypt_dst(cf)))
 		return MACAN_FRAME_PROCESSED;
 
 	switch (macan_crypt_flags(cf)) {
@@ -959,10 +1460,26 @@ enum macan_process_status macan_process_frame(struct macan_ctx *ctx, const struc
 			/* REQ_CHALLENGE from KS */
 			macan_ecuid fwd_id = cf->data[1];
 
-			if (fwd_id >= ctx->config->node_count)
+			if (fwd_id >= macan_id_count(ctx->config))
 				return MACAN_FRAME_UNKNOWN;
 
-			macan_request_key(ctx, fwd_id);
+			struct com_part *cp = ctx->cpart[fwd_id];
+
+			if (!cp)
+				return MACAN_FRAME_PROCESSED;
+
+			/* KS generated a new key, the partner may have restarted */
+			if (!macan_get_group(ctx->config, fwd_id) && is_channel_ready(ctx, fwd_id))
+				partner_lost(ctx, cp, "new key");
+
+			/* KS has not seen our challenge, which was
+			 * probably sent before KS was running. KS
+			 * ignores it if it was just slow. */
+			if (cp->awaiting_skey &&
+			    read_time() + ctx->config->skey_chg_timeout - cp->valid_until >= MACAN_RECHALLENGE_SEP)
+				macan_send_challenge(ctx, ctx->config->key_server_id, fwd_id, cp->chg);
+			else
+				macan_request_key(ctx, fwd_id);
 			return MACAN_FRAME_PROCESSED;
 		}
 		return MACAN_FRAME_UNKNOWN;
@@ -1052,7 +1569,29 @@ macan_housekeeping_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
 	(void)loop; (void)revents; /* suppress warnings */
 	struct macan_ctx *ctx = w->data;
 
+	/* The timer is one-shot, it is rearmed below */
+	ctx->hk_armed = UINT64_MAX;
+	ctx->hk_running = true;
 	macan_request_expired_keys(ctx);
+	ctx->hk_running = false;
+	macan_deadline_arm(ctx);
+}
+
+/**
+ * Setup the housekeeping timer and schedule the initial key requests.
+ */
+void macan_housekeeping_init(struct macan_ctx *ctx)
+{
+	macan_ecuid e;
+
+	macan_ev_timer_init(&ctx->housekeeping, macan_housekeeping_cb, 0, 0);
+	ctx->housekeeping.data = ctx;
+	ctx->hk_armed = UINT64_MAX;
+
+	/* Request keys for all partners and groups immediately */
+	for (e = 0; e < macan_id_count(ctx->config); e++)
+		if (ctx->cpart[e])
+			set_valid_until(ctx, ctx->cpart[e], 0);
 }
 
 static void
@@ -1060,10 +1599,12 @@ can_rx_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
 {
 	(void)loop; (void)revents; /* suppress warnings */
 	struct macan_ctx *ctx = w->data;
-	struct can_frame cf;
+	union macan_frame f;
 
-	while (macan_read(ctx, &cf))
-		macan_process_frame(ctx, &cf);
+	while (macan_read(ctx, &f.cf)) {
+		macan_busload_account(ctx, &f.cf);
+		macan_process_frame(ctx, &f.cf);
+	}
 }
 
 /**
@@ -1077,7 +1618,7 @@ struct macan_ctx *macan_alloc_mem(const struct macan_config *config,
 				  const struct macan_node_config *node)
 {
 	/* TODO: error handling (failed allocation) */
-	unsigned i;
+	unsigned i, id_count = macan_id_count(config);
 	uint64_t cparts_bitmap = 0;
 	struct macan_ctx *ctx;
 
@@ -1089,7 +1630,11 @@ struct macan_ctx *macan_alloc_mem(const struct macan_config *config,
 	if (node->node_id == config->key_server_id)
 		return ctx;
 
-	ctx->cpart = calloc(config->node_count, sizeof(struct com_part *));
+	ctx->cpart = calloc(id_count, sizeof(struct com_part *));
+	/* Two deadlines per partner, one per signal and PDU plus the time request */
+	ctx->dlheap = calloc(2U * id_count + config->sig_count + config->pdu_count + 1U,
+			     sizeof(struct macan_deadline *));
+	ctx->time.req_dl.owner = MACAN_DL_TIME;
 
 	/* Figure out how many communication partners is needed */
 	if (node->node_id == config->time_server_id) {
@@ -1110,10 +1655,29 @@ struct macan_ctx *macan_alloc_mem(const struct macan_config *config,
 			if (ss->dst_id == node->node_id)
 				cparts_bitmap |= (1ULL << ss->src_id);
 			ctx->sighand[i] = calloc(1, sizeof(struct sig_handle));
+			ctx->sighand[i]->dl.owner = (uint16_t)(MACAN_DL_SIG | i);
 		}
+		ctx->pduhand = calloc(config->pdu_count, sizeof(struct pdu_handle));
+		for (i = 0; i < config->pdu_count; i++) {
+			const struct macan_pdu_spec *pdu = &config->pdus[i];
+			unsigned j;
+			if (pdu->src_id == node->node_id)
+				cparts_bitmap |= (1ULL << pdu->dst_id);
+			if (pdu->dst_id == node->node_id)
+				cparts_bitmap |= (1ULL << pdu->src_id);
+			for (j = 0; j < pdu->sig_count; j++) {
+				ctx->sighand[pdu->sigs[j]]->pdu = (uint8_t)(i + 1);
+				ctx->sighand[pdu->sigs[j]]->pdu_pos = (uint8_t)j;
+			}
+			ctx->pduhand[i].dl.owner = (uint16_t)(MACAN_DL_PDU | i);
+		}
+		/* Group keys are shared with all members of the group */
+		for (i = 0; i < config->group_count; i++)
+			if (config->groups[i].members & (1U << node->node_id))
+				cparts_bitmap |= (1ULL << config->groups[i].group_id);
 	}
 	/* Allocate communication partners */
-	for(i = 0; i < config->node_count; i++)
+	for(i = 0; i < id_count; i++)
 		if (cparts_bitmap & (1ULL << i))
 			ctx->cpart[i] = calloc(1, sizeof(struct com_part));
 
@@ -1125,13 +1689,17 @@ void __macan_init(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd)
 	ctx->sockfd = sockfd;
 	ctx->loop = loop;
 
+	macan_txq_init(ctx);
 	macan_target_init(ctx);
 
 	if (ctx->cpart) { /* All nodes but KS */
 		macan_ecuid e;
-		for (e = 0; e < ctx->config->node_count; e++)
-			if (ctx->cpart[e])
+		for (e = 0; e < macan_id_count(ctx->config); e++)
+			if (ctx->cpart[e]) {
 				ctx->cpart[e]->ecu_id = e;
+				ctx->cpart[e]->dl.owner = e;
+				ctx->cpart[e]->resync_dl.owner = (uint16_t)(e | MACAN_DL_RESYNC);
+			}
 	}
 }
 
@@ -1160,15 +1728,39 @@ int macan_init(struct macan_ctx *ctx,
 		ctx->sighand[i]->presc_cnt = 1;
 		ctx->sighand[i]->flags = 0;
 		ctx->sighand[i]->cback = NULL;
+		ctx->sighand[i]->stale_cback = NULL;
 	}
 
 	/* Initialize event handlers */
 	macan_ev_canrx_setup (ctx, &ctx->can_watcher, can_rx_cb);
-	macan_ev_timer_setup (ctx, &ctx->housekeeping, macan_housekeeping_cb, 0, 1000);
+	macan_housekeeping_init(ctx);
 
 	return 0;
 }
 
+/**
+ * Stop all event watchers of the context.
+ *
+ * Used to replace the context by a fresh one, e.g. to simulate a
+ * restart of the node. Timers set up by the application have to be
+ * stopped by the application.
+ */
+void macan_deinit(struct macan_ctx *ctx)
+{
+	macan_ev_can_stop(ctx->loop, &ctx->can_watcher);
+	macan_txq_stop(ctx);
+	if (ctx->dlheap) {
+		macan_ev_timer_stop(ctx->loop, &ctx->housekeeping);
+		ctx->hk_armed = UINT64_MAX;
+	}
+	if (ctx->node->node_id == ctx->config->time_server_id)
+		macan_ev_timer_stop(ctx->loop, &ctx->ts.time_bcast);
+	if (ctx->node->node_id == ctx->config->key_server_id && ctx->ks.predist)
+		macan_ev_timer_stop(ctx->loop, &ctx->ks.predist_timer);
+	if (ctx->fault)
+		macan_fault_detach(ctx);
+}
+
 void
 macan_ev_timer_setup(struct macan_ctx *ctx, macan_ev_timer *ev,
 		    void (*cb) (macan_ev_loop *loop,  macan_ev_timer *w, int revents),
@@ -1194,5 +1786,7 @@ macan_ev_canrx_setup(struct macan_ctx *ctx, macan_ev_can *ev,
 
 const char *macan_ecu_name(struct macan_ctx *ctx, macan_ecuid id)
 {
+	if (id >= ctx->config->node_count)
+		return "group";
 	return ctx->config->canid->ecu[id].name;
 }
@@ -0,0 +1,505 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Simulated target for the discrete event simulation (see macan_sim.h)
+ *
+ * Sent frames are appended to a log together with their arrival time.
+ * As the virtual clock never goes back and the bus delay is the same
+ * for all frames, the log is sorted by arrival. Every node reads the
+ * log at its own pace into its receive ring, like a CAN controller
+ * filling its FIFO.
+ *
+ * With a bitrate set, sent frames first wait in the TX queue of their
+ * node. Whenever the bus is idle, the queued frame with the highest
+ * priority wins the arbitration and is appended to the log with the
+ * time its transmission ends. Frames do not preempt each other, so a
+ * high priority frame may wait for a long one already on the bus. The
+ * data phase of CAN FD frames with bit rate switching is sent with the
+ * data bitrate.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "macan_private.h"
+#include "macan_sim.h"
+
+#define SIM_MAX_LAG 65536	/* Frames a node may lag before it loses them */
+
+struct sim_frame {
+	uint64_t at;		/* Arrival time */
+	int src;
+	union macan_frame f;
+};
+
+struct sim_txframe {
+	uint64_t queued;
+	uint32_t prio;		/* Arbitration field, lower wins */
+	union macan_frame f;
+};
+
+struct sim_node {
+	struct macan_rxring rx;
+	int id;
+	uint64_t tail;		/* Next frame in the log */
+	struct sim_txframe *txq; /* Sorted by priority, FIFO for equal IDs */
+	unsigned txq_len, txq_size;
+};
+
+static uint64_t now, until = UINT64_MAX, delay;
+static uint32_t bitrate, data_bitrate;
+static uint64_t busy_until;	/* End of the frame on the bus */
+static uint64_t rand_state;
+static struct sim_node **nodes;	/* Not moved, watchers point to rx */
+static unsigned node_count;
+static struct sim_frame *log_buf;
+static uint64_t log_base, log_end;	/* Sequence numbers of the log */
+static size_t log_size;
+static macan_sim_tap_fn *tap;
+static void *tap_arg;
+static macan_sim_tx_fn *tx_hook;
+static void *tx_arg;
+static struct macan_sim_stats stats;
+
+/**
+ * Starts a new simulation at virtual time 0 with no nodes
+ *
+ * Contexts and event loops of the previous simulation must not be used
+ * any more.
+ */
+void macan_sim_reset(uint64_t seed)
+{
+	unsigned i;
+
+	for (i = 0; i < node_count; i++) {
+		free(nodes[i]->txq);
+		free(nodes[i]);
+	}
+	free(nodes);
+	free(log_buf);
+	nodes = NULL;
+	node_count = 0;
+	log_buf = NULL;
+	log_base = log_end = 0;
+	log_size = 0;
+	now = 0;
+	until = UINT64_MAX;
+	delay = 0;
+	bitrate = 0;
+	data_bitrate = 0;
+	busy_until = 0;
+	tap = NULL;
+	tx_hook = NULL;
+	memset(&stats, 0, sizeof(stats));
+	rand_state = seed;
+}
+
+/**
+ * Attaches a new node to the bus
+ *
+ * @return CAN interface to be passed to macan_init() and friends
+ */
+int macan_sim_open(void)
+{
+	struct sim_node **n = realloc(nodes, (node_count + 1) * sizeof(*nodes));
+
+	if (!n)
+		return -1;
+	nodes = n;
+	nodes[node_count] = calloc(1, sizeof(**nodes));
+	if (!nodes[node_count])
+		return -1;
+	nodes[node_count]->id = (int)node_count;
+	/* Frames sent from now on are received */
+	nodes[node_count]->tail = log_end;
+	return (int)node_count++;
+}
+
+/**
+ * Sets the time between sending and receiving a frame (default 0)
+ */
+void macan_sim_set_delay(uint64_t delay_us)
+{
+	delay = delay_us;
+}
+
+/**
+ * Sets the bitrate of the bus (default 0)
+ *
+ * With a non-zero bitrate, frames are arbitrated by their CAN IDs and
+ * occupy the bus for the time their bits take, including stuff bits
+ * and the interframe space. With 0, the bus is ideal and frames are
+ * received right after they are sent.
+ */
+void macan_sim_set_bitrate(uint32_t bits_per_sec)
+{
+	bitrate = bits_per_sec;
+}
+
+/**
+ * Sets the bitrate of the data phase of CAN FD frames (default 0)
+ *
+ * With 0, the whole frame is sent with the bitrate set by
+ * macan_sim_set_bitrate().
+ */
+void macan_sim_set_data_bitrate(uint32_t bits_per_sec)
+{
+	data_bitrate = bits_per_sec;
+}
+
+/**
+ * Sets a function called whenever a frame wins the arbitration
+ *
+ * Only called with a non-zero bitrate.
+ */
+void macan_sim_set_tx_hook(macan_sim_tx_fn *fn, void *arg)
+{
+	tx_hook = fn;
+	tx_arg = arg;
+}
+
+void macan_sim_set_tap(macan_sim_tap_fn *fn, void *arg)
+{
+	tap = fn;
+	tap_arg = arg;
+}
+
+/**
+ * Runs the loop until the virtual time reaches @a until_us, nothing
+ * remains to be done or macan_ev_break() is called
+ *
+ * @return The virtual time
+ */
+uint64_t macan_sim_run(macan_ev_loop *loop, uint64_t until_us)
+{
+	until = until_us;
+	macan_ev_run(loop);
+	until = UINT64_MAX;
+	return now;
+}
+
+void macan_sim_stats(struct macan_sim_stats *st)
+{
+	*st = stats;
+}
+
+static struct sim_frame *log_at(uint64_t seq)
+{
+	return &log_buf[seq - log_base];
+}
+
+/* Makes room for a frame by dropping frames all nodes have received
+ * or by growing the log */
+static bool log_reserve(void)
+{
+	uint64_t min = log_end;
+	unsigned i;
+
+	if (log_end - log_base < log_size)
+		return true;
+	for (i = 0; i < node_count; i++) {
+		struct sim_node *n = nodes[i];
+
+		if (log_end - n->tail > SIM_MAX_LAG) {
+			n->rx.overflows += (uint32_t)(log_end - SIM_MAX_LAG - n->tail);
+			n->tail = log_end - SIM_MAX_LAG;
+		}
+		if (n->tail < min)
+			min = n->tail;
+	}
+	if (min > log_base) {
+		memmove(log_buf, log_at(min), (size_t)(log_end - min) * sizeof(*log_buf));
+		log_base = min;
+	}
+	if (log_end - log_base == log_size) {
+		size_t size = log_size ? 2 * log_size : 256;
+		struct sim_frame *b = realloc(log_buf, size * sizeof(*log_buf));
+
+		if (!b)
+			return false;
+		log_buf = b;
+		log_size = size;
+	}
+	return true;
+}
+
+/* Arbitration field as sent on the bus: base ID, RTR or SRR, IDE and,
+ * for extended frames, the rest of the ID and RTR */
+static uint32_t arb_field(const struct can_frame *cf)
+{
+	uint32_t rtr = !!(cf->can_id & CAN_RTR_FLAG);
+
+	if (cf->can_id & CAN_EFF_FLAG) {
+		uint32_t id = cf->can_id & CAN_EFF_MASK;
+
+		return (id >> 18) << 21 | 1U << 20 | 1U << 19 | (id & 0x3ffff) << 1 | rtr;
+	}
+	return (cf->can_id & CAN_SFF_MASK) << 21 | rtr << 20;
+}
+
+static bool txq_empty(void)
+{
+	unsigned i;
+
+	for (i = 0; i < node_count; i++)
+		if (nodes[i]->txq_len)
+			return false;
+	return true;
+}
+
+static bool txq_put(struct sim_node *n, const struct can_frame *cf)
+{
+	uint32_t prio = arb_field(cf);
+	unsigned i;
+
+	if (n->txq_len == n->txq_size) {
+		unsigned size = n->txq_size ? 2 * n->txq_size : 16;
+		struct sim_txframe *q = realloc(n->txq, size * sizeof(*q));
+
+		if (!q)
+			return false;
+		n->txq = q;
+		n->txq_size = size;
+	}
+	for (i = n->txq_len; i > 0 && n->txq[i - 1].prio > prio; i--)
+		;
+	memmove(&n->txq[i + 1], &n->txq[i], (n->txq_len - i) * sizeof(*n->txq));
+	n->txq[i].queued = now;
+	n->txq[i].prio = prio;
+	macan_frame_copy(&n->txq[i].f, cf);
+	n->txq_len++;
+	return true;
+}
+
+static void log_put(int src, const struct can_frame *cf, uint64_t at)
+{
+	struct sim_frame *f = log_at(log_end++);
+
+	f->at = at;
+	f->src = src;
+	macan_frame_copy(&f->f, cf);
+}
+
+/* Duration of a frame in us */
+static uint64_t tx_time(unsigned bits, unsigned data_bits)
+{
+	uint32_t drate = data_bitrate ? data_bitrate : bitrate;
+	uint64_t ns = (uint64_t)(bits - data_bits) * 1000000000 / bitrate +
+		(uint64_t)data_bits * 1000000000 / drate;
+
+	return (ns + 999) / 1000;
+}
+
+/* Transmits the winners of the arbitrations that take place until the
+ * current time */
+static void arbitrate(void)
+{
+	while (busy_until <= now) {
+		struct sim_node *win = NULL;
+		struct macan_sim_tx tx;
+		unsigned i;
+
+		for (i = 0; i < node_count; i++) {
+			struct sim_node *n = nodes[i];
+
+			if (n->txq_len && (!win || n->txq[0].prio < win->txq[0].prio))
+				win = n;
+		}
+		if (!win || !log_reserve())
+			break;
+
+		tx.canfd = win->id;
+		tx.f = win->txq[0].f;
+		tx.queued = win->txq[0].queued;
+		tx.bits = macan_can_frame_bits(&tx.cf, &tx.data_bits);
+		tx.start = now;
+		tx.end = now + tx_time(tx.bits, tx.data_bits);
+		log_put(win->id, &tx.cf, tx.end + delay);
+		busy_until = tx.end;
+		stats.busy_us += tx.end - tx.start;
+		stats.queue_us += tx.start - tx.queued;
+		if (tx.start - tx.queued > stats.queue_max_us)
+			stats.queue_max_us = tx.start - tx.queued;
+		if (tx_hook)
+			tx_hook(&tx, tx_arg);
+
+		win->txq_len--;
+		memmove(&win->txq[0], &win->txq[1], win->txq_len * sizeof(*win->txq));
+	}
+}
+
+uint64_t read_time(void)
+{
+	return now;
+}
+
+/*
+ * Generate random bytes (splitmix64, deterministic for a given seed)
+ */
+bool gen_rand_data(void *dest, size_t len)
+{
+	uint8_t *p = dest;
+
+	while (len) {
+		uint64_t z = (rand_state += 0x9e3779b97f4a7c15ULL);
+		size_t n = len < sizeof(z) ? len : sizeof(z);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+		memcpy(p, &z, n);
+		p += n;
+		len -= n;
+	}
+	return SUCCESS;
+}
+
+int helper_init(const char *ifname)
+{
+	int s = macan_sim_open();
+
+	if (s < 0) {
+		perror(ifname);
+		exit(1);
+	}
+	return s;
+}
+
+struct macan_rxring *macan_ev_rxring(int canfd)
+{
+	if (canfd < 0 || (unsigned)canfd >= node_count) {
+		fprintf(stderr, "Invalid simulated interface %d\n", canfd);
+		abort();
+	}
+	return &nodes[canfd]->rx;
+}
+
+void poll_can_fifo(struct macan_rxring *rx)
+{
+	struct sim_node *n = (struct sim_node *)((char *)rx - offsetof(struct sim_node, rx));
+
+	for (; n->tail < log_end && log_at(n->tail)->at <= now; n->tail++) {
+		const struct sim_frame *f = log_at(n->tail);
+
+		if (f->src == n->id)
+			continue;
+		/* When the ring is full, the frame stays in the log */
+		if (macan_rxring_count(rx) >= MACAN_RXRING_SIZE)
+			break;
+		macan_rxring_put(rx, &f->f.cf);
+		stats.deliveries++;
+	}
+}
+
+bool macan_ev_tx_ready(int canfd)
+{
+	(void)canfd;
+	return true;
+}
+
+/* Whether a read watcher has frames to process at the current time */
+static bool frames_due(macan_ev_loop *loop)
+{
+	macan_ev_can *can;
+
+	for (can = loop->cans; can; can = can->next) {
+		struct sim_node *n = nodes[can->canfd];
+
+		if (!(can->events & MACAN_EV_READ))
+			continue;
+		if (!macan_rxring_empty(&n->rx))
+			return true;
+		while (n->tail < log_end && log_at(n->tail)->at <= now && log_at(n->tail)->src == n->id)
+			n->tail++;
+		if (n->tail < log_end && log_at(n->tail)->at <= now)
+			return true;
+	}
+	return false;
+}
+
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us)
+{
+	uint64_t next = deadline_us, seq;
+
+	/* Like a level triggered loop, callbacks that do not read all
+	 * frames at once are called again before time advances */
+	if (frames_due(loop))
+		return;
+
+	arbitrate();
+	if (busy_until > now && busy_until < next && !txq_empty())
+		next = busy_until;
+
+	/* Frames not arrived yet are at the end of the log */
+	for (seq = log_end; seq > log_base && log_at(seq - 1)->at > now; seq--)
+		;
+	if (seq < log_end && log_at(seq)->at < next)
+		next = log_at(seq)->at;
+
+	if (next > until) {
+		/* End of the run */
+		now = until;
+		macan_ev_break(loop);
+		return;
+	}
+	if (next == UINT64_MAX) {
+		/* Nothing will ever happen */
+		macan_ev_break(loop);
+		return;
+	}
+	now = next;
+	stats.steps++;
+}
+
+bool macan_read(struct macan_ctx *ctx, struct can_frame *cf)
+{
+	struct macan_rxring *rx = macan_ev_rxring(ctx->sockfd);
+
+	if (!macan_rxring_get(rx, cf)) {
+		poll_can_fifo(rx);
+		if (!macan_rxring_get(rx, cf))
+			return false;
+	}
+	return true;
+}
+
+enum macan_xmit_status macan_xmit(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	if (bitrate) {
+		if (!txq_put(nodes[ctx->sockfd], cf))
+			return MACAN_XMIT_ERROR;
+	} else {
+		if (!log_reserve())
+			return MACAN_XMIT_ERROR;
+		log_put(ctx->sockfd, cf, now + delay);
+	}
+	stats.frames++;
+	if (tap)
+		tap(now, ctx->sockfd, cf, tap_arg);
+	return MACAN_XMIT_OK;
+}
+
+void macan_target_init(struct macan_ctx *ctx)
+{
+	if (getenv("MACAN_DEBUG"))
+		ctx->print_msg_enabled = true;
+}
@@ -11,6 +11,9 @@
 /* global time */
 static uint64_t time = 0;
 
+/* Frames received by CAN1, filled in CAN1_RX0_IRQHandler() */
+static struct macan_rxring can1_rx;
+
 /* ================ PRIVATE FUNCTIONS ===================== */
 
 /**
@@ -115,6 +118,17 @@ static void can_config(void)
 	CAN_FilterInitStructure.CAN_FilterIdHigh =0x2460;
 	CAN_FilterInitStructure.CAN_FilterNumber = 15;
 	CAN_FilterInit(&CAN_FilterInitStructure);
+
+	/* Receive CAN1 FIFO0 in the interrupt */
+	CAN_ITConfig(CAN1, CAN_IT_FMP0 | CAN_IT_FOV0, ENABLE);
+	NVIC_InitTypeDef nvicStructure;
+	nvicStructure.NVIC_IRQChannel = CAN1_RX0_IRQn;
+	nvicStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	nvicStructure.NVIC_IRQChannelSubPriority = 1;
+	nvicStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&nvicStructure);
+	nvicStructure.NVIC_IRQChannel = CAN1_TX_IRQn;
+	NVIC_Init(&nvicStructure);
 }
 
 /*
@@ -157,6 +171,40 @@ void TIM2_IRQHandler()
     }
 }
 
+/*
+ * ISR for CAN1 FIFO0, moves received frames to can1_rx where
+ * macan_read() picks them up. The hardware FIFO has only three
+ * entries, so emptying it here avoids losing frames in bursts.
+ */
+void CAN1_RX0_IRQHandler()
+{
+	CanRxMsg can_rx_msg;
+	struct can_frame cf;
+
+	if (CAN_GetFlagStatus(CAN1, CAN_FLAG_FOV0) != RESET) {
+		CAN_ClearFlag(CAN1, CAN_FLAG_FOV0);
+		can1_rx.hw_overruns++;
+	}
+
+	while (CAN_MessagePending(CAN1, CAN_FIFO0)) {
+		CAN_Receive(CAN1, CAN_FIFO0, &can_rx_msg);
+		cf.can_id = can_rx_msg.StdId;
+		cf.can_dlc = can_rx_msg.DLC;
+		memcpy(cf.data, can_rx_msg.Data, 8);
+		macan_rxring_put(&can1_rx, &cf);
+	}
+}
+
+/*
+ * ISR for CAN1 transmit mailbox empty - only wakes up macan_ev_wait().
+ * The interrupt is masked here as it would fire again as long as
+ * a mailbox is empty.
+ */
+void CAN1_TX_IRQHandler()
+{
+	CAN_ITConfig(CAN1, CAN_IT_TME, DISABLE);
+}
+
 /* ================ PUBLIC FUNCTIONS ===================== */
 
 /*
@@ -200,9 +248,9 @@ int helper_init() {
 }
 
 /**
- * macan_send() - sends a can frame
+ * macan_xmit() - hands a can frame to a free TX mailbox
  */
-bool macan_send(struct macan_ctx *ctx,  const struct can_frame *cf)
+enum macan_xmit_status macan_xmit(struct macan_ctx *ctx,  const struct can_frame *cf)
 {
 
 	CanTxMsg TxMessage;
@@ -223,10 +271,10 @@ bool macan_send(struct macan_ctx *ctx,  const struct can_frame *cf)
 	ret = CAN_Transmit(CAN1, &TxMessage);
 
 	if(ret == CAN_TxStatus_NoMailBox) {
-		return false;
+		return MACAN_XMIT_BUSY;
 	}
 
-	return true;
+	return MACAN_XMIT_OK;
 }
 /*
  * Generate random bytes
@@ -254,23 +302,51 @@ uint64_t read_time()
 	return time;
 }
 
+struct macan_rxring *macan_ev_rxring(int canfd)
+{
+	(void)canfd;
+	return &can1_rx;
+}
+
+bool macan_ev_tx_ready(int canfd)
+{
+	(void)canfd;
+	return (CAN1->TSR & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) != 0;
+}
+
 /*
- * Poll CAN1 FIFO0
+ * Nothing to do, CAN1 FIFO0 is emptied by CAN1_RX0_IRQHandler()
  */
-void poll_can_fifo(void (*cback)(struct can_frame *cf, void *data), void *data)
+void poll_can_fifo(struct macan_rxring *rx)
 {
-	
-	CanRxMsg can_rx_msg; 
-	struct can_frame cf;
-	int i;
+	(void)rx;
+}
 
-	while(CAN_MessagePending(CAN1,CAN_FIFO0)) {
-		CAN_Receive(CAN1,CAN_FIFO0,&can_rx_msg);	
-		cf.can_id = can_rx_msg.StdId;
-		cf.can_dlc = can_rx_msg.DLC;
-		memcpy(cf.data,can_rx_msg.Data,8);	
-		cback(&cf, data);
-	}	  
+bool macan_read(struct macan_ctx *ctx, struct can_frame *cf)
+{
+	return macan_rxring_get(ctx->can_watcher.rx, cf);
+}
+
+/*
+ * Sleep until the next timer tick, CAN reception or free TX mailbox
+ * (when waited for). The pending
+ * check is done with interrupts disabled so that a frame received
+ * just before WFI is not missed - WFI wakes up on a pending
+ * interrupt even when it is masked by PRIMASK.
+ */
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us)
+{
+	macan_ev_can *can;
+
+	/* Wake up when a TX mailbox gets free if someone waits for it */
+	for (can = loop->cans; can; can = can->next)
+		if (can->events & MACAN_EV_WRITE)
+			CAN_ITConfig(CAN1, CAN_IT_TME, ENABLE);
+
+	__disable_irq();
+	if (macan_rxring_empty(&can1_rx) && read_time() < deadline_us)
+		__WFI();
+	__enable_irq();
 }
 
 void macan_target_init(struct macan_ctx *ctx)
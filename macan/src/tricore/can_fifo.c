@@ -44,15 +44,34 @@ struct Can_HardwareObject
 #define CAN_HWOBJ ((struct Can_HardwareObject volatile *)(void*) &CAN_MOFCR0)
 #define CAN_MOAR_ID_STD_SHIFT  (18U)
 
-void poll_can_fifo(void (*cback)(struct can_frame *cf, void *data), void *data)
+/* MOSTAT is read at the address of MOCTR. Writing a bit of the lower
+ * half-word of MOCTR resets the same bit in MOSTAT. */
+#define CAN_MOSTAT_NEWDAT (1U << 3)
+#define CAN_MOSTAT_MSGLST (1U << 4)
+
+static struct macan_rxring can_rx;
+
+struct macan_rxring *macan_ev_rxring(int canfd)
+{
+	(void)canfd;
+	return &can_rx;
+}
+
+/*
+ * Copy all frames from the receive FIFO to the ring and free the
+ * message objects immediately, so that they can be reused while the
+ * frames are being processed. Frames overwritten in a message object
+ * before it was freed (MSGLST) are counted in hw_overruns.
+ */
+void poll_can_fifo(struct macan_rxring *rx)
 {
 	uint32_t i;
 	Can_IdType can_id;
+	uint32_t stat;
 	struct can_frame cf;
 
 	i = CAN_MOFGPR0.B.SEL - 1;
 
-	/* ToDo: free MOs, i.e. avoid MSGLOST */
 	while (i != CAN_MOFGPR0.B.CUR) {
 		if (CAN_HWOBJ[i].MOAR.B.IDE)
 			can_id = CAN_HWOBJ[i].MOAR.B.ID | CAN_EXTENDED_MSB_SET;
@@ -63,7 +82,12 @@ void poll_can_fifo(void (*cback)(struct can_frame *cf, void *data), void *data)
 		cf.can_dlc = CAN_HWOBJ[i].MOFCR.B.DLC;
 		memcpy(cf.data, (uint8 *) CAN_HWOBJ[i].MODAT, 8);
 
-		cback(&cf, data);
+		stat = CAN_HWOBJ[i].MOCTR.U;
+		if (stat & CAN_MOSTAT_MSGLST)
+			rx->hw_overruns++;
+		CAN_HWOBJ[i].MOCTR.U = CAN_MOSTAT_NEWDAT | CAN_MOSTAT_MSGLST;
+
+		macan_rxring_put(rx, &cf);
 
 		i++;
 		if (i > 32) {
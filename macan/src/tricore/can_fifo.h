@@ -33,6 +33,7 @@
 
 #include <macan.h>
 
-void poll_can_fifo(void (*cback)(struct can_frame *cf, void *data), void *data);
+struct macan_rxring *macan_ev_rxring(int canfd);
+void poll_can_fifo(struct macan_rxring *rx);
 
 #endif /* CAN_FIFO_H_ */
@@ -52,24 +52,36 @@
 #define CAN_IF 1
 
 /**
- * write() - sends a can frame
- * @s:   ignored
+ * macan_xmit() - sends a can frame
+ * @ctx: ignored
  * @cf:  a can frame
- * @len: ignored
  *
- * write implemented on top of AUTOSAR functions.
+ * Implemented on top of AUTOSAR Can_Write(), which returns CAN_BUSY
+ * when no hardware object is free.
  */
-bool macan_send(struct macan_ctx *ctx,  const struct can_frame *cf)
+enum macan_xmit_status macan_xmit(struct macan_ctx *ctx,  const struct can_frame *cf)
 {
 	/* ToDo: consider some use of PduIdType */
 	Can_PduType pdu_info = {17, cf->can_dlc, cf->can_id, cf->data};
-	Can_Write(CAN_IF, &pdu_info);
 
-	/* ToDo: redo */
-	uint64_t wait = read_time();
-	while (wait + 1000 > read_time()) {};
+	switch (Can_Write(CAN_IF, &pdu_info)) {
+	case CAN_OK:
+		return MACAN_XMIT_OK;
+	case CAN_BUSY:
+		return MACAN_XMIT_BUSY;
+	default:
+		return MACAN_XMIT_ERROR;
+	}
+}
 
-	return 16;
+/*
+ * Can_Write() reports a busy hardware object itself, so just let the
+ * transmit queue try again.
+ */
+bool macan_ev_tx_ready(int canfd)
+{
+	(void)canfd;
+	return true;
 }
 
 uint64_t read_time()
@@ -124,5 +136,20 @@ void bench_tack(char *s)
 	printf("%s: %.2f us\n",s,(stop - bench_time) / 100.0);
 }
 
+bool macan_read(struct macan_ctx *ctx, struct can_frame *cf)
+{
+	return macan_rxring_get(ctx->can_watcher.rx, cf);
+}
+
+/*
+ * CAN reception is polled, so we cannot sleep here - just return and
+ * let the event loop poll the FIFO again.
+ */
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us)
+{
+	(void)loop;
+	(void)deadline_us;
+}
+
 void macan_target_init(struct macan_ctx *ctx)
 {}
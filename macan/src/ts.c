@@ -88,15 +88,15 @@ void macan_rx_cb_ts(macan_ev_loop *loop, macan_ev_can *w, int revents)
 {
 	(void)loop; (void)revents; /* suppress warnings */
 	struct macan_ctx *ctx = w->data;
-	struct can_frame cf;
+	union macan_frame f;
 
-	while (macan_read(ctx, &cf)) {
+	while (macan_read(ctx, &f.cf)) {
 		enum macan_process_status status;
 
-		status = macan_process_frame(ctx, &cf);
+		status = macan_process_frame(ctx, &f.cf);
 
 		if (status == MACAN_FRAME_CHALLENGE)
-			ts_receive_challenge(ctx, &cf);
+			ts_receive_challenge(ctx, &f.cf);
 	}
 }
 
@@ -128,7 +128,7 @@ int macan_init_ts(struct macan_ctx *ctx, macan_ev_loop *loop, int sockfd)
 	__macan_init(ctx, loop, sockfd);
 
 	macan_ev_canrx_setup(ctx, &ctx->can_watcher, macan_rx_cb_ts);
-	macan_ev_timer_setup(ctx, &ctx->housekeeping, macan_housekeeping_cb, 0, 1000);
+	macan_housekeeping_init(ctx);
 	macan_ev_timer_setup(ctx, &ctx->ts.time_bcast, time_broadcast_cb, 0, ctx->config->time_div / 1000);
 
 	return 0;
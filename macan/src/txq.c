@@ -0,0 +1,201 @@
+/*
+ *  Copyright 2019 Czech Technical University in Prague
+ *
+ *  This file is part of MaCAN.
+ *
+ *  MaCAN is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  MaCAN is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with MaCAN.	If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Prioritised transmit queue
+ *
+ * macan_send() hands the frame directly to the target's macan_xmit()
+ * when nothing of the same or higher priority is waiting. If the
+ * controller is busy, the frame is queued and a write watcher is
+ * started on the CAN interface. When the controller can accept more
+ * frames, macan_tx_complete() transmits the queued frames, time and
+ * handshake frames before signals. Controllers whose interface stays
+ * writable while their queue is full (ENOBUFS on SocketCAN) are
+ * retried from a timer every MACAN_TXQ_BACKOFF instead.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "macan_debug.h"
+#include "macan_ev.h"
+#include "macan_private.h"
+
+static enum macan_tx_prio tx_prio(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	macan_ecuid ecu;
+
+	if (cf->can_id == ctx->config->canid->time)
+		return MACAN_TX_PRIO_PROTO;
+	if (macan_canid2ecuid(ctx->config, cf->can_id, &ecu) &&
+	    !(macan_crypt_flags(cf) == FL_SIGNAL && cf->can_dlc == 8))
+		return MACAN_TX_PRIO_PROTO; /* Everything but crypt-frame signals */
+	return MACAN_TX_PRIO_SIG;
+}
+
+static bool higher_prio_queued(struct macan_txq *q, enum macan_tx_prio prio)
+{
+	unsigned p;
+
+	for (p = 0; p <= prio; p++)
+		if (q->stats.prio[p].depth)
+			return true;
+	return false;
+}
+
+/* Wait for the watcher (BUSY), the retry timer (RETRY) or nothing (OK) */
+static void txq_wait(struct macan_ctx *ctx, enum macan_xmit_status wait)
+{
+	struct macan_txq *q = &ctx->txq;
+
+	if (wait == q->wait)
+		return;
+	if (q->wait == MACAN_XMIT_BUSY)
+		macan_ev_can_stop(ctx->loop, &q->watcher);
+	else if (q->wait == MACAN_XMIT_RETRY)
+		macan_ev_timer_stop(ctx->loop, &q->retry);
+	if (wait == MACAN_XMIT_BUSY)
+		macan_ev_can_start(ctx->loop, &q->watcher);
+	else if (wait == MACAN_XMIT_RETRY)
+		macan_ev_timer_rearm(ctx->loop, &q->retry, MACAN_TXQ_BACKOFF);
+	q->wait = wait;
+}
+
+static void
+txq_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	(void)loop; (void)revents;
+	macan_tx_complete(w->data);
+}
+
+static void
+retry_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	struct macan_ctx *ctx = w->data;
+
+	ctx->txq.wait = MACAN_XMIT_OK; /* The one-shot timer is stopped */
+	macan_tx_complete(ctx);
+}
+
+/**
+ * Initialize the transmit queue. Frames are passed to the target's
+ * macan_xmit() unless txq.xmit is changed afterwards.
+ */
+void macan_txq_init(struct macan_ctx *ctx)
+{
+	struct macan_txq *q = &ctx->txq;
+
+	q->xmit = macan_xmit;
+	q->wait = MACAN_XMIT_OK;
+	macan_ev_can_init(&q->watcher, txq_cb, ctx->sockfd, MACAN_EV_WRITE);
+	q->watcher.data = ctx;
+	macan_ev_timer_init(&q->retry, retry_cb, 0, 0);
+	q->retry.data = ctx;
+}
+
+/**
+ * Stop waiting for the controller. Queued frames stay queued.
+ */
+void macan_txq_stop(struct macan_ctx *ctx)
+{
+	txq_wait(ctx, MACAN_XMIT_OK);
+}
+
+/**
+ * Send a CAN frame or queue it if the controller is busy.
+ *
+ * @return false if the frame was dropped, either because the queue
+ * is full or because the controller rejected it.
+ */
+bool macan_send(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	struct macan_txq *q = &ctx->txq;
+	enum macan_tx_prio prio = tx_prio(ctx, cf);
+	uint32_t *depth = &q->stats.prio[prio].depth;
+	enum macan_xmit_status st = q->wait; /* Already waiting if anything is queued */
+
+	if (!higher_prio_queued(q, prio)) {
+		st = q->xmit(ctx, cf);
+		switch (st) {
+		case MACAN_XMIT_OK:
+			q->stats.sent++;
+			macan_busload_account(ctx, cf);
+			return true;
+		case MACAN_XMIT_ERROR:
+			q->stats.errors++;
+			return false;
+		case MACAN_XMIT_BUSY:
+		case MACAN_XMIT_RETRY:
+			q->stats.retries++;
+			break;
+		}
+	}
+
+	if (*depth == MACAN_TXQ_LEN) {
+		q->stats.prio[prio].dropped++;
+		fail_printf(ctx, "TX queue full, dropping frame 0x%x\n", (unsigned)cf->can_id);
+		return false;
+	}
+	macan_frame_copy(&q->frame[prio][(q->head[prio] + *depth) % MACAN_TXQ_LEN], cf);
+	if (++*depth > q->stats.prio[prio].max_depth)
+		q->stats.prio[prio].max_depth = *depth;
+	txq_wait(ctx, st);
+	return true;
+}
+
+/**
+ * Transmit queued frames until the controller is busy again.
+ *
+ * Called by the write watcher, the retry timer or directly by targets
+ * that learn about completed transmissions in another way.
+ */
+void macan_tx_complete(struct macan_ctx *ctx)
+{
+	struct macan_txq *q = &ctx->txq;
+	unsigned p;
+
+	for (p = 0; p < MACAN_TX_PRIO_COUNT; p++) {
+		uint32_t *depth = &q->stats.prio[p].depth;
+
+		while (*depth) {
+			const struct can_frame *cf = &q->frame[p][q->head[p]].cf;
+			enum macan_xmit_status st = q->xmit(ctx, cf);
+
+			if (st == MACAN_XMIT_BUSY || st == MACAN_XMIT_RETRY) {
+				q->stats.retries++;
+				txq_wait(ctx, st);
+				return;
+			}
+			if (st == MACAN_XMIT_OK) {
+				q->stats.sent++;
+				macan_busload_account(ctx, cf);
+			} else {
+				q->stats.errors++;
+			}
+			q->head[p] = (uint8_t)((q->head[p] + 1) % MACAN_TXQ_LEN);
+			(*depth)--;
+		}
+	}
+	txq_wait(ctx, MACAN_XMIT_OK);
+}
+
+void macan_get_tx_stats(struct macan_ctx *ctx, struct macan_tx_stats *stats)
+{
+	*stats = ctx->txq.stats;
+}
@@ -82,11 +82,11 @@ struct macan_ctx *ks_ctx;
 static void print_frame_cb (macan_ev_loop *loop, macan_ev_can *w, int revents)
 {
 	(void)loop; (void)revents; (void)w; /* suppress warnings */
-	struct can_frame cf;
+	union macan_frame f;
 	struct macan_ctx faked_ctx = { .sockfd = w->fd };
 
-	while (macan_read(&faked_ctx, &cf))
-		print_frame(ks_ctx, &cf, "       ");
+	while (macan_read(&faked_ctx, &f.cf))
+		print_frame(ks_ctx, &f.cf, "       ");
 }
 
 int main(int argc, char *argv[])
@@ -99,7 +99,7 @@ int main(int argc, char *argv[])
 
 	/* All nodes run in a single process and share one event loop. */
 	for (i = 0; i < NODE_COUNT; i++) {
-		int s = helper_init("can0");
+		int s = helper_init("vbus:can0");
 		node_config[i].node_id = (macan_ecuid)i;
 		node_config[i].ltk = ltk[i];
 		struct macan_ctx *ctx = macan_alloc_mem(&config, &node_config[i]);
@@ -122,7 +122,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	macan_ev_can_init (&can_print, print_frame_cb, helper_init("can0"), EV_READ);
+	macan_ev_can_init (&can_print, print_frame_cb, helper_init("vbus:can0"), EV_READ);
 	macan_ev_can_start (loop, &can_print);
 
 	macan_ev_run(loop);
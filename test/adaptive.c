@@ -0,0 +1,187 @@
+/* Test of the adaptive signing rate of prescaled signals
+ *
+ * A node sends four signals every 10 ms to a receiver on a 500 kbit/s
+ * bus. Every call of macan_send_sig() is to be signed, but the sender
+ * may sign only every eighth one when the bus is loaded. Between 5 s
+ * and 10 s, another node loads the bus with four plain frames every
+ * millisecond. The signing rate, the prescaler and the bus load
+ * estimated by the sender and the bus load of the simulation are
+ * printed for the time before, during and after the load, once with
+ * a fixed and once with the adaptive prescaler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 5
+#define SIG_COUNT 5
+#define SOURCE 2
+#define RECEIVER 3
+#define LOADER 4
+#define LOAD_SIG 4
+#define LOAD_FRAMES 4		/* Per millisecond */
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define SECONDS 15
+
+static struct macan_sig_spec sig_spec[SIG_COUNT] = {
+	{ .can_nsid = 0x220, .can_sid = 0x210, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1, .presc_max = 8 },
+	{ .can_nsid = 0x221, .can_sid = 0x211, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1, .presc_max = 8 },
+	{ .can_nsid = 0x222, .can_sid = 0x212, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1, .presc_max = 8 },
+	{ .can_nsid = 0x223, .can_sid = 0x213, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1, .presc_max = 8 },
+	{ .can_nsid = 0x300, .src_id = LOADER, .dst_id = RECEIVER, .presc = 0 },
+};
+static struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+/* State at the end of every second */
+struct second {
+	uint64_t busy_us;
+	uint32_t auth, plain;	/* Frames of the source's signals */
+	uint32_t rx_auth;	/* Authenticated signals received */
+	uint8_t presc, busload;
+};
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer, load_timer, sample_timer;
+static macan_ev_loop loop;
+static struct second sec[SECONDS + 1];
+static unsigned now_sec;
+static uint32_t rx_auth;
+
+static void rx_cb(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	(void)sig_num; (void)sig_val;
+	if (s == MACAN_SIGNAL_AUTH)
+		rx_auth++;
+}
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint8_t i;
+
+	for (i = 0; i < LOAD_SIG; i++)
+		macan_send_sig(c, i, i);
+}
+
+static void load_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint64_t t = read_time();
+	unsigned i;
+
+	if (t < 5 * SEC || t >= 10 * SEC)
+		return;
+	for (i = 0; i < LOAD_FRAMES; i++)
+		macan_send_sig(c, LOAD_SIG, i);
+}
+
+static void sample_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)w; (void)revents;
+	struct macan_sim_stats st;
+	struct second *s;
+	uint8_t i;
+
+	if (++now_sec > SECONDS)
+		return;
+	s = &sec[now_sec];
+	macan_sim_stats(&st);
+	s->busy_us = st.busy_us;
+	s->rx_auth = rx_auth;
+	for (i = 0; i < LOAD_SIG; i++) {
+		struct macan_sig_stats ss;
+
+		macan_get_sig_stats(ctx[SOURCE], i, &ss);
+		s->auth += ss.auth;
+		s->plain += ss.plain;
+		s->presc = ss.presc;
+		s->busload = ss.busload;
+	}
+}
+
+static void run(bool adaptive)
+{
+	uint8_t s;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(sec, 0, sizeof(sec));
+	now_sec = 0;
+	rx_auth = 0;
+	config.bitrate = adaptive ? 500000 : 0;
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+
+	test_sim_nodes(&config, &loop, ctx);
+	for (s = 0; s < LOAD_SIG; s++)
+		macan_reg_callback(ctx[RECEIVER], s, rx_cb, rx_cb);
+	macan_ev_timer_setup(ctx[SOURCE], &send_timer, send_cb, PERIOD_MS, PERIOD_MS);
+	macan_ev_timer_setup(ctx[LOADER], &load_timer, load_cb, 1, 1);
+	macan_ev_timer_setup(ctx[TIME_SERVER], &sample_timer, sample_cb, 1000, 1000);
+
+	macan_sim_run(&loop, SECONDS * SEC + 1);
+}
+
+struct phase {
+	double signing, load, rx;	/* rx: authenticated signals per second */
+	uint8_t presc, busload;		/* At the end of the phase */
+};
+
+/* Seconds (from, to] */
+static struct phase phase(unsigned from, unsigned to)
+{
+	struct phase p;
+	uint32_t auth = sec[to].auth - sec[from].auth;
+	uint32_t plain = sec[to].plain - sec[from].plain;
+
+	p.signing = (double)auth / (auth + plain);
+	p.load = (double)(sec[to].busy_us - sec[from].busy_us) / ((to - from) * SEC);
+	p.rx = (double)(sec[to].rx_auth - sec[from].rx_auth) / (to - from);
+	p.presc = sec[to].presc;
+	p.busload = sec[to].busload;
+	return p;
+}
+
+int main()
+{
+	static const char *const mode[] = { "fixed", "adaptive" };
+	static const char *const name[] = { "before", "during", "after" };
+	static const unsigned range[3][2] = { { 1, 5 }, { 6, 10 }, { 11, 15 } };
+	struct phase ph[2][3];
+	unsigned m, p;
+
+	for (m = 0; m < 2; m++) {
+		run(m);
+		for (p = 0; p < 3; p++) {
+			ph[m][p] = phase(range[p][0], range[p][1]);
+			printf("%-8s %-6s load: signed %5.1f %% (prescaler %u), %6.1f authenticated "
+			       "signals/s, bus load %4.1f %% (estimated %u %%)\n",
+			       mode[m], name[p], 100 * ph[m][p].signing, ph[m][p].presc,
+			       ph[m][p].rx, 100 * ph[m][p].load, ph[m][p].busload);
+		}
+	}
+	/* The fixed prescaler signs everything */
+	for (p = 0; p < 3; p++)
+		WVPASS(ph[0][p].signing > 0.99);
+	/* The adaptive one backs off under load only */
+	WVPASS(ph[1][0].signing > 0.99 && ph[1][0].presc == 1);
+	WVPASS(ph[1][1].signing < 0.2 && ph[1][1].presc == 8);
+	WVPASS(ph[1][2].signing > 0.99 && ph[1][2].presc == 1);
+	WVPASS(ph[1][1].load < ph[0][1].load);
+	/* Signals stay authenticated at the lower rate */
+	WVPASS(ph[1][1].rx > ph[0][1].rx / 10);
+	return test_status();
+}
@@ -0,0 +1,341 @@
+/* Test and benchmark of the rate and sequence anomaly detector
+ *
+ * Regular traffic with jitter must not raise anomalies, injected
+ * challenges, replayed session keys, unsigned frames of signed
+ * signals and frames sent too often must. The benchmark feeds the
+ * detector with frames of a fully loaded 1 Mbit/s bus.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_anomaly.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_SIGNED,		/* Always signed */
+	SIG_PRESC,		/* Every third frame signed */
+	SIG_ONDEMAND,		/* Signed on request */
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	SENDER,
+	RECEIVER,
+	NODE_COUNT
+};
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_SIGNED]   = {.can_nsid = 0x201, .can_sid = 0x202, .src_id = SENDER, .dst_id = RECEIVER, .presc = 1},
+	[SIG_PRESC]    = {.can_nsid = 0x203, .can_sid = 0x204, .src_id = SENDER, .dst_id = RECEIVER, .presc = 3},
+	[SIG_ONDEMAND] = {.can_nsid = 0,     .can_sid = 0,     .src_id = SENDER, .dst_id = RECEIVER, .presc = 0},
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x000,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100, "KS"},
+		[TIME_SERVER] = {0x101, "TS"},
+		[SENDER]      = {0x102, "S"},
+		[RECEIVER]    = {0x103, "R"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+	.time_div          = 1000000,
+	.skey_validity     = 60000000,
+	.skey_chg_timeout  = 5000000,
+	.time_req_sep      = 1000000,
+	.time_delta        = 1000000,
+};
+
+#define MS 1000000ull
+#define SEC 1000000000ull
+
+static unsigned reports;
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* Period with +-10 % jitter */
+static uint64_t jitter(uint64_t period)
+{
+	return period - period / 10 + rnd() % (period / 5 + 1);
+}
+
+static void anomaly_cb(void *arg, const struct macan_anomaly_info *info)
+{
+	(void)arg;
+	printf("%llu.%06llu %s ID %03x node %d sig %d period %llu interval %llu\n",
+	       (unsigned long long)(info->ts_ns / SEC), (unsigned long long)(info->ts_ns % SEC / 1000),
+	       macan_anomaly_name(info->type), info->can_id, info->node, info->sig_num,
+	       (unsigned long long)info->period_ns, (unsigned long long)info->interval_ns);
+	reports++;
+}
+
+static void frame(struct macan_anomaly *an, uint64_t ts, uint32_t can_id, uint8_t dlc,
+		  uint8_t d0, uint8_t d1, uint8_t d2)
+{
+	struct can_frame cf = { .can_id = can_id, .can_dlc = dlc };
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+		cf.data[i] = (uint8_t)rnd();
+	cf.data[0] = d0;
+	cf.data[1] = d1;
+	cf.data[2] = d2;
+	macan_anomaly_frame(an, ts, &cf);
+}
+
+static void challenge(struct macan_anomaly *an, uint64_t ts, macan_ecuid src, macan_ecuid dst)
+{
+	frame(an, ts, test_can_ids.ecu[src].canid, 8, FL_CHALLENGE << 6 | dst, RECEIVER, (uint8_t)rnd());
+}
+
+/* Session key transfer, the same seed gives the same key */
+static void skey(struct macan_anomaly *an, uint64_t ts, macan_ecuid dst, uint32_t key_seed,
+		 unsigned skip)
+{
+	uint32_t saved = seed;
+	unsigned i;
+
+	seed = key_seed;
+	for (i = 0; i < 6; i++) {
+		if (i == skip)
+			continue;
+		frame(an, ts + i * 100000, test_can_ids.ecu[KEY_SERVER].canid, 8,
+		      FL_SESS_KEY << 6 | dst, (uint8_t)(i << 4 | (i == 5 ? 2 : 6)), (uint8_t)rnd());
+	}
+	seed = saved;
+}
+
+static void auth_time(struct macan_anomaly *an, uint64_t ts)
+{
+	frame(an, ts, test_can_ids.time, 8, 0, 0, 0);
+}
+
+static void plain_time(struct macan_anomaly *an, uint64_t ts)
+{
+	frame(an, ts, test_can_ids.time, 4, 0, 0, 0);
+}
+
+/**
+ * Generate regular traffic for the time from *ts to end.
+ *
+ * Signals SIG_SIGNED every 10 ms, SIG_PRESC every 5 ms (every third
+ * signed) and SIG_ONDEMAND every 20 ms after it was requested. Plain
+ * time every second, authenticated time requested every second.
+ */
+struct traffic {
+	uint64_t ts;
+	uint64_t next_signed, next_presc, next_ondemand, next_time;
+	unsigned presc_cnt;
+	uint32_t key_seed;
+};
+
+static void traffic(struct macan_anomaly *an, struct traffic *t, uint64_t end)
+{
+	while (t->ts < end) {
+		uint64_t ts = t->next_signed;
+
+		if (t->next_presc < ts)
+			ts = t->next_presc;
+		if (t->next_ondemand < ts)
+			ts = t->next_ondemand;
+		if (t->next_time < ts)
+			ts = t->next_time;
+		t->ts = ts;
+
+		if (ts == t->next_signed) {
+			frame(an, ts, test_sig_spec[SIG_SIGNED].can_sid, 8, 0, 0, 0);
+			t->next_signed += jitter(10 * MS);
+		} else if (ts == t->next_presc) {
+			if (t->presc_cnt++ % 3 == 0)
+				frame(an, ts, test_sig_spec[SIG_PRESC].can_sid, 8, 0, 0, 0);
+			else
+				frame(an, ts, test_sig_spec[SIG_PRESC].can_nsid, 4, 0, 0, 0);
+			t->next_presc += jitter(5 * MS);
+		} else if (ts == t->next_ondemand) {
+			frame(an, ts, test_can_ids.ecu[SENDER].canid, 8,
+			      FL_SIGNAL << 6 | RECEIVER, SIG_ONDEMAND, 0);
+			t->next_ondemand += jitter(20 * MS);
+		} else {
+			plain_time(an, ts);
+			challenge(an, ts + 1 * MS, SENDER, TIME_SERVER);
+			auth_time(an, ts + 2 * MS);
+			t->next_time += SEC;
+		}
+	}
+}
+
+static void start(struct macan_anomaly *an, struct traffic *t)
+{
+	*t = (struct traffic){ .ts = 0, .next_signed = 3 * MS, .next_presc = 4 * MS,
+			       .next_ondemand = ~0ull, .next_time = SEC / 2, .key_seed = 77 };
+
+	/* Key distribution */
+	challenge(an, 1 * MS, SENDER, KEY_SERVER);
+	skey(an, 2 * MS, SENDER, t->key_seed, 6);
+	skey(an, 3 * MS, RECEIVER, t->key_seed + 1, 6);
+	challenge(an, 4 * MS, RECEIVER, KEY_SERVER);
+	skey(an, 5 * MS, RECEIVER, t->key_seed + 2, 6);
+	skey(an, 6 * MS, SENDER, t->key_seed + 3, 6);
+	t->ts = 10 * MS;
+	traffic(an, t, SEC);
+
+	/* Request of the on-demand signal */
+	frame(an, SEC + 1 * MS, test_can_ids.ecu[RECEIVER].canid, 7,
+	      FL_AUTH_REQ << 6 | SENDER, SIG_ONDEMAND, 1);
+	t->next_ondemand = SEC + 2 * MS;
+	traffic(an, t, 10 * SEC);
+}
+
+static uint64_t count(struct macan_anomaly *an, enum macan_anomaly_type type)
+{
+	struct macan_anomaly_stats st;
+
+	macan_anomaly_get_stats(an, &st);
+	return st.anomalies[type];
+}
+
+static uint64_t total(struct macan_anomaly *an)
+{
+	struct macan_anomaly_stats st;
+	uint64_t sum = 0;
+	unsigned i;
+
+	macan_anomaly_get_stats(an, &st);
+	for (i = 0; i < MACAN_AN_COUNT; i++)
+		sum += st.anomalies[i];
+	return sum;
+}
+
+static void test_clean(void)
+{
+	struct macan_anomaly *an = macan_anomaly_create(&config, anomaly_cb, NULL);
+	struct traffic t;
+	unsigned i;
+
+	start(an, &t);
+	for (i = 0; i < 5; i++) {
+		/* Session key renewal */
+		uint64_t ts = t.ts + 1 * MS;
+		challenge(an, ts, SENDER, KEY_SERVER);
+		skey(an, ts + 1 * MS, SENDER, t.key_seed + 10 + 2 * i, 6);
+		skey(an, ts + 2 * MS, RECEIVER, t.key_seed + 11 + 2 * i, 6);
+		traffic(an, &t, t.ts + 10 * SEC);
+	}
+	WVPASS(total(an) == 0);
+	macan_anomaly_free(an);
+}
+
+static void test_attacks(void)
+{
+	struct macan_anomaly *an = macan_anomaly_create(&config, anomaly_cb, NULL);
+	struct macan_anomaly_stats st;
+	struct traffic t;
+	uint64_t ts;
+	unsigned i;
+
+	start(an, &t);
+	WVPASS(total(an) == 0);
+
+	/* Challenge flood */
+	for (i = 0, ts = t.ts; i < 100; i++, ts += 1 * MS)
+		challenge(an, ts, RECEIVER, KEY_SERVER);
+	WVPASS(count(an, MACAN_AN_CHALLENGE_FLOOD) > 80);
+	traffic(an, &t, ts);
+
+	/* Replayed session key and an incomplete transfer */
+	skey(an, t.ts + 1 * MS, SENDER, t.key_seed, 6);
+	WVPASS(count(an, MACAN_AN_SKEY_DUPLICATE) == 1);
+	skey(an, t.ts + 2 * MS, SENDER, 1234, 3);
+	WVPASS(count(an, MACAN_AN_SKEY_SEQUENCE) == 1);
+	traffic(an, &t, t.ts + 10 * MS);
+
+	/* Unsigned frame of a signal that is always signed */
+	frame(an, t.ts + 1, test_sig_spec[SIG_SIGNED].can_nsid, 4, 0, 0, 0);
+	WVPASS(count(an, MACAN_AN_NONSECURE) == 1);
+
+	/* Authenticated time nobody asked for */
+	auth_time(an, t.ts + 2);
+	WVPASS(count(an, MACAN_AN_TIME_UNSOLICITED) == 1);
+
+	/* Injected signal frames */
+	for (i = 0, ts = t.ts + 3; i < 20; i++, ts += 1 * MS)
+		frame(an, ts, test_sig_spec[SIG_PRESC].can_sid, 8, 0, 0, 0);
+	WVPASS(count(an, MACAN_AN_RATE) > 0);
+	for (i = 0, ts += 1 * MS; i < 20; i++, ts += 1 * MS)
+		frame(an, ts, test_can_ids.ecu[SENDER].canid, 8, FL_SIGNAL << 6 | RECEIVER, SIG_ONDEMAND, 0);
+
+	macan_anomaly_get_stats(an, &st);
+	WVPASS(st.anomalies[MACAN_AN_RATE] > 20);
+	/* Reports are limited to one per second and stream */
+	WVPASS(st.reported[MACAN_AN_RATE] == 2);
+	WVPASS(st.reported[MACAN_AN_CHALLENGE_FLOOD] == 1);
+	macan_anomaly_free(an);
+}
+
+/* Signals of the benchmark configuration */
+#define BENCH_SIGS 64
+
+static void bench(void)
+{
+	static struct macan_sig_spec sigspec[BENCH_SIGS];
+	struct macan_config cfg = config;
+	struct macan_anomaly *an;
+	struct timespec t0, t1;
+	const unsigned n = 2000000;
+	/* 8-byte frame with worst case stuffing at 1 Mbit/s */
+	const uint64_t frame_ns = 135000;
+	uint64_t ts = 0;
+	double ns;
+	unsigned i;
+
+	for (i = 0; i < BENCH_SIGS; i++)
+		sigspec[i] = (struct macan_sig_spec){ .can_nsid = (uint16_t)(0x300 + 2 * i), .can_sid = (uint16_t)(0x301 + 2 * i),
+						      .src_id = SENDER, .dst_id = RECEIVER, .presc = 4 };
+	cfg.sig_count = BENCH_SIGS;
+	cfg.sigspec = sigspec;
+	an = macan_anomaly_create(&cfg, NULL, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		unsigned sig = i % BENCH_SIGS;
+		struct can_frame cf = { .can_dlc = 8 };
+
+		cf.can_id = (i / BENCH_SIGS) % 4 == 0 ? sigspec[sig].can_sid : sigspec[sig].can_nsid;
+		macan_anomaly_frame(an, ts, &cf);
+		ts += frame_ns;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+	printf("%u frames (%.0f s of a fully loaded bus) in %.3f s, %.1f ns/frame\n",
+	       n, (double)ts / 1e9, ns / 1e9, ns / n);
+	WVPASS(total(an) == 0);
+	WVPASS(ns / n < frame_ns);
+	macan_anomaly_free(an);
+}
+
+int main()
+{
+	test_clean();
+	test_attacks();
+	bench();
+	return test_status();
+}
@@ -43,9 +43,11 @@ struct macan_node_config node_config[NODE_COUNT];
 
 int main(int argc, char *argv[])
 {
-	(void)argc; (void)argv;
 	macan_ev_loop *loop = MACAN_EV_DEFAULT;
 	ev_timer ev_request_key, ev_exit;
+	/* Virtual buses unless interfaces are given */
+	const char *if_i = argc > 2 ? argv[1] : "shm:vcani";
+	const char *if_j = argc > 2 ? argv[2] : "shm:vcanj";
 
 	macan_ecuid i, ecu_from = 0, ecu_to = NODE_COUNT - 1;
 
@@ -55,13 +57,13 @@ int main(int argc, char *argv[])
 		struct macan_ctx *ctx = macan_alloc_mem(&config, &node_config[i]);
 		switch (i) {
 		case KEY_SERVER:
-			macan_init_ks(ctx, loop, helper_init("vcanj"), ltk);
+			macan_init_ks(ctx, loop, helper_init(if_j), ltk);
 			break;
 		case TIME_SERVER:
-			macan_init_ts(ctx, loop, helper_init("vcanj"));
+			macan_init_ts(ctx, loop, helper_init(if_j));
 			break;
 		case ECU_I:
-			macan_init(ctx, loop, helper_init("vcani"));
+			macan_init(ctx, loop, helper_init(if_i));
 			macan_ev_timer_setup(ctx, &ev_request_key, request_key, 100, 0);
 
 			/* This is run as a part of automated test
@@ -70,7 +72,7 @@ int main(int argc, char *argv[])
 			macan_ev_timer_setup(ctx, &ev_exit, do_exit, 200, 0);
 			break;
 		case ECU_J:
-			macan_init(ctx, loop, helper_init("vcanj"));
+			macan_init(ctx, loop, helper_init(if_j));
 			macan_reg_callback(ctx, SIGNAL_0, sig_callback, NULL);
 			break;
 		}
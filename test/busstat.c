@@ -0,0 +1,249 @@
+/* Test of bus load statistics
+ *
+ * Frame lengths are compared with a straightforward bit stuffing
+ * implementation, periodic traffic must be accounted to the right
+ * classes with the right rate and jitter and the snapshots must be
+ * printed. The accounting time per frame is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_busstat.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_A,
+	SIG_B,
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	NODE2,
+	NODE3,
+	NODE_COUNT
+};
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_A] = {.can_nsid = 0x201, .can_sid = 0x202, .src_id = NODE2, .dst_id = NODE3, .presc = 2},
+	[SIG_B] = {.can_nsid = 0,     .can_sid = 0x203,   .src_id = NODE3, .dst_id = NODE2, .presc = 1},
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x001,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100, "KS"},
+		[TIME_SERVER] = {0x101, "TS"},
+		[NODE2]       = {0x102, "ECU2"},
+		[NODE3]       = {0x103, "ECU3"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+};
+
+/* Reference: build the bit stream, compute the CRC and count the stuff
+ * bits bit by bit */
+static unsigned ref_bits(const struct can_frame *cf)
+{
+	unsigned char b[160];
+	unsigned n = 0, i, len, crc = 0, run = 0, stuff = 0, last = 2;
+	bool rtr = cf->can_id & CAN_RTR_FLAG;
+
+#define PUT(v, w) for (i = (w); i-- > 0;) b[n++] = ((v) >> i) & 1
+	len = rtr ? 0 : cf->can_dlc;
+	PUT(0, 1);
+	if (cf->can_id & CAN_EFF_FLAG) {
+		PUT((cf->can_id & CAN_EFF_MASK) >> 18, 11);
+		PUT(1, 1);
+		PUT(1, 1);
+		PUT(cf->can_id & 0x3ffff, 18);
+		PUT(rtr, 1);
+		PUT(0, 2);
+	} else {
+		PUT(cf->can_id, 11);
+		PUT(rtr, 1);
+		PUT(0, 2);
+	}
+	PUT(cf->can_dlc, 4);
+	for (unsigned j = 0; j < len; j++)
+		PUT(cf->data[j], 8);
+	for (unsigned j = 0; j < n; j++) {
+		unsigned top = (crc >> 14) & 1;
+		crc = (crc << 1) & 0x7fff;
+		if (b[j] ^ top)
+			crc ^= 0x4599;
+	}
+	PUT(crc, 15);
+#undef PUT
+	for (i = 0; i < n; i++) {
+		if (b[i] == last) {
+			if (++run == 5) {
+				stuff++;
+				last = !b[i];
+				run = 1;
+			}
+		} else {
+			last = b[i];
+			run = 1;
+		}
+	}
+	return n + stuff + 13;
+}
+
+static void test_bits(void)
+{
+	struct can_frame cf;
+	unsigned i, j, bad = 0, bounds = 0;
+
+	/* All zeros: every fifth bit is stuffed */
+	memset(&cf, 0, sizeof(cf));
+	WVPASS(macan_can_frame_bits(&cf, NULL) == ref_bits(&cf));
+	WVPASS(macan_can_frame_bits(&cf, NULL) > 47);
+
+	srand(1);
+	for (i = 0; i < 100000; i++) {
+		unsigned min, max, bits;
+
+		memset(&cf, 0, sizeof(cf));
+		cf.can_id = (canid_t)rand() & CAN_SFF_MASK;
+		if (i % 3 == 0)
+			cf.can_id = ((canid_t)rand() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		if (i % 17 == 0)
+			cf.can_id |= CAN_RTR_FLAG;
+		cf.can_dlc = (__u8)(rand() % 9);
+		for (j = 0; j < cf.can_dlc; j++)
+			cf.data[j] = (i % 5 == 0) ? (__u8)(i & 1 ? 0xff : 0) : (__u8)rand();
+		bits = macan_can_frame_bits(&cf, NULL);
+		if (bits != ref_bits(&cf))
+			bad++;
+		if (!(cf.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG))) {
+			min = 47 + 8 * (unsigned)cf.can_dlc;
+			max = min + (34 + 8 * (unsigned)cf.can_dlc - 1) / 4;
+			if (bits < min || bits > max)
+				bounds++;
+		}
+	}
+	WVPASS(bad == 0);
+	WVPASS(bounds == 0);
+}
+
+#define F(id, dlc, ...) (struct can_frame){ .can_id = (id), .can_dlc = (dlc), .data = { __VA_ARGS__ } }
+
+static void test_classes(void)
+{
+	struct macan_busstat *bs = macan_busstat_create(&config, 500000);
+	const struct macan_bstat *st;
+	const unsigned ms = 1000000;
+	struct can_frame cf;
+	uint64_t t, bits = 0;
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *json;
+	unsigned i;
+
+	/* 10 ms signal with +-0.5 ms jitter, 100 ms authenticated copy,
+	 * 1 s time and some key exchange */
+	for (i = 0; i < 100; i++) {
+		t = (uint64_t)i * 10 * ms + (i & 1 ? ms / 2 : 0);
+		cf = F(0x201, 4, (__u8)i, 0, 0, 0);
+		bits += macan_can_frame_bits(&cf, NULL);
+		macan_busstat_frame(bs, t, &cf);
+		if (i % 10 == 0) {
+			cf = F(0x202, 8, (__u8)i, 0, 0, 0, 1, 2, 3, 4);
+			macan_busstat_frame(bs, t + 100000, &cf);
+		}
+	}
+	macan_busstat_frame(bs, 0, &F(0x001, 4, 0, 0, 0, 0));
+	macan_busstat_frame(bs, 5 * ms, &F(0x001, 8, 0, 0, 0, 0, 1, 2, 3, 4));
+	macan_busstat_frame(bs, 6 * ms, &F(0x102, 2, FL_REQ_CHALLENGE << 6 | KEY_SERVER, NODE3));
+	macan_busstat_frame(bs, 7 * ms, &F(0x100, 8, FL_SESS_KEY << 6 | NODE2, 0x06, 1, 2, 3, 4, 5, 6));
+	macan_busstat_frame(bs, 8 * ms, &F(0x103, 8, FL_CHALLENGE << 6 | NODE2, NODE2, 1, 2, 3, 4, 5, 6));
+	macan_busstat_frame(bs, 9 * ms, &F(0x103, 8, FL_ACK << 6 | NODE2, 0x05, 0, 0, 1, 2, 3, 4));
+	macan_busstat_frame(bs, 11 * ms, &F(0x102, 7, FL_AUTH_REQ << 6 | NODE3, SIG_A, 1, 1, 2, 3, 4));
+	macan_busstat_frame(bs, 12 * ms, &F(0x103, 8, FL_SIGNAL << 6 | NODE2, SIG_B, 0, 1, 1, 2, 3, 4));
+	macan_busstat_frame(bs, 13 * ms, &F(0x12345 | CAN_EFF_FLAG, 8, 1, 2, 3, 4, 5, 6, 7, 8));
+	macan_busstat_frame(bs, 14 * ms, &F(0x555, 1, 0));
+
+	st = macan_busstat_class(bs, MACAN_BC_SIGNAL);
+	WVPASS(st->frames == 100);
+	WVPASS(st->bits == bits);
+	WVPASS(st->gaps == 99);
+	WVPASS(st->gap_mean > 9.9 * ms && st->gap_mean < 10.1 * ms);
+	WVPASS(st->gap_min == 9 * ms + ms / 2 && st->gap_max == 10 * ms + ms / 2);
+	/* Gaps alternate between 10.5 and 9.5 ms */
+	WVPASS(macan_bstat_jitter(st) > 0.49 * ms && macan_bstat_jitter(st) < 0.51 * ms);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_AUTH_SIG32)->frames == 10);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_TIME)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_AUTH_TIME)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_REQ_CHALLENGE)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_SESS_KEY)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_CHALLENGE)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_ACK)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_AUTH_REQ)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_AUTH_SIG)->frames == 1);
+	WVPASS(macan_busstat_class(bs, MACAN_BC_OTHER)->frames == 2);
+	WVPASS(macan_busstat_id(bs, 0x201)->frames == 100);
+	WVPASS(macan_busstat_id(bs, 0x103)->frames == 3);
+	WVPASS(macan_busstat_id(bs, 0x12345 | CAN_EFF_FLAG)->frames == 1);
+	WVPASS(macan_busstat_id(bs, 0x54321 | CAN_EFF_FLAG) == NULL);
+
+	json = open_memstream(&buf, &size);
+	macan_busstat_report(bs, 1000ULL * ms, stdout, json);
+	fclose(json);
+	printf("%s", buf);
+	WVPASS(strstr(buf, "{\"ts_ns\":1000000000,\"window_s\":1.000000,\"bitrate\":500000,") == buf);
+	WVPASS(strstr(buf, "\"SIGNAL\":{\"fps\":100.000,") != NULL);
+	WVPASS(strstr(buf, "{\"id\":74565,\"fps\":1.000,") != NULL);
+	WVPASS(buf[size - 1] == '\n' && strchr(buf, '\n') == buf + size - 1);
+	free(buf);
+
+	/* New window, totals are kept */
+	st = macan_busstat_class(bs, MACAN_BC_SIGNAL);
+	WVPASS(st->frames == 0 && st->total_frames == 100);
+	macan_busstat_frame(bs, 1005ULL * ms, &F(0x201, 4, 0, 0, 0, 0));
+	WVPASS(st->frames == 1 && st->gaps == 1);
+	macan_busstat_free(bs);
+}
+
+static void bench(void)
+{
+	struct macan_busstat *bs = macan_busstat_create(&config, 500000);
+	static const uint32_t ids[] = { 0x001, 0x100, 0x102, 0x103, 0x201, 0x202, 0x12345 | CAN_EFF_FLAG, 0x555 };
+	const unsigned n = 10000000;
+	struct can_frame cf = F(0, 8, 1, 2, 3, 4, 5, 6, 7, 8);
+	struct timespec t0, t1;
+	unsigned i;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		cf.can_id = ids[i & 7];
+		cf.data[1] = (__u8)i;
+		macan_busstat_frame(bs, (uint64_t)i * 135000, &cf);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+	printf("%.1f ns/frame\n", ns / n);
+	WVPASS(macan_busstat_id(bs, 0x201)->frames == n / 8);
+	macan_busstat_free(bs);
+}
+
+int main()
+{
+	test_bits();
+	test_classes();
+	bench();
+	return test_status();
+}
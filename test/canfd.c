@@ -0,0 +1,123 @@
+/* Test of multi-signal authenticated PDUs on a CAN FD bus
+ *
+ * One node sends eight signals every 10 ms to one receiver on a bus
+ * with a nominal bitrate of 500 kbit/s. On a classic CAN bus, every
+ * signal is signed and sent in a frame of its own. With CAN FD, all
+ * eight signals are signed with one longer CMAC and sent in one PDU
+ * whose data phase runs at 2 Mbit/s. The frames and the bus time per
+ * authenticated signal are printed for both setups and all signals
+ * must be received in both of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 4
+#define SIG_COUNT 8
+#define SOURCE 2
+#define RECEIVER 3
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define DURATION (20 * SEC)
+
+static struct macan_sig_spec sig_spec[SIG_COUNT];
+static const uint8_t pdu_sigs[SIG_COUNT] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+static const struct macan_pdu_spec pdus[] = {
+	{ .can_id = 0x300, .src_id = SOURCE, .dst_id = RECEIVER,
+	  .sig_count = SIG_COUNT, .sigs = pdu_sigs },
+};
+static struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer;
+static macan_ev_loop loop;
+static unsigned received[SIG_COUNT];
+
+static void rx_cb(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	if (s == MACAN_SIGNAL_AUTH && sig_num < SIG_COUNT && sig_val == sig_num)
+		received[sig_num]++;
+}
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint32_t vals[SIG_COUNT];
+	uint8_t i;
+
+	for (i = 0; i < SIG_COUNT; i++)
+		vals[i] = i;
+	if (config.pdu_count)
+		macan_send_pdu(c, 0, vals);
+	else
+		for (i = 0; i < SIG_COUNT; i++)
+			macan_send_sig(c, i, vals[i]);
+}
+
+static void run(bool fd, struct macan_sim_stats *st)
+{
+	uint8_t s;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(received, 0, sizeof(received));
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+	if (fd) {
+		macan_sim_set_data_bitrate(2000000);
+		config.pdu_count = 1;
+		config.pdus = pdus;
+	} else {
+		config.pdu_count = 0;
+		config.pdus = NULL;
+	}
+
+	test_sim_nodes(&config, &loop, ctx);
+	for (s = 0; s < SIG_COUNT; s++)
+		macan_reg_callback(ctx[RECEIVER], s, rx_cb, rx_cb);
+	macan_ev_timer_setup(ctx[SOURCE], &send_timer, send_cb, PERIOD_MS, PERIOD_MS);
+
+	macan_sim_run(&loop, DURATION);
+	macan_sim_stats(st);
+}
+
+int main()
+{
+	static const char *const mode[] = { "classic CAN", "CAN FD PDU" };
+	struct macan_sim_stats st[2];
+	unsigned sigs[2], g, s;
+
+	for (s = 0; s < SIG_COUNT; s++) {
+		sig_spec[s].can_sid = (uint16_t)(0x200 + s);
+		sig_spec[s].src_id = SOURCE;
+		sig_spec[s].dst_id = RECEIVER;
+		sig_spec[s].presc = 1;
+	}
+	for (g = 0; g < 2; g++) {
+		run(g, &st[g]);
+		for (sigs[g] = 0, s = 0; s < SIG_COUNT; s++)
+			sigs[g] += received[s];
+		printf("%-12s %6llu frames, bus load %5.2f %%, %6u signals, "
+		       "%5.3f frames and %6.1f us of bus time per signal\n",
+		       mode[g], (unsigned long long)st[g].frames,
+		       100.0 * (double)st[g].busy_us / DURATION, sigs[g],
+		       (double)st[g].frames / sigs[g], (double)st[g].busy_us / sigs[g]);
+		for (s = 0; s < SIG_COUNT; s++)
+			WVPASS(received[s] > DURATION / 1000 / PERIOD_MS * 9 / 10);
+	}
+	/* Per signal, the PDUs need several times fewer frames and less bus time */
+	WVPASS(st[1].frames * sigs[0] * 3 < st[0].frames * sigs[1]);
+	WVPASS(st[1].busy_us * sigs[0] * 3 < st[0].busy_us * sigs[1]);
+	return test_status();
+}
@@ -0,0 +1,216 @@
+/* Test of the indexed capture file writer and reader
+ *
+ * A synthetic capture spanning many small chunks is written and read
+ * back by time range and by CAN ID, both with the index written by
+ * the writer and with the index rebuilt by the reader. The reader
+ * must also rebuild indexes corrupted to point outside of the file.
+ * CAN FD frames must be skipped.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capfile.h"
+#include "testlib.h"
+
+#define FRAMES		100000
+#define CHUNK_SIZE	(4 * CAPFILE_HDR_SIZE)
+#define RARE_ID		0x200
+#define RARE_FROM	50000
+#define RARE_TO		50100
+
+static uint64_t frame_ts(unsigned i)
+{
+	/* 100 us apart, every 1000th frame is late by 50 us */
+	return (uint64_t)i * 100000 - (i % 1000 == 999 ? 150000 : 0);
+}
+
+static uint32_t frame_id(unsigned i)
+{
+	if (i >= RARE_FROM && i <= RARE_TO)
+		return RARE_ID;
+	return i % 10 == 0 ? 0x100 : 0x300 + i % 7;
+}
+
+static bool write_capture(const char *path, unsigned flags)
+{
+	struct capfile_writer *w = capfile_create(path, CHUNK_SIZE, 0x1234, flags);
+	unsigned i;
+
+	if (!w)
+		return false;
+	WVPASS(capfile_add_if(w, "can0") == 0);
+	WVPASS(capfile_add_if(w, "can1") == 1);
+	WVPASS(capfile_add_if(w, "can0") == 0);
+	for (i = 0; i < FRAMES; i++) {
+		uint8_t data[8];
+		memcpy(data, &i, sizeof(i));
+		memset(data + 4, 0, 4);
+		if (!capfile_write(w, frame_ts(i), (int)(i & 1), frame_id(i), 8, data))
+			break;
+	}
+	/* CAN FD frames are not recorded as truncated classic frames */
+	{
+		uint8_t fd_data[64] = { 0 };
+
+		WVPASS(capfile_write(w, frame_ts(FRAMES), 0, RARE_ID, 64, fd_data));
+		WVPASS(capfile_fd_skipped(w) == 1);
+	}
+	return capfile_close(w) && i == FRAMES;
+}
+
+static void check_capture(const char *path)
+{
+	struct capfile *cap = capfile_open(path);
+	struct capfile_iter it;
+	const struct capfile_rec *r;
+	const struct capfile_id_ent *id;
+	uint64_t prev = 0;
+	unsigned n, expected, i;
+	bool ordered = true, intact = true;
+
+	WVPASS(cap != NULL);
+	if (!cap)
+		return;
+	WVPASS(capfile_hdr(cap)->config_hash == 0x1234);
+	WVPASS(capfile_hdr(cap)->if_count == 2);
+	WVPASS(strcmp(capfile_hdr(cap)->ifname[1], "can1") == 0);
+	WVPASS(capfile_chunks(cap) > 100);
+
+	/* Everything, in order */
+	n = 0;
+	capfile_iter_init(&it, cap, 0, UINT64_MAX);
+	while ((r = capfile_next(&it))) {
+		uint32_t idx;
+		memcpy(&idx, r->data, sizeof(idx));
+		if (r->ts_ns < prev)
+			ordered = false;
+		if (idx != n || r->can_id != frame_id(n) || r->ifidx != (n & 1))
+			intact = false;
+		prev = r->ts_ns;
+		n++;
+	}
+	WVPASS(n == FRAMES);
+	WVPASS(ordered);
+	WVPASS(intact);
+
+	/* Time range in the middle */
+	n = 0;
+	capfile_iter_init(&it, cap, 3000000000ull, 4000000000ull);
+	while ((r = capfile_next(&it)))
+		n++;
+	for (expected = 0, prev = 0, i = 0; i < FRAMES; i++) {
+		uint64_t ts = frame_ts(i) < prev ? prev : frame_ts(i);
+		prev = ts;
+		if (ts >= 3000000000ull && ts <= 4000000000ull)
+			expected++;
+	}
+	WVPASS(n == expected);
+	WVPASS(capfile_seek(cap, 3000000000ull) > 0);
+	WVPASS(capfile_seek(cap, UINT64_MAX) == capfile_chunks(cap));
+
+	/* One CAN ID, visiting only the chunks containing it */
+	id = capfile_find_id(cap, RARE_ID);
+	WVPASS(id != NULL);
+	WVPASS(id && id->frames == RARE_TO - RARE_FROM + 1);
+	WVPASS(id && id->chunk_count <= 2);
+	n = 0;
+	capfile_iter_init_id(&it, cap, RARE_ID, 0, UINT64_MAX);
+	while ((r = capfile_next(&it)))
+		n += r->can_id == RARE_ID;
+	WVPASS(n == RARE_TO - RARE_FROM + 1);
+
+	n = 0;
+	capfile_iter_init_id(&it, cap, 0x100, 1000000000ull, 2000000000ull);
+	while ((r = capfile_next(&it)))
+		n++;
+	WVPASS(n == 1001);	/* Both ends included */
+
+	capfile_iter_init_id(&it, cap, 0x7ff, 0, UINT64_MAX);
+	WVPASS(capfile_next(&it) == NULL);
+
+	capfile_free(cap);
+}
+
+enum corruption { CHUNK_OFFSET, CHUNK_COUNT, LIST_OFF, LIST_ENTRY };
+
+/* Overwrite one field of the index written by write_capture() */
+static void corrupt_index(const char *path, enum corruption what)
+{
+	struct capfile_header hdr;
+	struct capfile_index_hdr ih;
+	uint64_t off64 = UINT64_MAX - 16;
+	uint32_t val = 0x7fffffff;
+	const void *buf = &val;
+	size_t len = sizeof(val);
+	uint64_t pos;
+	int fd = open(path, O_RDWR);
+
+	WVPASS(fd >= 0 && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+	WVPASS(pread(fd, &ih, sizeof(ih), (off_t)hdr.index_offset) == sizeof(ih));
+	pos = hdr.index_offset + sizeof(ih);
+	switch (what) {
+	case CHUNK_OFFSET:	/* Of the sixth chunk, past the end of the file */
+		pos += 5 * sizeof(struct capfile_chunk_ent);
+		buf = &off64;
+		len = sizeof(off64);
+		break;
+	case CHUNK_COUNT:	/* Records in the first chunk */
+		pos += offsetof(struct capfile_chunk_ent, count);
+		break;
+	case LIST_OFF:		/* Chunk list of the first CAN ID */
+		pos += ih.chunk_count * sizeof(struct capfile_chunk_ent) +
+			offsetof(struct capfile_id_ent, list_off);
+		break;
+	case LIST_ENTRY:	/* Last chunk number in the lists */
+		pos += ih.chunk_count * sizeof(struct capfile_chunk_ent) +
+			ih.id_count * sizeof(struct capfile_id_ent) +
+			(ih.list_len - 1) * sizeof(uint32_t);
+		break;
+	}
+	WVPASS(pwrite(fd, buf, len, (off_t)pos) == (ssize_t)len);
+	close(fd);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/capfileXXXXXX";
+	uint64_t zero = 0;
+	enum corruption what;
+	struct capfile *cap;
+	int fd = mkstemp(path);
+
+	WVPASS(fd >= 0);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	WVPASS(write_capture(path, 0));
+	check_capture(path);
+
+	/* Corrupted index */
+	for (what = CHUNK_OFFSET; what <= LIST_ENTRY; what++) {
+		WVPASS(write_capture(path, 0));
+		corrupt_index(path, what);
+		check_capture(path);
+	}
+
+	/* Capture that was not closed: the reader rebuilds the index */
+	fd = open(path, O_WRONLY);
+	WVPASS(pwrite(fd, &zero, sizeof(zero),
+		      offsetof(struct capfile_header, index_offset)) == sizeof(zero));
+	close(fd);
+	check_capture(path);
+
+	/* Empty capture */
+	capfile_close(capfile_create(path, 0, 0, 0));
+	cap = capfile_open(path);
+	WVPASS(cap && capfile_chunks(cap) == 0);
+	if (cap)
+		capfile_free(cap);
+
+	unlink(path);
+	return test_status();
+}
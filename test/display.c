@@ -0,0 +1,220 @@
+/* Test and benchmark of the fast frame display
+ *
+ * Frames of all kinds are rendered by print_frame() and by the
+ * display, whose lines must not differ except for the timestamps.
+ * Then both render frames of a busy bus to /dev/null and the frames
+ * per second are printed.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_display.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_TIME,
+	SIG_SPEED,
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	NODE2,
+	NODE_WITH_A_LONG_NAME,
+	NODE_COUNT
+};
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_TIME]  = {.can_nsid = 0x201, .can_sid = 0x202, .src_id = NODE2, .dst_id = NODE_WITH_A_LONG_NAME, .presc = 2},
+	[SIG_SPEED] = {.can_nsid = 0,     .can_sid = 0x203, .src_id = NODE2, .dst_id = NODE_WITH_A_LONG_NAME, .presc = 1},
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x001,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]            = {0x100, NULL},
+		[TIME_SERVER]           = {0x101, NULL},
+		[NODE2]                 = {0x102, NULL},
+		[NODE_WITH_A_LONG_NAME] = {0x1234567, "LONGNAME"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+};
+
+static struct macan_node_config node = { .node_id = 0xff };
+static struct macan_ctx ctx = { .config = &config, .node = &node };
+#define F(id, dlc, ...) { .can_id = (id), .can_dlc = (dlc), .data = { __VA_ARGS__ } }
+
+static const struct can_frame frames[] = {
+	F(0x001, 4, 1, 2, 3, 4),
+	F(0x001, 8, 0xff, 0xff, 0xff, 0xff, 5, 6, 7, 8),
+	F(0x001, 5, 1),
+	F(0x100, 1, 0),
+	F(0x102, 2, FL_REQ_CHALLENGE << 6 | KEY_SERVER, NODE_WITH_A_LONG_NAME),
+	F(0x102, 3, FL_REQ_CHALLENGE << 6 | KEY_SERVER, 77),
+	F(0x102, 8, FL_CHALLENGE << 6 | KEY_SERVER, NODE_WITH_A_LONG_NAME, 1, 2, 3, 4, 5, 6),
+	F(0x100, 8, FL_SESS_KEY << 6 | NODE2, 0x56, 1, 2, 3, 4, 5, 6),
+	F(0x102, 8, FL_ACK << 6 | 63, 0x05, 0x80, 0x81, 1, 2, 3, 4),
+	F(0x102, 8, FL_ACK << 6 | NODE_WITH_A_LONG_NAME, 0, 0, 0, 1, 2, 3, 4),
+	F(0x1234567, 8, FL_SIGNAL << 6 | NODE2, SIG_SPEED, 0x12, 0x34, 1, 2, 3, 4),
+	F(0x1234567, 3, FL_AUTH_REQ << 6 | NODE2, SIG_TIME, 3),
+	F(0x102, 7, FL_AUTH_REQ << 6 | NODE_WITH_A_LONG_NAME, SIG_SPEED, 0, 1, 2, 3, 4),
+	F(0x102, 5, FL_AUTH_REQ << 6 | NODE_WITH_A_LONG_NAME, SIG_SPEED, 0, 1, 2),
+	F(0x201, 4, 0xde, 0xad, 0xbe, 0xef),
+	F(0x202, 8, 0xde, 0xad, 0xbe, 0xef, 1, 2, 3, 4),
+	F(0x203, 8, 0xde, 0xad, 0xbe, 0xef, 1, 2, 3, 4),
+	F(0x000, 2, 0xaa, 0xbb),
+	F(0x7ff, 0),
+	F(0x123 | CAN_RTR_FLAG, 2),
+	F(0x1abcdef | CAN_EFF_FLAG, 8, 1, 2, 3, 4, 5, 6, 7, 8),
+};
+
+/* Remove the timestamp following the colour escape sequence */
+static void strip_time(char *line)
+{
+	char *dot = strchr(line, '.'), *t = dot;
+
+	while (t > line && (t[-1] == ' ' || (t[-1] >= '0' && t[-1] <= '9')))
+		t--;
+	memmove(t, dot + 4, strlen(dot + 4) + 1);
+}
+
+static void test_same_output(void)
+{
+	char print_path[] = "/tmp/display-print-XXXXXX", disp_path[] = "/tmp/display-disp-XXXXXX";
+	int pfd = mkstemp(print_path), dfd = mkstemp(disp_path);
+	int out = dup(STDOUT_FILENO);
+	struct macan_display *d = macan_display_create(&ctx, dfd, MACAN_DISPLAY_COLOR);
+	char a[512], b[512];
+	unsigned i, same = 0;
+	FILE *pf, *df;
+
+	fflush(stdout);
+	dup2(pfd, STDOUT_FILENO);
+	for (i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+		struct can_frame cf = frames[i];
+		print_frame(&ctx, &cf, "");
+		macan_display_frame(d, i * 1000000000ull, &cf);
+	}
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	macan_display_free(d);
+
+	pf = fopen(print_path, "r");
+	df = fopen(disp_path, "r");
+	for (i = 0; fgets(a, sizeof(a), pf) && fgets(b, sizeof(b), df); i++) {
+		if (i == 1)
+			WVPASS(strstr(b, "   1.000 001#") != NULL);
+		strip_time(a);
+		strip_time(b);
+		if (strcmp(a, b) == 0)
+			same++;
+		else
+			printf("print_frame: %sdisplay:     %s", a, b);
+	}
+	WVPASS(same == sizeof(frames) / sizeof(frames[0]));
+	fclose(pf);
+	fclose(df);
+	unlink(print_path);
+	unlink(disp_path);
+	close(pfd);
+	close(out);
+}
+
+static void test_compact(void)
+{
+	char path[] = "/tmp/display-compact-XXXXXX";
+	int fd = mkstemp(path);
+	struct macan_display *d = macan_display_create(&ctx, fd, MACAN_DISPLAY_COMPACT);
+	struct can_frame sig = frames[10], chg = frames[6];
+	char buf[256] = "";
+
+	macan_display_frame(d, 5000000000ull, &sig);
+	macan_display_frame(d, 6234000000ull, &chg);
+	macan_display_free(d);
+	pread(fd, buf, sizeof(buf) - 1, 0);
+	WVPASS(strcmp(buf, "0.000 567#C201123401020304 LONGNAM>02 sig 1\n"
+		       "1.234 102#4003010203040506 02>KS chg LONGNAME\n") == 0);
+	close(fd);
+	unlink(path);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Signals, with every tenth frame a crypt or time frame */
+static const struct can_frame *bench_frame(unsigned i)
+{
+	static const unsigned mix[10] = { 14, 15, 16, 14, 15, 16, 10, 14, 0, 8 };
+	return &frames[mix[i % 10]];
+}
+
+static void bench(void)
+{
+	const unsigned n = 500000;
+	int null = open("/dev/null", O_WRONLY);
+	int out = dup(STDOUT_FILENO);
+	struct macan_display *d;
+	double t0, t_print, t_disp, t_compact;
+	unsigned i;
+
+	fflush(stdout);
+	dup2(null, STDOUT_FILENO);
+	t0 = now();
+	for (i = 0; i < n; i++) {
+		struct can_frame cf = *bench_frame(i);
+		print_frame(&ctx, &cf, "");
+	}
+	fflush(stdout);
+	t_print = now() - t0;
+	dup2(out, STDOUT_FILENO);
+
+	d = macan_display_create(&ctx, null, MACAN_DISPLAY_COLOR);
+	t0 = now();
+	for (i = 0; i < n; i++)
+		macan_display_frame(d, i * 135000ull, bench_frame(i));
+	macan_display_flush(d);
+	t_disp = now() - t0;
+	macan_display_free(d);
+
+	d = macan_display_create(&ctx, null, MACAN_DISPLAY_COMPACT);
+	t0 = now();
+	for (i = 0; i < n; i++)
+		macan_display_frame(d, i * 135000ull, bench_frame(i));
+	macan_display_flush(d);
+	t_compact = now() - t0;
+	macan_display_free(d);
+
+	printf("print_frame: %.0f frames/s\n", n / t_print);
+	printf("display:     %.0f frames/s\n", n / t_disp);
+	printf("compact:     %.0f frames/s\n", n / t_compact);
+	WVPASS(t_disp < t_print);
+	close(null);
+	close(out);
+}
+
+int main()
+{
+	test_same_output();
+	test_compact();
+	bench();
+	return test_status();
+}
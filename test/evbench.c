@@ -0,0 +1,203 @@
+/* Event loop benchmark at full bus load
+ *
+ * A generator thread offers frames at the rate of a fully loaded
+ * 1 Mbit/s bus (8-byte standard frames without stuffing) and the
+ * MaCAN node echoes each of them back using macan_read() and
+ * macan_send(). The CPU time of the node thread per frame is
+ * reported. The same source is built as evbench_libev and, with
+ * MACAN_EV_URING, as evbench_uring.
+ *
+ * By default the bus is simulated by a socket pair so that the
+ * benchmark runs without CAN hardware. Use -i to run over a real or
+ * virtual CAN interface.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <macan.h>
+#include "helper.h"
+#include "macan_private.h"
+
+#ifdef MACAN_EV_URING
+#define BACKEND "io_uring"
+#else
+#define BACKEND "libev"
+#endif
+
+#define GEN_ID	0x123
+#define ECHO_ID	0x124
+
+enum sig_id { SIGNAL_0, SIG_COUNT };
+enum node_id { KEY_SERVER, TIME_SERVER, NODE, NODE_COUNT };
+
+const struct macan_sig_spec sig_spec[] = {
+	[SIGNAL_0] = {.can_nsid = 0x416, .can_sid = 0x516, .src_id = NODE, .dst_id = NODE, .presc = 1},
+};
+
+const struct macan_can_ids can_ids = {
+	.time = 0x000,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100,"KS"},
+		[TIME_SERVER] = {0x101,"TS"},
+		[NODE]        = {0x102,"N"},
+	},
+};
+
+const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+	.time_div          = 1000000,
+	.skey_validity     = 60000000,
+	.skey_chg_timeout  = 5000000,
+	.time_req_sep      = 1000000,
+	.time_delta        = 1000000,
+};
+
+const struct macan_node_config node = {
+	.node_id = NODE,
+	.ltk = &(struct macan_key) { .data = { 0 } },
+};
+
+static unsigned rate = 8900;	/* 1 Mbit/s / 111 bits per frame */
+static unsigned duration = 3;
+static volatile bool gen_stop;
+static unsigned long offered, echoed, rx_frames;
+
+static void *generator(void *arg)
+{
+	int fd = *(int *)arg;
+	struct can_frame cf = { .can_id = GEN_ID, .can_dlc = 8 }, echo;
+	struct timespec next;
+	double due = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!gen_stop) {
+		/* Offer the frames due in this millisecond */
+		for (due += rate / 1000.0; due >= 1; due--) {
+			memcpy(cf.data, &offered, sizeof(cf.data));
+			if (write(fd, &cf, sizeof(cf)) != sizeof(cf))
+				break;
+			offered++;
+		}
+		while (recv(fd, &echo, sizeof(echo), MSG_DONTWAIT) == sizeof(echo))
+			if (echo.can_id == ECHO_ID)
+				echoed++;
+		next.tv_nsec += 1000000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+	/* Collect echoes still in flight */
+	usleep(10000);
+	while (recv(fd, &echo, sizeof(echo), MSG_DONTWAIT) == sizeof(echo))
+		if (echo.can_id == ECHO_ID)
+			echoed++;
+	return NULL;
+}
+
+static void rx_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	struct macan_ctx *ctx = w->data;
+	union macan_frame f;
+
+	(void)loop; (void)revents;
+	while (macan_read(ctx, &f.cf)) {
+		if (f.cf.can_id != GEN_ID)
+			continue;
+		rx_frames++;
+		f.cf.can_id = ECHO_ID;
+		macan_send(ctx, &f.cf);
+	}
+}
+
+static void stop_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)w; (void)revents;
+	macan_ev_break(loop);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-r frames_per_s] [-d seconds] [-i ifname]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct macan_ctx *ctx;
+	struct macan_tx_stats txs;
+	macan_ev_can rxw;
+	macan_ev_timer stop;
+	struct rusage ru0, ru1;
+	pthread_t gen;
+	const char *ifname = NULL;
+	int fds[2], opt;
+	double cpu_us;
+
+	while ((opt = getopt(argc, argv, "r:d:i:")) != -1) {
+		switch (opt) {
+		case 'r': rate = (unsigned)atoi(optarg); break;
+		case 'd': duration = (unsigned)atoi(optarg); break;
+		case 'i': ifname = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if (ifname) {
+		fds[0] = helper_init(ifname);
+		fds[1] = helper_init(ifname);
+	} else if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) != 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	ctx = macan_alloc_mem(&config, &node);
+	__macan_init(ctx, MACAN_EV_DEFAULT, fds[0]);
+	macan_ev_canrx_setup(ctx, &rxw, rx_cb);
+	macan_ev_timer_setup(ctx, &stop, stop_cb, duration * 1000, 0);
+
+	pthread_create(&gen, NULL, generator, &fds[1]);
+	getrusage(RUSAGE_THREAD, &ru0);
+	macan_ev_run(ctx->loop);
+	getrusage(RUSAGE_THREAD, &ru1);
+	gen_stop = true;
+	pthread_join(gen, NULL);
+
+	cpu_us = (double)(ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec +
+			  ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1e6 +
+		(double)(ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec +
+			 ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec);
+	macan_get_tx_stats(ctx, &txs);
+
+	printf("%s: %u frames/s offered for %u s\n", BACKEND, rate, duration);
+	printf("  offered %lu, received %lu, echoed %lu, tx retries %u, tx dropped %u\n",
+	       offered, rx_frames, echoed, txs.retries, txs.prio[MACAN_TX_PRIO_SIG].dropped);
+	printf("  CPU %.3f us/frame (%.1f %% of one core)\n",
+	       rx_frames ? cpu_us / (double)rx_frames : 0., cpu_us / (duration * 1e4));
+#ifdef MACAN_EV_URING
+	{
+		struct macan_ev_uring_stats us;
+
+		macan_ev_uring_get_stats(ctx->loop, &us);
+		printf("  io_uring_enter %.3f per frame, multishot re-arms %llu, send retries %llu\n",
+		       rx_frames ? (double)us.enters / (double)rx_frames : 0.,
+		       (unsigned long long)us.rx_rearms, (unsigned long long)us.tx_retries);
+	}
+#endif
+	/* Frames offered shortly before the end may not be received */
+	return rx_frames + rate / 100 >= offered && echoed == rx_frames ? 0 : 1;
+}
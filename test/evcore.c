@@ -0,0 +1,355 @@
+/* Test and benchmark of the bare-metal event loop (evcore) on the host
+ *
+ * The target hooks are simulated: read_time() returns virtual time
+ * and macan_ev_wait() advances it to the next timer deadline or the
+ * next scheduled frame arrival, whichever comes first. This is what
+ * an ideal tickless target does, so the number of waits is the
+ * number of wake-ups the target would need.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <can_frame.h>
+#include <macan_evcore.h>
+#include "testlib.h"
+
+/***************************/
+/* Simulated target hooks  */
+/***************************/
+
+static uint64_t now;
+static unsigned sleeps;
+static const uint64_t *rx_at;
+static unsigned rx_cnt, rx_next;
+static struct macan_rxring rxring;
+static uint64_t tx_ready_at = UINT64_MAX;
+
+uint64_t read_time(void)
+{
+	return now;
+}
+
+struct macan_rxring *macan_ev_rxring(int canfd)
+{
+	(void)canfd;
+	return &rxring;
+}
+
+void poll_can_fifo(struct macan_rxring *rx)
+{
+	while (rx_next < rx_cnt && rx_at[rx_next] <= now) {
+		struct can_frame cf = { .can_id = rx_next };
+		rx_next++;
+		macan_rxring_put(rx, &cf);
+	}
+}
+
+bool macan_ev_tx_ready(int canfd)
+{
+	(void)canfd;
+	return now >= tx_ready_at;
+}
+
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us)
+{
+	uint64_t next_rx = rx_next < rx_cnt ? rx_at[rx_next] : UINT64_MAX;
+	uint64_t t = deadline_us < next_rx ? deadline_us : next_rx;
+
+	if (t == UINT64_MAX) {
+		/* Nothing will ever happen - end of the test */
+		macan_ev_break(loop);
+		return;
+	}
+	sleeps++;
+	now = t;
+}
+
+static void reset(macan_ev_loop *loop, const uint64_t *rx, unsigned cnt)
+{
+	memset(loop, 0, sizeof(*loop));
+	memset(&rxring, 0, sizeof(rxring));
+	now = 0;
+	sleeps = 0;
+	rx_at = rx;
+	rx_cnt = cnt;
+	rx_next = 0;
+	tx_ready_at = UINT64_MAX;
+}
+
+/*********/
+/* Tests */
+/*********/
+
+#define LOG_MAX 128
+static struct { uint64_t t; int id; } evlog[LOG_MAX];
+static unsigned evlog_cnt;
+
+static void log_event(int id)
+{
+	if (evlog_cnt < LOG_MAX) {
+		evlog[evlog_cnt].t = now;
+		evlog[evlog_cnt].id = id;
+	}
+	evlog_cnt++;
+}
+
+static void log_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	log_event((int)(intptr_t)w->data);
+}
+
+static void test_oneshot(void)
+{
+	macan_ev_loop loop;
+	macan_ev_timer t;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	macan_ev_timer_init(&t, log_cb, 5, 0);
+	macan_ev_timer_start(&loop, &t);
+	macan_ev_run(&loop);
+
+	WVPASS(evlog_cnt == 1 && evlog[0].t == 5000);
+	WVPASS(sleeps == 1);
+	WVPASS(!t.active);
+}
+
+static void periodic_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	log_event(0);
+	now += 3000;		/* Processing takes some time */
+	if (evlog_cnt == 100)
+		macan_ev_timer_stop(loop, w);
+}
+
+static void test_periodic_no_drift(void)
+{
+	macan_ev_loop loop;
+	macan_ev_timer t;
+	bool exact = true;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	macan_ev_timer_init(&t, periodic_cb, 10, 10);
+	macan_ev_timer_start(&loop, &t);
+	macan_ev_run(&loop);
+
+	for (unsigned i = 0; i < evlog_cnt; i++)
+		exact = exact && evlog[i].t == (i + 1) * 10000;
+	WVPASS(evlog_cnt == 100);
+	WVPASS(exact);
+	WVPASS(sleeps == 100);
+}
+
+static void test_same_deadline_order(void)
+{
+	macan_ev_loop loop;
+	macan_ev_timer t[3];
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	for (int i = 0; i < 3; i++) {
+		macan_ev_timer_init(&t[i], log_cb, 7, 0);
+		t[i].data = (void *)(intptr_t)i;
+		macan_ev_timer_start(&loop, &t[i]);
+	}
+	macan_ev_run(&loop);
+
+	WVPASS(evlog_cnt == 3);
+	WVPASS(evlog[0].id == 0 && evlog[1].id == 1 && evlog[2].id == 2);
+	WVPASS(sleeps == 1);
+}
+
+static void rearm_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	log_event(0);
+	if (evlog_cnt < 4)
+		macan_ev_timer_rearm(loop, w, 1000ULL << evlog_cnt);
+}
+
+static void test_rearm_from_cb(void)
+{
+	macan_ev_loop loop;
+	macan_ev_timer t;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	macan_ev_timer_init(&t, rearm_cb, 1, 0);
+	macan_ev_timer_start(&loop, &t);
+	macan_ev_run(&loop);
+
+	WVPASS(evlog_cnt == 4);
+	WVPASS(evlog[0].t == 1000 && evlog[1].t == 3000 &&
+	       evlog[2].t == 7000 && evlog[3].t == 15000);
+}
+
+static macan_ev_timer *victim;
+
+static void stop_other_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)w; (void)revents;
+	log_event(0);
+	macan_ev_timer_stop(loop, victim);
+}
+
+static void test_stop_other(void)
+{
+	macan_ev_loop loop;
+	macan_ev_timer a, b;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	macan_ev_timer_init(&a, stop_other_cb, 5, 0);
+	macan_ev_timer_init(&b, log_cb, 10, 0);
+	b.data = (void *)1;
+	victim = &b;
+	macan_ev_timer_start(&loop, &b);
+	macan_ev_timer_start(&loop, &a);
+	macan_ev_run(&loop);
+
+	WVPASS(evlog_cnt == 1 && evlog[0].id == 0);
+	WVPASS(macan_ev_next_deadline(&loop) == UINT64_MAX);
+}
+
+static void can_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	struct can_frame cf;
+
+	(void)loop; (void)revents;
+	while (macan_rxring_get(w->rx, &cf))
+		log_event(100 + (int)cf.can_id);
+}
+
+static void count_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	log_event(0);
+	if (now >= 15000)
+		macan_ev_timer_stop(loop, w);
+}
+
+static void test_rx_wakeup(void)
+{
+	static const uint64_t rx[] = { 2500, 7100 };
+	macan_ev_loop loop;
+	macan_ev_can can;
+	macan_ev_timer t;
+
+	reset(&loop, rx, 2);
+	evlog_cnt = 0;
+	macan_ev_can_init(&can, can_cb, 0, MACAN_EV_READ);
+	macan_ev_can_start(&loop, &can);
+	macan_ev_timer_init(&t, count_cb, 5, 5);
+	macan_ev_timer_start(&loop, &t);
+	macan_ev_run(&loop);
+
+	WVPASS(evlog_cnt == 5);
+	WVPASS(evlog[0].id == 100 && evlog[0].t == 2500);
+	WVPASS(evlog[2].id == 101 && evlog[2].t == 7100);
+	/* Woken up only for the five events, never by a periodic tick */
+	WVPASS(sleeps == 5);
+}
+
+static void tx_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	log_event(revents);
+	macan_ev_can_stop(loop, w);
+}
+
+static void test_write_watcher(void)
+{
+	macan_ev_loop loop;
+	macan_ev_can tx;
+	macan_ev_timer t;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	tx_ready_at = 3000;
+	macan_ev_can_init(&tx, tx_cb, 0, MACAN_EV_WRITE);
+	macan_ev_can_start(&loop, &tx);
+	macan_ev_timer_init(&t, log_cb, 5, 0);
+	t.data = (void *)0;
+	macan_ev_timer_start(&loop, &t);
+	now = 1000;
+	macan_ev_run(&loop);
+
+	/* The watcher fires on the first loop iteration after the
+	 * controller becomes ready, i.e. at the timer wake-up */
+	WVPASS(evlog_cnt == 2);
+	WVPASS(evlog[0].id == MACAN_EV_WRITE && evlog[0].t == 5000);
+	WVPASS(evlog[1].id == 0 && evlog[1].t == 5000);
+	WVPASS(loop.cans == NULL);
+}
+
+/*************/
+/* Benchmark */
+/*************/
+
+static void bench_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)w; (void)revents;
+	if (++evlog_cnt >= 1000000)
+		macan_ev_break(loop);
+}
+
+static void benchmark(unsigned ntimers)
+{
+	macan_ev_loop loop;
+	macan_ev_timer *t = calloc(ntimers, sizeof(*t));
+	struct timespec start, end;
+	double ns;
+
+	reset(&loop, NULL, 0);
+	evlog_cnt = 0;
+	srand(1);
+	for (unsigned i = 0; i < ntimers; i++) {
+		unsigned period = 1 + (unsigned)rand() % 100;
+		macan_ev_timer_init(&t[i], bench_cb, period, period);
+		macan_ev_timer_start(&loop, &t[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	macan_ev_run(&loop);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+	printf("%4u timers: %6.1f ns/expiration, %.3f wake-ups/expiration\n",
+	       ntimers, ns / evlog_cnt, (double)sleeps / evlog_cnt);
+	free(t);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		switch (opt) {
+		case 'b':
+			benchmark(1);
+			benchmark(8);
+			benchmark(32);
+			benchmark(128);
+			return 0;
+		default:
+			fprintf(stderr, "Usage: %s [-b]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	test_oneshot();
+	test_periodic_no_drift();
+	test_same_deadline_order();
+	test_rearm_from_cb();
+	test_stop_other();
+	test_rx_wakeup();
+	test_write_watcher();
+
+	return test_status();
+}
@@ -0,0 +1,215 @@
+/* Test of fault injection and recovery of the protocol
+ *
+ * A network of four nodes exchanging two signals on a 500 kbit/s bus
+ * runs in the simulation once for every fault scenario. The time to
+ * recover, i.e. the time from the first fault until the end of the
+ * last outage of authenticated signals, is printed for every scenario
+ * and must be shorter than the session key validity. Gaps of less
+ * than ten signal periods are not considered outages. The second
+ * signal is sent on demand, so it is restored after a restart of
+ * its source only by the resynchronization with the restarted
+ * partner.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_fault.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 4
+#define SIG_COUNT 2
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define OUTAGE (10 * PERIOD_MS * 1000ULL)	/* Longer gaps are outages */
+#define DURATION (60 * SEC)
+
+static struct macan_sig_spec sig_spec[SIG_COUNT] = {
+	{ .can_sid = 0x200, .src_id = 2, .dst_id = 3, .presc = 1 },
+	{ .can_sid = 0,     .src_id = 3, .dst_id = 2, .presc = 0 },
+};
+
+static const struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 30000000,
+	.liveness_timeout  = 1000000,
+};
+
+struct sig_rx {
+	uint64_t last;		/* Last authenticated signal */
+	uint64_t outage_end;	/* End of the last outage */
+	uint64_t max_gap;	/* Longest gap after startup */
+};
+
+static struct sig_rx rx[SIG_COUNT];
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer[NODE_COUNT];
+static macan_ev_loop loop;
+static struct macan_faults *faults;
+
+static void sig_callback(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	uint64_t now = read_time();
+
+	(void)sig_val;
+	if (s != MACAN_SIGNAL_AUTH)
+		return;
+	if (rx[sig_num].outage_end == UINT64_MAX || now - rx[sig_num].last > OUTAGE)
+		rx[sig_num].outage_end = now;
+	if (rx[sig_num].last && now - rx[sig_num].last > rx[sig_num].max_gap)
+		rx[sig_num].max_gap = now - rx[sig_num].last;
+	rx[sig_num].last = now;
+}
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+
+	macan_send_sig(c, (uint8_t)(c->node->node_id - 2), 0);
+}
+
+static void start_node(macan_ecuid i)
+{
+	struct macan_ctx *c = test_sim_node(&config, &loop, i);
+
+	if (i != KEY_SERVER && i != TIME_SERVER) {
+		macan_reg_callback(c, (uint8_t)(3 - i), sig_callback, sig_callback);
+		macan_ev_timer_setup(c, &send_timer[i], send_cb, PERIOD_MS, PERIOD_MS);
+	}
+	macan_fault_attach(faults, c);
+	ctx[i] = c;
+}
+
+/* Replaces the node by a fresh one, which has lost all its state */
+static void restart_node(macan_ecuid i, void *arg)
+{
+	(void)arg;
+	macan_deinit(ctx[i]);
+	if (i != KEY_SERVER && i != TIME_SERVER)
+		macan_ev_timer_stop(&loop, &send_timer[i]);
+	start_node(i);
+}
+
+struct result {
+	bool recovered;
+	uint64_t ttr;		/* Time to recover */
+	uint64_t startup;	/* First authenticated signal */
+	uint64_t max_gap;	/* Longest time without authenticated signals */
+	struct macan_fault_stats st;
+};
+
+static struct result run(const char *script)
+{
+	struct result res = { .recovered = true };
+	macan_ecuid i;
+	unsigned s;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(rx, 0, sizeof(rx));
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+	faults = macan_fault_alloc();
+	macan_fault_parse(faults, script);
+	macan_fault_set_restart(faults, restart_node, NULL);
+	for (i = 0; i < NODE_COUNT; i++)
+		start_node(i);
+
+	/* Startup is an outage of its own */
+	for (s = 0; s < SIG_COUNT; s++)
+		rx[s].outage_end = UINT64_MAX;
+	macan_sim_run(&loop, DURATION);
+	macan_fault_stats(faults, &res.st);
+
+	for (s = 0; s < SIG_COUNT; s++) {
+		if (rx[s].max_gap > res.max_gap)
+			res.max_gap = rx[s].max_gap;
+		if (rx[s].outage_end == UINT64_MAX || DURATION - rx[s].last > OUTAGE) {
+			res.recovered = false;
+			continue;
+		}
+		if (rx[s].outage_end > res.startup && rx[s].outage_end <= res.st.first_us)
+			res.startup = rx[s].outage_end;
+		if (res.st.first_us != UINT64_MAX && rx[s].outage_end > res.st.first_us &&
+		    rx[s].outage_end - res.st.first_us > res.ttr)
+			res.ttr = rx[s].outage_end - res.st.first_us;
+	}
+	macan_fault_free(faults);
+	return res;
+}
+
+static void test_parse(void)
+{
+	struct macan_faults *f = macan_fault_alloc();
+
+	WVPASS(macan_fault_parse(f, "drop SESS_KEY seq 3\n"
+				 "# comment\n"
+				 "\n"
+				 "drop p 0.2 node 2 at 10 s until 12s # outage\n"
+				 "corrupt ACK count 3; delay 5 ms SIGNAL p 0.1\n"
+				 "reorder id 0x200 mask 0x7f0\n"
+				 "restart node 5 at t=10 s") == 0);
+	WVPASS(macan_fault_parse(f, "drop\ndrop FOO") == 2);
+	WVPASS(macan_fault_parse(f, "restart at 1 s") == 1);
+	WVPASS(macan_fault_parse(f, "drop seq 6") == 1);
+	WVPASS(macan_fault_parse(f, "delay SIGNAL") == 1);
+	WVPASS(macan_fault_parse(f, "drop p 2") == 1);
+	WVPASS(macan_fault_parse(f, "drop at 10 min") == 1);
+	macan_fault_free(f);
+}
+
+static const char *const scenarios[] = {
+	"",
+	"drop SESS_KEY seq 3",
+	"drop CHALLENGE",
+	"drop REQ_CHALLENGE",
+	"drop AUTH_REQ",
+	"drop ACK count 2",
+	"corrupt SIGNED_TIME",
+	"drop TIME at 10 s until 20 s",
+	"drop p 0.3 at 10 s until 20 s",
+	"drop node 2 at 10 s until 12 s",
+	"delay 50 ms SIGNAL p 0.1 at 10 s until 20 s",
+	"reorder SIGNAL p 0.1 at 10 s until 20 s",
+	"restart node 0 at 10 s",
+	"restart node 1 at 10 s",
+	"restart node 2 at 10 s",
+	"restart node 3 at 10 s",
+	"restart node 3 at 10 s; drop ACK node 3 at 10 s until 11 s",
+	"restart node 3 at 10 s; drop AUTH_REQ node 2 count 3 at 10 s",
+	"restart node 0 at 10 s; restart node 3 at 10 s",
+};
+
+int main()
+{
+	unsigned i;
+
+	test_parse();
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(*scenarios); i++) {
+		const char *sc = scenarios[i];
+		struct result r = run(sc);
+
+		if (!*sc)
+			printf("%-60s startup %6.3f s\n", "no faults", (double)r.startup / SEC);
+		else if (r.recovered)
+			printf("%-60s recovered in %6.3f s, longest gap %6.3f s "
+			       "(%u dropped, %u corrupted, %u delayed, %u reordered)\n",
+			       sc, (double)r.ttr / SEC, (double)r.max_gap / SEC, r.st.dropped,
+			       r.st.corrupted, r.st.delayed, r.st.reordered);
+		else
+			printf("%-60s not recovered\n", sc);
+		WVPASS(r.recovered && r.ttr < config.skey_validity);
+		if (!*sc)
+			WVPASS(r.st.first_us == UINT64_MAX);
+		else
+			WVPASS(r.st.first_us != UINT64_MAX);
+	}
+	return test_status();
+}
@@ -0,0 +1,193 @@
+/* Test of display filters
+ *
+ * Expressions are matched against frames of every kind, invalid
+ * expressions must be rejected and the CAN IDs for the kernel filter
+ * must cover all matching frames. The evaluation time per frame is
+ * printed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_filter.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_A,
+	SIG_B,
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	NODE2,
+	NODE3,
+	NODE_COUNT
+};
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_A] = {.can_nsid = 0x201, .can_sid = 0x202, .src_id = NODE2, .dst_id = NODE3, .presc = 2},
+	[SIG_B] = {.can_nsid = 0,     .can_sid = 0x203, .src_id = NODE3, .dst_id = NODE2, .presc = 1},
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x001,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100, "KS"},
+		[TIME_SERVER] = {0x101, "TS"},
+		[NODE2]       = {0x102, "ECU2"},
+		[NODE3]       = {0x103, "ECU3"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+};
+
+#define F(id, dlc, ...) { .can_id = (id), .can_dlc = (dlc), .data = { __VA_ARGS__ } }
+
+static const struct can_frame frames[] = {
+	/*  0 */ F(0x001, 4, 100, 0, 0, 0),
+	/*  1 */ F(0x001, 8, 200, 0, 0, 0, 1, 2, 3, 4),
+	/*  2 */ F(0x102, 2, FL_REQ_CHALLENGE << 6 | KEY_SERVER, NODE3),
+	/*  3 */ F(0x102, 8, FL_CHALLENGE << 6 | KEY_SERVER, NODE3, 1, 2, 3, 4, 5, 6),
+	/*  4 */ F(0x100, 8, FL_SESS_KEY << 6 | NODE2, 0x36, 1, 2, 3, 4, 5, 6),
+	/*  5 */ F(0x100, 8, FL_SESS_KEY << 6 | 5, 0x56, 1, 2, 3, 4, 5, 6),
+	/*  6 */ F(0x103, 8, FL_ACK << 6 | NODE2, 0x05, 0, 0, 1, 2, 3, 4),
+	/*  7 */ F(0x103, 8, FL_SIGNAL << 6 | NODE2, SIG_B, 0x12, 0x34, 1, 2, 3, 4),
+	/*  8 */ F(0x102, 7, FL_AUTH_REQ << 6 | NODE3, SIG_A, 3, 1, 2, 3, 4),
+	/*  9 */ F(0x201, 4, 1, 2, 3, 4),
+	/* 10 */ F(0x202, 8, 1, 2, 3, 4, 5, 6, 7, 8),
+	/* 11 */ F(0x203, 8, 1, 2, 3, 4, 5, 6, 7, 8),
+	/* 12 */ F(0x555, 1, 0),
+	/* 13 */ F(0x103, 1, 0),
+};
+
+#define FRAME_COUNT (sizeof(frames) / sizeof(frames[0]))
+
+/* Bit mask of the frames matched by expr, -1 on a compile error */
+static long match(const char *expr)
+{
+	char err[128];
+	struct macan_filter *f = macan_filter_compile(&config, expr, err, sizeof(err));
+	const uint32_t *ids;
+	long mask = 0;
+	unsigned i;
+	int n, j;
+
+	if (!f) {
+		printf("%s: %s\n", expr, err);
+		return -1;
+	}
+	n = macan_filter_can_ids(f, &ids);
+	for (i = 0; i < FRAME_COUNT; i++) {
+		if (!macan_filter_match(f, &frames[i]))
+			continue;
+		mask |= 1L << i;
+		/* The kernel filter must pass the frame */
+		for (j = 0; j < n && ids[j] != frames[i].can_id; j++);
+		if (n >= 0 && j == n) {
+			printf("%s: frame %u not in the kernel filter\n", expr, i);
+			mask |= 1L << 30;
+		}
+	}
+	macan_filter_free(f);
+	return mask;
+}
+
+static int can_id_count(const char *expr)
+{
+	char err[128];
+	struct macan_filter *f = macan_filter_compile(&config, expr, err, sizeof(err));
+	const uint32_t *ids;
+	int n = macan_filter_can_ids(f, &ids);
+
+	macan_filter_free(f);
+	return n;
+}
+
+#define B(i) (1L << (i))
+
+static void test_match(void)
+{
+	WVPASS(match("id == 0x201") == B(9));
+	WVPASS(match("time") == B(0));
+	WVPASS(match("authtime || time > 150") == B(1));
+	WVPASS(match("sesskey") == (B(4) | B(5)));
+	WVPASS(match("sesskey && dst == 5") == B(5));
+	WVPASS(match("type == sesskey and seq == 3") == B(4));
+	WVPASS(match("src == ECU3") == (B(6) | B(7) | B(11) | B(13)));
+	WVPASS(match("src == 3 && (sig16 || secure)") == (B(7) | B(11)));
+	WVPASS(match("sig == 0") == (B(8) | B(9) | B(10)));
+	WVPASS(match("dst == ECU2 && !ack") == (B(4) | B(7) | B(11)));
+	WVPASS(match("challenge || reqchallenge") == (B(2) | B(3)));
+	WVPASS(match("fwd == ECU3 && flags == 1") == B(3));
+	WVPASS(match("authreq && presc >= 3") == B(8));
+	WVPASS(match("other") == (B(12) | B(13)));
+	WVPASS(match("dlc < 4") == (B(2) | B(12) | B(13)));
+	WVPASS(match("not (id >= 0x100 && id <= 0x1ff)") == (B(0) | B(1) | B(9) | B(10) | B(11) | B(12)));
+	WVPASS(match("nonsecure or src == TS") == (B(0) | B(1) | B(9)));
+	/* Fields the frame does not have */
+	WVPASS(match("seq != 3") == B(5));
+	WVPASS(match("!(seq == 3)") == (((1L << FRAME_COUNT) - 1) & ~B(4)));
+}
+
+static void test_errors(void)
+{
+	WVPASS(match("") == -1);
+	WVPASS(match("id ==") == -1);
+	WVPASS(match("foo == 1") == -1);
+	WVPASS(match("src == NOSUCHECU") == -1);
+	WVPASS(match("(time") == -1);
+	WVPASS(match("time time") == -1);
+	WVPASS(match("dlc") == -1);
+}
+
+static void test_kernel_ids(void)
+{
+	WVPASS(can_id_count("id == 0x201 || id == 0x202") == 2);
+	WVPASS(can_id_count("sesskey") == 1);
+	WVPASS(can_id_count("src == ECU2") == 3);
+	WVPASS(can_id_count("secure && src == ECU3") == 1);
+	WVPASS(can_id_count("sig == 1") == 5);
+	WVPASS(can_id_count("dlc == 8") == -1);
+	WVPASS(can_id_count("!time") == -1);
+	WVPASS(can_id_count("time || dlc == 8") == -1);
+}
+
+static void bench(void)
+{
+	char err[128];
+	struct macan_filter *f = macan_filter_compile(&config, "(sig16 || secure) && src == ECU3 && dlc == 8",
+						      err, sizeof(err));
+	const unsigned n = 10000000;
+	struct timespec t0, t1;
+	unsigned i, matched = 0;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		matched += macan_filter_match(f, &frames[i % FRAME_COUNT]);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+	printf("%.1f ns/frame\n", ns / n);
+	WVPASS(matched > 0);
+	macan_filter_free(f);
+}
+
+int main()
+{
+	test_match();
+	test_errors();
+	test_kernel_ids();
+	bench();
+	return test_status();
+}
@@ -0,0 +1,129 @@
+/* Test of signals sent to a group of nodes sharing one session key
+ *
+ * One node sends a signal every 10 ms to four receivers on a 500
+ * kbit/s bus. With pairwise keys, the signal is configured once for
+ * every receiver and signed and sent four times. With a group key,
+ * it is signed and sent once and accepted by all members of the
+ * group. The bus load of both setups is printed and all receivers
+ * must get authenticated signals in both of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 7
+#define RX_COUNT 4
+#define SOURCE 2
+#define GROUP 8
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define DURATION (20 * SEC)
+
+static struct macan_sig_spec pairwise_spec[RX_COUNT] = {
+	{ .src_id = SOURCE, .dst_id = 3, .presc = 1 },
+	{ .src_id = SOURCE, .dst_id = 4, .presc = 1 },
+	{ .src_id = SOURCE, .dst_id = 5, .presc = 1 },
+	{ .src_id = SOURCE, .dst_id = 6, .presc = 1 },
+};
+static struct macan_sig_spec group_spec[1] = {
+	{ .src_id = SOURCE, .dst_id = GROUP, .presc = 1 },
+};
+static const struct macan_group groups[] = {
+	{ .group_id = GROUP, .members = 1U << 2 | 1U << 3 | 1U << 4 | 1U << 5 | 1U << 6 },
+};
+
+static struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer;
+static macan_ev_loop loop;
+static unsigned received[NODE_COUNT];
+
+/* The callback does not tell the receiver, so every receiver has its own */
+#define RX_CALLBACK(n)							\
+	static void rx##n(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s) \
+	{								\
+		(void)sig_num; (void)sig_val;				\
+		if (s == MACAN_SIGNAL_AUTH)				\
+			received[n]++;					\
+	}
+RX_CALLBACK(3)
+RX_CALLBACK(4)
+RX_CALLBACK(5)
+RX_CALLBACK(6)
+static const macan_sig_cback rx_cb[NODE_COUNT] = { NULL, NULL, NULL, rx3, rx4, rx5, rx6 };
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint8_t i;
+
+	for (i = 0; i < config.sig_count; i++)
+		macan_send_sig(c, i, 42);
+}
+
+static void run(bool group, struct macan_sim_stats *st)
+{
+	macan_ecuid i;
+	uint8_t s;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(received, 0, sizeof(received));
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+	if (group) {
+		config.sig_count = 1;
+		config.sigspec = group_spec;
+		config.group_count = 1;
+		config.groups = groups;
+	} else {
+		config.sig_count = RX_COUNT;
+		config.sigspec = pairwise_spec;
+		config.group_count = 0;
+		config.groups = NULL;
+	}
+
+	test_sim_nodes(&config, &loop, ctx);
+	for (i = SOURCE + 1; i < NODE_COUNT; i++)
+		for (s = 0; s < config.sig_count; s++)
+			if (config.sigspec[s].dst_id == i || group)
+				macan_reg_callback(ctx[i], s, rx_cb[i], rx_cb[i]);
+	macan_ev_timer_setup(ctx[SOURCE], &send_timer, send_cb, PERIOD_MS, PERIOD_MS);
+
+	macan_sim_run(&loop, DURATION);
+	macan_sim_stats(st);
+}
+
+int main()
+{
+	static const char *const mode[] = { "pairwise keys", "group key" };
+	struct macan_sim_stats st[2];
+	unsigned g;
+	macan_ecuid i;
+
+	for (g = 0; g < 2; g++) {
+		run(g, &st[g]);
+		printf("%-14s %7llu frames, bus load %5.2f %%, received",
+		       mode[g], (unsigned long long)st[g].frames,
+		       100.0 * (double)st[g].busy_us / DURATION);
+		for (i = SOURCE + 1; i < NODE_COUNT; i++)
+			printf(" %u", received[i]);
+		printf("\n");
+		for (i = SOURCE + 1; i < NODE_COUNT; i++)
+			WVPASS(received[i] > DURATION / 1000 / PERIOD_MS * 9 / 10);
+	}
+	printf("bus load reduced by %.1f %%\n",
+	       100.0 * (1.0 - (double)st[1].busy_us / (double)st[0].busy_us));
+	WVPASS(st[1].busy_us < st[0].busy_us / 2);
+	return test_status();
+}
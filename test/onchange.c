@@ -0,0 +1,135 @@
+/* Test of send-on-change signals with an authenticated heartbeat
+ *
+ * A node publishes a button state, which changes once a second, to a
+ * receiver every 10 ms on a 500 kbit/s bus. Without a heartbeat, every
+ * call of macan_send_sig() is signed and sent. With a heartbeat of
+ * 200 ms, only the changes and the heartbeats are sent. The sender
+ * stops at 15 s and the receiver must be told that the signal is
+ * stale within its timeout. The frames, the longest delay of a change
+ * and the time of the staleness callback are printed for both setups.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 4
+#define SOURCE 2
+#define RECEIVER 3
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define HEARTBEAT 200000
+#define STALE_TIMEOUT 500000
+#define STOP (15 * SEC)
+#define DURATION (20 * SEC)
+
+static struct macan_sig_spec sig_spec[] = {
+	{ .can_sid = 0x200, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1 },
+};
+static const struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = 1,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer, stop_timer;
+static macan_ev_loop loop;
+static uint32_t button, last_rx;
+static uint64_t changed_at, max_delay;
+static unsigned changes, stale;
+static uint64_t stale_at;
+
+static uint32_t button_state(uint64_t now)
+{
+	return (uint32_t)(now / SEC) & 1;
+}
+
+static void rx_cb(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	(void)sig_num;
+	if (s != MACAN_SIGNAL_AUTH || sig_val == last_rx)
+		return;
+	last_rx = sig_val;
+	changes++;
+	if (sig_val == button && read_time() - changed_at > max_delay)
+		max_delay = read_time() - changed_at;
+}
+
+static void stale_cb(uint8_t sig_num)
+{
+	(void)sig_num;
+	stale++;
+	stale_at = read_time();
+}
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint32_t b = button_state(read_time());
+
+	if (b != button) {
+		button = b;
+		changed_at = read_time();
+	}
+	macan_send_sig(c, 0, b);
+}
+
+static void stop_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	macan_ev_timer_stop(l, w);
+	macan_ev_timer_stop(l, &send_timer);
+	macan_deinit(ctx[SOURCE]);
+}
+
+static void run(uint32_t heartbeat, struct macan_sim_stats *st)
+{
+	memset(&loop, 0, sizeof(loop));
+	button = last_rx = 0;
+	changed_at = max_delay = 0;
+	changes = stale = 0;
+	stale_at = 0;
+	sig_spec[0].heartbeat = heartbeat;
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+
+	test_sim_nodes(&config, &loop, ctx);
+	macan_reg_callback(ctx[RECEIVER], 0, rx_cb, rx_cb);
+	macan_reg_stale_callback(ctx[RECEIVER], 0, STALE_TIMEOUT, stale_cb);
+	macan_ev_timer_setup(ctx[SOURCE], &send_timer, send_cb, PERIOD_MS, PERIOD_MS);
+	macan_ev_timer_setup(ctx[RECEIVER], &stop_timer, stop_cb, STOP / 1000, 0);
+
+	macan_sim_run(&loop, DURATION);
+	macan_sim_stats(st);
+}
+
+int main()
+{
+	static const char *const mode[] = { "every call", "on change" };
+	static const uint32_t heartbeat[] = { 0, HEARTBEAT };
+	struct macan_sim_stats st[2];
+	unsigned m;
+
+	for (m = 0; m < 2; m++) {
+		run(heartbeat[m], &st[m]);
+		printf("%-10s %6llu frames, %2u changes received, longest delay %5.3f ms, "
+		       "stale %u time(s) %5.3f s after the stop\n", mode[m],
+		       (unsigned long long)st[m].frames, changes, (double)max_delay / 1000,
+		       stale, stale ? (double)(stale_at - STOP) / SEC : 0.0);
+		/* The button changes at every second until the stop */
+		WVPASS(changes >= STOP / SEC - 1);
+		WVPASS(max_delay < 2000);
+		WVPASS(stale == 1);
+		WVPASS(stale_at > STOP + STALE_TIMEOUT - HEARTBEAT && stale_at <= STOP + STALE_TIMEOUT);
+	}
+	WVPASS(st[1].frames * 5 < st[0].frames);
+	return test_status();
+}
@@ -0,0 +1,162 @@
+/* Test of packing signals into PDUs in macan_send_sig()
+ *
+ * Like the 4signals demo, one node publishes four signals to one
+ * receiver every 10 ms with one call of macan_send_sig() per signal on
+ * a 500 kbit/s bus. Without PDUs, every signal is signed and sent in a
+ * frame of its own. With one CAN FD PDU or two classic PDUs of two
+ * signals, the signals are packed and signed together. When only
+ * three of the four signals of the CAN FD PDU are published, it is
+ * sent when its latency expires. The frames per signal and the
+ * longest delay from macan_send_sig() to the receiver's callback are
+ * printed for every setup (after the first second).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 4
+#define SIG_COUNT 4
+#define SOURCE 2
+#define RECEIVER 3
+#define SEC 1000000ULL
+#define PERIOD_MS 10
+#define DURATION (20 * SEC)
+#define CYCLES (DURATION / 1000 / PERIOD_MS)
+#define LATENCY 2000
+#define WARMUP SEC		/* Delays during key distribution are ignored */
+
+static struct macan_sig_spec sig_spec[SIG_COUNT] = {
+	{ .can_sid = 0x200, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1 },
+	{ .can_sid = 0x201, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1 },
+	{ .can_sid = 0x202, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1 },
+	{ .can_sid = 0x203, .src_id = SOURCE, .dst_id = RECEIVER, .presc = 1 },
+};
+static const uint8_t sigs[SIG_COUNT] = { 0, 1, 2, 3 };
+static const struct macan_pdu_spec fd_pdu[] = {
+	{ .can_id = 0x300, .src_id = SOURCE, .dst_id = RECEIVER,
+	  .sig_count = 4, .sigs = sigs, .latency = LATENCY },
+};
+static const struct macan_pdu_spec classic_pdus[] = {
+	{ .can_id = 0x300, .src_id = SOURCE, .dst_id = RECEIVER, .sig_count = 2,
+	  .sigs = sigs, .flags = MACAN_PDU_CLASSIC, .latency = LATENCY },
+	{ .can_id = 0x301, .src_id = SOURCE, .dst_id = RECEIVER, .sig_count = 2,
+	  .sigs = sigs + 2, .flags = MACAN_PDU_CLASSIC, .latency = LATENCY },
+};
+static struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+enum mode { UNPACKED, FD_PDU, CLASSIC_PDUS, PARTIAL, MODE_COUNT };
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_timer send_timer;
+static macan_ev_loop loop;
+static unsigned published;	/* Signals published per cycle */
+static unsigned received[SIG_COUNT];
+static uint64_t sent_at[CYCLES + 1];
+static uint32_t cycle;
+static uint64_t max_delay;
+
+static void rx_cb(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	uint64_t delay;
+
+	/* Signals not published repeat their previous value */
+	if (s != MACAN_SIGNAL_AUTH || sig_num >= published || sig_val > cycle)
+		return;
+	received[sig_num]++;
+	delay = read_time() - sent_at[sig_val];
+	if (sent_at[sig_val] >= WARMUP && delay > max_delay)
+		max_delay = delay;
+}
+
+static void send_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)l; (void)revents;
+	struct macan_ctx *c = w->data;
+	uint8_t i;
+
+	if (cycle >= CYCLES)
+		return;
+	cycle++;
+	sent_at[cycle] = read_time();
+	for (i = 0; i < published; i++)
+		macan_send_sig(c, i, cycle);
+}
+
+static void run(enum mode m, struct macan_sim_stats *st)
+{
+	uint8_t s;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(received, 0, sizeof(received));
+	cycle = 0;
+	max_delay = 0;
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+	macan_sim_set_data_bitrate(2000000);
+	published = m == PARTIAL ? SIG_COUNT - 1 : SIG_COUNT;
+	switch (m) {
+	case UNPACKED:
+		config.pdu_count = 0;
+		config.pdus = NULL;
+		break;
+	case FD_PDU:
+	case PARTIAL:
+		config.pdu_count = 1;
+		config.pdus = fd_pdu;
+		break;
+	default:
+		config.pdu_count = 2;
+		config.pdus = classic_pdus;
+		break;
+	}
+
+	test_sim_nodes(&config, &loop, ctx);
+	for (s = 0; s < SIG_COUNT; s++)
+		macan_reg_callback(ctx[RECEIVER], s, rx_cb, rx_cb);
+	macan_ev_timer_setup(ctx[SOURCE], &send_timer, send_cb, PERIOD_MS, PERIOD_MS);
+
+	macan_sim_run(&loop, DURATION);
+	macan_sim_stats(st);
+}
+
+int main()
+{
+	static const char *const mode[] = {
+		"unpacked", "CAN FD PDU", "classic PDUs", "3 of 4 signals",
+	};
+	struct macan_sim_stats st[MODE_COUNT];
+	double per_sig[MODE_COUNT];
+	uint64_t delay[MODE_COUNT];
+	unsigned m, s, n;
+
+	for (m = 0; m < MODE_COUNT; m++) {
+		run(m, &st[m]);
+		for (n = 0, s = 0; s < SIG_COUNT; s++)
+			n += received[s];
+		per_sig[m] = (double)st[m].frames / n;
+		delay[m] = max_delay;
+		printf("%-14s %6llu frames, %6u signals, %5.3f frames per signal, "
+		       "longest delay %5.3f ms\n", mode[m],
+		       (unsigned long long)st[m].frames, n, per_sig[m],
+		       (double)delay[m] / 1000);
+		for (s = 0; s < published; s++)
+			WVPASS(received[s] > CYCLES * 9 / 10);
+	}
+	WVPASS(per_sig[FD_PDU] * 3 < per_sig[UNPACKED]);
+	WVPASS(per_sig[CLASSIC_PDUS] * 1.5 < per_sig[UNPACKED]);
+	/* Complete PDUs are sent at once, the others after the latency */
+	WVPASS(delay[FD_PDU] < LATENCY);
+	WVPASS(delay[PARTIAL] >= LATENCY && delay[PARTIAL] < LATENCY + 1000);
+	return test_status();
+}
@@ -0,0 +1,144 @@
+/* Test of the proactive key distribution by the key server
+ *
+ * A network of twelve nodes, each ECU sending signals to two others,
+ * starts on a 500 kbit/s bus with the key server either running from
+ * the start or starting half a second after the ECUs, which is when
+ * their first challenges are lost. The time until all channels of
+ * the signal matrix are ready is printed for both the pull-based
+ * setup and the key server asking for the challenges itself, which
+ * must not wait for the ECUs to repeat their challenges.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 12
+#define SIG_COUNT (2 * (NODE_COUNT - 2))
+#define SEC 1000000ULL
+#define KS_LATE (SEC / 2)
+
+static struct macan_sig_spec sig_spec[SIG_COUNT];
+
+static const struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+static void make_sig_spec(void)
+{
+	unsigned i;
+
+	for (i = 0; i < SIG_COUNT; i++) {
+		unsigned src = i / 2, step = (i & 1) ? 3 : 1;
+
+		sig_spec[i].src_id = (macan_ecuid)(2 + src);
+		sig_spec[i].dst_id = (macan_ecuid)(2 + (src + step) % (NODE_COUNT - 2));
+		sig_spec[i].presc = 1;
+	}
+}
+
+static struct macan_ctx *ctx[NODE_COUNT];
+static macan_ev_loop loop;
+static macan_ev_timer ks_timer, poll_timer;
+static bool predist;
+static uint64_t ready_at;
+
+static bool both_ready(macan_ecuid a, macan_ecuid b)
+{
+	uint32_t both = 1U << a | 1U << b;
+
+	return (ctx[a]->cpart[b]->group_field & both) == both &&
+		(ctx[b]->cpart[a]->group_field & both) == both;
+}
+
+static void poll_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	unsigned i;
+
+	for (i = 0; i < SIG_COUNT; i++)
+		if (!both_ready(sig_spec[i].src_id, sig_spec[i].dst_id))
+			return;
+	for (i = 2; i < NODE_COUNT; i++)
+		if (!ctx[i]->time.ready)
+			return;
+	ready_at = read_time();
+	macan_ev_timer_stop(l, w);
+}
+
+static void start_ks(void)
+{
+	struct macan_ctx *c = test_sim_node(&config, &loop, KEY_SERVER);
+
+	if (predist)
+		WVPASS(macan_ks_predistribute(c) == 0);
+	ctx[KEY_SERVER] = c;
+}
+
+static void ks_cb(macan_ev_loop *l, macan_ev_timer *w, int revents)
+{
+	(void)revents;
+	macan_ev_timer_stop(l, w);
+	start_ks();
+}
+
+/* Time until all channels are ready or UINT64_MAX */
+static uint64_t run(bool pd, uint64_t ks_start, struct macan_sim_stats *st)
+{
+	macan_ecuid i;
+
+	memset(&loop, 0, sizeof(loop));
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(500000);
+	predist = pd;
+	ready_at = UINT64_MAX;
+
+	if (!ks_start)
+		start_ks();
+	for (i = 1; i < NODE_COUNT; i++)
+		ctx[i] = test_sim_node(&config, &loop, i);
+	if (ks_start)
+		macan_ev_timer_setup(ctx[TIME_SERVER], &ks_timer, ks_cb,
+				     (unsigned)(ks_start / 1000), 0);
+	macan_ev_timer_setup(ctx[TIME_SERVER], &poll_timer, poll_cb, 1, 1);
+
+	macan_sim_run(&loop, 20 * SEC);
+	macan_sim_stats(st);
+	return ready_at;
+}
+
+int main()
+{
+	static const char *const mode[] = { "pull", "predistribution" };
+	uint64_t t[2][2];
+	unsigned late, pd;
+
+	make_sig_spec();
+
+	for (late = 0; late < 2; late++)
+		for (pd = 0; pd < 2; pd++) {
+			struct macan_sim_stats st;
+
+			t[late][pd] = run(pd, late ? KS_LATE : 0, &st);
+			printf("KS %-12s %-16s all channels ready in %7.3f s, %"PRIu64" frames\n",
+			       late ? "0.5 s late," : "at start,", mode[pd],
+			       t[late][pd] == UINT64_MAX ? -1.0 : (double)t[late][pd] / SEC,
+			       st.frames);
+			WVPASS(t[late][pd] != UINT64_MAX);
+		}
+	/* The ECUs repeat lost challenges only after skey_chg_timeout */
+	WVPASS(t[1][0] >= config.skey_chg_timeout);
+	WVPASS(t[1][1] < KS_LATE + SEC / 2);
+	/* ECUs asking on their own are not disturbed much */
+	WVPASS(t[0][1] < t[0][0] + SEC / 20);
+	return test_status();
+}
@@ -0,0 +1,169 @@
+/* Test of the RX ring with the event loop as the consumer and a thread
+ * simulating the CAN RX interrupt as the producer
+ *
+ * The producer emits bursts of frames (like the six SESS_KEY frames
+ * sent by the key server) with sequence numbers. The consumer checks
+ * that the frames it gets are intact and in order and that every
+ * frame was either received or counted as an overflow.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <can_frame.h>
+#include <macan_evcore.h>
+#include "testlib.h"
+
+#define FRAMES 200000U
+#define BURST  6
+
+static struct macan_rxring ring;
+static volatile int producer_done;
+
+uint64_t read_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+struct macan_rxring *macan_ev_rxring(int canfd)
+{
+	(void)canfd;
+	return &ring;
+}
+
+void poll_can_fifo(struct macan_rxring *rx)
+{
+	(void)rx;		/* Filled by the "ISR" thread */
+}
+
+bool macan_ev_tx_ready(int canfd)
+{
+	(void)canfd;
+	return true;
+}
+
+void macan_ev_wait(macan_ev_loop *loop, uint64_t deadline_us)
+{
+	(void)loop; (void)deadline_us;
+	sched_yield();
+}
+
+static void fill_frame(struct can_frame *cf, uint32_t seq)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = seq & 0x7ff;
+	cf->can_dlc = 8;
+	memcpy(cf->data, &seq, 4);
+	for (int i = 4; i < 8; i++)
+		cf->data[i] = (uint8_t)(seq * 7 + (uint32_t)i);
+}
+
+static void *isr_thread(void *arg)
+{
+	struct can_frame cf;
+
+	(void)arg;
+	for (uint32_t seq = 0; seq < FRAMES; seq++) {
+		fill_frame(&cf, seq);
+		macan_rxring_put(&ring, &cf);
+		if (seq % BURST == BURST - 1)
+			sched_yield();	/* Return from the "interrupt" */
+	}
+	producer_done = 1;
+	return NULL;
+}
+
+static uint32_t received, batches, last_seq;
+static bool in_order = true, intact = true;
+
+static void can_cb(macan_ev_loop *loop, macan_ev_can *w, int revents)
+{
+	struct can_frame cf, ref;
+	uint32_t seq;
+
+	(void)loop; (void)revents;
+	batches++;
+	while (macan_rxring_get(w->rx, &cf)) {
+		memcpy(&seq, cf.data, 4);
+		fill_frame(&ref, seq);
+		intact = intact && memcmp(&cf, &ref, sizeof(cf)) == 0;
+		in_order = in_order && (received == 0 || seq > last_seq);
+		last_seq = seq;
+		received++;
+	}
+}
+
+static void done_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)w; (void)revents;
+	if (producer_done && macan_rxring_empty(&ring))
+		macan_ev_break(loop);
+}
+
+static void test_single_thread(void)
+{
+	struct can_frame cf;
+	bool ok = true;
+
+	/* Start close to the wrap-around of the indices */
+	memset(&ring, 0, sizeof(ring));
+	ring.head = ring.tail = UINT32_MAX - 3;
+
+	for (uint32_t i = 0; i < MACAN_RXRING_SIZE; i++) {
+		fill_frame(&cf, i);
+		ok = ok && macan_rxring_put(&ring, &cf);
+	}
+	WVPASS(ok);
+	WVPASS(macan_rxring_count(&ring) == MACAN_RXRING_SIZE);
+	WVPASS(!macan_rxring_put(&ring, &cf) && ring.overflows == 1);
+
+	for (uint32_t i = 0; i < MACAN_RXRING_SIZE; i++) {
+		uint32_t seq;
+		ok = ok && macan_rxring_get(&ring, &cf);
+		memcpy(&seq, cf.data, 4);
+		ok = ok && seq == i;
+	}
+	WVPASS(ok);
+	WVPASS(!macan_rxring_get(&ring, &cf) && macan_rxring_empty(&ring));
+	WVPASS(ring.max_fill == MACAN_RXRING_SIZE);
+}
+
+static void test_isr_producer(void)
+{
+	macan_ev_loop loop;
+	macan_ev_can can;
+	macan_ev_timer done;
+	pthread_t thread;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(&ring, 0, sizeof(ring));
+	macan_ev_can_init(&can, can_cb, 0, MACAN_EV_READ);
+	macan_ev_can_start(&loop, &can);
+	macan_ev_timer_init(&done, done_cb, 1, 1);
+	macan_ev_timer_start(&loop, &done);
+
+	pthread_create(&thread, NULL, isr_thread, NULL);
+	macan_ev_run(&loop);
+	pthread_join(thread, NULL);
+
+	printf("received %u, overflows %u, %.1f frames/batch, max fill %u/%u\n",
+	       received, ring.overflows, (double)received / batches,
+	       ring.max_fill, MACAN_RXRING_SIZE);
+	WVPASS(received + ring.overflows == FRAMES);
+	WVPASS(intact);
+	WVPASS(in_order);
+}
+
+int main(void)
+{
+	test_single_thread();
+	test_isr_producer();
+
+	return test_status();
+}
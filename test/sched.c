@@ -0,0 +1,160 @@
+/* Test of the schedulability analysis
+ *
+ * Frame times, utilisation, response times and CMAC time windows of a
+ * small configuration are compared with values computed by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <macan.h>
+#include "macan_sched.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_A,
+	SIG_B,
+	SIG_C,
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	NODE2,
+	NODE3,
+	NODE_COUNT
+};
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_A] = {.can_nsid = 0x010, .can_sid = 0x020, .src_id = NODE2, .dst_id = NODE3, .presc = 2},
+	[SIG_B] = {.can_nsid = 0x200, .can_sid = 0,     .src_id = NODE2, .dst_id = NODE3, .presc = 1},
+	[SIG_C] = {.can_nsid = 0x300, .can_sid = 0x301, .src_id = NODE3, .dst_id = NODE2, .presc = 0},
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x001,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100, "KS"},
+		[TIME_SERVER] = {0x101, "TS"},
+		[NODE2]       = {0x102, "ECU2"},
+		[NODE3]       = {0x103, "ECU3"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+	.time_div          = 100000,
+	.skey_validity     = 60000000,
+	.skey_chg_timeout  = 5000000,
+	.time_delta        = 1000,
+};
+
+#define US 1000ULL
+#define MS 1000000ULL
+#define BIT 2000ULL	/* 500 kbit/s */
+
+static const struct macan_smsg *find(const struct macan_sched *s, uint32_t can_id, enum macan_smsg_kind kind)
+{
+	unsigned i;
+
+	for (i = 0; i < s->count; i++)
+		if (s->msg[i].can_id == can_id && s->msg[i].kind == kind)
+			return &s->msg[i];
+	return NULL;
+}
+
+static void test_frames(void)
+{
+	struct macan_sched_sig sigs[SIG_COUNT] = { { 0 } };
+	struct macan_sched *s = macan_sched_create(&config, sigs, 500000);
+
+	/* 34 + 8n + 13 bits and (34 + 8n - 1) / 4 stuff bits */
+	WVPASS(macan_sched_frame_time(s, 0x100, 8) == 135 * BIT);
+	WVPASS(macan_sched_frame_time(s, 0x100, 4) == 95 * BIT);
+	WVPASS(macan_sched_frame_time(s, 0x100, 0) == 55 * BIT);
+	WVPASS(macan_sched_frame_time(s, 0x12345, 8) == 160 * BIT);
+	/* Only the time is broadcast when no signal is sent */
+	WVPASS(s->count == 1 && s->msg[0].kind == MACAN_SM_TIME);
+	macan_sched_free(s);
+}
+
+static void test_analysis(void)
+{
+	struct macan_sched_sig sigs[SIG_COUNT] = {
+		[SIG_A] = { .period = 10 * MS },
+		[SIG_B] = { .period = 20 * MS },
+	};
+	struct macan_sched *s = macan_sched_create(&config, sigs, 500000);
+	const struct macan_smsg *m;
+	unsigned older, newer;
+
+	WVPASS(macan_sched_analyse(s) == 0);
+	macan_sched_print(s, stdout, 0);
+
+	/* TIME, A, A signed, 3 key pairs (2-3, 2-TS, 3-TS), B signed */
+	WVPASS(s->count == 7);
+	WVPASS(s->msg[0].kind == MACAN_SM_TIME && s->msg[6].can_id == 0x102);
+
+	/* Highest priority: blocked by one 8 byte frame */
+	m = find(s, 0x001, MACAN_SM_TIME);
+	WVPASS(m->r == (135 + 95) * BIT);
+	/* Blocked by 8 bytes, TIME */
+	m = find(s, 0x010, MACAN_SM_SIGNAL);
+	WVPASS(m->r == (135 + 95 + 95) * BIT);
+	/* Blocked by 8 bytes, TIME and the plain frame of the signal */
+	m = find(s, 0x020, MACAN_SM_AUTH_SIG32);
+	WVPASS(m->period == 20 * MS);
+	WVPASS(m->r == (135 + 95 + 95 + 135) * BIT);
+	/* Lowest priority: TIME, 3 key distributions and, as they take
+	 * more than 10 ms, two values of A */
+	m = find(s, 0x102, MACAN_SM_AUTH_SIG);
+	WVPASS(m->r == (95 + 135 + 95 + 3 * 13 * 135 + 135) * BIT);
+
+	WVPASS(s->util[MACAN_SM_TIME] > 0.0018 && s->util[MACAN_SM_TIME] < 0.0020);
+	/* A: half of the values signed; B: all signed */
+	WVPASS(s->util[MACAN_SM_SIGNAL] > 0.0094 && s->util[MACAN_SM_SIGNAL] < 0.0096);
+	WVPASS(s->util[MACAN_SM_AUTH_SIG32] > 0.0134 && s->util[MACAN_SM_AUTH_SIG32] < 0.0136);
+	WVPASS(s->util[MACAN_SM_AUTH_SIG] > 0.0134 && s->util[MACAN_SM_AUTH_SIG] < 0.0136);
+	WVPASS(s->util_plain > 0.0284 && s->util_plain < 0.0286);
+
+	/* R = 0.92 ms of a 100 ms time unit */
+	WVPASS(macan_sched_window(s, SIG_A, 0, &older, &newer) && older == 1 && newer == 0);
+	WVPASS(macan_sched_window(s, SIG_A, 100 * MS, &older, &newer) && older == 2 && newer == 1);
+	WVPASS(!macan_sched_window(s, SIG_C, 0, &older, &newer));
+	macan_sched_free(s);
+}
+
+static void test_overload(void)
+{
+	struct macan_sched_sig sigs[SIG_COUNT] = {
+		[SIG_A] = { .period = 200 * US },
+		[SIG_B] = { .period = 1 * MS },
+		[SIG_C] = { .period = 500 * US, .deadline = 300 * US },
+	};
+	struct macan_sched *s = macan_sched_create(&config, sigs, 500000);
+	const struct macan_smsg *m;
+
+	/* A alone loads the bus more than fully */
+	WVPASS(macan_sched_analyse(s) > 0);
+	WVPASS(s->util_total > 1);
+	m = find(s, 0x102, MACAN_SM_AUTH_SIG);
+	WVPASS(m->r == MACAN_SCHED_UNBOUNDED);
+	/* On-demand C is analysed as always signed */
+	m = find(s, 0x301, MACAN_SM_AUTH_SIG32);
+	WVPASS(m && m->presc == 1 && m->r > m->deadline);
+	WVPASS(find(s, 0x300, MACAN_SM_SIGNAL) == NULL);
+	macan_sched_free(s);
+}
+
+int main()
+{
+	test_frames();
+	test_analysis();
+	test_overload();
+	return test_status();
+}
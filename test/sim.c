@@ -0,0 +1,150 @@
+/* Test of the discrete event simulation
+ *
+ * A network of 24 nodes (key server, time server and 22 ECUs each
+ * sending a signal to the next one every second, the most the 24 bit
+ * ACK group field allows) runs for an hour of
+ * virtual time. All signals must be received authenticated, session
+ * keys must be renewed and two runs with the same seed must put the
+ * very same frames on the bus at the very same times. The ratio of
+ * virtual and wall clock time is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 24
+#define SIG_COUNT (NODE_COUNT - 2)
+#define SEC 1000000ULL
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static struct macan_sig_spec sig_spec[SIG_COUNT];
+
+static const struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 600000000,
+};
+
+static void make_sig_spec(void)
+{
+	unsigned i;
+
+	for (i = 0; i < SIG_COUNT; i++) {
+		sig_spec[i].src_id = (macan_ecuid)(2 + i);
+		sig_spec[i].dst_id = (macan_ecuid)(2 + (i + 1) % SIG_COUNT);
+		/* Half of the signals on their own CAN ID */
+		sig_spec[i].can_sid = (i & 1) ? 0 : (uint16_t)(0x200 + i);
+		sig_spec[i].presc = 1;
+	}
+}
+
+struct run {
+	uint64_t hash;
+	unsigned sess_key;
+	struct macan_sim_stats st;
+	double wall;
+};
+
+static unsigned received[SIG_COUNT], invalid;
+static uint32_t val;
+
+static void sig_callback(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	(void)sig_val;
+	if (s == MACAN_SIGNAL_AUTH)
+		received[sig_num]++;
+	else
+		invalid++;
+}
+
+static void send_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	struct macan_ctx *ctx = w->data;
+
+	macan_send_sig(ctx, (uint8_t)(ctx->node->node_id - 2), val++);
+}
+
+static void tap(uint64_t time_us, int canfd, const struct can_frame *cf, void *arg)
+{
+	struct run *r = arg;
+	const uint8_t *p = (const uint8_t *)cf;
+	uint64_t h = r->hash;
+	unsigned i;
+
+	h = (h ^ time_us) * FNV_PRIME;
+	h = (h ^ (uint64_t)canfd) * FNV_PRIME;
+	for (i = 0; i < sizeof(*cf); i++)
+		h = (h ^ (uint64_t)p[i]) * FNV_PRIME;
+	r->hash = h;
+	if (cf->can_id == test_can_ids.ecu[KEY_SERVER].canid && (cf->data[0] >> 6) == FL_SESS_KEY)
+		r->sess_key++;
+}
+
+static struct run simulate(uint64_t seed, uint64_t duration)
+{
+	static struct macan_ctx *ctx[NODE_COUNT];
+	static macan_ev_timer timer[NODE_COUNT];
+	macan_ev_loop loop;
+	struct run r = { .hash = 0xcbf29ce484222325ULL };
+	struct timespec t0, t1;
+	unsigned i;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(received, 0, sizeof(received));
+	invalid = 0;
+	val = 0;
+	macan_sim_reset(seed);
+	macan_sim_set_tap(tap, &r);
+
+	test_sim_nodes(&config, &loop, ctx);
+	for (i = 2; i < NODE_COUNT; i++) {
+		macan_reg_callback(ctx[i], (uint8_t)((i - 3 + SIG_COUNT) % SIG_COUNT), sig_callback, sig_callback);
+		macan_ev_timer_setup(ctx[i], &timer[i], send_cb, 1000, 1000);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	WVPASS(macan_sim_run(&loop, duration) == duration);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	r.wall = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+	macan_sim_stats(&r.st);
+	return r;
+}
+
+int main()
+{
+	const uint64_t hour = 3600 * SEC;
+	struct run a, b, c;
+	unsigned i, min = UINT32_MAX;
+
+	make_sig_spec();
+
+	a = simulate(1, hour);
+	for (i = 0; i < SIG_COUNT; i++)
+		if (received[i] < min)
+			min = received[i];
+	printf("%llu frames, %llu received, %llu steps, %u session key frames\n",
+	       (unsigned long long)a.st.frames, (unsigned long long)a.st.deliveries,
+	       (unsigned long long)a.st.steps, a.sess_key);
+	printf("1 h of protocol time in %.2f s (%.0fx real time)\n", a.wall, 3600 / a.wall);
+	/* Keys and authenticated time take a few seconds */
+	WVPASS(min > 3550);
+	WVPASS(invalid == 0);
+	/* Keys of 22 pairs with the time server and 22 signal pairs
+	 * renewed every 10 minutes */
+	WVPASS(a.sess_key >= 6 * 2 * 44 * 6);
+
+	b = simulate(1, hour);
+	WVPASS(a.hash == b.hash && a.st.frames == b.st.frames && a.st.steps == b.st.steps);
+	c = simulate(2, hour);
+	WVPASS(a.hash != c.hash);
+	return test_status();
+}
@@ -0,0 +1,186 @@
+/* Test of the simulated bus with arbitration and bit timing
+ *
+ * Frames must take the time of their bits including stuff bits, the
+ * frame with the lowest ID must win the arbitration but must not
+ * preempt the frame on the bus, and the end-to-end latency of an
+ * authenticated signal must grow when the bitrate goes down. The
+ * latencies are printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_sim.h"
+#include "testlib.h"
+
+#define NODE_COUNT 4
+#define SEC 1000000ULL
+
+static struct macan_sim_tx txs[16];
+static unsigned tx_count;
+static uint64_t busy;
+static struct macan_ctx late;
+
+static void record_tx(const struct macan_sim_tx *tx, void *arg)
+{
+	(void)arg;
+	busy += tx->end - tx->start;
+	if (tx_count < 16)
+		txs[tx_count++] = *tx;
+	/* Queued while the first frame is on the bus */
+	if (tx_count == 1 && late.sockfd) {
+		struct can_frame cf = { .can_id = 0x001, .can_dlc = 1 };
+
+		macan_xmit(&late, &cf);
+	}
+}
+
+static void test_arbitration(void)
+{
+	struct macan_ctx ctx[3];
+	struct can_frame cf = { .can_dlc = 0 };
+	struct macan_sim_stats st;
+	macan_ev_loop loop;
+	uint64_t t;
+	unsigned i;
+
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(1000000);
+	macan_sim_set_tx_hook(record_tx, NULL);
+	memset(&loop, 0, sizeof(loop));
+	memset(ctx, 0, sizeof(ctx));
+	memset(&late, 0, sizeof(late));
+	tx_count = 0;
+	busy = 0;
+	for (i = 0; i < 3; i++)
+		ctx[i].sockfd = macan_sim_open();
+	late.sockfd = macan_sim_open();
+
+	/* All dominant bits: a stuff bit after every five of the 34 */
+	cf.can_id = 0x000;
+	WVPASS(macan_xmit(&ctx[0], &cf) == MACAN_XMIT_OK);
+	t = macan_sim_run(&loop, SEC);
+	WVPASS(t == SEC);
+	WVPASS(tx_count == 2 && txs[0].bits == 34 + 6 + 13 && txs[0].end - txs[0].start == 53);
+	WVPASS(txs[1].canfd == late.sockfd && txs[1].start == 53);
+
+	/* Frames queued at the same time go in the order of their IDs,
+	 * a standard frame before an extended one with the same base ID */
+	late.sockfd = 0;
+	tx_count = 0;
+	cf.can_dlc = 8;
+	memset(cf.data, 0x55, 8);
+	cf.can_id = 0x300;
+	macan_xmit(&ctx[0], &cf);
+	cf.can_id = 0x100;
+	macan_xmit(&ctx[1], &cf);
+	cf.can_id = 0x200 << 18 | CAN_EFF_FLAG;
+	macan_xmit(&ctx[2], &cf);
+	cf.can_id = 0x200;
+	macan_xmit(&ctx[2], &cf);
+	macan_sim_run(&loop, 2 * SEC);
+	WVPASS(tx_count == 4);
+	WVPASS(txs[0].cf.can_id == 0x100 && txs[0].queued == t && txs[0].start == t);
+	WVPASS(txs[1].cf.can_id == 0x200 && txs[1].start == txs[0].end);
+	WVPASS(txs[2].cf.can_id == (0x200 << 18 | CAN_EFF_FLAG) && txs[2].start == txs[1].end);
+	WVPASS(txs[3].cf.can_id == 0x300 && txs[3].start == txs[2].end);
+	for (i = 0; i < tx_count; i++) {
+		unsigned n = txs[i].cf.can_id & CAN_EFF_FLAG ? 54 + 64 : 34 + 64;
+
+		WVPASS(txs[i].bits >= n + 13 && txs[i].bits <= n + (n - 1) / 4 + 13);
+	}
+	macan_sim_stats(&st);
+	WVPASS(st.busy_us == busy);
+	WVPASS(st.queue_max_us == txs[3].start - t);
+}
+
+static struct macan_sig_spec sig_spec[] = {
+	{ .can_sid = 0x200, .src_id = 2, .dst_id = 3, .presc = 1 },
+};
+
+static const struct macan_config config = {
+	TEST_SIM_CONFIG,
+	.sig_count         = 1,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.skey_validity     = 60000000,
+};
+
+struct latency {
+	unsigned count;
+	uint64_t sum, max;
+};
+
+static struct latency lat;
+
+static void sig_callback(uint8_t sig_num, uint32_t sig_val, enum macan_signal_status s)
+{
+	uint64_t l = (uint32_t)read_time() - sig_val;
+
+	(void)sig_num;
+	if (s != MACAN_SIGNAL_AUTH)
+		return;
+	lat.count++;
+	lat.sum += l;
+	if (l > lat.max)
+		lat.max = l;
+}
+
+static void send_cb(macan_ev_loop *loop, macan_ev_timer *w, int revents)
+{
+	(void)loop; (void)revents;
+	macan_send_sig(w->data, 0, (uint32_t)read_time());
+}
+
+/* Signal latency in a network of four nodes on a bus with @a bitrate */
+static struct latency signal_latency(uint32_t bitrate, struct macan_sim_stats *st)
+{
+	static struct macan_ctx *ctx[NODE_COUNT];
+	static macan_ev_timer timer;
+	macan_ev_loop loop;
+
+	memset(&loop, 0, sizeof(loop));
+	memset(&lat, 0, sizeof(lat));
+	macan_sim_reset(1);
+	macan_sim_set_bitrate(bitrate);
+
+	test_sim_nodes(&config, &loop, ctx);
+	macan_ev_timer_setup(ctx[2], &timer, send_cb, 10, 10);
+	macan_reg_callback(ctx[3], 0, sig_callback, sig_callback);
+	macan_sim_run(&loop, 60 * SEC);
+	macan_sim_stats(st);
+	return lat;
+}
+
+static void test_signal_latency(void)
+{
+	static const uint32_t bitrates[] = { 0, 1000000, 500000, 125000 };
+	struct latency l[4];
+	struct macan_sim_stats st;
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		l[i] = signal_latency(bitrates[i], &st);
+		printf("%7u bit/s: %u signals, latency mean %llu us, max %llu us, "
+		       "bus load %.1f %%, queuing max %llu us\n",
+		       bitrates[i], l[i].count,
+		       l[i].count ? (unsigned long long)(l[i].sum / l[i].count) : 0,
+		       (unsigned long long)l[i].max, 100.0 * (double)st.busy_us / (60.0 * SEC),
+		       (unsigned long long)st.queue_max_us);
+		WVPASS(l[i].count > 5000);
+	}
+	WVPASS(l[0].max == 0);
+	/* A signal frame has at least 111 bits */
+	WVPASS(l[1].sum >= 111ULL * l[1].count);
+	WVPASS(l[3].sum >= 888ULL * l[3].count);
+	WVPASS(l[1].max < l[2].max && l[2].max < l[3].max);
+}
+
+int main()
+{
+	test_arbitration();
+	test_signal_latency();
+	return test_status();
+}
@@ -0,0 +1,83 @@
+/* Helpers shared by the tests, see testlib.h */
+
+#include <stdio.h>
+#include <string.h>
+#include "testlib.h"
+
+static int failures;
+
+void test_pass(const char *file, int line, const char *text, int ok)
+{
+	printf("! %s:%d  %s  %s\n", file, line, text, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+int test_status(void)
+{
+	return failures ? 1 : 0;
+}
+
+#ifdef MACAN_SIM
+#include "helper.h"
+
+static struct macan_ecu ecu[TEST_NODE_MAX];
+static struct macan_key keys[TEST_NODE_MAX];
+static const struct macan_key *ltk[TEST_NODE_MAX];
+static struct macan_node_config node_cfg[TEST_NODE_MAX];
+
+const struct macan_can_ids test_can_ids = {
+	.time = 0x001,
+	.ecu = ecu,
+};
+
+static void init_network(void)
+{
+	static const char *const name[] = { "KS", "TS" };
+	unsigned i;
+
+	for (i = 0; i < TEST_NODE_MAX; i++) {
+		ecu[i].canid = 0x100 + i;
+		ecu[i].name = i < 2 ? name[i] : "N";
+		memset(keys[i].data, (int)i, sizeof(keys[i].data));
+		ltk[i] = &keys[i];
+		node_cfg[i].node_id = (macan_ecuid)i;
+		node_cfg[i].ltk = ltk[i];
+	}
+}
+
+/**
+ * Start node @a id of the simulated network as the key server, the
+ * time server or an ECU. The simulation must have been reset.
+ */
+struct macan_ctx *test_sim_node(const struct macan_config *config, macan_ev_loop *loop,
+				macan_ecuid id)
+{
+	struct macan_ctx *ctx;
+	int s;
+
+	if (!ltk[0])
+		init_network();
+	ctx = macan_alloc_mem(config, &node_cfg[id]);
+	s = helper_init("sim");
+	if (id == config->key_server_id)
+		macan_init_ks(ctx, loop, s, ltk);
+	else if (id == config->time_server_id)
+		macan_init_ts(ctx, loop, s);
+	else
+		macan_init(ctx, loop, s);
+	return ctx;
+}
+
+/**
+ * Start all nodes of @a config and store their contexts in @a ctx.
+ */
+void test_sim_nodes(const struct macan_config *config, macan_ev_loop *loop,
+		    struct macan_ctx **ctx)
+{
+	macan_ecuid i;
+
+	for (i = 0; i < config->node_count; i++)
+		ctx[i] = test_sim_node(config, loop, i);
+}
+#endif
@@ -0,0 +1,48 @@
+/* Helpers shared by the tests
+ *
+ * WVPASS() prints the result of a check in the format of wvtest
+ * (wvtest/c), which wvtool parses, and test_status() is the exit
+ * status of the test.
+ *
+ * Tests built with libmacansim get the network of the simulations in
+ * addition: the key server is node 0, the time server node 1, the
+ * crypt frames of node i use CAN ID 0x100 + i, the time is sent with
+ * CAN ID 0x001 and the long-term key of node i is all bytes i.
+ * TEST_SIM_CONFIG initializes these and the protocol timing in a
+ * struct macan_config, which adds the signals and the session key
+ * validity.
+ */
+
+#ifndef TESTLIB_H
+#define TESTLIB_H
+
+#define WVPASS(cond) test_pass(__FILE__, __LINE__, #cond, cond)
+
+void test_pass(const char *file, int line, const char *text, int ok);
+int test_status(void);
+
+#ifdef MACAN_SIM
+#include <macan.h>
+
+#define KEY_SERVER	0
+#define TIME_SERVER	1
+#define TEST_NODE_MAX	32
+
+#define TEST_SIM_CONFIG					\
+	.canid             = &test_can_ids,		\
+	.key_server_id     = KEY_SERVER,		\
+	.time_server_id    = TIME_SERVER,		\
+	.time_div          = 1000000,			\
+	.skey_chg_timeout  = 5000000,			\
+	.time_req_sep      = 1000000,			\
+	.time_delta        = 1000000
+
+extern const struct macan_can_ids test_can_ids;
+
+struct macan_ctx *test_sim_node(const struct macan_config *config, macan_ev_loop *loop,
+				macan_ecuid id);
+void test_sim_nodes(const struct macan_config *config, macan_ev_loop *loop,
+		    struct macan_ctx **ctx);
+#endif
+
+#endif
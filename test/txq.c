@@ -0,0 +1,240 @@
+/* Test of the prioritised TX queue with a simulated CAN controller
+ *
+ * The controller has three transmit mailboxes like bxCAN on STM32.
+ * Transmission completion is simulated by the test, which frees the
+ * mailboxes and calls macan_tx_complete() as a target would. The
+ * controller can also report a full queue while its file descriptor
+ * stays writable, like SocketCAN with ENOBUFS.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "testlib.h"
+
+enum sig_id { SIGNAL_0, SIG_COUNT };
+enum node_id { KEY_SERVER, TIME_SERVER, SENDER, RECEIVER, NODE_COUNT };
+
+const struct macan_sig_spec sig_spec[] = {
+	[SIGNAL_0] = {.can_nsid = 0x416, .can_sid = 0x516, .src_id = SENDER, .dst_id = RECEIVER, .presc = 1},
+};
+
+const struct macan_can_ids can_ids = {
+	.time = 0x000,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100,"KS"},
+		[TIME_SERVER] = {0x101,"TS"},
+		[SENDER]      = {0x102,"S"},
+		[RECEIVER]    = {0x103,"R"},
+	},
+};
+
+const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+	.time_div          = 1000000,
+	.skey_validity     = 60000000,
+	.skey_chg_timeout  = 5000000,
+	.time_req_sep      = 1000000,
+	.time_delta        = 1000000,
+};
+
+const struct macan_node_config node = {
+	.node_id = SENDER,
+	.ltk = &(struct macan_key) { .data = { 0 } },
+};
+
+/* Simulated controller */
+
+#define MAILBOXES 3
+#define WIRE_MAX 256
+
+static unsigned inflight;
+static bool reject, full;
+static unsigned xmit_calls;
+static struct can_frame wire[WIRE_MAX];
+static unsigned wire_cnt;
+
+static enum macan_xmit_status sim_xmit(struct macan_ctx *ctx, const struct can_frame *cf)
+{
+	(void)ctx;
+	xmit_calls++;
+	if (reject)
+		return MACAN_XMIT_ERROR;
+	if (full)
+		return MACAN_XMIT_RETRY;
+	if (inflight == MAILBOXES)
+		return MACAN_XMIT_BUSY;
+	inflight++;
+	if (wire_cnt < WIRE_MAX)
+		wire[wire_cnt] = *cf;
+	wire_cnt++;
+	return MACAN_XMIT_OK;
+}
+
+static void complete(struct macan_ctx *ctx, unsigned n)
+{
+	inflight -= n < inflight ? n : inflight;
+	macan_tx_complete(ctx);
+}
+
+static struct can_frame sig_frame(uint8_t val)
+{
+	struct can_frame cf = { .can_id = 0x416, .can_dlc = 4, .data = { val } };
+	return cf;
+}
+
+static struct can_frame crypt_sig_frame(uint8_t val)
+{
+	struct can_frame cf = { .can_id = 0x102, .can_dlc = 8,
+				.data = { FL_SIGNAL << 6 | RECEIVER, SIGNAL_0, val } };
+	return cf;
+}
+
+static struct can_frame challenge_frame(void)
+{
+	struct can_frame cf = { .can_id = 0x102, .can_dlc = 8,
+				.data = { FL_CHALLENGE << 6 | KEY_SERVER, RECEIVER } };
+	return cf;
+}
+
+static struct can_frame time_frame(void)
+{
+	struct can_frame cf = { .can_id = 0x000, .can_dlc = 4 };
+	return cf;
+}
+
+static void test_priority(struct macan_ctx *ctx)
+{
+	struct macan_tx_stats st;
+	struct can_frame cf;
+	bool ok = true;
+	uint8_t i;
+
+	for (i = 0; i < 7; i++) {
+		cf = (i % 2) ? crypt_sig_frame(i) : sig_frame(i);
+		ok = ok && macan_send(ctx, &cf);
+	}
+	cf = challenge_frame();
+	ok = ok && macan_send(ctx, &cf);
+	cf = time_frame();
+	ok = ok && macan_send(ctx, &cf);
+	WVPASS(ok);
+	WVPASS(wire_cnt == MAILBOXES);
+
+	macan_get_tx_stats(ctx, &st);
+	WVPASS(st.prio[MACAN_TX_PRIO_SIG].depth == 4);
+	WVPASS(st.prio[MACAN_TX_PRIO_PROTO].depth == 2);
+	WVPASS(ctx->txq.wait == MACAN_XMIT_BUSY);
+
+	/* Handshake and time frames overtake the queued signals */
+	complete(ctx, 3);
+	WVPASS(wire_cnt == 6);
+	WVPASS(wire[3].can_id == 0x102 && macan_crypt_flags(&wire[3]) == FL_CHALLENGE);
+	WVPASS(wire[4].can_id == 0x000);
+	WVPASS(wire[5].data[2] == 3);
+
+	/* Signals keep their order */
+	complete(ctx, 3);
+	complete(ctx, 3);
+	WVPASS(wire_cnt == 9);
+	WVPASS(wire[6].data[0] == 4 && wire[7].data[2] == 5 && wire[8].data[0] == 6);
+
+	macan_get_tx_stats(ctx, &st);
+	WVPASS(st.sent == 9);
+	WVPASS(st.prio[MACAN_TX_PRIO_SIG].depth == 0 && st.prio[MACAN_TX_PRIO_PROTO].depth == 0);
+	WVPASS(st.prio[MACAN_TX_PRIO_SIG].max_depth == 4);
+	WVPASS(ctx->txq.wait == MACAN_XMIT_OK);
+	complete(ctx, 3);
+}
+
+static void test_overflow(struct macan_ctx *ctx)
+{
+	struct macan_tx_stats st;
+	struct can_frame cf = sig_frame(0);
+	bool ok = true;
+	unsigned i;
+
+	wire_cnt = 0;
+	for (i = 0; i < MAILBOXES + MACAN_TXQ_LEN; i++)
+		ok = ok && macan_send(ctx, &cf);
+	WVPASS(ok);
+	WVPASS(!macan_send(ctx, &cf));
+	macan_get_tx_stats(ctx, &st);
+	WVPASS(st.prio[MACAN_TX_PRIO_SIG].dropped == 1);
+
+	/* A full signal queue does not block handshake frames */
+	cf = challenge_frame();
+	WVPASS(macan_send(ctx, &cf));
+
+	while (ctx->txq.wait != MACAN_XMIT_OK)
+		complete(ctx, 1);
+	WVPASS(wire_cnt == MAILBOXES + MACAN_TXQ_LEN + 1);
+	complete(ctx, MAILBOXES);
+}
+
+static void test_error(struct macan_ctx *ctx)
+{
+	struct macan_tx_stats before, after;
+	struct can_frame cf = sig_frame(0);
+
+	macan_get_tx_stats(ctx, &before);
+	reject = true;
+	WVPASS(!macan_send(ctx, &cf));
+	reject = false;
+	macan_get_tx_stats(ctx, &after);
+	WVPASS(after.errors == before.errors + 1);
+}
+
+static void test_retry(struct macan_ctx *ctx)
+{
+	struct can_frame cf = sig_frame(0);
+	uint64_t end;
+	unsigned i;
+
+	wire_cnt = 0;
+	xmit_calls = 0;
+	full = true;
+	WVPASS(macan_send(ctx, &cf));
+	WVPASS(ctx->txq.wait == MACAN_XMIT_RETRY);
+
+	/* The pipe stays writable, a write watcher would retry in a busy loop */
+	end = read_time() + 20 * MACAN_TXQ_BACKOFF;
+	while (read_time() < end)
+		ev_run(ctx->loop, EVRUN_ONCE);
+	printf("%u transmit attempts in %u us with a full queue\n", xmit_calls, 20 * MACAN_TXQ_BACKOFF);
+	WVPASS(xmit_calls < 100);
+
+	full = false;
+	for (i = 0; i < 100 && ctx->txq.wait == MACAN_XMIT_RETRY; i++)
+		ev_run(ctx->loop, EVRUN_ONCE);
+	WVPASS(ctx->txq.wait != MACAN_XMIT_RETRY);
+	WVPASS(wire_cnt >= 1 && wire[0].can_id == cf.can_id);
+	complete(ctx, MAILBOXES);
+}
+
+int main(void)
+{
+	struct macan_ctx *ctx;
+	int fds[2];
+
+	if (pipe(fds) != 0)
+		return 1;
+
+	ctx = macan_alloc_mem(&config, &node);
+	__macan_init(ctx, MACAN_EV_DEFAULT, fds[1]);
+	ctx->txq.xmit = sim_xmit;
+
+	test_priority(ctx);
+	test_overflow(ctx);
+	test_error(ctx);
+	test_retry(ctx);
+
+	return test_status();
+}
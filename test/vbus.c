@@ -0,0 +1,219 @@
+/* Test of the virtual CAN bus
+ *
+ * Frames must reach all other endpoints in order, the sender only with
+ * MACAN_VBUS_RECV_OWN, CAN FD frames only endpoints with
+ * MACAN_VBUS_FD_FRAMES, the file descriptor must be readable exactly
+ * when frames wait, slow readers must lose the oldest frames and a
+ * shared bus must work across processes. The time per frame sent and
+ * received is printed.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <macan.h>
+#include "macan_private.h"
+#include "macan_vbus.h"
+#include "helper.h"
+#include "testlib.h"
+
+static bool readable(int fd, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, timeout) == 1;
+}
+
+static struct can_frame frame(uint32_t id, uint32_t n)
+{
+	struct can_frame cf = { .can_id = id, .can_dlc = 4 };
+
+	memcpy(cf.data, &n, sizeof(n));
+	return cf;
+}
+
+static uint32_t value(const struct can_frame *cf)
+{
+	uint32_t n;
+
+	memcpy(&n, cf->data, sizeof(n));
+	return n;
+}
+
+static void test_delivery(void)
+{
+	int a = macan_vbus_open("test", 0);
+	int b = macan_vbus_open("test", 0);
+	int c = macan_vbus_open("test", MACAN_VBUS_RECV_OWN);
+	int other = macan_vbus_open("other", 0);
+	struct can_frame cf, sent = frame(0x123, 42);
+	union macan_frame fd = { .fd = { .can_id = 0x124, .len = CANFD_MAX_DLEN, .flags = CANFD_FDF } }, rf;
+	struct macan_vbus_stats st;
+	unsigned i, bad = 0;
+
+	WVPASS(a >= 0 && b >= 0 && c >= 0 && other >= 0);
+	WVPASS(macan_vbus_fd(a) && !macan_vbus_fd(0));
+	WVPASS(macan_vbus_read(b, &cf) == -1 && errno == EAGAIN);
+	WVPASS(!readable(b, 0));
+
+	WVPASS(macan_vbus_write(a, &sent) == sizeof(sent));
+	WVPASS(readable(b, 0) && readable(c, 0));
+	WVPASS(!readable(a, 0) && !readable(other, 0));
+	WVPASS(macan_vbus_read(b, &cf) == sizeof(cf) && memcmp(&cf, &sent, sizeof(cf)) == 0);
+	WVPASS(macan_vbus_read(b, &cf) == -1);
+	/* The doorbell was consumed with the last frame */
+	WVPASS(!readable(b, 0));
+	WVPASS(macan_vbus_read(a, &cf) == -1);
+	WVPASS(macan_vbus_read(other, &cf) == -1);
+
+	/* Own frames */
+	WVPASS(macan_vbus_write(c, &sent) == sizeof(sent));
+	WVPASS(macan_vbus_read(c, &cf) == sizeof(cf) && value(&cf) == 42);
+	WVPASS(macan_vbus_read(c, &cf) == sizeof(cf) && value(&cf) == 42);
+	WVPASS(macan_vbus_read(c, &cf) == -1);
+	WVPASS(macan_vbus_read(b, &cf) == sizeof(cf) && macan_vbus_read(b, &cf) == -1);
+
+	/* Order of frames from several senders */
+	for (i = 0; i < 1000; i++) {
+		cf = frame(0x100, i);
+		macan_vbus_write(i & 1 ? a : c, &cf);
+	}
+	for (i = 0; i < 1000; i++)
+		if (macan_vbus_read(b, &cf) != sizeof(cf) || value(&cf) != i)
+			bad++;
+	WVPASS(bad == 0);
+	macan_vbus_stats(b, &st);
+	WVPASS(st.rx == 1002 && st.tx == 0 && st.lost == 0);
+
+	/* Through the MaCAN API */
+	struct macan_ctx ctx_a = { .sockfd = a, .dump_disabled = true };
+	struct macan_ctx ctx_b = { .sockfd = b, .dump_disabled = true };
+	while (macan_read(&ctx_b, &cf))
+		;
+	WVPASS(macan_xmit(&ctx_a, &sent) == MACAN_XMIT_OK);
+	WVPASS(macan_read(&ctx_b, &cf) && value(&cf) == 42);
+	WVPASS(!macan_read(&ctx_b, &cf));
+
+	/* CAN FD frames do not overflow classic buffers */
+	memset(fd.fd.data, 0x5a, sizeof(fd.fd.data));
+	WVPASS(macan_vbus_write(a, &fd.cf) == CANFD_MTU);
+	WVPASS(macan_vbus_read(b, &cf) == -1 && errno == EAGAIN);
+	WVPASS(macan_vbus_set_fd_frames(b, true) == 0);
+	WVPASS(macan_vbus_write(a, &fd.cf) == CANFD_MTU);
+	WVPASS(macan_vbus_read(b, &rf.cf) == CANFD_MTU && memcmp(&rf, &fd, CANFD_MTU) == 0);
+	WVPASS(macan_vbus_set_fd_frames(0, true) == -1 && errno == EBADF);
+
+	macan_vbus_close(a);
+	WVPASS(!macan_vbus_fd(a));
+	macan_vbus_close(b);
+	macan_vbus_close(c);
+	macan_vbus_close(other);
+}
+
+static void test_overrun(void)
+{
+	int a = helper_init("vbus:overrun");
+	int b = helper_init("vbus:overrun");
+	struct macan_vbus_stats st;
+	struct can_frame cf;
+	unsigned i, n = 0, bad = 0;
+	uint32_t last = 0;
+
+	for (i = 0; i < 3 * MACAN_VBUS_SLOTS; i++) {
+		cf = frame(0x100, i);
+		macan_vbus_write(a, &cf);
+	}
+	while (macan_vbus_read(b, &cf) == sizeof(cf)) {
+		if (n && value(&cf) != last + 1)
+			bad++;
+		last = value(&cf);
+		n++;
+	}
+	macan_vbus_stats(b, &st);
+	WVPASS(bad == 0 && last == 3 * MACAN_VBUS_SLOTS - 1);
+	WVPASS(n > 0 && n <= MACAN_VBUS_SLOTS);
+	WVPASS(st.lost + n == 3 * MACAN_VBUS_SLOTS);
+	macan_vbus_close(a);
+	macan_vbus_close(b);
+}
+
+static void test_shared(void)
+{
+	const unsigned n = 1000;
+	char name[32];
+	int fd, ready[2], status;
+	unsigned got = 0, bad = 0;
+	struct can_frame cf;
+	pid_t pid;
+
+	snprintf(name, sizeof(name), "test%d", getpid());
+	fd = macan_vbus_open(name, MACAN_VBUS_SHARED);
+	WVPASS(fd >= 0);
+	WVPASS(pipe(ready) == 0);
+
+	pid = fork();
+	if (pid == 0) {
+		int s = macan_vbus_open(name, MACAN_VBUS_SHARED);
+		char c = s >= 0;
+		unsigned i;
+
+		if (write(ready[1], &c, 1) != 1 || s < 0)
+			_exit(1);
+		for (i = 0; i < n; i++) {
+			cf = frame(0x200, i);
+			macan_vbus_write(s, &cf);
+		}
+		_exit(0);
+	}
+	WVPASS(read(ready[0], &status, 1) == 1);
+	while (got < n && readable(fd, 1000))
+		while (macan_vbus_read(fd, &cf) == sizeof(cf))
+			if (value(&cf) != got++)
+				bad++;
+	WVPASS(got == n && bad == 0);
+	WVPASS(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	WVPASS(macan_vbus_unlink(name) == 0);
+	macan_vbus_close(fd);
+	close(ready[0]);
+	close(ready[1]);
+}
+
+static void bench(void)
+{
+	const unsigned nodes = 64, n = 10000;
+	int fd[64];
+	struct can_frame cf = frame(0x100, 0);
+	struct timespec t0, t1;
+	unsigned i, j, got = 0;
+	double ns;
+
+	for (i = 0; i < nodes; i++)
+		fd[i] = macan_vbus_open("bench", 0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		macan_vbus_write(fd[i % nodes], &cf);
+		for (j = 0; j < nodes; j++)
+			while (macan_vbus_read(fd[j], &cf) == sizeof(cf))
+				got++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+	printf("%u nodes: %.1f ns/frame received\n", nodes, ns / got);
+	WVPASS(got == n * (nodes - 1));
+	for (i = 0; i < nodes; i++)
+		macan_vbus_close(fd[i]);
+}
+
+int main()
+{
+	test_delivery();
+	test_overrun();
+	test_shared();
+	bench();
+	return test_status();
+}
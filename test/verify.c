@@ -0,0 +1,355 @@
+/* Test of the passive MaCAN traffic verifier
+ *
+ * A trace of a key distribution, time synchronisation and signal
+ * traffic is generated with the library's own crypto functions, with
+ * a few corrupted, stale and forged frames mixed in. A signal sent to
+ * a group is checked with the group key distributed to its members.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <macan.h>
+#include "cryptlib.h"
+#include "macan_private.h"
+#include "macan_verify.h"
+#include "testlib.h"
+
+enum sig_id {
+	SIG_16,
+	SIG_32,
+	SIG_GROUP,
+	SIG_COUNT
+};
+
+enum node_id {
+	KEY_SERVER,
+	TIME_SERVER,
+	SENDER,
+	RECEIVER,
+	RECEIVER2,
+	NODE_COUNT
+};
+
+#define GROUP 8		/* Group-IDs need not follow the ECU-IDs */
+
+static const struct macan_sig_spec test_sig_spec[] = {
+	[SIG_16]    = {.can_nsid = 0,     .can_sid = 0,     .src_id = SENDER, .dst_id = RECEIVER, .presc = 0},
+	[SIG_32]    = {.can_nsid = 0x515, .can_sid = 0x516, .src_id = SENDER, .dst_id = RECEIVER, .presc = 1},
+	[SIG_GROUP] = {.can_nsid = 0,     .can_sid = 0x517, .src_id = SENDER, .dst_id = GROUP,    .presc = 1},
+};
+
+static const struct macan_group test_groups[] = {
+	{ .group_id = GROUP, .members = 1U << SENDER | 1U << RECEIVER | 1U << RECEIVER2 },
+};
+
+static const struct macan_can_ids test_can_ids = {
+	.time = 0x000,
+	.ecu = (struct macan_ecu[]){
+		[KEY_SERVER]  = {0x100, "KS"},
+		[TIME_SERVER] = {0x101, "TS"},
+		[SENDER]      = {0x102, "S"},
+		[RECEIVER]    = {0x103, "R"},
+		[RECEIVER2]   = {0x104, "R2"},
+	},
+};
+
+static const struct macan_config config = {
+	.sig_count         = SIG_COUNT,
+	.sigspec           = test_sig_spec,
+	.node_count        = NODE_COUNT,
+	.canid		   = &test_can_ids,
+	.key_server_id     = KEY_SERVER,
+	.time_server_id    = TIME_SERVER,
+	.time_div          = 1000000,
+	.skey_validity     = 60000000,
+	.skey_chg_timeout  = 5000000,
+	.time_req_sep      = 1000000,
+	.time_delta        = 1000000,
+	.group_count       = 1,
+	.groups            = test_groups,
+};
+
+static const struct macan_key *ltk[NODE_COUNT] = {
+	NULL,
+	&(struct macan_key) { .data = { 0xae,0x27,0x97,0x20,0x20,0x79,0x3e,0x5a,0x48,0x0d,0x2c,0xa6,0xa5,0x47,0x15,0x45 } },
+	&(struct macan_key) { .data = { 0x0b,0x49,0x6b,0xfc,0x4a,0x24,0x6a,0xd5,0xaa,0x5f,0xfc,0x7e,0x7d,0x99,0x6b,0x78 } },
+	&(struct macan_key) { .data = { 0x34,0xdb,0x79,0xcf,0x34,0x61,0x25,0x26,0x1c,0x3a,0xe7,0xe8,0xec,0x54,0x36,0xaa } },
+	&(struct macan_key) { .data = { 0x5c,0x10,0xe3,0x87,0x61,0x0f,0x9a,0x44,0xd2,0x35,0x7b,0xc8,0x0e,0x96,0x21,0xfd } },
+};
+
+static struct macan_key skey_sr = { .data = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 } };
+static struct macan_key skey_tr = { .data = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 } };
+static struct macan_key skey_g = { .data = { 7, 7, 7, 7, 7, 7, 7, 7, 9, 9, 9, 9, 9, 9, 9, 9 } };
+
+#define T0 1000		/* MaCAN time at ts 0 */
+#define SEC 1000000000ull
+
+struct frame {
+	uint64_t ts;
+	struct can_frame cf;
+};
+
+static struct frame trace[1000];
+static unsigned frames;
+
+static struct can_frame *add(uint64_t ts, uint32_t can_id, uint8_t dlc)
+{
+	struct frame *f = &trace[frames++];
+
+	f->ts = ts;
+	f->cf.can_id = can_id;
+	f->cf.can_dlc = dlc;
+	return &f->cf;
+}
+
+static uint32_t time_at(uint64_t ts)
+{
+	return T0 + (uint32_t)(ts / SEC);
+}
+
+static void add_time(uint64_t ts, uint32_t t)
+{
+	struct can_frame *cf = add(ts, test_can_ids.time, 4);
+	memcpy(cf->data, &t, 4);
+}
+
+static void add_challenge(uint64_t ts, macan_ecuid src, macan_ecuid dst, macan_ecuid fwd,
+			  const uint8_t *chg)
+{
+	struct can_frame *cf = add(ts, test_can_ids.ecu[src].canid, 8);
+
+	cf->data[0] = (uint8_t)(FL_CHALLENGE << 6 | dst);
+	cf->data[1] = fwd;
+	memcpy(cf->data + 2, chg, 6);
+}
+
+static void add_skey(uint64_t ts, const struct macan_key *skey, macan_ecuid dst,
+		     macan_ecuid fwd, const uint8_t *chg, bool corrupt)
+{
+	uint8_t plain[24], wrap[32];
+	unsigned i;
+
+	memcpy(plain, skey->data, 16);
+	plain[16] = dst;
+	plain[17] = fwd;
+	memcpy(plain + 18, chg, 6);
+	macan_aes_wrap(ltk[dst], 24, wrap, plain);
+	if (corrupt)
+		wrap[20] ^= 1;
+	for (i = 0; i < 6; i++) {
+		unsigned len = i == 5 ? 2 : 6;
+		struct can_frame *cf = add(ts + i * 1000, test_can_ids.ecu[KEY_SERVER].canid, 8);
+
+		cf->data[0] = (uint8_t)(FL_SESS_KEY << 6 | dst);
+		cf->data[1] = (uint8_t)(i << 4 | len);
+		memcpy(cf->data + 2, wrap + 6 * i, len);
+	}
+}
+
+/* Key shared by SENDER and dst, which is RECEIVER or GROUP */
+static struct macan_key *skey(macan_ecuid dst)
+{
+	return dst == GROUP ? &skey_g : &skey_sr;
+}
+
+static void add_sig16(uint64_t ts, uint8_t sig, uint16_t val, int dt, bool corrupt)
+{
+	struct can_frame *cf = add(ts, test_can_ids.ecu[SENDER].canid, 8);
+	uint32_t t = time_at(ts) + (uint32_t)dt;
+	uint8_t dst = test_sig_spec[sig].dst_id;
+	uint8_t plain[9];
+
+	memcpy(plain, &t, 4);
+	plain[4] = SENDER;
+	plain[5] = dst;
+	plain[6] = sig;
+	memcpy(plain + 7, &val, 2);
+	cf->data[0] = (uint8_t)(FL_SIGNAL << 6 | dst);
+	cf->data[1] = sig;
+	memcpy(cf->data + 2, &val, 2);
+	macan_sign(skey(dst), cf->data + 4, plain, sizeof(plain));
+	if (corrupt)
+		cf->data[7] ^= 0x80;
+}
+
+static void add_sig32(uint64_t ts, uint8_t sig, uint32_t val)
+{
+	struct can_frame *cf = add(ts, test_sig_spec[sig].can_sid, 8);
+	uint32_t t = time_at(ts), id = test_sig_spec[sig].can_sid;
+	uint8_t plain[12];
+
+	memcpy(plain, &val, 4);
+	memcpy(plain + 4, &t, 4);
+	memcpy(plain + 8, &id, 4);
+	memcpy(cf->data, &val, 4);
+	macan_sign(skey(test_sig_spec[sig].dst_id), cf->data + 4, plain, sizeof(plain));
+}
+
+static void add_ack(uint64_t ts, macan_ecuid src, macan_ecuid dst)
+{
+	struct can_frame *cf = add(ts, test_can_ids.ecu[src].canid, 8);
+	uint32_t t = time_at(ts);
+	uint8_t plain[8];
+
+	memcpy(plain, &t, 4);
+	plain[4] = dst;
+	plain[5] = 1 << src;
+	plain[6] = plain[7] = 0;
+	cf->data[0] = (uint8_t)(FL_ACK << 6 | dst);
+	memcpy(cf->data + 1, plain + 5, 3);
+	macan_sign(skey(dst), cf->data + 4, plain, sizeof(plain));
+}
+
+static void add_auth_req(uint64_t ts, macan_ecuid src, uint8_t sig)
+{
+	struct can_frame *cf = add(ts, test_can_ids.ecu[src].canid, 7);
+	uint32_t t = time_at(ts);
+	uint8_t plain[8];
+
+	memcpy(plain, &t, 4);
+	plain[4] = src;
+	plain[5] = SENDER;
+	plain[6] = sig;
+	plain[7] = 2;
+	cf->data[0] = FL_AUTH_REQ << 6 | SENDER;
+	cf->data[1] = sig;
+	cf->data[2] = 2;
+	macan_sign(skey(test_sig_spec[sig].dst_id), cf->data + 3, plain, sizeof(plain));
+}
+
+static void add_auth_time(uint64_t ts, const uint8_t *chg, bool forged)
+{
+	struct can_frame *cf = add(ts, test_can_ids.time, 8);
+	uint32_t t = time_at(ts), id = test_can_ids.ecu[TIME_SERVER].canid;
+	uint8_t plain[12];
+
+	memcpy(plain, &t, 4);
+	memcpy(plain + 4, chg, 6);
+	memcpy(plain + 10, &id, 2);
+	memcpy(cf->data, &t, 4);
+	macan_sign(&skey_tr, cf->data + 4, plain, sizeof(plain));
+	if (forged)
+		cf->data[4] ^= 1;
+}
+
+static void build_trace(void)
+{
+	const uint8_t chg_s[6] = { 1, 1, 1, 1, 1, 1 };
+	const uint8_t chg_r[6] = { 2, 2, 2, 2, 2, 2 };
+	const uint8_t chg_t[6] = { 3, 3, 3, 3, 3, 3 };
+	const uint8_t chg_x[6] = { 4, 4, 4, 4, 4, 4 };
+	const uint8_t chg_g[6] = { 5, 5, 5, 5, 5, 5 };
+	uint64_t ts;
+	unsigned i;
+
+	add_sig16(1000, SIG_16, 0, 0, false);		/* No time */
+	add_time(SEC / 2, time_at(SEC / 2));
+	add_sig16(SEC / 2 + 1000, SIG_16, 0, 0, false);	/* No key */
+
+	add_challenge(SEC, SENDER, KEY_SERVER, RECEIVER, chg_s);
+	add_skey(SEC + 100000, &skey_sr, SENDER, RECEIVER, chg_s, false);
+	add_challenge(SEC + 200000, RECEIVER, KEY_SERVER, SENDER, chg_r);
+	add_skey(SEC + 300000, &skey_sr, RECEIVER, SENDER, chg_r, false);
+	add_challenge(SEC + 400000, RECEIVER, KEY_SERVER, TIME_SERVER, chg_t);
+	add_skey(SEC + 500000, &skey_tr, RECEIVER, TIME_SERVER, chg_x, false);	/* Replay */
+	add_skey(SEC + 600000, &skey_tr, RECEIVER, TIME_SERVER, chg_t, false);
+	add_skey(SEC + 700000, &skey_sr, SENDER, RECEIVER, chg_s, true);	/* Corrupted */
+	add_ack(SEC + 800000, SENDER, RECEIVER);
+
+	/* The group key, asked for by one member, sent to all of them */
+	add_challenge(SEC + 810000, RECEIVER2, KEY_SERVER, GROUP, chg_g);
+	add_skey(SEC + 820000, &skey_g, RECEIVER2, GROUP, chg_g, false);
+	add_skey(SEC + 830000, &skey_g, SENDER, GROUP, chg_s, false);
+	add_skey(SEC + 840000, &skey_g, RECEIVER, GROUP, chg_r, false);
+	add_skey(SEC + 850000, &skey_g, TIME_SERVER, GROUP, chg_t, false);	/* Not a member */
+	add_ack(SEC + 860000, RECEIVER2, GROUP);
+
+	add_challenge(SEC + 900000, RECEIVER, TIME_SERVER, 0, chg_t);
+	add_auth_time(SEC + 950000, chg_t, false);
+	add_auth_time(SEC + 960000, chg_t, true);
+
+	add_auth_req(2 * SEC, RECEIVER, SIG_16);
+	add_auth_req(2 * SEC + 500, RECEIVER2, SIG_GROUP);
+	for (i = 0, ts = 2 * SEC + 1000; i < 300; i++, ts += 10000000) {
+		if (ts % SEC < 10000000)
+			add_time(ts, time_at(ts));
+		if (i % 2)
+			add_sig16(ts, SIG_16, (uint16_t)i, 0, i == 101);
+		else
+			add_sig32(ts, SIG_32, i);
+		if (i % 10 == 0)
+			add_sig16(ts + 500, SIG_GROUP, (uint16_t)i, 0, false);
+		if (i % 10 == 5)
+			add_sig32(ts + 500, SIG_GROUP, i);
+	}
+	add_sig16(ts, SIG_16, 0, -5, false);	/* Stale */
+	ts += SEC;
+	add_time(ts, time_at(ts) + 100);	/* Time jump */
+	{
+		struct can_frame *cf = add(ts + 1000, test_sig_spec[SIG_32].can_nsid, 4);
+		memset(cf->data, 0, 4);
+	}
+}
+
+static unsigned alert_count[MACAN_A_COUNT];
+
+static void count_alert(void *arg, const struct macan_valert_info *a)
+{
+	(void)arg;
+	alert_count[a->alert]++;
+}
+
+int main(void)
+{
+	struct macan_verifier *v = macan_verify_create(&config, ltk);
+	struct macan_vreport rep;
+	struct macan_vjob jobs[16];
+	unsigned i, n = 0, j;
+
+	WVPASS(v != NULL);
+	WVPASS(macan_vreport_init(&rep, &config));
+	rep.alert_cb = count_alert;
+	build_trace();
+
+	for (i = 0; i < frames; i++) {
+		if (macan_verify_is_protocol_id(v, trace[i].cf.can_id))
+			macan_verify_track(v, trace[i].ts, &trace[i].cf, &rep);
+		if (macan_verify_prepare(v, trace[i].ts, &trace[i].cf, &jobs[n], &rep) == MACAN_V_NONE)
+			continue;
+		if (++n == 16 || i == frames - 1) {
+			macan_verify_batch(jobs, n);
+			for (j = 0; j < n; j++)
+				macan_verify_account(&jobs[j], &rep);
+			n = 0;
+		}
+	}
+	macan_verify_batch(jobs, n);
+	for (j = 0; j < n; j++)
+		macan_verify_account(&jobs[j], &rep);
+
+	WVPASS(rep.frames == frames);
+	WVPASS(rep.keys == 3);
+	WVPASS(rep.alerts[MACAN_A_SKEY_REPLAY] == 1);
+	WVPASS(rep.alerts[MACAN_A_BAD_SKEY] == 2);
+	WVPASS(rep.alerts[MACAN_A_KEY_RENEWAL] == 0);
+	WVPASS(rep.time_auth_ok == 1);
+	WVPASS(rep.alerts[MACAN_A_FORGED_TIME] == 1);
+	WVPASS(rep.alerts[MACAN_A_TIME_JUMP] == 1);
+	WVPASS(rep.kind[MACAN_V_ACK][MACAN_V_OK] == 2);
+	WVPASS(rep.sig[SIG_16].auth_req[MACAN_V_OK] == 1);
+	WVPASS(rep.sig[SIG_GROUP].auth_req[MACAN_V_OK] == 1);
+	WVPASS(rep.sig[SIG_GROUP].result[MACAN_V_OK] == 60);
+	WVPASS(rep.sig[SIG_16].result[MACAN_V_NOTIME] == 1);
+	WVPASS(rep.sig[SIG_16].result[MACAN_V_NOKEY] == 1);
+	WVPASS(rep.sig[SIG_16].result[MACAN_V_OK] == 149);
+	WVPASS(rep.sig[SIG_16].result[MACAN_V_INVALID] == 1);
+	WVPASS(rep.sig[SIG_16].result[MACAN_V_STALE] == 1);
+	WVPASS(rep.sig[SIG_32].result[MACAN_V_OK] == 150);
+	WVPASS(rep.sig[SIG_32].plain == 1);
+	WVPASS(alert_count[MACAN_A_INVALID_CMAC] == 1);
+	WVPASS(alert_count[MACAN_A_STALE] == 1);
+
+	macan_vreport_free(&rep);
+	macan_verify_free(v);
+	return test_status();
+}